@@ -0,0 +1,48 @@
+/*****************************************************************************
+ * intrin.h: aarch64 intrinsics
+ *****************************************************************************
+ * Copyright (C) 2003-2022 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#ifndef X264_AARCH64_INTRIN_H
+#define X264_AARCH64_INTRIN_H
+
+#include <arm_neon.h>
+
+/* 4-byte loads and stores of pixels at any alignment, which M32 would make a
+ * misaligned access; compilers turn the memcpy into a plain mov. */
+static ALWAYS_INLINE uint32_t intrin_load32( const void *p )
+{
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    return v;
+}
+
+static ALWAYS_INLINE void intrin_store32( void *p, uint32_t v )
+{
+    memcpy( p, &v, 4 );
+}
+
+#define x264_pixel_init_intrin x264_template(pixel_init_intrin)
+void x264_pixel_init_intrin( uint32_t cpu, x264_pixel_function_t *pixf );
+#define x264_mc_init_intrin x264_template(mc_init_intrin)
+void x264_mc_init_intrin( uint32_t cpu, x264_mc_functions_t *pf );
+
+#endif
@@ -0,0 +1,504 @@
+/*****************************************************************************
+ * mc-intrin.c: aarch64 motion compensation, intrinsics
+ *****************************************************************************
+ * Copyright (C) 2003-2022 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "common/common.h"
+#include "intrin.h"
+
+#define LOAD4(p) vreinterpret_u8_u32( vdup_n_u32( intrin_load32( p ) ) )
+#define STORE4(p, x) intrin_store32( p, vget_lane_u32( vreinterpret_u32_u8( x ), 0 ) )
+
+/* Row kernels take any width: whole vectors first, then 8 and 4 pixels, then
+ * a scalar tail identical to the C reference. */
+static ALWAYS_INLINE void avg_row( pixel *dst, pixel *src1, pixel *src2, int width )
+{
+    int x = 0;
+    for( ; x+16 <= width; x += 16 )
+        vst1q_u8( dst+x, vrhaddq_u8( vld1q_u8( src1+x ), vld1q_u8( src2+x ) ) );
+    if( x+8 <= width )
+    {
+        vst1_u8( dst+x, vrhadd_u8( vld1_u8( src1+x ), vld1_u8( src2+x ) ) );
+        x += 8;
+    }
+    if( x+4 <= width )
+    {
+        STORE4( dst+x, vrhadd_u8( LOAD4( src1+x ), LOAD4( src2+x ) ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = ( src1[x] + src2[x] + 1 ) >> 1;
+}
+
+/* Implicit weighted bipred: weight1 + weight2 = 64, so with 8-bit input every
+ * intermediate fits in a signed halfword. */
+static ALWAYS_INLINE uint8x8_t avg_weight8( uint8x8_t a, uint8x8_t b, int16_t w1, int16_t w2 )
+{
+    int16x8_t r = vmulq_n_s16( vreinterpretq_s16_u16( vmovl_u8( a ) ), w1 );
+    r = vmlaq_n_s16( r, vreinterpretq_s16_u16( vmovl_u8( b ) ), w2 );
+    return vqrshrun_n_s16( r, 6 );
+}
+
+static ALWAYS_INLINE void avg_weight_row( pixel *dst, pixel *src1, pixel *src2, int width, int i_weight1 )
+{
+    int i_weight2 = 64 - i_weight1;
+    int x = 0;
+    for( ; x+8 <= width; x += 8 )
+        vst1_u8( dst+x, avg_weight8( vld1_u8( src1+x ), vld1_u8( src2+x ), i_weight1, i_weight2 ) );
+    if( x+4 <= width )
+    {
+        STORE4( dst+x, avg_weight8( LOAD4( src1+x ), LOAD4( src2+x ), i_weight1, i_weight2 ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = x264_clip_pixel( (src1[x]*i_weight1 + src2[x]*i_weight2 + (1<<5)) >> 6 );
+}
+
+/* Explicit weighted prediction. With denom == 0 the rounding term is 0 and the
+ * shift a no-op, which matches the C opscale_noden path. */
+typedef struct
+{
+    int16x8_t round, offset, shift;
+    int i_scale, i_round, i_offset, i_denom;
+} weight_neon_t;
+
+static ALWAYS_INLINE void weight_init( weight_neon_t *w, const x264_weight_t *weight )
+{
+    w->i_scale  = weight->i_scale;
+    w->i_denom  = weight->i_denom;
+    w->i_round  = w->i_denom >= 1 ? 1 << (w->i_denom - 1) : 0;
+    w->i_offset = weight->i_offset;
+    w->round  = vdupq_n_s16( w->i_round );
+    w->offset = vdupq_n_s16( w->i_offset );
+    w->shift  = vdupq_n_s16( -w->i_denom );
+}
+
+static ALWAYS_INLINE uint8x8_t weight8( uint8x8_t src, const weight_neon_t *w )
+{
+    int16x8_t x = vmlaq_n_s16( w->round, vreinterpretq_s16_u16( vmovl_u8( src ) ), w->i_scale );
+    x = vaddq_s16( vshlq_s16( x, w->shift ), w->offset );
+    return vqmovun_s16( x );
+}
+
+static ALWAYS_INLINE void weight_row( pixel *dst, pixel *src, int width, const weight_neon_t *w )
+{
+    int x = 0;
+    for( ; x+8 <= width; x += 8 )
+        vst1_u8( dst+x, weight8( vld1_u8( src+x ), w ) );
+    if( x+4 <= width )
+    {
+        STORE4( dst+x, weight8( LOAD4( src+x ), w ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = x264_clip_pixel( ((src[x] * w->i_scale + w->i_round) >> w->i_denom) + w->i_offset );
+}
+
+static ALWAYS_INLINE void copy_row( pixel *dst, pixel *src, int width )
+{
+    int x = 0;
+    for( ; x+16 <= width; x += 16 )
+        vst1q_u8( dst+x, vld1q_u8( src+x ) );
+    if( x+8 <= width )
+    {
+        vst1_u8( dst+x, vld1_u8( src+x ) );
+        x += 8;
+    }
+    if( x+4 <= width )
+    {
+        intrin_store32( dst+x, intrin_load32( src+x ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = src[x];
+}
+
+#define PIXEL_AVG_NEON( w, h ) \
+static void pixel_avg_##w##x##h##_neon( pixel *pix1, intptr_t i_stride_pix1,\
+                                       pixel *pix2, intptr_t i_stride_pix2,\
+                                       pixel *pix3, intptr_t i_stride_pix3, int weight )\
+{\
+    for( int y = 0; y < h; y++, pix1 += i_stride_pix1, pix2 += i_stride_pix2, pix3 += i_stride_pix3 )\
+    {\
+        if( weight == 32 )\
+            avg_row( pix1, pix2, pix3, w );\
+        else\
+            avg_weight_row( pix1, pix2, pix3, w, weight );\
+    }\
+}
+PIXEL_AVG_NEON( 16, 16 )
+PIXEL_AVG_NEON( 16, 8 )
+PIXEL_AVG_NEON( 8, 16 )
+PIXEL_AVG_NEON( 8, 8 )
+PIXEL_AVG_NEON( 8, 4 )
+PIXEL_AVG_NEON( 4, 16 )
+PIXEL_AVG_NEON( 4, 8 )
+PIXEL_AVG_NEON( 4, 4 )
+PIXEL_AVG_NEON( 4, 2 )
+
+#define MC_WEIGHT_NEON( w ) \
+static void mc_weight_w##w##_neon( pixel *dst, intptr_t i_dst_stride, pixel *src, intptr_t i_src_stride,\
+                                  const x264_weight_t *weight, int height )\
+{\
+    weight_neon_t wt;\
+    weight_init( &wt, weight );\
+    for( int y = 0; y < height; y++, dst += i_dst_stride, src += i_src_stride )\
+        weight_row( dst, src, w, &wt );\
+}
+MC_WEIGHT_NEON( 2 )
+MC_WEIGHT_NEON( 4 )
+MC_WEIGHT_NEON( 8 )
+MC_WEIGHT_NEON( 12 )
+MC_WEIGHT_NEON( 16 )
+MC_WEIGHT_NEON( 20 )
+
+static weight_fn_t mc_weight_wtab_neon[6] =
+{
+    mc_weight_w2_neon,
+    mc_weight_w4_neon,
+    mc_weight_w8_neon,
+    mc_weight_w12_neon,
+    mc_weight_w16_neon,
+    mc_weight_w20_neon,
+};
+
+/* Shared body of mc_luma and get_ref. Returns the plane to read from when no
+ * interpolation or weighting is needed, leaving dst untouched. */
+static ALWAYS_INLINE pixel *mc_luma_neon( pixel *dst, intptr_t i_dst_stride,
+                                          pixel *src[4], intptr_t i_src_stride,
+                                          int mvx, int mvy,
+                                          int i_width, int i_height, const x264_weight_t *weight )
+{
+    int qpel_idx = ((mvy&3)<<2) + (mvx&3);
+    int offset = (mvy>>2)*i_src_stride + (mvx>>2);
+    pixel *src1 = src[x264_hpel_ref0[qpel_idx]] + offset + ((mvy&3) == 3) * i_src_stride;
+    weight_neon_t wt;
+    if( weight->weightfn )
+        weight_init( &wt, weight );
+
+    if( qpel_idx & 5 ) /* qpel interpolation needed */
+    {
+        pixel *src2 = src[x264_hpel_ref1[qpel_idx]] + offset + ((mvx&3) == 3);
+        for( int y = 0; y < i_height; y++, dst += i_dst_stride, src1 += i_src_stride, src2 += i_src_stride )
+        {
+            avg_row( dst, src1, src2, i_width );
+            if( weight->weightfn )
+                weight_row( dst, dst, i_width, &wt );
+        }
+        return NULL;
+    }
+    else if( weight->weightfn )
+    {
+        for( int y = 0; y < i_height; y++, dst += i_dst_stride, src1 += i_src_stride )
+            weight_row( dst, src1, i_width, &wt );
+        return NULL;
+    }
+    return src1;
+}
+
+static void mc_luma_wrap_neon( pixel *dst, intptr_t i_dst_stride,
+                               pixel *src[4], intptr_t i_src_stride,
+                               int mvx, int mvy,
+                               int i_width, int i_height, const x264_weight_t *weight )
+{
+    pixel *src1 = mc_luma_neon( dst, i_dst_stride, src, i_src_stride, mvx, mvy, i_width, i_height, weight );
+    if( src1 )
+        for( int y = 0; y < i_height; y++, dst += i_dst_stride, src1 += i_src_stride )
+            copy_row( dst, src1, i_width );
+}
+
+static pixel *get_ref_neon( pixel *dst, intptr_t *i_dst_stride,
+                            pixel *src[4], intptr_t i_src_stride,
+                            int mvx, int mvy,
+                            int i_width, int i_height, const x264_weight_t *weight )
+{
+    pixel *src1 = mc_luma_neon( dst, *i_dst_stride, src, i_src_stride, mvx, mvy, i_width, i_height, weight );
+    if( !src1 )
+        return dst;
+    *i_dst_stride = i_src_stride;
+    return src1;
+}
+
+static ALWAYS_INLINE uint8x8_t chroma8( uint8x8_t a, uint8x8_t b, uint8x8_t c, uint8x8_t d,
+                                        uint8x8_t cA, uint8x8_t cB, uint8x8_t cC, uint8x8_t cD )
+{
+    uint16x8_t r = vmull_u8( a, cA );
+    r = vmlal_u8( r, b, cB );
+    r = vmlal_u8( r, c, cC );
+    r = vmlal_u8( r, d, cD );
+    return vrshrn_n_u16( r, 6 );
+}
+
+static void mc_chroma_neon( pixel *dstu, pixel *dstv, intptr_t i_dst_stride,
+                            pixel *src, intptr_t i_src_stride,
+                            int mvx, int mvy,
+                            int i_width, int i_height )
+{
+    int d8x = mvx&0x07;
+    int d8y = mvy&0x07;
+    int cA = (8-d8x)*(8-d8y);
+    int cB = d8x    *(8-d8y);
+    int cC = (8-d8x)*d8y;
+    int cD = d8x    *d8y;
+    uint8x8_t vA = vdup_n_u8( cA ), vB = vdup_n_u8( cB ), vC = vdup_n_u8( cC ), vD = vdup_n_u8( cD );
+
+    src += (mvy >> 3) * i_src_stride + (mvx >> 3)*2;
+    pixel *srcp = &src[i_src_stride];
+
+    for( int y = 0; y < i_height; y++ )
+    {
+        int x = 0;
+        for( ; x+8 <= i_width; x += 8 )
+        {
+            uint8x8x2_t a = vld2_u8( src+2*x ),  b = vld2_u8( src+2*x+2 );
+            uint8x8x2_t c = vld2_u8( srcp+2*x ), d = vld2_u8( srcp+2*x+2 );
+            vst1_u8( dstu+x, chroma8( a.val[0], b.val[0], c.val[0], d.val[0], vA, vB, vC, vD ) );
+            vst1_u8( dstv+x, chroma8( a.val[1], b.val[1], c.val[1], d.val[1], vA, vB, vC, vD ) );
+        }
+        if( x+4 <= i_width )
+        {
+            uint8x8x2_t a = vuzp_u8( vld1_u8( src+2*x ),    vld1_u8( src+2*x ) );
+            uint8x8x2_t b = vuzp_u8( vld1_u8( src+2*x+2 ),  vld1_u8( src+2*x+2 ) );
+            uint8x8x2_t c = vuzp_u8( vld1_u8( srcp+2*x ),   vld1_u8( srcp+2*x ) );
+            uint8x8x2_t d = vuzp_u8( vld1_u8( srcp+2*x+2 ), vld1_u8( srcp+2*x+2 ) );
+            STORE4( dstu+x, chroma8( a.val[0], b.val[0], c.val[0], d.val[0], vA, vB, vC, vD ) );
+            STORE4( dstv+x, chroma8( a.val[1], b.val[1], c.val[1], d.val[1], vA, vB, vC, vD ) );
+            x += 4;
+        }
+        for( ; x < i_width; x++ )
+        {
+            dstu[x] = ( cA*src[2*x]  + cB*src[2*x+2] +
+                        cC*srcp[2*x] + cD*srcp[2*x+2] + 32 ) >> 6;
+            dstv[x] = ( cA*src[2*x+1]  + cB*src[2*x+3] +
+                        cC*srcp[2*x+1] + cD*srcp[2*x+3] + 32 ) >> 6;
+        }
+        dstu += i_dst_stride;
+        dstv += i_dst_stride;
+        src   = srcp;
+        srcp += i_src_stride;
+    }
+}
+
+/****************************************************************************
+ * hpel_filter: the 6-tap filter (1,-5,20,20,-5,1) on halfwords. Taps on
+ * pixels and the sums of tap pairs on intermediate v values both fit in 16
+ * bits; only the final centre filter needs words.
+ ****************************************************************************/
+#define TAPFILTER(pix, d) ((pix)[x-2*d] + (pix)[x+3*d] - 5*((pix)[x-d] + (pix)[x+2*d]) + 20*((pix)[x] + (pix)[x+d]))
+
+static ALWAYS_INLINE int16x8_t tap8( pixel *p, intptr_t d )
+{
+    int16x8_t af = vreinterpretq_s16_u16( vaddl_u8( vld1_u8( p-2*d ), vld1_u8( p+3*d ) ) );
+    int16x8_t be = vreinterpretq_s16_u16( vaddl_u8( vld1_u8( p-d ),   vld1_u8( p+2*d ) ) );
+    int16x8_t cd = vreinterpretq_s16_u16( vaddl_u8( vld1_u8( p ),     vld1_u8( p+d ) ) );
+    return vmlaq_n_s16( vmlsq_n_s16( af, be, 5 ), cd, 20 );
+}
+
+static ALWAYS_INLINE uint8x8_t tap_centre8( int16_t *p )
+{
+    int16x8_t af = vaddq_s16( vld1q_s16( p-2 ), vld1q_s16( p+3 ) );
+    int16x8_t be = vaddq_s16( vld1q_s16( p-1 ), vld1q_s16( p+2 ) );
+    int16x8_t cd = vaddq_s16( vld1q_s16( p ),   vld1q_s16( p+1 ) );
+    int32x4_t lo = vmovl_s16( vget_low_s16( af ) );
+    int32x4_t hi = vmovl_high_s16( af );
+    lo = vmlal_n_s16( lo, vget_low_s16( be ), -5 );
+    hi = vmlal_high_n_s16( hi, be, -5 );
+    lo = vmlal_n_s16( lo, vget_low_s16( cd ), 20 );
+    hi = vmlal_high_n_s16( hi, cd, 20 );
+    return vqmovn_u16( vcombine_u16( vqrshrun_n_s32( lo, 10 ), vqrshrun_n_s32( hi, 10 ) ) );
+}
+
+static void hpel_filter_neon( pixel *dsth, pixel *dstv, pixel *dstc, pixel *src,
+                              intptr_t stride, int width, int height, int16_t *buf )
+{
+    for( int y = 0; y < height; y++ )
+    {
+        int x = -2;
+        for( ; x+8 <= width+3; x += 8 )
+        {
+            int16x8_t v = tap8( src+x, stride );
+            vst1q_s16( buf+x+2, v );
+            vst1_u8( dstv+x, vqrshrun_n_s16( v, 5 ) );
+        }
+        for( ; x < width+3; x++ )
+        {
+            int v = TAPFILTER(src,stride);
+            dstv[x] = x264_clip_pixel( (v + 16) >> 5 );
+            buf[x+2] = v;
+        }
+        for( x = 0; x+8 <= width; x += 8 )
+        {
+            vst1_u8( dstc+x, tap_centre8( buf+2+x ) );
+            vst1_u8( dsth+x, vqrshrun_n_s16( tap8( src+x, 1 ), 5 ) );
+        }
+        for( ; x < width; x++ )
+        {
+            dstc[x] = x264_clip_pixel( (TAPFILTER(buf+2,1) + 512) >> 10 );
+            dsth[x] = x264_clip_pixel( (TAPFILTER(src,1) + 16) >> 5 );
+        }
+        dsth += stride;
+        dstv += stride;
+        dstc += stride;
+        src += stride;
+    }
+}
+
+/* Same float operations in the same order as the C version. */
+static void mbtree_propagate_cost_neon( int16_t *dst, uint16_t *propagate_in, uint16_t *intra_costs,
+                                        uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len )
+{
+    float fps_c = *fps_factor;
+    float32x4_t fps = vdupq_n_f32( fps_c );
+    float32x4_t half = vdupq_n_f32( 0.5f );
+    uint16x8_t mask = vdupq_n_u16( LOWRES_COST_MASK );
+    int i = 0;
+    for( ; i+8 <= len; i += 8 )
+    {
+        uint16x8_t intra = vld1q_u16( intra_costs+i );
+        uint16x8_t num = vqsubq_u16( intra, vandq_u16( vld1q_u16( inter_costs+i ), mask ) );
+        uint16x8_t invq = vld1q_u16( inv_qscales+i );
+        uint16x8_t prop = vld1q_u16( propagate_in+i );
+        int16x4_t res[2];
+        for( int j = 0; j < 2; j++ )
+        {
+            uint16x4_t intra4 = j ? vget_high_u16( intra ) : vget_low_u16( intra );
+            uint16x4_t num4   = j ? vget_high_u16( num )   : vget_low_u16( num );
+            uint16x4_t invq4  = j ? vget_high_u16( invq )  : vget_low_u16( invq );
+            uint16x4_t prop4  = j ? vget_high_u16( prop )  : vget_low_u16( prop );
+            float32x4_t qscale = vcvtq_f32_u32( vmull_u16( intra4, invq4 ) );
+            float32x4_t amount = vaddq_f32( vcvtq_f32_u32( vmovl_u16( prop4 ) ), vmulq_f32( qscale, fps ) );
+            float32x4_t cost = vdivq_f32( vmulq_f32( amount, vcvtq_f32_u32( vmovl_u16( num4 ) ) ),
+                                          vcvtq_f32_u32( vmovl_u16( intra4 ) ) );
+            /* NaN from intra_cost == 0 converts to 0, as in the C version's int16 store */
+            res[j] = vqmovn_s32( vcvtq_s32_f32( vaddq_f32( cost, half ) ) );
+        }
+        vst1q_s16( dst+i, vcombine_s16( res[0], res[1] ) );
+    }
+    for( ; i < len; i++ )
+    {
+        int intra_cost = intra_costs[i];
+        int inter_cost = X264_MIN(intra_costs[i], inter_costs[i] & LOWRES_COST_MASK);
+        float propagate_intra  = intra_cost * inv_qscales[i];
+        float propagate_amount = propagate_in[i] + propagate_intra*fps_c;
+        float propagate_num    = intra_cost - inter_cost;
+        float propagate_denom  = intra_cost;
+        dst[i] = X264_MIN((int)(propagate_amount * propagate_num / propagate_denom + 0.5f), 32767);
+    }
+}
+
+/* (weight * amount + 512) >> 10 with 32-bit intermediates, weight <= 1024. */
+static ALWAYS_INLINE int16x8_t propagate_weight( int16x8_t weight, int16x8_t amount )
+{
+    int32x4_t lo = vmull_s16( vget_low_s16( weight ), vget_low_s16( amount ) );
+    int32x4_t hi = vmull_s16( vget_high_s16( weight ), vget_high_s16( amount ) );
+    return vcombine_s16( vrshrn_n_s32( lo, 10 ), vrshrn_n_s32( hi, 10 ) );
+}
+
+/* Fills the buffer PROPAGATE_LIST scatters from: for every 8 mbs, their {mbx, mby} target,
+ * then the weighted amounts for the top two and bottom two target mbs. */
+void x264_mbtree_propagate_list_internal_neon( int16_t (*mvs)[2], int16_t *propagate_amount,
+                                               uint16_t *lowres_costs, int16_t *output,
+                                               int bipred_weight, int mb_y, int len )
+{
+    const int16_t pos_init[8] = { 0, mb_y, 1, mb_y, 2, mb_y, 3, mb_y };
+    const int16_t step_init[8] = { 4, 0, 4, 0, 4, 0, 4, 0 };
+    const uint16_t even_init[8] = { 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 };
+    int16x8_t pos = vld1q_s16( pos_init );
+    int16x8_t step = vld1q_s16( step_init );
+    uint16x8_t even = vld1q_u16( even_init );
+    uint16x8_t bipred = vdupq_n_u16( 0xc000 );
+    int16x4_t bipred_w = vdup_n_s16( bipred_weight );
+    int16x8_t pw_32 = vdupq_n_s16( 32 );
+    int i = 0;
+    for( ; i+8 <= len; i += 8, output += 48 )
+    {
+        int16x8_t amount = vld1q_s16( propagate_amount+i );
+        uint16x8_t lists3 = vceqq_u16( vandq_u16( vld1q_u16( lowres_costs+i ), bipred ), bipred );
+        int16x8_t weighted = vcombine_s16( vrshrn_n_s32( vmull_s16( vget_low_s16( amount ), bipred_w ), 6 ),
+                                           vrshrn_n_s32( vmull_s16( vget_high_s16( amount ), bipred_w ), 6 ) );
+        amount = vbslq_s16( lists3, weighted, amount );
+
+        for( int j = 0; j < 2; j++ )
+        {
+            int16x8_t mv = vld1q_s16( mvs[i+4*j] );
+            vst1q_s16( output+8*j, vaddq_s16( vshrq_n_s16( mv, 5 ), pos ) );
+            pos = vaddq_s16( pos, step );
+
+            int16x8_t frac = vandq_s16( mv, vdupq_n_s16( 31 ) );
+            int16x8_t fx = vtrn1q_s16( frac, frac );
+            int16x8_t fy = vtrn2q_s16( frac, frac );
+            int16x8_t wx = vbslq_s16( even, vsubq_s16( pw_32, fx ), fx ); /* {32-x, x} */
+            int16x8_t a = j ? vzip2q_s16( amount, amount ) : vzip1q_s16( amount, amount );
+            vst1q_s16( output+16+8*j, propagate_weight( vmulq_s16( vsubq_s16( pw_32, fy ), wx ), a ) );
+            vst1q_s16( output+32+8*j, propagate_weight( vmulq_s16( fy, wx ), a ) );
+        }
+    }
+    for( int k = 0; i < len; i++, k += 2 )
+    {
+        int amount = propagate_amount[i];
+        if( (lowres_costs[i] >> LOWRES_COST_SHIFT) == 3 )
+            amount = (amount * bipred_weight + 32) >> 6;
+        int x = mvs[i][0];
+        int y = mvs[i][1];
+        output[k+0] = (x>>5) + i;
+        output[k+1] = (y>>5) + mb_y;
+        x &= 31;
+        y &= 31;
+        output[k+16] = ((32-y)*(32-x) * amount + 512) >> 10;
+        output[k+17] = ((32-y)*x * amount + 512) >> 10;
+        output[k+32] = (y*(32-x) * amount + 512) >> 10;
+        output[k+33] = (y*x * amount + 512) >> 10;
+    }
+}
+
+PROPAGATE_LIST(neon)
+
+/****************************************************************************
+ * x264_mc_init_intrin:
+ ****************************************************************************/
+void x264_mc_init_intrin( uint32_t cpu, x264_mc_functions_t *pf )
+{
+    if( !(cpu&X264_CPU_NEON) )
+        return;
+
+    pf->mc_luma   = mc_luma_wrap_neon;
+    pf->get_ref   = get_ref_neon;
+    pf->mc_chroma = mc_chroma_neon;
+
+    pf->avg[PIXEL_16x16] = pixel_avg_16x16_neon;
+    pf->avg[PIXEL_16x8]  = pixel_avg_16x8_neon;
+    pf->avg[PIXEL_8x16]  = pixel_avg_8x16_neon;
+    pf->avg[PIXEL_8x8]   = pixel_avg_8x8_neon;
+    pf->avg[PIXEL_8x4]   = pixel_avg_8x4_neon;
+    pf->avg[PIXEL_4x16]  = pixel_avg_4x16_neon;
+    pf->avg[PIXEL_4x8]   = pixel_avg_4x8_neon;
+    pf->avg[PIXEL_4x4]   = pixel_avg_4x4_neon;
+    pf->avg[PIXEL_4x2]   = pixel_avg_4x2_neon;
+
+    pf->weight    = mc_weight_wtab_neon;
+    pf->offsetadd = mc_weight_wtab_neon;
+    pf->offsetsub = mc_weight_wtab_neon;
+
+    pf->hpel_filter = hpel_filter_neon;
+
+    pf->mbtree_propagate_cost = mbtree_propagate_cost_neon;
+    pf->mbtree_propagate_list = mbtree_propagate_list_neon;
+}
@@ -0,0 +1,410 @@
+/*****************************************************************************
+ * pixel-intrin.c: aarch64 pixel metrics, intrinsics
+ *****************************************************************************
+ * Copyright (C) 2003-2022 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "common/common.h"
+#include "intrin.h"
+
+/* Same layout as the x86 sse2 intrinsics: 16 pixels per register, 8-wide
+ * blocks as two rows and 4-wide blocks as four rows, and word-sized
+ * differences for the transforms. */
+
+static ALWAYS_INLINE uint8x16_t load_rows( pixel *p, intptr_t stride, int w )
+{
+    if( w == 16 )
+        return vld1q_u8( p );
+    if( w == 8 )
+        return vcombine_u8( vld1_u8( p ), vld1_u8( p+stride ) );
+    uint32x4_t r = vdupq_n_u32( intrin_load32( p ) );
+    r = vsetq_lane_u32( intrin_load32( p+stride ), r, 1 );
+    r = vsetq_lane_u32( intrin_load32( p+2*stride ), r, 2 );
+    r = vsetq_lane_u32( intrin_load32( p+3*stride ), r, 3 );
+    return vreinterpretq_u8_u32( r );
+}
+
+static ALWAYS_INLINE int sad_neon( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int rows = 16 / w;
+    uint16x8_t sum = vdupq_n_u16( 0 );
+    for( int y = 0; y < h; y += rows, pix1 += rows*i_pix1, pix2 += rows*i_pix2 )
+    {
+        uint8x16_t a = load_rows( pix1, i_pix1, w );
+        uint8x16_t b = load_rows( pix2, i_pix2, w );
+        sum = vabal_u8( sum, vget_low_u8( a ), vget_low_u8( b ) );
+        sum = vabal_high_u8( sum, a, b );
+    }
+    return vaddlvq_u16( sum );
+}
+
+static ALWAYS_INLINE void sad_xn_neon( int n, pixel *fenc, pixel **pix, intptr_t i_stride, int *scores, int w, int h )
+{
+    int rows = 16 / w;
+    uint16x8_t sum[4] = { vdupq_n_u16( 0 ), vdupq_n_u16( 0 ), vdupq_n_u16( 0 ), vdupq_n_u16( 0 ) };
+    for( int y = 0; y < h; y += rows )
+    {
+        uint8x16_t f = load_rows( fenc + y*FENC_STRIDE, FENC_STRIDE, w );
+        for( int i = 0; i < n; i++ )
+        {
+            uint8x16_t p = load_rows( pix[i] + y*i_stride, i_stride, w );
+            sum[i] = vabal_u8( sum[i], vget_low_u8( f ), vget_low_u8( p ) );
+            sum[i] = vabal_high_u8( sum[i], f, p );
+        }
+    }
+    for( int i = 0; i < n; i++ )
+        scores[i] = vaddlvq_u16( sum[i] );
+}
+
+static ALWAYS_INLINE int ssd_neon( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int rows = 16 / w;
+    uint32x4_t sum = vdupq_n_u32( 0 );
+    for( int y = 0; y < h; y += rows, pix1 += rows*i_pix1, pix2 += rows*i_pix2 )
+    {
+        uint8x16_t d = vabdq_u8( load_rows( pix1, i_pix1, w ), load_rows( pix2, i_pix2, w ) );
+        sum = vpadalq_u16( sum, vmull_u8( vget_low_u8( d ), vget_low_u8( d ) ) );
+        sum = vpadalq_u16( sum, vmull_high_u8( d, d ) );
+    }
+    return vaddvq_u32( sum );
+}
+
+/* 8 differences widened to words. 4-wide blocks pack each row with the row
+ * 4 below it, so that one transform covers two 4x4 blocks. */
+static ALWAYS_INLINE int16x8_t diff_row( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    uint8x8_t a, b;
+    if( w >= 8 )
+    {
+        a = vld1_u8( pix1 );
+        b = vld1_u8( pix2 );
+    }
+    else
+    {
+        uint32x2_t ra = vdup_n_u32( intrin_load32( pix1 ) );
+        uint32x2_t rb = vdup_n_u32( intrin_load32( pix2 ) );
+        if( h == 4 )
+        {
+            ra = vset_lane_u32( 0, ra, 1 );
+            rb = vset_lane_u32( 0, rb, 1 );
+        }
+        else
+        {
+            ra = vset_lane_u32( intrin_load32( pix1+4*i_pix1 ), ra, 1 );
+            rb = vset_lane_u32( intrin_load32( pix2+4*i_pix2 ), rb, 1 );
+        }
+        a = vreinterpret_u8_u32( ra );
+        b = vreinterpret_u8_u32( rb );
+    }
+    return vreinterpretq_s16_u16( vsubl_u8( a, b ) );
+}
+
+#define SUMSUB( a, b )\
+{\
+    int16x8_t t_ = a;\
+    a = vaddq_s16( t_, b );\
+    b = vsubq_s16( t_, b );\
+}
+
+/* Horizontal butterflies between words 1, 2 and 4 apart: the lower word of
+ * each pair gets the sum, the upper one the difference. */
+static ALWAYS_INLINE int16x8_t hadamard_h1( int16x8_t x )
+{
+    static const int16_t m[8] = { 1, -1, 1, -1, 1, -1, 1, -1 };
+    return vmlaq_s16( vrev32q_s16( x ), x, vld1q_s16( m ) );
+}
+
+static ALWAYS_INLINE int16x8_t hadamard_h2( int16x8_t x )
+{
+    static const int16_t m[8] = { 1, 1, -1, -1, 1, 1, -1, -1 };
+    int16x8_t s = vreinterpretq_s16_s32( vrev64q_s32( vreinterpretq_s32_s16( x ) ) );
+    return vmlaq_s16( s, x, vld1q_s16( m ) );
+}
+
+static ALWAYS_INLINE int16x8_t hadamard_h4( int16x8_t x )
+{
+    static const int16_t m[8] = { 1, 1, 1, 1, -1, -1, -1, -1 };
+    return vmlaq_s16( vextq_s16( x, x, 4 ), x, vld1q_s16( m ) );
+}
+
+static ALWAYS_INLINE int satd_neon( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int step = w == 4 ? 8 : 4;
+    int32x4_t sum = vdupq_n_s32( 0 );
+    for( int x = 0; x < w; x += 8 )
+        for( int y = 0; y < h; y += step )
+        {
+            pixel *p1 = pix1 + y*i_pix1 + x;
+            pixel *p2 = pix2 + y*i_pix2 + x;
+            int16x8_t d0 = diff_row( p1,          i_pix1, p2,          i_pix2, w, h );
+            int16x8_t d1 = diff_row( p1+  i_pix1, i_pix1, p2+  i_pix2, i_pix2, w, h );
+            int16x8_t d2 = diff_row( p1+2*i_pix1, i_pix1, p2+2*i_pix2, i_pix2, w, h );
+            int16x8_t d3 = diff_row( p1+3*i_pix1, i_pix1, p2+3*i_pix2, i_pix2, w, h );
+            SUMSUB( d0, d1 );
+            SUMSUB( d2, d3 );
+            SUMSUB( d0, d2 );
+            SUMSUB( d1, d3 );
+            d0 = vabsq_s16( hadamard_h2( hadamard_h1( d0 ) ) );
+            d1 = vabsq_s16( hadamard_h2( hadamard_h1( d1 ) ) );
+            d2 = vabsq_s16( hadamard_h2( hadamard_h1( d2 ) ) );
+            d3 = vabsq_s16( hadamard_h2( hadamard_h1( d3 ) ) );
+            sum = vpadalq_s16( sum, vaddq_s16( vaddq_s16( d0, d1 ), vaddq_s16( d2, d3 ) ) );
+        }
+    return vaddvq_s32( sum ) >> 1;
+}
+
+/* 8x8 hadamard of d[], returning the sum of |coefs|. If sum4 is non-NULL it
+ * also receives the sum after the 4x4 stage. */
+static ALWAYS_INLINE int32x4_t hadamard_8x8( int16x8_t d[8], int32x4_t *sum4 )
+{
+    SUMSUB( d[0], d[1] ); SUMSUB( d[2], d[3] );
+    SUMSUB( d[4], d[5] ); SUMSUB( d[6], d[7] );
+    SUMSUB( d[0], d[2] ); SUMSUB( d[1], d[3] );
+    SUMSUB( d[4], d[6] ); SUMSUB( d[5], d[7] );
+    for( int i = 0; i < 8; i++ )
+        d[i] = hadamard_h2( hadamard_h1( d[i] ) );
+    if( sum4 )
+    {
+        int32x4_t s = vdupq_n_s32( 0 );
+        for( int i = 0; i < 8; i += 2 )
+            s = vpadalq_s16( s, vaddq_s16( vabsq_s16( d[i] ), vabsq_s16( d[i+1] ) ) );
+        *sum4 = s;
+    }
+    SUMSUB( d[0], d[4] ); SUMSUB( d[1], d[5] );
+    SUMSUB( d[2], d[6] ); SUMSUB( d[3], d[7] );
+    /* 8x8 coefs need up to 15 bits, so only pairs may be added as words */
+    int32x4_t sum = vdupq_n_s32( 0 );
+    for( int i = 0; i < 8; i += 2 )
+    {
+        d[i]   = hadamard_h4( d[i] );
+        d[i+1] = hadamard_h4( d[i+1] );
+        sum = vpadalq_s16( sum, vaddq_s16( vabsq_s16( d[i] ), vabsq_s16( d[i+1] ) ) );
+    }
+    return sum;
+}
+
+static ALWAYS_INLINE int sa8d_neon( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int32x4_t sum = vdupq_n_s32( 0 );
+    for( int y = 0; y < h; y += 8 )
+        for( int x = 0; x < w; x += 8 )
+        {
+            int16x8_t d[8];
+            for( int i = 0; i < 8; i++ )
+                d[i] = diff_row( pix1 + (y+i)*i_pix1 + x, i_pix1, pix2 + (y+i)*i_pix2 + x, i_pix2, 8, 8 );
+            sum = vaddq_s32( sum, hadamard_8x8( d, NULL ) );
+        }
+    return (vaddvq_s32( sum ) + 2) >> 2;
+}
+
+static ALWAYS_INLINE uint64_t hadamard_ac_neon( pixel *pix, intptr_t stride, int w, int h )
+{
+    int32x4_t sum4 = vdupq_n_s32( 0 ), sum8 = sum4;
+    int dc = 0;
+    for( int y = 0; y < h; y += 8 )
+        for( int x = 0; x < w; x += 8 )
+        {
+            int16x8_t d[8];
+            int32x4_t s4;
+            for( int i = 0; i < 8; i++ )
+                d[i] = vreinterpretq_s16_u16( vmovl_u8( vld1_u8( pix + (y+i)*stride + x ) ) );
+            sum8 = vaddq_s32( sum8, hadamard_8x8( d, &s4 ) );
+            sum4 = vaddq_s32( sum4, s4 );
+            /* the transform leaves the pixel sum, i.e. the dc, in word 0 */
+            dc += vgetq_lane_s16( d[0], 0 );
+        }
+    uint32_t s4 = vaddvq_s32( sum4 ) - dc;
+    uint32_t s8 = vaddvq_s32( sum8 ) - dc;
+    return ((uint64_t)(s8>>2)<<32) + (s4>>1);
+}
+
+static ALWAYS_INLINE uint64_t var_neon( pixel *pix, intptr_t i_stride, int w, int h )
+{
+    int rows = 16 / w;
+    uint16x8_t sum = vdupq_n_u16( 0 );
+    uint32x4_t sqr = vdupq_n_u32( 0 );
+    for( int y = 0; y < h; y += rows, pix += rows*i_stride )
+    {
+        uint8x16_t p = load_rows( pix, i_stride, w );
+        sum = vpadalq_u8( sum, p );
+        sqr = vpadalq_u16( sqr, vmull_u8( vget_low_u8( p ), vget_low_u8( p ) ) );
+        sqr = vpadalq_u16( sqr, vmull_high_u8( p, p ) );
+    }
+    return vaddlvq_u16( sum ) + ((uint64_t)vaddvq_u32( sqr ) << 32);
+}
+
+static ALWAYS_INLINE int var2_neon( pixel *fenc, pixel *fdec, int ssd[2], int h, int shift )
+{
+    int16x8_t sum_u = vdupq_n_s16( 0 ), sum_v = sum_u;
+    int32x4_t sqr_u = vdupq_n_s32( 0 ), sqr_v = sqr_u;
+    for( int y = 0; y < h; y++, fenc += FENC_STRIDE, fdec += FDEC_STRIDE )
+    {
+        int16x8_t du = diff_row( fenc, 0, fdec, 0, 8, 8 );
+        int16x8_t dv = diff_row( fenc+FENC_STRIDE/2, 0, fdec+FDEC_STRIDE/2, 0, 8, 8 );
+        sum_u = vaddq_s16( sum_u, du );
+        sum_v = vaddq_s16( sum_v, dv );
+        sqr_u = vmlal_s16( sqr_u, vget_low_s16( du ), vget_low_s16( du ) );
+        sqr_u = vmlal_high_s16( sqr_u, du, du );
+        sqr_v = vmlal_s16( sqr_v, vget_low_s16( dv ), vget_low_s16( dv ) );
+        sqr_v = vmlal_high_s16( sqr_v, dv, dv );
+    }
+    int su = vaddlvq_s16( sum_u );
+    int sv = vaddlvq_s16( sum_v );
+    ssd[0] = vaddvq_s32( sqr_u );
+    ssd[1] = vaddvq_s32( sqr_v );
+    return ssd[0] - ((int64_t)su * su >> shift) +
+           ssd[1] - ((int64_t)sv * sv >> shift);
+}
+
+static ALWAYS_INLINE void satd_xn_neon( int n, pixel *fenc, pixel **pix, intptr_t i_stride, int *scores, int w, int h )
+{
+    for( int i = 0; i < n; i++ )
+        scores[i] = satd_neon( fenc, FENC_STRIDE, pix[i], i_stride, w, h );
+}
+
+#define PIXEL_CMP_NEON( name, w, h ) \
+static int pixel_##name##_##w##x##h##_neon( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2 )\
+{\
+    return name##_neon( pix1, i_pix1, pix2, i_pix2, w, h );\
+}
+#define PIXEL_X_NEON( name, w, h ) \
+static void pixel_##name##_x3_##w##x##h##_neon( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                               intptr_t i_stride, int scores[3] )\
+{\
+    pixel *pix[3] = { pix0, pix1, pix2 };\
+    name##_xn_neon( 3, fenc, pix, i_stride, scores, w, h );\
+}\
+static void pixel_##name##_x4_##w##x##h##_neon( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                               pixel *pix3, intptr_t i_stride, int scores[4] )\
+{\
+    pixel *pix[4] = { pix0, pix1, pix2, pix3 };\
+    name##_xn_neon( 4, fenc, pix, i_stride, scores, w, h );\
+}
+
+PIXEL_CMP_NEON( sad, 16, 16 )
+PIXEL_CMP_NEON( sad, 16,  8 )
+PIXEL_CMP_NEON( sad,  8, 16 )
+PIXEL_CMP_NEON( sad,  8,  8 )
+PIXEL_CMP_NEON( sad,  8,  4 )
+PIXEL_CMP_NEON( sad,  4, 16 )
+PIXEL_CMP_NEON( sad,  4,  8 )
+PIXEL_CMP_NEON( sad,  4,  4 )
+PIXEL_X_NEON( sad, 16, 16 )
+PIXEL_X_NEON( sad, 16,  8 )
+PIXEL_X_NEON( sad,  8, 16 )
+PIXEL_X_NEON( sad,  8,  8 )
+PIXEL_X_NEON( sad,  8,  4 )
+PIXEL_X_NEON( sad,  4,  8 )
+PIXEL_X_NEON( sad,  4,  4 )
+PIXEL_CMP_NEON( ssd, 16, 16 )
+PIXEL_CMP_NEON( ssd, 16,  8 )
+PIXEL_CMP_NEON( ssd,  8, 16 )
+PIXEL_CMP_NEON( ssd,  8,  8 )
+PIXEL_CMP_NEON( ssd,  8,  4 )
+PIXEL_CMP_NEON( ssd,  4, 16 )
+PIXEL_CMP_NEON( ssd,  4,  8 )
+PIXEL_CMP_NEON( ssd,  4,  4 )
+PIXEL_CMP_NEON( satd, 16, 16 )
+PIXEL_CMP_NEON( satd, 16,  8 )
+PIXEL_CMP_NEON( satd,  8, 16 )
+PIXEL_CMP_NEON( satd,  8,  8 )
+PIXEL_CMP_NEON( satd,  8,  4 )
+PIXEL_CMP_NEON( satd,  4, 16 )
+PIXEL_CMP_NEON( satd,  4,  8 )
+PIXEL_CMP_NEON( satd,  4,  4 )
+PIXEL_X_NEON( satd, 16, 16 )
+PIXEL_X_NEON( satd, 16,  8 )
+PIXEL_X_NEON( satd,  8, 16 )
+PIXEL_X_NEON( satd,  8,  8 )
+PIXEL_X_NEON( satd,  8,  4 )
+PIXEL_X_NEON( satd,  4,  8 )
+PIXEL_X_NEON( satd,  4,  4 )
+PIXEL_CMP_NEON( sa8d, 16, 16 )
+PIXEL_CMP_NEON( sa8d,  8,  8 )
+
+#define HADAMARD_AC_NEON( w, h ) \
+static uint64_t pixel_hadamard_ac_##w##x##h##_neon( pixel *pix, intptr_t stride )\
+{\
+    return hadamard_ac_neon( pix, stride, w, h );\
+}
+HADAMARD_AC_NEON( 16, 16 )
+HADAMARD_AC_NEON( 16, 8 )
+HADAMARD_AC_NEON( 8, 16 )
+HADAMARD_AC_NEON( 8, 8 )
+
+#define VAR_NEON( w, h ) \
+static uint64_t pixel_var_##w##x##h##_neon( pixel *pix, intptr_t i_stride )\
+{\
+    return var_neon( pix, i_stride, w, h );\
+}
+VAR_NEON( 16, 16 )
+VAR_NEON( 8, 16 )
+VAR_NEON( 8, 8 )
+
+static int pixel_var2_8x16_neon( pixel *fenc, pixel *fdec, int ssd[2] )
+{
+    return var2_neon( fenc, fdec, ssd, 16, 7 );
+}
+
+static int pixel_var2_8x8_neon( pixel *fenc, pixel *fdec, int ssd[2] )
+{
+    return var2_neon( fenc, fdec, ssd, 8, 6 );
+}
+
+/****************************************************************************
+ * x264_pixel_init_intrin:
+ ****************************************************************************/
+void x264_pixel_init_intrin( uint32_t cpu, x264_pixel_function_t *pixf )
+{
+#define INIT4( name, cpu ) \
+    pixf->name[PIXEL_16x16] = pixel_##name##_16x16##cpu;\
+    pixf->name[PIXEL_16x8]  = pixel_##name##_16x8##cpu;\
+    pixf->name[PIXEL_8x16]  = pixel_##name##_8x16##cpu;\
+    pixf->name[PIXEL_8x8]   = pixel_##name##_8x8##cpu;
+#define INIT7( name, cpu ) \
+    INIT4( name, cpu ) \
+    pixf->name[PIXEL_8x4]   = pixel_##name##_8x4##cpu;\
+    pixf->name[PIXEL_4x8]   = pixel_##name##_4x8##cpu;\
+    pixf->name[PIXEL_4x4]   = pixel_##name##_4x4##cpu;
+#define INIT8( name, cpu ) \
+    INIT7( name, cpu ) \
+    pixf->name[PIXEL_4x16]  = pixel_##name##_4x16##cpu;
+
+    if( cpu&X264_CPU_NEON )
+    {
+        INIT8( sad, _neon );
+        INIT7( sad_x3, _neon );
+        INIT7( sad_x4, _neon );
+        INIT8( ssd, _neon );
+        INIT8( satd, _neon );
+        INIT7( satd_x3, _neon );
+        INIT7( satd_x4, _neon );
+        INIT4( hadamard_ac, _neon );
+        pixf->sa8d[PIXEL_16x16] = pixel_sa8d_16x16_neon;
+        pixf->sa8d[PIXEL_8x8]   = pixel_sa8d_8x8_neon;
+        pixf->var[PIXEL_16x16] = pixel_var_16x16_neon;
+        pixf->var[PIXEL_8x16]  = pixel_var_8x16_neon;
+        pixf->var[PIXEL_8x8]   = pixel_var_8x8_neon;
+        pixf->var2[PIXEL_8x16] = pixel_var2_8x16_neon;
+        pixf->var2[PIXEL_8x8]  = pixel_var2_8x8_neon;
+        // AArch64 has no distinct instructions for aligned load/store
+        memcpy( pixf->sad_aligned, pixf->sad, sizeof(pixf->sad_aligned) );
+    }
+}
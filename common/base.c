@@ -98,12 +98,44 @@ void x264_log_internal( int i_level, const char *psz_fmt, ... )
     va_end( arg );
 }
 
+#if HAVE_THP
+/* The size of a transparent huge page is that of a PMD, which depends on the base page size:
+ * 2 MiB with 4K pages, but e.g. 32 MiB with 16K and 512 MiB with 64K pages on arm64. */
+static int thp_size( void )
+{
+    static int size;
+    int i_size = x264_atomic_load( &size );
+    if( !i_size )
+    {
+        long long pmd_size = 0;
+        FILE *f = x264_fopen( "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r" );
+        if( f )
+        {
+            if( fscanf( f, "%lld", &pmd_size ) != 1 )
+                pmd_size = 0;
+            fclose( f );
+        }
+        if( pmd_size > 0 && pmd_size <= (1<<30) && !(pmd_size & (pmd_size-1)) )
+            i_size = pmd_size;
+        else
+            i_size = 2*1024*1024;
+        x264_atomic_store( &size, i_size );
+    }
+    return i_size;
+}
+#endif
+
 /****************************************************************************
  * x264_malloc:
  ****************************************************************************/
 void *x264_malloc( int64_t i_size )
 {
+#if HAVE_THP
+    size_t huge_page_size = thp_size();
+#define HUGE_PAGE_SIZE huge_page_size
+#else
 #define HUGE_PAGE_SIZE 2*1024*1024
+#endif
 #define HUGE_PAGE_THRESHOLD HUGE_PAGE_SIZE*7/8 /* FIXME: Is this optimal? */
     if( i_size < 0 || (uint64_t)i_size > (SIZE_MAX - HUGE_PAGE_SIZE) /*|| (uint64_t)i_size > (SIZE_MAX - NATIVE_ALIGN - sizeof(void **))*/ )
     {
@@ -967,6 +999,10 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
     }
     OPT("sliced-threads")
         p->b_sliced_threads = atobool(value);
+    OPT("wavefront-threads")
+        p->b_wavefront_threads = atobool(value);
+    OPT("entropy-threads")
+        p->b_entropy_threads = atobool(value);
     OPT("sync-lookahead")
     {
         if( !strcasecmp(value, "auto") )
@@ -1096,6 +1132,8 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
             p->i_scenecut_threshold = atoi(value);
         }
     }
+    OPT("scenecut-prepass")
+        p->b_scenecut_prepass = atobool(value);
     OPT("intra-refresh")
         p->b_intra_refresh = atobool(value);
     OPT("bframes")
@@ -1111,6 +1149,8 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
     }
     OPT("b-bias")
         p->i_bframe_bias = atoi(value);
+    OPT("lookahead-levels")
+        p->i_lookahead_levels = atoi(value);
     OPT("b-pyramid")
     {
         b_error |= parse_enum( value, x264_b_pyramid_names, &p->i_bframe_pyramid );
@@ -1239,6 +1279,10 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
         p->i_log_level = atoi(value);
     OPT("dump-yuv")
         CHECKED_ERROR_PARAM_STRDUP( p->psz_dump_yuv, p, value );
+    OPT("analysis-out")
+        CHECKED_ERROR_PARAM_STRDUP( p->psz_analysis_out, p, value );
+    OPT("analysis-in")
+        CHECKED_ERROR_PARAM_STRDUP( p->psz_analysis_in, p, value );
     OPT2("analyse", "partitions")
     {
         p->analyse.inter = 0;
@@ -1324,6 +1368,8 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
         p->rc.f_rf_constant_max = atof(value);
     OPT("rc-lookahead")
         p->rc.i_lookahead = atoi(value);
+    OPT("rc-lookahead-min")
+        p->rc.i_lookahead_min = atoi(value);
     OPT2("qpmin", "qp-min")
         p->rc.i_qp_min = atoi(value);
     OPT2("qpmax", "qp-max")
@@ -1338,6 +1384,8 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
         p->rc.i_vbv_buffer_size = atoi(value);
     OPT("vbv-init")
         p->rc.f_vbv_buffer_init = atof(value);
+    OPT("vbv-speculate")
+        p->rc.i_vbv_speculate = atoi(value);
     OPT2("ipratio", "ip-factor")
         p->rc.f_ip_factor = atof(value);
     OPT2("pbratio", "pb-factor")
@@ -1352,6 +1400,8 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
         p->rc.b_stat_write = pass & 1;
         p->rc.b_stat_read = pass & 2;
     }
+    OPT("lookahead-pass")
+        p->rc.b_lookahead_pass = atobool(value);
     OPT("stats")
     {
         CHECKED_ERROR_PARAM_STRDUP( p->rc.psz_stat_in, p, value );
@@ -1361,6 +1411,8 @@ REALIGN_STACK int x264_param_parse( x264_param_t *p, const char *name, const cha
         p->rc.f_qcompress = atof(value);
     OPT("mbtree")
         p->rc.b_mb_tree = atobool(value);
+    OPT("mbtree-incremental")
+        p->rc.b_mb_tree_incremental = atobool(value);
     OPT("qblur")
         p->rc.f_qblur = atof(value);
     OPT2("cplxblur", "cplx-blur")
@@ -1467,6 +1519,10 @@ char *x264_param2string( x264_param_t *p, int b_res )
     s += sprintf( s, " threads=%d", p->i_threads );
     s += sprintf( s, " lookahead_threads=%d", p->i_lookahead_threads );
     s += sprintf( s, " sliced_threads=%d", p->b_sliced_threads );
+    if( p->b_wavefront_threads )
+        s += sprintf( s, " wavefront_threads=%d", p->b_wavefront_threads );
+    if( p->b_entropy_threads )
+        s += sprintf( s, " entropy_threads=%d", p->b_entropy_threads );
     if( p->i_slice_count )
         s += sprintf( s, " slices=%d", p->i_slice_count );
     if( p->i_slice_count_max )
@@ -1501,13 +1557,23 @@ char *x264_param2string( x264_param_t *p, int b_res )
         s += sprintf( s, " keyint=%d", p->i_keyint_max );
     s += sprintf( s, " keyint_min=%d scenecut=%d intra_refresh=%d",
                   p->i_keyint_min, p->i_scenecut_threshold, p->b_intra_refresh );
+    if( p->b_scenecut_prepass )
+        s += sprintf( s, " scenecut_prepass=%d", p->b_scenecut_prepass );
+    if( p->i_lookahead_levels )
+        s += sprintf( s, " lookahead_levels=%d", p->i_lookahead_levels );
 
     if( p->rc.b_mb_tree || p->rc.i_vbv_buffer_size )
         s += sprintf( s, " rc_lookahead=%d", p->rc.i_lookahead );
+    if( p->rc.i_lookahead_min )
+        s += sprintf( s, " rc_lookahead_min=%d", p->rc.i_lookahead_min );
+    if( p->rc.b_mb_tree_incremental )
+        s += sprintf( s, " mbtree_incremental=%d", p->rc.b_mb_tree_incremental );
 
     s += sprintf( s, " rc=%s mbtree=%d", p->rc.i_rc_method == X264_RC_ABR ?
                                ( p->rc.b_stat_read ? "2pass" : p->rc.i_vbv_max_bitrate == p->rc.i_bitrate ? "cbr" : "abr" )
                                : p->rc.i_rc_method == X264_RC_CRF ? "crf" : "cqp", p->rc.b_mb_tree );
+    if( p->rc.b_lookahead_pass )
+        s += sprintf( s, " lookahead_pass=%d", p->rc.b_lookahead_pass );
     if( p->rc.i_rc_method == X264_RC_ABR || p->rc.i_rc_method == X264_RC_CRF )
     {
         if( p->rc.i_rc_method == X264_RC_CRF )
@@ -1524,6 +1590,8 @@ char *x264_param2string( x264_param_t *p, int b_res )
         {
             s += sprintf( s, " vbv_maxrate=%d vbv_bufsize=%d",
                           p->rc.i_vbv_max_bitrate, p->rc.i_vbv_buffer_size );
+            if( p->rc.i_vbv_speculate )
+                s += sprintf( s, " vbv_speculate=%d", p->rc.i_vbv_speculate );
             if( p->rc.i_rc_method == X264_RC_CRF )
                 s += sprintf( s, " crf_max=%.1f", p->rc.f_rf_constant_max );
         }
@@ -137,6 +137,7 @@ enum sei_payload_type_e
 #define X264_REF_MAX 16
 #define X264_THREAD_MAX 128
 #define X264_LOOKAHEAD_THREAD_MAX 16
+#define X264_SPECULATE_MAX 8
 #define X264_LOOKAHEAD_MAX 250
 
 // number of pixels (per thread) in progress at any given time.
@@ -45,6 +45,7 @@
 #define x264_encoder_maximum_delayed_frames x264_template(encoder_maximum_delayed_frames)
 #define x264_encoder_intra_refresh x264_template(encoder_intra_refresh)
 #define x264_encoder_invalidate_reference x264_template(encoder_invalidate_reference)
+#define x264_encoder_input_layout x264_template(encoder_input_layout)
 
 /* This undef allows to rename the external symbol and force link failure in case
  * of incompatible libraries. Then the define enables templating as above. */
@@ -220,8 +221,16 @@ typedef struct x264_lookahead_t
     uint8_t                       b_thread_active;
     uint8_t                       b_analyse_keyframe;
     int                           i_last_keyframe;
-    int                           i_slicetype_length;
+    int                           i_slicetype_length;  /* current window, adapted between min and max */
+    int                           i_slicetype_min;
+    int                           i_slicetype_max;
+    int                           i_adapt_score;       /* adaptive window state, encoder side */
+    int64_t                       i_last_fetch;
+    int64_t                       i_fetch_period;
     x264_frame_t                  *last_nonb;
+    int                           i_mbtree_pass;       /* incremental mb-tree state */
+    int                           i_mbtree_last_frame;
+    float                         f_mbtree_duration;
     x264_pthread_t                thread_handle;
     x264_sync_frame_list_t        ifbuf;
     x264_sync_frame_list_t        next;
@@ -229,6 +238,8 @@ typedef struct x264_lookahead_t
 } x264_lookahead_t;
 
 typedef struct x264_ratecontrol_t   x264_ratecontrol_t;
+typedef struct x264_wavefront_t     x264_wavefront_t;
+typedef struct x264_speculate_t     x264_speculate_t;
 
 typedef struct x264_left_table_t
 {
@@ -276,6 +287,7 @@ struct x264_t
 
     x264_t          *thread[X264_THREAD_MAX+1];
     x264_t          *lookahead_thread[X264_LOOKAHEAD_THREAD_MAX];
+    x264_t          *lookahead_coarse; /* frametype decisions at the resolution of i_lookahead_levels */
     int             b_thread_active;
     int             i_thread_phase; /* which thread to use for the next frame */
     int             i_thread_idx;   /* which thread this is */
@@ -284,6 +296,11 @@ struct x264_t
     int             i_threadslice_pass; /* which pass of encoding we are on */
     x264_threadpool_t *threadpool;
     x264_threadpool_t *lookaheadpool;
+    x264_threadpool_t *analysispool; /* mb analysis of each frame thread, with b_entropy_threads */
+    x264_wavefront_t  *wavefront; /* row progress and finished mbs shared by wavefront threads */
+    x264_t          *wavefront_writer; /* on a thread analysing mbs for a bitstream writer, the writer */
+    x264_threadpool_t *speculatepool; /* rows encoded ahead of time by the frame threads, with rc.i_vbv_speculate */
+    x264_speculate_t  *speculate; /* contexts encoding the current row of a frame thread ahead of time */
     x264_pthread_mutex_t mutex;
     x264_pthread_cond_t cv;
 
@@ -405,6 +422,7 @@ struct x264_t
         int64_t i_second_largest_pts;
         int b_have_lowres;  /* Whether 1/2 resolution luma planes are being used */
         int b_have_sub8x8_esa;
+        x264_frame_t *pyramid; /* lookahead levels between the lowres planes and the coarsest one */
     } frames;
 
     /* current frame being encoded */
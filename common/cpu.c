@@ -125,6 +125,52 @@ static void sigill_handler( int sig )
 int x264_cpu_cpuid_test( void );
 void x264_cpu_cpuid( uint32_t op, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx );
 uint64_t x264_cpu_xgetbv( int xcr );
+#elif HAVE_INTRIN && (ARCH_X86 || ARCH_X86_64)
+/* No cpu-a.asm without nasm: query the cpu through the compiler instead. */
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#if !ARCH_X86_64
+static int x264_cpu_cpuid_test( void )
+{
+#ifdef _MSC_VER
+    return 1;
+#else
+    return __get_cpuid_max( 0, NULL ) != 0;
+#endif
+}
+#endif
+
+static void x264_cpu_cpuid( uint32_t op, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx )
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuidex( regs, op, 0 );
+    *eax = regs[0];
+    *ebx = regs[1];
+    *ecx = regs[2];
+    *edx = regs[3];
+#else
+    __cpuid_count( op, 0, *eax, *ebx, *ecx, *edx );
+#endif
+}
+
+static uint64_t x264_cpu_xgetbv( int xcr )
+{
+#ifdef _MSC_VER
+    return _xgetbv( xcr );
+#else
+    uint32_t eax, edx;
+    __asm__ volatile( "xgetbv" : "=a"(eax), "=d"(edx) : "c"(xcr) );
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
+
+#if HAVE_MMX || (HAVE_INTRIN && (ARCH_X86 || ARCH_X86_64))
 
 uint32_t x264_cpu_detect( void )
 {
@@ -403,11 +449,11 @@ uint32_t x264_cpu_detect( void )
     return flags;
 }
 
-#elif HAVE_AARCH64
+#elif HAVE_AARCH64 || (HAVE_INTRIN && ARCH_AARCH64)
 
 uint32_t x264_cpu_detect( void )
 {
-#if HAVE_NEON
+#if HAVE_NEON || HAVE_INTRIN
     return X264_CPU_ARMV8 | X264_CPU_NEON;
 #else
     return X264_CPU_ARMV8;
@@ -56,13 +56,8 @@ static int frame_internal_csp( int external_csp )
     return X264_CSP_NONE;
 }
 
-static x264_frame_t *frame_new( x264_t *h, int b_fdec )
+static int frame_align( x264_t *h )
 {
-    x264_frame_t *frame;
-    int i_csp = frame_internal_csp( h->param.i_csp );
-    int i_mb_count = h->mb.i_mb_count;
-    int i_stride, i_width, i_lines, luma_plane_count;
-    int i_padv = PADV << PARAM_INTERLACED;
     int align = NATIVE_ALIGN / SIZEOF_PIXEL;
 #if ARCH_X86 || ARCH_X86_64
     if( h->param.cpu&X264_CPU_CACHELINE_64 || h->param.cpu&X264_CPU_AVX512 )
@@ -72,19 +67,100 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
     else
         align = 16 / SIZEOF_PIXEL;
 #endif
+    return align;
+}
+
 #if ARCH_PPC
-    int disalign = (1<<9) / SIZEOF_PIXEL;
+#define FRAME_DISALIGN ((1<<9) / SIZEOF_PIXEL)
 #else
-    int disalign = (1<<10) / SIZEOF_PIXEL;
+#define FRAME_DISALIGN ((1<<10) / SIZEOF_PIXEL)
 #endif
 
+static int frame_stride( x264_t *h )
+{
+    /* allocate frame data (+64 for extra data for me) */
+    return align_stride( h->mb.i_mb_width*16 + PADH2, frame_align( h ), FRAME_DISALIGN );
+}
+
+/* Level of the lookahead pyramid, level 0 being the lowres planes of the frame itself.
+ * Only the level frametype decisions are made on has lowres costs, the ones in between
+ * are just downscaled through. */
+x264_frame_t *x264_frame_new_level( x264_t *h, int level )
+{
+    x264_frame_t *frame;
+    int i_mb_width = (h->mb.i_mb_width + (1<<level) - 1) >> level;
+    int i_mb_height = (h->mb.i_mb_height + (1<<level) - 1) >> level;
+    int i_mb_count = i_mb_width * i_mb_height;
+    int b_costs = level == h->param.i_lookahead_levels;
+    int disalign = FRAME_DISALIGN;
+
+    CHECKED_MALLOCZERO( frame, sizeof(x264_frame_t) );
+    PREALLOC_INIT
+
+    frame->i_width_lowres = i_mb_width*8;
+    frame->i_lines_lowres = i_mb_height*8;
+    frame->i_stride_lowres = align_stride( frame->i_width_lowres + PADH2, frame_align( h ), disalign<<1 );
+    int64_t luma_plane_size = align_plane_size( frame->i_stride_lowres * (frame->i_lines_lowres + 2*PADV), disalign );
+
+    PREALLOC( frame->buffer_lowres, 4 * luma_plane_size * SIZEOF_PIXEL );
+    if( b_costs )
+    {
+        for( int j = 0; j <= !!h->param.i_bframe; j++ )
+            for( int i = 0; i <= h->param.i_bframe; i++ )
+            {
+                PREALLOC( frame->lowres_mvs[j][i], 2*i_mb_count*sizeof(int16_t) );
+                PREALLOC( frame->lowres_mv_costs[j][i], i_mb_count*sizeof(int) );
+            }
+        for( int j = 0; j <= h->param.i_bframe+1; j++ )
+            for( int i = 0; i <= h->param.i_bframe+1; i++ )
+                PREALLOC( frame->lowres_costs[j][i], i_mb_count * sizeof(uint16_t) );
+    }
+
+    PREALLOC_END( frame->base );
+
+    for( int i = 0; i < 4; i++ )
+        frame->lowres[i] = frame->buffer_lowres + frame->i_stride_lowres * PADV + PADH_ALIGN + i * luma_plane_size;
+
+    if( b_costs )
+    {
+        for( int j = 0; j <= !!h->param.i_bframe; j++ )
+            for( int i = 0; i <= h->param.i_bframe; i++ )
+                memset( frame->lowres_mvs[j][i], 0, 2*i_mb_count*sizeof(int16_t) );
+
+        frame->i_intra_cost = frame->lowres_costs[0][0];
+        memset( frame->i_intra_cost, -1, i_mb_count * sizeof(uint16_t) );
+    }
+
+    if( x264_pthread_mutex_init( &frame->mutex, NULL ) )
+        goto fail;
+    if( x264_pthread_cond_init( &frame->cv, NULL ) )
+        goto fail;
+
+    return frame;
+
+fail:
+    x264_free( frame );
+    return NULL;
+}
+
+static x264_frame_t *frame_new( x264_t *h, int b_fdec )
+{
+    x264_frame_t *frame;
+    int i_csp = frame_internal_csp( h->param.i_csp );
+    int i_mb_count = h->mb.i_mb_count;
+    int i_stride, i_width, i_lines, luma_plane_count;
+    int i_padv = PADV << PARAM_INTERLACED;
+    int align = frame_align( h );
+    int disalign = FRAME_DISALIGN;
+    /* with zero-copy input the planes of fenc frames are borrowed from the caller */
+    int b_own_planes = b_fdec || !h->param.b_zero_copy_input;
+
     CHECKED_MALLOCZERO( frame, sizeof(x264_frame_t) );
     PREALLOC_INIT
 
-    /* allocate frame data (+64 for extra data for me) */
     i_width  = h->mb.i_mb_width*16;
     i_lines  = h->mb.i_mb_height*16;
-    i_stride = align_stride( i_width + PADH2, align, disalign );
+    i_stride = frame_stride( h );
 
     if( i_csp == X264_CSP_NV12 || i_csp == X264_CSP_NV16 )
     {
@@ -147,7 +223,9 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
 
     frame->orig = frame;
 
-    if( i_csp == X264_CSP_NV12 || i_csp == X264_CSP_NV16 )
+    if( !b_own_planes )
+        luma_plane_count = 0;
+    else if( i_csp == X264_CSP_NV12 || i_csp == X264_CSP_NV16 )
     {
         int chroma_padv = i_padv >> (i_csp == X264_CSP_NV12);
         int chroma_plane_size = (frame->i_stride[1] * (frame->i_lines[1] + 2*chroma_padv));
@@ -215,6 +293,15 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
                     PREALLOC( frame->lowres_mv_costs[j][i], h->mb.i_mb_count*sizeof(int) );
                 }
             PREALLOC( frame->i_propagate_cost, i_mb_count * sizeof(uint16_t) );
+            if( h->param.analyse.i_weighted_pred && h->param.i_lookahead_threads > 1 )
+                PREALLOC( frame->buffer_weighted_lowres, luma_plane_size * SIZEOF_PIXEL );
+            if( h->param.b_scenecut_prepass )
+            {
+                PREALLOC( frame->i_lowres_block_sum, i_mb_count * sizeof(uint16_t) );
+                PREALLOC( frame->i_lowres_block_var, i_mb_count * sizeof(uint32_t) );
+            }
+            if( h->param.rc.b_mb_tree_incremental )
+                PREALLOC( frame->i_propagate_cost_delta, i_mb_count * sizeof(uint16_t) );
             for( int j = 0; j <= h->param.i_bframe+1; j++ )
                 for( int i = 0; i <= h->param.i_bframe+1; i++ )
                     PREALLOC( frame->lowres_costs[j][i], i_mb_count * sizeof(uint16_t) );
@@ -233,7 +320,7 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
 
     PREALLOC_END( frame->base );
 
-    if( i_csp == X264_CSP_NV12 || i_csp == X264_CSP_NV16 )
+    if( b_own_planes && (i_csp == X264_CSP_NV12 || i_csp == X264_CSP_NV16) )
     {
         int chroma_padv = i_padv >> (i_csp == X264_CSP_NV12);
         frame->plane[1] = frame->buffer[1] + frame->i_stride[1] * chroma_padv + PADH_ALIGN;
@@ -289,6 +376,13 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
             if( h->param.rc.i_aq_mode )
                 /* shouldn't really be initialized, just silences a valgrind false-positive in x264_mbtree_propagate_cost_sse2 */
                 memset( frame->i_inv_qscale_factor, 0, (h->mb.i_mb_count+3) * sizeof(uint16_t) );
+
+            if( h->param.i_lookahead_levels )
+            {
+                frame->coarse = x264_frame_new_level( h, h->param.i_lookahead_levels );
+                if( !frame->coarse )
+                    goto fail;
+            }
         }
     }
 
@@ -315,6 +409,8 @@ void x264_frame_delete( x264_frame_t *frame )
     if( !frame->b_duplicate )
     {
         x264_free( frame->base );
+        if( frame->coarse )
+            x264_frame_delete( frame->coarse );
 
         if( frame->param && frame->param->param_free )
         {
@@ -323,6 +419,8 @@ void x264_frame_delete( x264_frame_t *frame )
         }
         if( frame->mb_info_free )
             frame->mb_info_free( frame->mb_info );
+        if( frame->img_free )
+            frame->img_free( frame->img_opaque );
         if( frame->extra_sei.sei_free )
         {
             for( int i = 0; i < frame->extra_sei.num_payloads; i++ )
@@ -338,6 +436,8 @@ void x264_frame_delete( x264_frame_t *frame )
     x264_free( frame );
 }
 
+static void frame_ingest( x264_t *h, x264_frame_t *frame, pixel *src, intptr_t i_src_stride );
+
 static int get_plane_ptr( x264_t *h, x264_picture_t *src, uint8_t **pix, int *stride, int plane, int xshift, int yshift )
 {
     int width = h->param.i_width >> xshift;
@@ -359,15 +459,8 @@ static int get_plane_ptr( x264_t *h, x264_picture_t *src, uint8_t **pix, int *st
 
 #define get_plane_ptr(...) do { if( get_plane_ptr(__VA_ARGS__) < 0 ) return -1; } while( 0 )
 
-int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
+static int frame_copy_properties( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
 {
-    int i_csp = src->img.i_csp & X264_CSP_MASK;
-    if( dst->i_csp != frame_internal_csp( i_csp ) )
-    {
-        x264_log( h, X264_LOG_ERROR, "Invalid input colorspace\n" );
-        return -1;
-    }
-
 #if HIGH_BIT_DEPTH
     if( !(src->img.i_csp & X264_CSP_HIGH_DEPTH) )
     {
@@ -382,12 +475,6 @@ int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
     }
 #endif
 
-    if( BIT_DEPTH != 10 && i_csp == X264_CSP_V210 )
-    {
-        x264_log( h, X264_LOG_ERROR, "v210 input is only compatible with bit-depth of 10 bits\n" );
-        return -1;
-    }
-
     if( src->i_type < X264_TYPE_AUTO || src->i_type > X264_TYPE_KEYFRAME )
     {
         x264_log( h, X264_LOG_WARNING, "forced frame type (%d) at %d is unknown\n", src->i_type, h->frames.i_input );
@@ -405,9 +492,31 @@ int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
     dst->opaque     = src->opaque;
     dst->mb_info    = h->param.analyse.b_mb_info ? src->prop.mb_info : NULL;
     dst->mb_info_free = h->param.analyse.b_mb_info ? src->prop.mb_info_free : NULL;
+    return 0;
+}
+
+int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
+{
+    int i_csp = src->img.i_csp & X264_CSP_MASK;
+    if( dst->i_csp != frame_internal_csp( i_csp ) )
+    {
+        x264_log( h, X264_LOG_ERROR, "Invalid input colorspace\n" );
+        return -1;
+    }
+
+    if( frame_copy_properties( h, dst, src ) < 0 )
+        return -1;
+
+    if( BIT_DEPTH != 10 && i_csp == X264_CSP_V210 )
+    {
+        x264_log( h, X264_LOG_ERROR, "v210 input is only compatible with bit-depth of 10 bits\n" );
+        return -1;
+    }
 
     uint8_t *pix[3];
     int stride[3];
+    pixel *luma = NULL;
+    int luma_stride = 0;
     if( i_csp == X264_CSP_YUYV || i_csp == X264_CSP_UYVY )
     {
         int p = i_csp == X264_CSP_UYVY;
@@ -442,8 +551,9 @@ int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
     {
         int v_shift = CHROMA_V_SHIFT;
         get_plane_ptr( h, src, &pix[0], &stride[0], 0, 0, 0 );
-        h->mc.plane_copy( dst->plane[0], dst->i_stride[0], (pixel*)pix[0],
-                          stride[0]/SIZEOF_PIXEL, h->param.i_width, h->param.i_height );
+        /* copied by frame_ingest */
+        luma = (pixel*)pix[0];
+        luma_stride = stride[0]/SIZEOF_PIXEL;
         if( i_csp == X264_CSP_NV12 || i_csp == X264_CSP_NV16 )
         {
             get_plane_ptr( h, src, &pix[1], &stride[1], 1, 0, v_shift );
@@ -476,6 +586,47 @@ int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
                               stride[2]/SIZEOF_PIXEL, h->param.i_width, h->param.i_height );
         }
     }
+    frame_ingest( h, dst, luma, luma_stride );
+    return 0;
+}
+
+void x264_frame_input_layout( x264_t *h, x264_image_t *img )
+{
+    int i_csp = frame_internal_csp( h->param.i_csp );
+    memset( img, 0, sizeof(x264_image_t) );
+    img->i_csp = i_csp | (HIGH_BIT_DEPTH ? X264_CSP_HIGH_DEPTH : 0);
+    img->i_plane = i_csp == X264_CSP_I444 ? 3 : i_csp == X264_CSP_I400 ? 1 : 2;
+    for( int i = 0; i < img->i_plane; i++ )
+        img->i_stride[i] = frame_stride( h ) * SIZEOF_PIXEL;
+}
+
+int x264_frame_borrow_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
+{
+    x264_image_t layout;
+    x264_frame_input_layout( h, &layout );
+    if( src->img.i_csp != layout.i_csp || src->img.i_plane != layout.i_plane )
+    {
+        x264_log( h, X264_LOG_ERROR, "zero-copy input requires colorspace %s%s\n",
+                  dst->i_csp == X264_CSP_NV12 ? "nv12" : dst->i_csp == X264_CSP_NV16 ? "nv16" :
+                  dst->i_csp == X264_CSP_I444 ? "i444" : "i400", HIGH_BIT_DEPTH ? " high depth" : "" );
+        return -1;
+    }
+    for( int i = 0; i < layout.i_plane; i++ )
+        if( src->img.i_stride[i] != layout.i_stride[i] || ((intptr_t)src->img.plane[i] & (NATIVE_ALIGN-1)) )
+        {
+            x264_log( h, X264_LOG_ERROR, "zero-copy input requires a stride of %d and %d-byte aligned planes\n",
+                      layout.i_stride[i], NATIVE_ALIGN );
+            return -1;
+        }
+
+    if( frame_copy_properties( h, dst, src ) < 0 )
+        return -1;
+
+    for( int i = 0; i < dst->i_plane; i++ )
+        dst->filtered[i][0] = dst->plane[i] = (pixel*)src->img.plane[i];
+    dst->img_free = src->prop.img_free;
+    dst->img_opaque = src->prop.img_opaque;
+    frame_ingest( h, dst, NULL, 0 );
     return 0;
 }
 
@@ -623,12 +774,6 @@ void x264_frame_expand_border_filtered( x264_t *h, x264_frame_t *frame, int mb_y
         }
 }
 
-void x264_frame_expand_border_lowres( x264_frame_t *frame )
-{
-    for( int i = 0; i < 4; i++ )
-        plane_expand_border( frame->lowres[i], frame->i_stride_lowres, frame->i_width_lowres, frame->i_lines_lowres, PADH, PADV, 1, 1, 0 );
-}
-
 void x264_frame_expand_border_chroma( x264_t *h, x264_frame_t *frame, int plane )
 {
     int v_shift = CHROMA_V_SHIFT;
@@ -636,31 +781,118 @@ void x264_frame_expand_border_chroma( x264_t *h, x264_frame_t *frame, int plane
                          PADH, PADV>>v_shift, 1, 1, CHROMA_H_SHIFT );
 }
 
-void x264_frame_expand_border_mod16( x264_t *h, x264_frame_t *frame )
+static void frame_expand_border_mod16( x264_t *h, x264_frame_t *frame, int i )
 {
-    for( int i = 0; i < frame->i_plane; i++ )
+    int i_width = h->param.i_width;
+    int h_shift = i && CHROMA_H_SHIFT;
+    int v_shift = i && CHROMA_V_SHIFT;
+    int i_height = h->param.i_height >> v_shift;
+    int i_padx = (h->mb.i_mb_width * 16 - h->param.i_width);
+    int i_pady = (h->mb.i_mb_height * 16 - h->param.i_height) >> v_shift;
+
+    if( i_padx )
     {
-        int i_width = h->param.i_width;
-        int h_shift = i && CHROMA_H_SHIFT;
-        int v_shift = i && CHROMA_V_SHIFT;
-        int i_height = h->param.i_height >> v_shift;
-        int i_padx = (h->mb.i_mb_width * 16 - h->param.i_width);
-        int i_pady = (h->mb.i_mb_height * 16 - h->param.i_height) >> v_shift;
+        for( int y = 0; y < i_height; y++ )
+            pixel_memset( &frame->plane[i][y*frame->i_stride[i] + i_width],
+                          &frame->plane[i][y*frame->i_stride[i] + i_width - 1-h_shift],
+                          i_padx>>h_shift, SIZEOF_PIXEL<<h_shift );
+    }
+    if( i_pady )
+    {
+        for( int y = i_height; y < i_height + i_pady; y++ )
+            memcpy( &frame->plane[i][y*frame->i_stride[i]],
+                    &frame->plane[i][(i_height-(~y&PARAM_INTERLACED)-1)*frame->i_stride[i]],
+                    (i_width + i_padx) * SIZEOF_PIXEL );
+    }
+}
 
-        if( i_padx )
-        {
-            for( int y = 0; y < i_height; y++ )
-                pixel_memset( &frame->plane[i][y*frame->i_stride[i] + i_width],
-                              &frame->plane[i][y*frame->i_stride[i] + i_width - 1-h_shift],
-                              i_padx>>h_shift, SIZEOF_PIXEL<<h_shift );
-        }
-        if( i_pady )
-        {
-            for( int y = i_height; y < i_height + i_pady; y++ )
-                memcpy( &frame->plane[i][y*frame->i_stride[i]],
-                        &frame->plane[i][(i_height-(~y&PARAM_INTERLACED)-1)*frame->i_stride[i]],
-                        (i_width + i_padx) * SIZEOF_PIXEL );
-        }
+/* Each level of the lookahead pyramid is downscaled from the one above it the same way the lowres
+ * planes are from the input, the levels in between going through h->frames.pyramid. */
+static void frame_ingest_levels( x264_t *h, x264_frame_t *frame )
+{
+    x264_frame_t *coarse = frame->coarse;
+    x264_frame_t *src = frame;
+    for( int level = 1; level <= h->param.i_lookahead_levels; level++ )
+    {
+        x264_frame_t *dst = level == h->param.i_lookahead_levels ? coarse : h->frames.pyramid;
+        h->mc.frame_init_lowres_core( src->lowres[0], dst->lowres[0], dst->lowres[1], dst->lowres[2], dst->lowres[3],
+                                      src->i_stride_lowres, dst->i_stride_lowres, dst->i_width_lowres, dst->i_lines_lowres );
+        for( int i = 0; i < (dst == coarse ? 4 : 1); i++ )
+            plane_expand_border( dst->lowres[i], dst->i_stride_lowres, dst->i_width_lowres, dst->i_lines_lowres,
+                                 PADH, PADV, 1, 1, 0 );
+        src = dst;
+    }
+
+    memset( coarse->i_cost_est, -1, sizeof(coarse->i_cost_est) );
+    for( int y = 0; y <= !!h->param.i_bframe; y++ )
+        for( int x = 0; x <= h->param.i_bframe; x++ )
+            coarse->lowres_mvs[y][x][0][0] = 0x7FFF;
+}
+
+#define INGEST_STRIP 32
+
+/* Input frames used to be copied, padded to mod16 and read again to build the lowres planes,
+ * which streams the luma plane through the cache three times.  Instead do all of it in strips
+ * of INGEST_STRIP lines, lagging the lowres rows by one line since each needs three input lines.
+ * src is NULL if plane[0] is already filled in (zero-copy or packed input). */
+static void frame_ingest( x264_t *h, x264_frame_t *frame, pixel *src, intptr_t i_src_stride )
+{
+    pixel *pix = frame->plane[0];
+    intptr_t stride = frame->i_stride[0];
+    int width = h->param.i_width;
+    int height = h->param.i_height;
+    int lines = frame->i_lines[0];
+    int b_lowres = h->frames.b_have_lowres;
+    /* padding up to the macroblock-aligned width, plus the column duplicated for the lowres filter */
+    int padx = frame->i_width[0] - width + b_lowres;
+    int lowres_y = 0;
+
+    for( int y = 0; y < lines; y += INGEST_STRIP )
+    {
+        int y_end = X264_MIN( y + INGEST_STRIP, lines );
+        int copy_end = X264_MIN( y_end, height );
+        if( src && y < copy_end )
+            h->mc.plane_copy( pix + y*stride, stride, src + y*i_src_stride, i_src_stride, width, copy_end - y );
+        if( padx )
+            for( int i = y; i < copy_end; i++ )
+                pixel_memset( pix + i*stride + width, pix + i*stride + width - 1, padx, SIZEOF_PIXEL );
+        for( int i = X264_MAX( y, height ); i < y_end; i++ )
+            memcpy( pix + i*stride, pix + (height-(~i&PARAM_INTERLACED)-1)*stride, (width + padx) * SIZEOF_PIXEL );
+        if( !b_lowres )
+            continue;
+
+        /* duplicate the last row too so that its interpolation doesn't have to be special-cased */
+        if( y_end == lines )
+            memcpy( pix + lines*stride, pix + (lines-1)*stride, (width + padx) * SIZEOF_PIXEL );
+        int lowres_end = y_end == lines ? frame->i_lines_lowres : (y_end - 1) / 2;
+        intptr_t offset = lowres_y * frame->i_stride_lowres;
+        h->mc.frame_init_lowres_core( pix + 2*lowres_y*stride, frame->lowres[0] + offset, frame->lowres[1] + offset,
+                                      frame->lowres[2] + offset, frame->lowres[3] + offset,
+                                      stride, frame->i_stride_lowres, frame->i_width_lowres, lowres_end - lowres_y );
+        for( int i = 0; i < 4; i++ )
+            plane_expand_border( frame->lowres[i] + offset, frame->i_stride_lowres, frame->i_width_lowres,
+                                 lowres_end - lowres_y, PADH, PADV, !lowres_y, y_end == lines, 0 );
+        lowres_y = lowres_end;
+    }
+
+    for( int i = 1; i < frame->i_plane; i++ )
+        if( width != 16 * h->mb.i_mb_width || height != 16 * h->mb.i_mb_height )
+            frame_expand_border_mod16( h, frame, i );
+
+    if( b_lowres )
+    {
+        memset( frame->i_cost_est, -1, sizeof(frame->i_cost_est) );
+
+        for( int y = 0; y < h->param.i_bframe + 2; y++ )
+            for( int x = 0; x < h->param.i_bframe + 2; x++ )
+                frame->i_row_satds[y][x][0] = -1;
+
+        for( int y = 0; y <= !!h->param.i_bframe; y++ )
+            for( int x = 0; x <= h->param.i_bframe; x++ )
+                frame->lowres_mvs[y][x][0][0] = 0x7FFF;
+
+        if( frame->coarse )
+            frame_ingest_levels( h, frame );
     }
 }
 
@@ -773,7 +1005,14 @@ void x264_frame_push_unused( x264_t *h, x264_frame_t *frame )
     assert( frame->i_reference_count > 0 );
     frame->i_reference_count--;
     if( frame->i_reference_count == 0 )
+    {
+        if( frame->img_free )
+        {
+            frame->img_free( frame->img_opaque );
+            frame->img_free = NULL;
+        }
         x264_frame_push( h->frames.unused[frame->b_fdec], frame );
+    }
 }
 
 x264_frame_t *x264_frame_pop_unused( x264_t *h, int b_fdec )
@@ -788,6 +1027,9 @@ x264_frame_t *x264_frame_pop_unused( x264_t *h, int b_fdec )
     frame->b_last_minigop_bframe = 0;
     frame->i_reference_count = 1;
     frame->b_intra_calculated = 0;
+    if( frame->coarse )
+        frame->coarse->b_intra_calculated = 0;
+    frame->i_mbtree_pass = 0;
     frame->b_scenecut = 1;
     frame->b_keyframe = 0;
     frame->b_corrupt = 0;
@@ -795,6 +1037,7 @@ x264_frame_t *x264_frame_pop_unused( x264_t *h, int b_fdec )
 
     memset( frame->weight, 0, sizeof(frame->weight) );
     memset( frame->f_weighted_cost_delta, 0, sizeof(frame->f_weighted_cost_delta) );
+    memset( frame->b_lowres_weight, 0, sizeof(frame->b_lowres_weight) );
 
     return frame;
 }
@@ -34,6 +34,8 @@
 #define PADH_ALIGN X264_MAX( PADH, NATIVE_ALIGN / SIZEOF_PIXEL )
 #define PADH2 (PADH_ALIGN + PADH)
 
+#define LOWRES_HIST_BINS 32
+
 typedef struct x264_frame
 {
     /* */
@@ -82,6 +84,7 @@ typedef struct x264_frame
     pixel *filtered[3][4]; /* plane[0], H, V, HV */
     pixel *filtered_fld[3][4];
     pixel *lowres[4]; /* half-size copy of input frame: Orig, H, V, HV */
+    struct x264_frame *coarse; /* lowres planes and costs at the resolution of i_lookahead_levels */
     uint16_t *integral;
 
     /* for unrestricted mv we allocate more data than needed
@@ -92,6 +95,11 @@ typedef struct x264_frame
 
     x264_weight_t weight[X264_REF_MAX][3]; /* [ref_index][plane] */
     pixel *weighted[X264_REF_MAX]; /* plane[0] weighted of the reference frames */
+    /* lookahead weights against the reference i+1 frames before, and the lowres plane of the reference
+     * 1 frame before scaled by them (only with lookahead threads) */
+    x264_weight_t lowres_weight[X264_BFRAME_MAX+1][3];
+    int     b_lowres_weight[X264_BFRAME_MAX+1];
+    pixel   *buffer_weighted_lowres;
     int b_duplicate;
     struct x264_frame *orig;
 
@@ -134,12 +142,22 @@ typedef struct x264_frame
     int     b_intra_calculated;
     uint16_t *i_intra_cost;
     uint16_t *i_propagate_cost;
+    uint16_t *i_propagate_cost_delta; /* incremental mb-tree: cost received in the current pass */
+    int     i_mbtree_pass;      /* incremental mb-tree: pass i_propagate_cost belongs to */
+    int     i_mbtree_ref[2];    /* i_frame of the references this frame was propagated into, -1 if not yet */
+    int     b_mbtree_referenced;
+    int     b_mbtree_dirty;     /* received cost in the current pass */
     uint16_t *i_inv_qscale_factor;
     int     b_scenecut; /* Set to zero if the frame cannot possibly be part of a real scenecut. */
     float   f_weighted_cost_delta[X264_BFRAME_MAX+2];
     uint32_t i_pixel_sum[3];
     uint64_t i_pixel_ssd[3];
 
+    /* scenecut pre-pass, gathered from the lowres luma plane on ingest */
+    uint32_t i_lowres_hist[LOWRES_HIST_BINS];
+    uint16_t *i_lowres_block_sum;   /* per lowres 8x8 block */
+    uint32_t *i_lowres_block_var;
+
     /* hrd */
     x264_hrd_t hrd_timing;
 
@@ -149,6 +167,7 @@ typedef struct x264_frame
     double f_planned_cpb_duration[X264_LOOKAHEAD_MAX+1];
     int64_t i_coded_fields_lookahead;
     int64_t i_cpb_delay_lookahead;
+    int64_t i_decided_date; /* when the lookahead thread handed the frame to the encoder */
 
     /* threading */
     int     i_lines_completed; /* in pixels */
@@ -177,6 +196,10 @@ typedef struct x264_frame
     uint8_t *mb_info;
     void (*mb_info_free)( void* );
 
+    /* zero-copy input: planes borrowed from the caller, handed back with img_free */
+    void (*img_free)( void* );
+    void *img_opaque;
+
 #if HAVE_OPENCL
     x264_frame_opencl_t opencl;
 #endif
@@ -220,20 +243,22 @@ typedef struct
 
 #define x264_frame_delete x264_template(frame_delete)
 void          x264_frame_delete( x264_frame_t *frame );
+#define x264_frame_new_level x264_template(frame_new_level)
+x264_frame_t *x264_frame_new_level( x264_t *h, int level );
 
 #define x264_frame_copy_picture x264_template(frame_copy_picture)
 int           x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src );
+#define x264_frame_borrow_picture x264_template(frame_borrow_picture)
+int           x264_frame_borrow_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src );
+#define x264_frame_input_layout x264_template(frame_input_layout)
+void          x264_frame_input_layout( x264_t *h, x264_image_t *img );
 
 #define x264_frame_expand_border x264_template(frame_expand_border)
 void          x264_frame_expand_border( x264_t *h, x264_frame_t *frame, int mb_y );
 #define x264_frame_expand_border_filtered x264_template(frame_expand_border_filtered)
 void          x264_frame_expand_border_filtered( x264_t *h, x264_frame_t *frame, int mb_y, int b_end );
-#define x264_frame_expand_border_lowres x264_template(frame_expand_border_lowres)
-void          x264_frame_expand_border_lowres( x264_frame_t *frame );
 #define x264_frame_expand_border_chroma x264_template(frame_expand_border_chroma)
 void          x264_frame_expand_border_chroma( x264_t *h, x264_frame_t *frame, int plane );
-#define x264_frame_expand_border_mod16 x264_template(frame_expand_border_mod16)
-void          x264_frame_expand_border_mod16( x264_t *h, x264_frame_t *frame );
 #define x264_expand_border_mbpair x264_template(expand_border_mbpair)
 void          x264_expand_border_mbpair( x264_t *h, int mb_x, int mb_y );
 
@@ -244,8 +269,6 @@ void          x264_macroblock_deblock( x264_t *h );
 
 #define x264_frame_filter x264_template(frame_filter)
 void          x264_frame_filter( x264_t *h, x264_frame_t *frame, int mb_y, int b_end );
-#define x264_frame_init_lowres x264_template(frame_init_lowres)
-void          x264_frame_init_lowres( x264_t *h, x264_frame_t *frame );
 
 #define x264_deblock_init x264_template(deblock_init)
 void          x264_deblock_init( uint32_t cpu, x264_deblock_function_t *pf, int b_mbaff );
@@ -350,26 +350,39 @@ void x264_macroblock_cache_free( x264_t *h )
     x264_free( h->mb.base );
 }
 
+/* The context that owns the whole-frame deblock strengths, when threads share them. */
+static x264_t *deblock_strength_owner( x264_t *h )
+{
+    if( h->wavefront_writer )
+        return h->wavefront_writer;
+    return h->param.b_entropy_threads ? h : h->thread[0];
+}
+
 int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
 {
     if( !b_lookahead )
     {
-        for( int i = 0; i < (PARAM_INTERLACED ? 5 : 2); i++ )
-            for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
-            {
-                CHECKED_MALLOC( h->intra_border_backup[i][j], (h->sps->i_mb_width*16+32) * SIZEOF_PIXEL );
-                h->intra_border_backup[i][j] += 16;
-            }
+        /* Wavefront threads encode neighbouring rows, so they share the backup of the row above. */
+        if( h->wavefront_writer )
+            memcpy( h->intra_border_backup, h->wavefront_writer->intra_border_backup, sizeof(h->intra_border_backup) );
+        else
+            for( int i = 0; i < (PARAM_INTERLACED ? 5 : 2); i++ )
+                for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
+                {
+                    CHECKED_MALLOC( h->intra_border_backup[i][j], (h->sps->i_mb_width*16+32) * SIZEOF_PIXEL );
+                    h->intra_border_backup[i][j] += 16;
+                }
         for( int i = 0; i <= PARAM_INTERLACED; i++ )
         {
-            if( h->param.b_sliced_threads )
+            if( h->param.b_sliced_threads || h->param.b_wavefront_threads || h->param.b_entropy_threads )
             {
                 /* Only allocate the first one, and allocate it for the whole frame, because we
-                 * won't be deblocking until after the frame is fully encoded. */
-                if( h == h->thread[0] && !i )
+                 * won't be deblocking until after the frame (or, with wavefront and entropy
+                 * threads, the row below) is fully encoded. */
+                if( h == deblock_strength_owner( h ) && !i )
                     CHECKED_MALLOC( h->deblock_strength[0], sizeof(**h->deblock_strength) * h->mb.i_mb_count );
                 else
-                    h->deblock_strength[i] = h->thread[0]->deblock_strength[0];
+                    h->deblock_strength[i] = deblock_strength_owner( h )->deblock_strength[0];
             }
             else
                 CHECKED_MALLOC( h->deblock_strength[i], sizeof(**h->deblock_strength) * h->mb.i_mb_width );
@@ -395,8 +408,12 @@ int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
     else
         h->scratch_buffer = NULL;
 
-    int buf_lookahead_threads = (h->mb.i_mb_height + (4 + 32) * h->param.i_lookahead_threads) * sizeof(int) * 2;
+    /* per thread lowres costs of every row, plus the wavefront progress of each row */
+    int buf_lookahead_threads = ((h->mb.i_mb_height + 3 + 32) * h->param.i_lookahead_threads * 2 + h->mb.i_mb_height) * sizeof(int);
     int buf_mbtree2 = buf_mbtree * 12; /* size of the internal propagate_list asm buffer */
+    /* followed by the reference costs of both lists when lookahead threads split mb-tree propagation */
+    if( h->param.i_lookahead_threads > 1 )
+        buf_mbtree2 += h->param.rc.b_mb_tree * 2 * h->mb.i_mb_count * sizeof(uint16_t);
     scratch_size = X264_MAX( buf_lookahead_threads, buf_mbtree2 );
     CHECKED_MALLOC( h->scratch_buffer2, scratch_size );
 
@@ -410,11 +427,13 @@ void x264_macroblock_thread_free( x264_t *h, int b_lookahead )
     if( !b_lookahead )
     {
         for( int i = 0; i <= PARAM_INTERLACED; i++ )
-            if( !h->param.b_sliced_threads || (h == h->thread[0] && !i) )
+            if( !(h->param.b_sliced_threads || h->param.b_wavefront_threads || h->param.b_entropy_threads) ||
+                (h == deblock_strength_owner( h ) && !i) )
                 x264_free( h->deblock_strength[i] );
-        for( int i = 0; i < (PARAM_INTERLACED ? 5 : 2); i++ )
-            for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
-                x264_free( h->intra_border_backup[i][j] - 16 );
+        if( !h->wavefront_writer )
+            for( int i = 0; i < (PARAM_INTERLACED ? 5 : 2); i++ )
+                for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
+                    x264_free( h->intra_border_backup[i][j] - 16 );
     }
     x264_free( h->scratch_buffer );
     x264_free( h->scratch_buffer2 );
@@ -873,7 +892,7 @@ static ALWAYS_INLINE void macroblock_cache_load( x264_t *h, int mb_x, int mb_y,
 
     const x264_left_table_t *left_index_table = h->mb.left_index_table;
 
-    h->mb.cache.deblock_strength = h->deblock_strength[mb_y&1][h->param.b_sliced_threads?h->mb.i_mb_xy:mb_x];
+    h->mb.cache.deblock_strength = h->deblock_strength[mb_y&1][h->param.b_sliced_threads || h->param.b_wavefront_threads || h->param.b_entropy_threads ? h->mb.i_mb_xy : mb_x];
 
     /* load cache */
     if( h->mb.i_neighbour & MB_TOP )
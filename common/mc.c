@@ -41,6 +41,13 @@
 #if HAVE_MSA
 #include "mips/mc.h"
 #endif
+#if HAVE_INTRIN
+#if ARCH_AARCH64
+#include "aarch64/intrin.h"
+#else
+#include "x86/intrin.h"
+#endif
+#endif
 
 
 static inline void pixel_avg( pixel *dst,  intptr_t i_dst_stride,
@@ -452,32 +459,6 @@ static void integral_init8v( uint16_t *sum8, intptr_t stride )
         sum8[x] = (uint16_t)(sum8[x+8*stride] - sum8[x]);
 }
 
-void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
-{
-    pixel *src = frame->plane[0];
-    int i_stride = frame->i_stride[0];
-    int i_height = frame->i_lines[0];
-    int i_width  = frame->i_width[0];
-
-    // duplicate last row and column so that their interpolation doesn't have to be special-cased
-    for( int y = 0; y < i_height; y++ )
-        src[i_width+y*i_stride] = src[i_width-1+y*i_stride];
-    memcpy( src+i_stride*i_height, src+i_stride*(i_height-1), (i_width+1) * SIZEOF_PIXEL );
-    h->mc.frame_init_lowres_core( src, frame->lowres[0], frame->lowres[1], frame->lowres[2], frame->lowres[3],
-                                  i_stride, frame->i_stride_lowres, frame->i_width_lowres, frame->i_lines_lowres );
-    x264_frame_expand_border_lowres( frame );
-
-    memset( frame->i_cost_est, -1, sizeof(frame->i_cost_est) );
-
-    for( int y = 0; y < h->param.i_bframe + 2; y++ )
-        for( int x = 0; x < h->param.i_bframe + 2; x++ )
-            frame->i_row_satds[y][x][0] = -1;
-
-    for( int y = 0; y <= !!h->param.i_bframe; y++ )
-        for( int x = 0; x <= h->param.i_bframe; x++ )
-            frame->lowres_mvs[y][x][0][0] = 0x7FFF;
-}
-
 static void frame_init_lowres_core( pixel *src0, pixel *dst0, pixel *dsth, pixel *dstv, pixel *dstc,
                                     intptr_t src_stride, intptr_t dst_stride, int width, int height )
 {
@@ -687,6 +668,9 @@ void x264_mc_init( uint32_t cpu, x264_mc_functions_t *pf, int cpu_independent )
     if( cpu&X264_CPU_MSA )
         x264_mc_init_mips( cpu, pf );
 #endif
+#if HAVE_INTRIN && !HIGH_BIT_DEPTH
+    x264_mc_init_intrin( cpu, pf );
+#endif
 
     if( cpu_independent )
     {
@@ -57,6 +57,44 @@ int64_t x264_mdate( void )
 #endif
 }
 
+#if X264_ATOMIC_LOCKED
+static x264_pthread_mutex_t atomic_mutex = X264_PTHREAD_MUTEX_INITIALIZER;
+
+int x264_atomic_load_locked( int *p )
+{
+    x264_pthread_mutex_lock( &atomic_mutex );
+    int res = *p;
+    x264_pthread_mutex_unlock( &atomic_mutex );
+    return res;
+}
+
+void x264_atomic_store_locked( int *p, int v )
+{
+    x264_pthread_mutex_lock( &atomic_mutex );
+    *p = v;
+    x264_pthread_mutex_unlock( &atomic_mutex );
+}
+
+int x264_atomic_fetch_add_locked( int *p, int v )
+{
+    x264_pthread_mutex_lock( &atomic_mutex );
+    int res = *p;
+    *p += v;
+    x264_pthread_mutex_unlock( &atomic_mutex );
+    return res;
+}
+
+int x264_atomic_cas_locked( int *p, int oldval, int newval )
+{
+    x264_pthread_mutex_lock( &atomic_mutex );
+    int res = *p == oldval;
+    if( res )
+        *p = newval;
+    x264_pthread_mutex_unlock( &atomic_mutex );
+    return res;
+}
+#endif
+
 #if HAVE_WIN32THREAD || PTW32_STATIC_LIB
 /* state of the threading library being initialized */
 static volatile LONG threading_is_init = 0;
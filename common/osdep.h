@@ -336,9 +336,8 @@ static inline int x264_is_regular_file( FILE *filehandle )
 #define ALIGNED_ARRAY_64 ALIGNED_ARRAY_16
 #endif
 
-#if STACK_ALIGNMENT > 16 || (ARCH_X86 && STACK_ALIGNMENT > 4)
-//#define REALIGN_STACK __attribute__((force_align_arg_pointer))
-#define REALIGN_STACK
+#if defined(__GNUC__) && (STACK_ALIGNMENT > 16 || (ARCH_X86 && STACK_ALIGNMENT > 4))
+#define REALIGN_STACK __attribute__((force_align_arg_pointer))
 #else
 #define REALIGN_STACK
 #endif
@@ -393,6 +392,7 @@ static inline int x264_pthread_create( x264_pthread_t *t, void *a, void *(*f)(vo
 #define x264_pthread_cond_init       pthread_cond_init
 #define x264_pthread_cond_destroy    pthread_cond_destroy
 #define x264_pthread_cond_broadcast  pthread_cond_broadcast
+#define x264_pthread_cond_signal     pthread_cond_signal
 #define x264_pthread_cond_wait       pthread_cond_wait
 #define x264_pthread_attr_t          pthread_attr_t
 #define x264_pthread_attr_init       pthread_attr_init
@@ -419,6 +419,7 @@ static inline int x264_pthread_create( x264_pthread_t *t, void *a, void *(*f)(vo
 #define x264_pthread_cond_init(c,f)  0
 #define x264_pthread_cond_destroy(c)
 #define x264_pthread_cond_broadcast(c)
+#define x264_pthread_cond_signal(c)
 #define x264_pthread_cond_wait(c,m)
 #define x264_pthread_attr_t          int
 #define x264_pthread_attr_init(a)    0
@@ -451,6 +452,51 @@ static ALWAYS_INLINE int x264_pthread_fetch_and_add( int *val, int add, x264_pth
 #endif
 }
 
+/* Atomic operations on ints for the lock-free threadpool queues.
+ * All of them are sequentially consistent. */
+#if HAVE_THREAD && defined(__GNUC__)
+#define x264_atomic_load(p)         __atomic_load_n( p, __ATOMIC_SEQ_CST )
+#define x264_atomic_store(p,v)      __atomic_store_n( p, v, __ATOMIC_SEQ_CST )
+#define x264_atomic_fetch_add(p,v)  __atomic_fetch_add( p, v, __ATOMIC_SEQ_CST )
+static ALWAYS_INLINE int x264_atomic_cas( int *p, int oldval, int newval )
+{
+    return __atomic_compare_exchange_n( p, &oldval, newval, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+#elif HAVE_WIN32THREAD
+#define x264_atomic_load(p)         InterlockedOr( (volatile LONG*)(p), 0 )
+#define x264_atomic_store(p,v)      InterlockedExchange( (volatile LONG*)(p), v )
+#define x264_atomic_fetch_add(p,v)  InterlockedExchangeAdd( (volatile LONG*)(p), v )
+#define x264_atomic_cas(p,o,n)      (InterlockedCompareExchange( (volatile LONG*)(p), n, o ) == (o))
+#elif HAVE_THREAD
+/* No atomics from the compiler: serialize them all on a single mutex, as
+ * x264_pthread_fetch_and_add does. Slow, but keeps the lock-free code correct. */
+X264_API int  x264_atomic_load_locked( int *p );
+X264_API void x264_atomic_store_locked( int *p, int v );
+X264_API int  x264_atomic_fetch_add_locked( int *p, int v );
+X264_API int  x264_atomic_cas_locked( int *p, int oldval, int newval );
+#define x264_atomic_load(p)         x264_atomic_load_locked( p )
+#define x264_atomic_store(p,v)      x264_atomic_store_locked( p, v )
+#define x264_atomic_fetch_add(p,v)  x264_atomic_fetch_add_locked( p, v )
+#define x264_atomic_cas(p,o,n)      x264_atomic_cas_locked( p, o, n )
+#define X264_ATOMIC_LOCKED 1
+#else
+#define x264_atomic_load(p)         (*(p))
+#define x264_atomic_store(p,v)      (*(p) = (v))
+static ALWAYS_INLINE int x264_atomic_fetch_add( int *p, int v )
+{
+    int res = *p;
+    *p += v;
+    return res;
+}
+static ALWAYS_INLINE int x264_atomic_cas( int *p, int oldval, int newval )
+{
+    if( *p != oldval )
+        return 0;
+    *p = newval;
+    return 1;
+}
+#endif
+
 #define WORD_SIZE sizeof(void*)
 
 #define asm __asm__
@@ -45,6 +45,13 @@
 #if HAVE_MSA
 #   include "mips/pixel.h"
 #endif
+#if HAVE_INTRIN
+#   if ARCH_AARCH64
+#       include "aarch64/intrin.h"
+#   else
+#       include "x86/intrin.h"
+#   endif
+#endif
 
 
 /****************************************************************************
@@ -1500,6 +1507,9 @@ void x264_pixel_init( uint32_t cpu, x264_pixel_function_t *pixf )
 #endif // HAVE_MSA
 
 #endif // HIGH_BIT_DEPTH
+#if HAVE_INTRIN && !HIGH_BIT_DEPTH
+    x264_pixel_init_intrin( cpu, pixf );
+#endif
 #if HAVE_ALTIVEC
     if( cpu&X264_CPU_ALTIVEC )
     {
@@ -23,79 +23,303 @@
  * For more information, contact us at licensing@x264.com.
  *****************************************************************************/
 
-#include "common.h"
+#include "base.h"
+#include "threadpool.h"
+
+/* Work-stealing pool.
+ *
+ * The pool is split into a core, holding the worker threads and their queues,
+ * and handles that own job slots. x264_threadpool_init creates a core with a
+ * single handle; a core created by x264_threadpool_init_shared can have any
+ * number of handles attached, one per encoder (and per lookahead) sharing it.
+ *
+ * Each handle has a fixed set of job slots and run() blocks once they are all
+ * in use. A slot doubles as the job's completion handle: wait() finds it by
+ * hashing arg, so there is no shared done list to lock and scan.
+ *
+ * Queues are bounded lock-free MPMC rings (Vyukov's sequenced-cell queue).
+ * A private pool has one ring per worker; run() spreads jobs round-robin over
+ * them, a worker drains its own ring first and then steals from the others.
+ * Jobs are always submitted from outside the pool, so the owner has no
+ * locality to exploit and owner and thieves share the FIFO end; this also
+ * avoids the single-producer restriction of Chase-Lev deques.
+ *
+ * A shared pool may have more jobs outstanding than workers, and frame-thread
+ * jobs block on the frames submitted before them. It therefore has a single
+ * ring, so jobs start in submission order and the oldest job of every encoder
+ * always has a worker.
+ *
+ * The queues and the core's counters are lock-free. Mutexes put threads to
+ * sleep and wake them up, and the job's mutex also hands its slot over: the
+ * worker finishes the job under it and wait() takes the result under it
+ * before freeing the slot. */
+
+#define SHARED_QUEUE_SIZE 4096
+
+enum
+{
+    JOB_FREE = 0,
+    JOB_BUSY,   /* claimed by run(), queued or running */
+    JOB_DONE,   /* finished, ret is valid until wait() releases the slot */
+};
 
 typedef struct
 {
     void *(*func)(void *);
     void *arg;
     void *ret;
+    int  state;
+    int  waiting;
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv_done;
 } x264_threadpool_job_t;
 
-struct x264_threadpool_t
+typedef struct
+{
+    int seq;
+    x264_threadpool_job_t *job;
+} threadpool_cell_t;
+
+typedef struct
+{
+    /* head and tail get their own cache lines, thieves hammer head */
+    ALIGNED_64( int head );
+    ALIGNED_64( int tail );
+    ALIGNED_64( threadpool_cell_t *cells );
+    int mask;
+} threadpool_queue_t;
+
+typedef struct threadpool_core_t threadpool_core_t;
+
+typedef struct
+{
+    threadpool_core_t *core;
+    int index;
+} threadpool_worker_t;
+
+struct threadpool_core_t
 {
-    volatile int   exit;
+    int            exit;
+    int            refcount;   /* handles using this core */
     int            threads;
+    int            threads_started;
     x264_pthread_t *thread_handle;
+    threadpool_worker_t *workers;
 
-    /* requires a synchronized list structure and associated methods,
-       so use what is already implemented for frames */
-    x264_sync_frame_list_t uninit; /* list of jobs that are awaiting use */
-    x264_sync_frame_list_t run;    /* list of jobs that are queued for processing by the pool */
-    x264_sync_frame_list_t done;   /* list of jobs that have finished processing */
+    int            nqueues;
+    threadpool_queue_t *queues;
+    int            capacity;   /* job slots the queues can hold */
+    int            njobs;      /* job slots of all handles */
+
+    ALIGNED_64( int next );    /* round-robin submission counter */
+    ALIGNED_64( int pending ); /* jobs pushed but not yet popped, may dip below 0 transiently */
+    int            sleeping;   /* workers blocked on cv_work */
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv_work;
 };
 
-REALIGN_STACK static void *threadpool_thread( x264_threadpool_t *pool )
+struct x264_threadpool_t
+{
+    threadpool_core_t *core;
+    int            njobs;
+    x264_threadpool_job_t *jobs;
+    int            full_waiting; /* run() callers blocked on cv_free */
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv_free;
+};
+
+static int threadpool_queue_push( threadpool_queue_t *q, x264_threadpool_job_t *job )
+{
+    uint32_t pos = x264_atomic_load( &q->tail );
+    threadpool_cell_t *cell;
+    while( 1 )
+    {
+        cell = &q->cells[pos & q->mask];
+        int dif = (int)(x264_atomic_load( &cell->seq ) - pos);
+        if( !dif )
+        {
+            if( x264_atomic_cas( &q->tail, pos, pos+1 ) )
+                break;
+        }
+        else if( dif < 0 )
+            return -1;
+        pos = x264_atomic_load( &q->tail );
+    }
+    cell->job = job;
+    x264_atomic_store( &cell->seq, pos+1 );
+    return 0;
+}
+
+static x264_threadpool_job_t *threadpool_queue_pop( threadpool_queue_t *q )
+{
+    uint32_t pos = x264_atomic_load( &q->head );
+    threadpool_cell_t *cell;
+    while( 1 )
+    {
+        cell = &q->cells[pos & q->mask];
+        int dif = (int)(x264_atomic_load( &cell->seq ) - (pos+1));
+        if( !dif )
+        {
+            if( x264_atomic_cas( &q->head, pos, pos+1 ) )
+                break;
+        }
+        else if( dif < 0 )
+            return NULL;
+        pos = x264_atomic_load( &q->head );
+    }
+    x264_threadpool_job_t *job = cell->job;
+    x264_atomic_store( &cell->seq, pos+q->mask+1 );
+    return job;
+}
+
+static x264_threadpool_job_t *threadpool_find_work( threadpool_core_t *core, int self )
 {
-    while( !pool->exit )
+    for( int i = 0; i < core->nqueues; i++ )
     {
-        x264_threadpool_job_t *job = NULL;
-        x264_pthread_mutex_lock( &pool->run.mutex );
-        while( !pool->exit && !pool->run.i_size )
-            x264_pthread_cond_wait( &pool->run.cv_fill, &pool->run.mutex );
-        if( pool->run.i_size )
+        x264_threadpool_job_t *job = threadpool_queue_pop( &core->queues[(self + i) % core->nqueues] );
+        if( job )
         {
-            job = (void*)x264_frame_shift( pool->run.list );
-            pool->run.i_size--;
+            x264_atomic_fetch_add( &core->pending, -1 );
+            return job;
         }
-        x264_pthread_mutex_unlock( &pool->run.mutex );
+    }
+    return NULL;
+}
+
+REALIGN_STACK static void *threadpool_thread( threadpool_worker_t *w )
+{
+    threadpool_core_t *core = w->core;
+    while( 1 )
+    {
+        x264_threadpool_job_t *job = threadpool_find_work( core, w->index );
         if( !job )
+        {
+            /* Announce ourselves before the final check of pending; run()
+             * bumps pending before checking sleeping, so one of the two
+             * sides always sees the other. */
+            x264_pthread_mutex_lock( &core->mutex );
+            x264_atomic_fetch_add( &core->sleeping, 1 );
+            while( !core->exit && x264_atomic_load( &core->pending ) <= 0 )
+                x264_pthread_cond_wait( &core->cv_work, &core->mutex );
+            x264_atomic_fetch_add( &core->sleeping, -1 );
+            int quit = core->exit;
+            x264_pthread_mutex_unlock( &core->mutex );
+            if( quit )
+                break;
             continue;
-        job->ret = job->func( job->arg );
-        x264_sync_frame_list_push( &pool->done, (void*)job );
+        }
+        void *ret = job->func( job->arg );
+        x264_pthread_mutex_lock( &job->mutex );
+        job->ret = ret;
+        x264_atomic_store( &job->state, JOB_DONE );
+        if( job->waiting )
+            x264_pthread_cond_signal( &job->cv_done );
+        x264_pthread_mutex_unlock( &job->mutex );
     }
     return NULL;
 }
 
-int x264_threadpool_init( x264_threadpool_t **p_pool, int threads )
+static void threadpool_core_unref( threadpool_core_t *core )
 {
-    if( threads <= 0 )
-        return -1;
+    x264_pthread_mutex_lock( &core->mutex );
+    int last = !--core->refcount;
+    if( last )
+    {
+        core->exit = 1;
+        x264_pthread_cond_broadcast( &core->cv_work );
+    }
+    x264_pthread_mutex_unlock( &core->mutex );
+    if( !last )
+        return;
 
-    if( x264_threading_init() < 0 )
-        return -1;
+    for( int i = 0; i < core->threads_started; i++ )
+        x264_pthread_join( core->thread_handle[i], NULL );
+    if( core->queues )
+        for( int i = 0; i < core->nqueues; i++ )
+            x264_free( core->queues[i].cells );
+    x264_pthread_mutex_destroy( &core->mutex );
+    x264_pthread_cond_destroy( &core->cv_work );
+    x264_free( core->queues );
+    x264_free( core->workers );
+    x264_free( core->thread_handle );
+    x264_free( core );
+}
+
+static threadpool_core_t *threadpool_core_init( int threads, int nqueues, int queue_size )
+{
+    threadpool_core_t *core;
+    CHECKED_MALLOCZERO( core, sizeof(threadpool_core_t) );
+    core->refcount = 1;
+    core->threads  = threads;
+    core->nqueues  = nqueues;
+
+    if( x264_pthread_mutex_init( &core->mutex, NULL ) ||
+        x264_pthread_cond_init( &core->cv_work, NULL ) )
+        goto fail;
+
+    int size = 1;
+    while( size < queue_size )
+        size <<= 1;
+    core->capacity = size;
+    CHECKED_MALLOCZERO( core->queues, nqueues * sizeof(threadpool_queue_t) );
+    for( int i = 0; i < nqueues; i++ )
+    {
+        threadpool_queue_t *q = &core->queues[i];
+        CHECKED_MALLOC( q->cells, size * sizeof(threadpool_cell_t) );
+        for( int j = 0; j < size; j++ )
+        {
+            q->cells[j].seq = j;
+            q->cells[j].job = NULL;
+        }
+        q->mask = size - 1;
+    }
+
+    CHECKED_MALLOCZERO( core->workers, threads * sizeof(threadpool_worker_t) );
+    CHECKED_MALLOC( core->thread_handle, threads * sizeof(x264_pthread_t) );
+    for( int i = 0; i < threads; i++ )
+    {
+        core->workers[i].core  = core;
+        core->workers[i].index = i;
+        if( x264_pthread_create( core->thread_handle+i, NULL, (void*)threadpool_thread, core->workers+i ) )
+            goto fail;
+        core->threads_started++;
+    }
+    return core;
+fail:
+    if( core )
+        threadpool_core_unref( core );
+    return NULL;
+}
 
+/* Creates a handle with njobs slots on core, taking a reference to it. */
+static int threadpool_handle_init( x264_threadpool_t **p_pool, threadpool_core_t *core, int njobs )
+{
     x264_threadpool_t *pool;
     CHECKED_MALLOCZERO( pool, sizeof(x264_threadpool_t) );
     *p_pool = pool;
 
-    pool->threads   = threads;
-
-    CHECKED_MALLOC( pool->thread_handle, pool->threads * sizeof(x264_pthread_t) );
+    x264_pthread_mutex_lock( &core->mutex );
+    /* every ring can hold all outstanding jobs, so pushes never fail */
+    int fits = core->njobs + njobs <= core->capacity;
+    if( fits )
+    {
+        core->njobs += njobs;
+        core->refcount++;
+        pool->core = core;
+    }
+    x264_pthread_mutex_unlock( &core->mutex );
+    if( !fits )
+        goto fail;
 
-    if( x264_sync_frame_list_init( &pool->uninit, pool->threads ) ||
-        x264_sync_frame_list_init( &pool->run, pool->threads ) ||
-        x264_sync_frame_list_init( &pool->done, pool->threads ) )
+    pool->njobs = njobs;
+    if( x264_pthread_mutex_init( &pool->mutex, NULL ) ||
+        x264_pthread_cond_init( &pool->cv_free, NULL ) )
         goto fail;
 
-    for( int i = 0; i < pool->threads; i++ )
-    {
-       x264_threadpool_job_t *job;
-       CHECKED_MALLOC( job, sizeof(x264_threadpool_job_t) );
-       x264_sync_frame_list_push( &pool->uninit, (void*)job );
-    }
-    for( int i = 0; i < pool->threads; i++ )
-        if( x264_pthread_create( pool->thread_handle+i, NULL, (void*)threadpool_thread, pool ) )
+    CHECKED_MALLOCZERO( pool->jobs, pool->njobs * sizeof(x264_threadpool_job_t) );
+    for( int i = 0; i < pool->njobs; i++ )
+        if( x264_pthread_mutex_init( &pool->jobs[i].mutex, NULL ) ||
+            x264_pthread_cond_init( &pool->jobs[i].cv_done, NULL ) )
             goto fail;
 
     return 0;
@@ -103,57 +327,179 @@ fail:
     return -1;
 }
 
-void x264_threadpool_run( x264_threadpool_t *pool, void *(*func)(void *), void *arg )
+int x264_threadpool_init( x264_threadpool_t **p_pool, int threads )
 {
-    x264_threadpool_job_t *job = (void*)x264_sync_frame_list_pop( &pool->uninit );
-    job->func = func;
-    job->arg  = arg;
-    x264_sync_frame_list_push( &pool->run, (void*)job );
+    if( threads <= 0 )
+        return -1;
+
+    if( x264_threading_init() < 0 )
+        return -1;
+
+    threadpool_core_t *core = threadpool_core_init( threads, threads, threads );
+    if( !core )
+        return -1;
+    int ret = threadpool_handle_init( p_pool, core, threads );
+    threadpool_core_unref( core );
+    return ret;
 }
 
-void *x264_threadpool_wait( x264_threadpool_t *pool, void *arg )
+int x264_threadpool_init_shared( x264_threadpool_t **p_pool, int threads )
 {
-    x264_pthread_mutex_lock( &pool->done.mutex );
-    while( 1 )
+    if( threads <= 0 )
+        return -1;
+
+    if( x264_threading_init() < 0 )
+        return -1;
+
+    threadpool_core_t *core = threadpool_core_init( threads, 1, SHARED_QUEUE_SIZE );
+    if( !core )
+        return -1;
+    int ret = threadpool_handle_init( p_pool, core, threads );
+    threadpool_core_unref( core );
+    return ret;
+}
+
+int x264_threadpool_attach( x264_threadpool_t **p_pool, x264_threadpool_t *shared, int jobs )
+{
+    if( jobs <= 0 )
+        return -1;
+    return threadpool_handle_init( p_pool, shared->core, jobs );
+}
+
+static ALWAYS_INLINE int threadpool_hash( x264_threadpool_t *pool, void *arg )
+{
+    /* args are usually x264_t or per-slice structs spaced far apart */
+    return (uint32_t)(((uintptr_t)arg >> 4) * 0x9E3779B1u) % pool->njobs;
+}
+
+void x264_threadpool_run( x264_threadpool_t *pool, void *(*func)(void *), void *arg )
+{
+    threadpool_core_t *core = pool->core;
+    int start = threadpool_hash( pool, arg );
+    x264_threadpool_job_t *job = NULL;
+    while( !job )
     {
-        for( int i = 0; i < pool->done.i_size; i++ )
-            if( ((x264_threadpool_job_t*)pool->done.list[i])->arg == arg )
+        for( int i = 0; i < pool->njobs; i++ )
+        {
+            x264_threadpool_job_t *slot = &pool->jobs[(start + i) % pool->njobs];
+            if( x264_atomic_load( &slot->state ) == JOB_FREE && x264_atomic_cas( &slot->state, JOB_FREE, JOB_BUSY ) )
             {
-                x264_threadpool_job_t *job = (void*)x264_frame_shift( pool->done.list+i );
-                pool->done.i_size--;
-                x264_pthread_mutex_unlock( &pool->done.mutex );
-
-                void *ret = job->ret;
-                x264_sync_frame_list_push( &pool->uninit, (void*)job );
-                return ret;
+                job = slot;
+                break;
             }
+        }
+        if( !job )
+        {
+            x264_pthread_mutex_lock( &pool->mutex );
+            x264_atomic_fetch_add( &pool->full_waiting, 1 );
+            int any_free = 0;
+            for( int i = 0; i < pool->njobs; i++ )
+                any_free |= x264_atomic_load( &pool->jobs[i].state ) == JOB_FREE;
+            if( !any_free )
+                x264_pthread_cond_wait( &pool->cv_free, &pool->mutex );
+            x264_atomic_fetch_add( &pool->full_waiting, -1 );
+            x264_pthread_mutex_unlock( &pool->mutex );
+        }
+    }
 
-        x264_pthread_cond_wait( &pool->done.cv_fill, &pool->done.mutex );
+    /* wait() looks the slot up by arg under the mutex */
+    x264_pthread_mutex_lock( &job->mutex );
+    job->func = func;
+    job->arg  = arg;
+    x264_pthread_mutex_unlock( &job->mutex );
+    int idx = (uint32_t)x264_atomic_fetch_add( &core->next, 1 ) % core->nqueues;
+    threadpool_queue_push( &core->queues[idx], job );
+
+    x264_atomic_fetch_add( &core->pending, 1 );
+    if( x264_atomic_load( &core->sleeping ) )
+    {
+        x264_pthread_mutex_lock( &core->mutex );
+        x264_pthread_cond_signal( &core->cv_work );
+        x264_pthread_mutex_unlock( &core->mutex );
     }
 }
 
-static void threadpool_list_delete( x264_sync_frame_list_t *slist )
+void *x264_threadpool_wait( x264_threadpool_t *pool, void *arg )
 {
-    for( int i = 0; slist->list[i]; i++ )
+    int start = threadpool_hash( pool, arg );
+    x264_threadpool_job_t *job = NULL;
+    for( int i = 0; i < pool->njobs; i++ )
     {
-        x264_free( slist->list[i] );
-        slist->list[i] = NULL;
+        x264_threadpool_job_t *slot = &pool->jobs[(start + i) % pool->njobs];
+        if( x264_atomic_load( &slot->state ) == JOB_FREE )
+            continue;
+        x264_pthread_mutex_lock( &slot->mutex );
+        if( slot->arg == arg )
+        {
+            job = slot;
+            break;
+        }
+        x264_pthread_mutex_unlock( &slot->mutex );
+    }
+    if( !job )
+        return NULL;
+
+    /* The worker marks the job done under the mutex, so once we hold it and
+     * see DONE, the worker is through with the slot and it can be reused. */
+    while( x264_atomic_load( &job->state ) != JOB_DONE )
+    {
+        job->waiting = 1;
+        x264_pthread_cond_wait( &job->cv_done, &job->mutex );
+    }
+    job->waiting = 0;
+    void *ret = job->ret;
+    job->arg = NULL;
+    x264_pthread_mutex_unlock( &job->mutex );
+
+    x264_atomic_store( &job->state, JOB_FREE );
+    if( x264_atomic_load( &pool->full_waiting ) )
+    {
+        x264_pthread_mutex_lock( &pool->mutex );
+        x264_pthread_cond_broadcast( &pool->cv_free );
+        x264_pthread_mutex_unlock( &pool->mutex );
     }
-    x264_sync_frame_list_delete( slist );
+    return ret;
 }
 
 void x264_threadpool_delete( x264_threadpool_t *pool )
 {
-    x264_pthread_mutex_lock( &pool->run.mutex );
-    pool->exit = 1;
-    x264_pthread_cond_broadcast( &pool->run.cv_fill );
-    x264_pthread_mutex_unlock( &pool->run.mutex );
-    for( int i = 0; i < pool->threads; i++ )
-        x264_pthread_join( pool->thread_handle[i], NULL );
-
-    threadpool_list_delete( &pool->uninit );
-    threadpool_list_delete( &pool->run );
-    threadpool_list_delete( &pool->done );
-    x264_free( pool->thread_handle );
+    if( !pool )
+        return;
+    threadpool_core_t *core = pool->core;
+    if( core )
+    {
+        /* On a shared core the workers outlive this handle, and one may still
+         * be running or finishing a job of ours. Let every slot settle before
+         * tearing them down; a DONE slot's worker has let go of the mutex once
+         * we get it. */
+        for( int i = 0; pool->jobs && i < pool->njobs; i++ )
+        {
+            x264_threadpool_job_t *job = &pool->jobs[i];
+            if( x264_atomic_load( &job->state ) == JOB_FREE )
+                continue;
+            x264_pthread_mutex_lock( &job->mutex );
+            while( x264_atomic_load( &job->state ) == JOB_BUSY )
+            {
+                job->waiting = 1;
+                x264_pthread_cond_wait( &job->cv_done, &job->mutex );
+            }
+            job->waiting = 0;
+            x264_pthread_mutex_unlock( &job->mutex );
+        }
+        x264_pthread_mutex_lock( &core->mutex );
+        core->njobs -= pool->njobs;
+        x264_pthread_mutex_unlock( &core->mutex );
+        threadpool_core_unref( core );
+    }
+
+    if( pool->jobs )
+        for( int i = 0; i < pool->njobs; i++ )
+        {
+            x264_pthread_mutex_destroy( &pool->jobs[i].mutex );
+            x264_pthread_cond_destroy( &pool->jobs[i].cv_done );
+        }
+    x264_pthread_mutex_destroy( &pool->mutex );
+    x264_pthread_cond_destroy( &pool->cv_free );
+    x264_free( pool->jobs );
     x264_free( pool );
 }
@@ -26,19 +26,21 @@
 #ifndef X264_THREADPOOL_H
 #define X264_THREADPOOL_H
 
-typedef struct x264_threadpool_t x264_threadpool_t;
+/* x264_threadpool_t is declared in x264.h, shared pools are part of the public api */
 
 #if HAVE_THREAD
-#define x264_threadpool_init x264_template(threadpool_init)
 X264_API int   x264_threadpool_init( x264_threadpool_t **p_pool, int threads );
-#define x264_threadpool_run x264_template(threadpool_run)
+/* a pool that several handles can be attached to; jobs start in submission order */
+X264_API int   x264_threadpool_init_shared( x264_threadpool_t **p_pool, int threads );
+/* a handle running up to jobs concurrent jobs on the workers of a shared pool */
+X264_API int   x264_threadpool_attach( x264_threadpool_t **p_pool, x264_threadpool_t *shared, int jobs );
 X264_API void  x264_threadpool_run( x264_threadpool_t *pool, void *(*func)(void *), void *arg );
-#define x264_threadpool_wait x264_template(threadpool_wait)
 X264_API void *x264_threadpool_wait( x264_threadpool_t *pool, void *arg );
-#define x264_threadpool_delete x264_template(threadpool_delete)
 X264_API void  x264_threadpool_delete( x264_threadpool_t *pool );
 #else
 #define x264_threadpool_init(p,t) -1
+#define x264_threadpool_init_shared(p,t) -1
+#define x264_threadpool_attach(p,s,j) -1
 #define x264_threadpool_run(p,f,a)
 #define x264_threadpool_wait(p,a)     NULL
 #define x264_threadpool_delete(p)
@@ -0,0 +1,661 @@
+/*****************************************************************************
+ * mc-intrin.c: x86 motion compensation, intrinsics
+ *****************************************************************************
+ * Copyright (C) 2003-2022 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "common/common.h"
+#include "intrin.h"
+
+#define LOAD4(p)  _mm_cvtsi32_si128( intrin_load32( p ) )
+#define LOAD8(p)  _mm_loadl_epi64( (__m128i*)(p) )
+#define LOAD16(p) _mm_loadu_si128( (__m128i*)(p) )
+#define STORE4(p, x)  intrin_store32( p, _mm_cvtsi128_si32( x ) )
+#define STORE8(p, x)  _mm_storel_epi64( (__m128i*)(p), x )
+#define STORE16(p, x) _mm_storeu_si128( (__m128i*)(p), x )
+
+/* Row kernels take any width: whole vectors first, then 8 and 4 pixels, then
+ * a scalar tail identical to the C reference. */
+static ALWAYS_INLINE INTRIN_SSE2 void avg_row_sse2( pixel *dst, pixel *src1, pixel *src2, int width )
+{
+    int x = 0;
+    for( ; x+16 <= width; x += 16 )
+        STORE16( dst+x, _mm_avg_epu8( LOAD16( src1+x ), LOAD16( src2+x ) ) );
+    if( x+8 <= width )
+    {
+        STORE8( dst+x, _mm_avg_epu8( LOAD8( src1+x ), LOAD8( src2+x ) ) );
+        x += 8;
+    }
+    if( x+4 <= width )
+    {
+        STORE4( dst+x, _mm_avg_epu8( LOAD4( src1+x ), LOAD4( src2+x ) ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = ( src1[x] + src2[x] + 1 ) >> 1;
+}
+
+/* Implicit weighted bipred: weight1 + weight2 = 64, so with 8-bit input every
+ * intermediate fits in a signed word. */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i avg_weight8_sse2( __m128i a, __m128i b, __m128i w1, __m128i w2 )
+{
+    const __m128i zero = _mm_setzero_si128();
+    a = _mm_mullo_epi16( _mm_unpacklo_epi8( a, zero ), w1 );
+    b = _mm_mullo_epi16( _mm_unpacklo_epi8( b, zero ), w2 );
+    return _mm_srai_epi16( _mm_add_epi16( _mm_add_epi16( a, b ), _mm_set1_epi16( 1<<5 ) ), 6 );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 void avg_weight_row_sse2( pixel *dst, pixel *src1, pixel *src2, int width, int i_weight1 )
+{
+    int i_weight2 = 64 - i_weight1;
+    __m128i w1 = _mm_set1_epi16( i_weight1 );
+    __m128i w2 = _mm_set1_epi16( i_weight2 );
+    int x = 0;
+    for( ; x+8 <= width; x += 8 )
+    {
+        __m128i r = avg_weight8_sse2( LOAD8( src1+x ), LOAD8( src2+x ), w1, w2 );
+        STORE8( dst+x, _mm_packus_epi16( r, r ) );
+    }
+    if( x+4 <= width )
+    {
+        __m128i r = avg_weight8_sse2( LOAD4( src1+x ), LOAD4( src2+x ), w1, w2 );
+        STORE4( dst+x, _mm_packus_epi16( r, r ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = x264_clip_pixel( (src1[x]*i_weight1 + src2[x]*i_weight2 + (1<<5)) >> 6 );
+}
+
+/* Explicit weighted prediction. With denom == 0 the rounding term is 0 and the
+ * shift a no-op, which matches the C opscale_noden path. */
+typedef struct
+{
+    __m128i scale, round, offset, shift;
+    int i_scale, i_round, i_offset, i_denom;
+} weight_sse2_t;
+
+static ALWAYS_INLINE INTRIN_SSE2 void weight_init_sse2( weight_sse2_t *w, const x264_weight_t *weight )
+{
+    w->i_scale  = weight->i_scale;
+    w->i_denom  = weight->i_denom;
+    w->i_round  = w->i_denom >= 1 ? 1 << (w->i_denom - 1) : 0;
+    w->i_offset = weight->i_offset;
+    w->scale  = _mm_set1_epi16( w->i_scale );
+    w->round  = _mm_set1_epi16( w->i_round );
+    w->offset = _mm_set1_epi16( w->i_offset );
+    w->shift  = _mm_cvtsi32_si128( w->i_denom );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 __m128i weight8_sse2( __m128i src, const weight_sse2_t *w )
+{
+    __m128i x = _mm_mullo_epi16( _mm_unpacklo_epi8( src, _mm_setzero_si128() ), w->scale );
+    x = _mm_sra_epi16( _mm_add_epi16( x, w->round ), w->shift );
+    return _mm_add_epi16( x, w->offset );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 void weight_row_sse2( pixel *dst, pixel *src, int width, const weight_sse2_t *w )
+{
+    int x = 0;
+    for( ; x+16 <= width; x += 16 )
+    {
+        __m128i s = LOAD16( src+x );
+        STORE16( dst+x, _mm_packus_epi16( weight8_sse2( s, w ), weight8_sse2( _mm_srli_si128( s, 8 ), w ) ) );
+    }
+    if( x+8 <= width )
+    {
+        __m128i r = weight8_sse2( LOAD8( src+x ), w );
+        STORE8( dst+x, _mm_packus_epi16( r, r ) );
+        x += 8;
+    }
+    if( x+4 <= width )
+    {
+        __m128i r = weight8_sse2( LOAD4( src+x ), w );
+        STORE4( dst+x, _mm_packus_epi16( r, r ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = x264_clip_pixel( ((src[x] * w->i_scale + w->i_round) >> w->i_denom) + w->i_offset );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 void copy_row_sse2( pixel *dst, pixel *src, int width )
+{
+    int x = 0;
+    for( ; x+16 <= width; x += 16 )
+        STORE16( dst+x, LOAD16( src+x ) );
+    if( x+8 <= width )
+    {
+        STORE8( dst+x, LOAD8( src+x ) );
+        x += 8;
+    }
+    if( x+4 <= width )
+    {
+        STORE4( dst+x, LOAD4( src+x ) );
+        x += 4;
+    }
+    for( ; x < width; x++ )
+        dst[x] = src[x];
+}
+
+#define PIXEL_AVG_SSE2( w, h ) \
+static INTRIN_SSE2 void pixel_avg_##w##x##h##_sse2( pixel *pix1, intptr_t i_stride_pix1,\
+                                                   pixel *pix2, intptr_t i_stride_pix2,\
+                                                   pixel *pix3, intptr_t i_stride_pix3, int weight )\
+{\
+    for( int y = 0; y < h; y++, pix1 += i_stride_pix1, pix2 += i_stride_pix2, pix3 += i_stride_pix3 )\
+    {\
+        if( weight == 32 )\
+            avg_row_sse2( pix1, pix2, pix3, w );\
+        else\
+            avg_weight_row_sse2( pix1, pix2, pix3, w, weight );\
+    }\
+}
+PIXEL_AVG_SSE2( 16, 16 )
+PIXEL_AVG_SSE2( 16, 8 )
+PIXEL_AVG_SSE2( 8, 16 )
+PIXEL_AVG_SSE2( 8, 8 )
+PIXEL_AVG_SSE2( 8, 4 )
+PIXEL_AVG_SSE2( 4, 16 )
+PIXEL_AVG_SSE2( 4, 8 )
+PIXEL_AVG_SSE2( 4, 4 )
+PIXEL_AVG_SSE2( 4, 2 )
+
+#define MC_WEIGHT_SSE2( w ) \
+static INTRIN_SSE2 void mc_weight_w##w##_sse2( pixel *dst, intptr_t i_dst_stride, pixel *src, intptr_t i_src_stride,\
+                                              const x264_weight_t *weight, int height )\
+{\
+    weight_sse2_t wt;\
+    weight_init_sse2( &wt, weight );\
+    for( int y = 0; y < height; y++, dst += i_dst_stride, src += i_src_stride )\
+        weight_row_sse2( dst, src, w, &wt );\
+}
+MC_WEIGHT_SSE2( 2 )
+MC_WEIGHT_SSE2( 4 )
+MC_WEIGHT_SSE2( 8 )
+MC_WEIGHT_SSE2( 12 )
+MC_WEIGHT_SSE2( 16 )
+MC_WEIGHT_SSE2( 20 )
+
+static weight_fn_t mc_weight_wtab_sse2[6] =
+{
+    mc_weight_w2_sse2,
+    mc_weight_w4_sse2,
+    mc_weight_w8_sse2,
+    mc_weight_w12_sse2,
+    mc_weight_w16_sse2,
+    mc_weight_w20_sse2,
+};
+
+/* Shared body of mc_luma and get_ref. Returns the plane to read from when no
+ * interpolation or weighting is needed, leaving dst untouched. */
+static ALWAYS_INLINE INTRIN_SSE2 pixel *mc_luma_sse2( pixel *dst, intptr_t i_dst_stride,
+                                                      pixel *src[4], intptr_t i_src_stride,
+                                                      int mvx, int mvy,
+                                                      int i_width, int i_height, const x264_weight_t *weight )
+{
+    int qpel_idx = ((mvy&3)<<2) + (mvx&3);
+    int offset = (mvy>>2)*i_src_stride + (mvx>>2);
+    pixel *src1 = src[x264_hpel_ref0[qpel_idx]] + offset + ((mvy&3) == 3) * i_src_stride;
+    weight_sse2_t wt;
+    if( weight->weightfn )
+        weight_init_sse2( &wt, weight );
+
+    if( qpel_idx & 5 ) /* qpel interpolation needed */
+    {
+        pixel *src2 = src[x264_hpel_ref1[qpel_idx]] + offset + ((mvx&3) == 3);
+        for( int y = 0; y < i_height; y++, dst += i_dst_stride, src1 += i_src_stride, src2 += i_src_stride )
+        {
+            avg_row_sse2( dst, src1, src2, i_width );
+            if( weight->weightfn )
+                weight_row_sse2( dst, dst, i_width, &wt );
+        }
+        return NULL;
+    }
+    else if( weight->weightfn )
+    {
+        for( int y = 0; y < i_height; y++, dst += i_dst_stride, src1 += i_src_stride )
+            weight_row_sse2( dst, src1, i_width, &wt );
+        return NULL;
+    }
+    return src1;
+}
+
+static INTRIN_SSE2 void mc_luma_wrap_sse2( pixel *dst, intptr_t i_dst_stride,
+                                           pixel *src[4], intptr_t i_src_stride,
+                                           int mvx, int mvy,
+                                           int i_width, int i_height, const x264_weight_t *weight )
+{
+    pixel *src1 = mc_luma_sse2( dst, i_dst_stride, src, i_src_stride, mvx, mvy, i_width, i_height, weight );
+    if( src1 )
+        for( int y = 0; y < i_height; y++, dst += i_dst_stride, src1 += i_src_stride )
+            copy_row_sse2( dst, src1, i_width );
+}
+
+static INTRIN_SSE2 pixel *get_ref_sse2( pixel *dst, intptr_t *i_dst_stride,
+                                        pixel *src[4], intptr_t i_src_stride,
+                                        int mvx, int mvy,
+                                        int i_width, int i_height, const x264_weight_t *weight )
+{
+    pixel *src1 = mc_luma_sse2( dst, *i_dst_stride, src, i_src_stride, mvx, mvy, i_width, i_height, weight );
+    if( !src1 )
+        return dst;
+    *i_dst_stride = i_src_stride;
+    return src1;
+}
+
+/* Bilinear filter on interleaved chroma: 8 words hold 4 u/v pairs */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i chroma8_sse2( __m128i a, __m128i b, __m128i c, __m128i d, __m128i cAB, __m128i cCD )
+{
+    __m128i ab = _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), cAB );
+    __m128i cd = _mm_madd_epi16( _mm_unpacklo_epi16( c, d ), cCD );
+    __m128i lo = _mm_add_epi32( ab, cd );
+    ab = _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), cAB );
+    cd = _mm_madd_epi16( _mm_unpackhi_epi16( c, d ), cCD );
+    __m128i hi = _mm_add_epi32( ab, cd );
+    return _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( lo, _mm_set1_epi32( 32 ) ), 6 ),
+                            _mm_srai_epi32( _mm_add_epi32( hi, _mm_set1_epi32( 32 ) ), 6 ) );
+}
+
+static INTRIN_SSE2 void mc_chroma_sse2( pixel *dstu, pixel *dstv, intptr_t i_dst_stride,
+                                        pixel *src, intptr_t i_src_stride,
+                                        int mvx, int mvy,
+                                        int i_width, int i_height )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lomask = _mm_set1_epi16( 0xff );
+    int d8x = mvx&0x07;
+    int d8y = mvy&0x07;
+    int cA = (8-d8x)*(8-d8y);
+    int cB = d8x    *(8-d8y);
+    int cC = (8-d8x)*d8y;
+    int cD = d8x    *d8y;
+    __m128i cAB = _mm_set1_epi32( (cB << 16) | cA );
+    __m128i cCD = _mm_set1_epi32( (cD << 16) | cC );
+
+    src += (mvy >> 3) * i_src_stride + (mvx >> 3)*2;
+    pixel *srcp = &src[i_src_stride];
+
+    for( int y = 0; y < i_height; y++ )
+    {
+        int x = 0;
+        for( ; x+8 <= i_width; x += 8 )
+        {
+            __m128i a = LOAD16( src+2*x ),  b = LOAD16( src+2*x+2 );
+            __m128i c = LOAD16( srcp+2*x ), d = LOAD16( srcp+2*x+2 );
+            __m128i lo = chroma8_sse2( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ),
+                                       _mm_unpacklo_epi8( c, zero ), _mm_unpacklo_epi8( d, zero ), cAB, cCD );
+            __m128i hi = chroma8_sse2( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ),
+                                       _mm_unpackhi_epi8( c, zero ), _mm_unpackhi_epi8( d, zero ), cAB, cCD );
+            __m128i uv = _mm_packus_epi16( lo, hi );
+            __m128i u = _mm_packus_epi16( _mm_and_si128( uv, lomask ), zero );
+            __m128i v = _mm_packus_epi16( _mm_srli_epi16( uv, 8 ), zero );
+            STORE8( dstu+x, u );
+            STORE8( dstv+x, v );
+        }
+        if( x+4 <= i_width )
+        {
+            __m128i a = LOAD8( src+2*x ),  b = LOAD8( src+2*x+2 );
+            __m128i c = LOAD8( srcp+2*x ), d = LOAD8( srcp+2*x+2 );
+            __m128i r = chroma8_sse2( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ),
+                                      _mm_unpacklo_epi8( c, zero ), _mm_unpacklo_epi8( d, zero ), cAB, cCD );
+            __m128i uv = _mm_packus_epi16( r, r );
+            __m128i u = _mm_packus_epi16( _mm_and_si128( uv, lomask ), zero );
+            __m128i v = _mm_packus_epi16( _mm_srli_epi16( uv, 8 ), zero );
+            STORE4( dstu+x, u );
+            STORE4( dstv+x, v );
+            x += 4;
+        }
+        for( ; x < i_width; x++ )
+        {
+            dstu[x] = ( cA*src[2*x]  + cB*src[2*x+2] +
+                        cC*srcp[2*x] + cD*srcp[2*x+2] + 32 ) >> 6;
+            dstv[x] = ( cA*src[2*x+1]  + cB*src[2*x+3] +
+                        cC*srcp[2*x+1] + cD*srcp[2*x+3] + 32 ) >> 6;
+        }
+        dstu += i_dst_stride;
+        dstv += i_dst_stride;
+        src   = srcp;
+        srcp += i_src_stride;
+    }
+}
+
+/****************************************************************************
+ * hpel_filter: the 6-tap filter (1,-5,20,20,-5,1) on words. Taps on pixels
+ * and the sums of tap pairs on intermediate v values both fit in 16 bits;
+ * only the final centre filter needs dwords.
+ ****************************************************************************/
+#define TAPFILTER(pix, d) ((pix)[x-2*d] + (pix)[x+3*d] - 5*((pix)[x-d] + (pix)[x+2*d]) + 20*((pix)[x] + (pix)[x+d]))
+
+static ALWAYS_INLINE INTRIN_SSE2 __m128i tap_sse2( __m128i a, __m128i b, __m128i c, __m128i d, __m128i e, __m128i f )
+{
+    __m128i t = _mm_sub_epi16( _mm_add_epi16( a, f ), _mm_mullo_epi16( _mm_add_epi16( b, e ), _mm_set1_epi16( 5 ) ) );
+    return _mm_add_epi16( t, _mm_mullo_epi16( _mm_add_epi16( c, d ), _mm_set1_epi16( 20 ) ) );
+}
+
+#define TAP_LOAD_SSE2( p, d ) \
+    tap_sse2( _mm_unpacklo_epi8( LOAD8( (p)-2*(d) ), zero ), _mm_unpacklo_epi8( LOAD8( (p)-(d) ), zero ),\
+              _mm_unpacklo_epi8( LOAD8( (p)       ), zero ), _mm_unpacklo_epi8( LOAD8( (p)+(d) ), zero ),\
+              _mm_unpacklo_epi8( LOAD8( (p)+2*(d) ), zero ), _mm_unpacklo_epi8( LOAD8( (p)+3*(d) ), zero ) )
+
+static ALWAYS_INLINE INTRIN_SSE2 __m128i tap_centre_sse2( int16_t *p )
+{
+    __m128i af = _mm_add_epi16( LOAD16( p-2 ), LOAD16( p+3 ) );
+    __m128i be = _mm_add_epi16( LOAD16( p-1 ), LOAD16( p+2 ) );
+    __m128i cd = _mm_add_epi16( LOAD16( p   ), LOAD16( p+1 ) );
+    const __m128i c1m5 = _mm_set1_epi32( (int)0xfffb0001 ); /* words 1, -5 */
+    const __m128i c20r = _mm_set1_epi32( (512 << 16) | 20 );
+    const __m128i one = _mm_set1_epi16( 1 );
+    __m128i lo = _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( af, be ), c1m5 ),
+                                _mm_madd_epi16( _mm_unpacklo_epi16( cd, one ), c20r ) );
+    __m128i hi = _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( af, be ), c1m5 ),
+                                _mm_madd_epi16( _mm_unpackhi_epi16( cd, one ), c20r ) );
+    return _mm_packs_epi32( _mm_srai_epi32( lo, 10 ), _mm_srai_epi32( hi, 10 ) );
+}
+
+static INTRIN_SSE2 void hpel_filter_sse2( pixel *dsth, pixel *dstv, pixel *dstc, pixel *src,
+                                          intptr_t stride, int width, int height, int16_t *buf )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i r5 = _mm_set1_epi16( 16 );
+    for( int y = 0; y < height; y++ )
+    {
+        int x = -2;
+        for( ; x+8 <= width+3; x += 8 )
+        {
+            __m128i v = TAP_LOAD_SSE2( src+x, stride );
+            STORE16( buf+x+2, v );
+            v = _mm_srai_epi16( _mm_add_epi16( v, r5 ), 5 );
+            STORE8( dstv+x, _mm_packus_epi16( v, v ) );
+        }
+        for( ; x < width+3; x++ )
+        {
+            int v = TAPFILTER(src,stride);
+            dstv[x] = x264_clip_pixel( (v + 16) >> 5 );
+            buf[x+2] = v;
+        }
+        for( x = 0; x+8 <= width; x += 8 )
+        {
+            __m128i c = tap_centre_sse2( buf+2+x );
+            STORE8( dstc+x, _mm_packus_epi16( c, c ) );
+            __m128i h = TAP_LOAD_SSE2( src+x, 1 );
+            h = _mm_srai_epi16( _mm_add_epi16( h, r5 ), 5 );
+            STORE8( dsth+x, _mm_packus_epi16( h, h ) );
+        }
+        for( ; x < width; x++ )
+        {
+            dstc[x] = x264_clip_pixel( (TAPFILTER(buf+2,1) + 512) >> 10 );
+            dsth[x] = x264_clip_pixel( (TAPFILTER(src,1) + 16) >> 5 );
+        }
+        dsth += stride;
+        dstv += stride;
+        dstc += stride;
+        src += stride;
+    }
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 __m256i tap_avx2( __m256i a, __m256i b, __m256i c, __m256i d, __m256i e, __m256i f )
+{
+    __m256i t = _mm256_sub_epi16( _mm256_add_epi16( a, f ), _mm256_mullo_epi16( _mm256_add_epi16( b, e ), _mm256_set1_epi16( 5 ) ) );
+    return _mm256_add_epi16( t, _mm256_mullo_epi16( _mm256_add_epi16( c, d ), _mm256_set1_epi16( 20 ) ) );
+}
+
+#define TAP_LOAD_AVX2( p, d ) \
+    tap_avx2( _mm256_cvtepu8_epi16( LOAD16( (p)-2*(d) ) ), _mm256_cvtepu8_epi16( LOAD16( (p)-(d) ) ),\
+              _mm256_cvtepu8_epi16( LOAD16( (p)       ) ), _mm256_cvtepu8_epi16( LOAD16( (p)+(d) ) ),\
+              _mm256_cvtepu8_epi16( LOAD16( (p)+2*(d) ) ), _mm256_cvtepu8_epi16( LOAD16( (p)+3*(d) ) ) )
+#define LOAD32(p) _mm256_loadu_si256( (__m256i*)(p) )
+
+static ALWAYS_INLINE INTRIN_AVX2 __m128i pack_avx2( __m256i x )
+{
+    return _mm_packus_epi16( _mm256_castsi256_si128( x ), _mm256_extracti128_si256( x, 1 ) );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 __m256i tap_centre_avx2( int16_t *p )
+{
+    __m256i af = _mm256_add_epi16( LOAD32( p-2 ), LOAD32( p+3 ) );
+    __m256i be = _mm256_add_epi16( LOAD32( p-1 ), LOAD32( p+2 ) );
+    __m256i cd = _mm256_add_epi16( LOAD32( p   ), LOAD32( p+1 ) );
+    const __m256i c1m5 = _mm256_set1_epi32( (int)0xfffb0001 ); /* words 1, -5 */
+    const __m256i c20r = _mm256_set1_epi32( (512 << 16) | 20 );
+    const __m256i one = _mm256_set1_epi16( 1 );
+    /* unpack and pack both work within 128-bit lanes, so word order survives */
+    __m256i lo = _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpacklo_epi16( af, be ), c1m5 ),
+                                   _mm256_madd_epi16( _mm256_unpacklo_epi16( cd, one ), c20r ) );
+    __m256i hi = _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpackhi_epi16( af, be ), c1m5 ),
+                                   _mm256_madd_epi16( _mm256_unpackhi_epi16( cd, one ), c20r ) );
+    return _mm256_packs_epi32( _mm256_srai_epi32( lo, 10 ), _mm256_srai_epi32( hi, 10 ) );
+}
+
+static INTRIN_AVX2 void hpel_filter_avx2( pixel *dsth, pixel *dstv, pixel *dstc, pixel *src,
+                                          intptr_t stride, int width, int height, int16_t *buf )
+{
+    const __m256i r5 = _mm256_set1_epi16( 16 );
+    for( int y = 0; y < height; y++ )
+    {
+        int x = -2;
+        for( ; x+16 <= width+3; x += 16 )
+        {
+            __m256i v = TAP_LOAD_AVX2( src+x, stride );
+            _mm256_storeu_si256( (__m256i*)(buf+x+2), v );
+            STORE16( dstv+x, pack_avx2( _mm256_srai_epi16( _mm256_add_epi16( v, r5 ), 5 ) ) );
+        }
+        for( ; x < width+3; x++ )
+        {
+            int v = TAPFILTER(src,stride);
+            dstv[x] = x264_clip_pixel( (v + 16) >> 5 );
+            buf[x+2] = v;
+        }
+        for( x = 0; x+16 <= width; x += 16 )
+        {
+            STORE16( dstc+x, pack_avx2( tap_centre_avx2( buf+2+x ) ) );
+            __m256i h = TAP_LOAD_AVX2( src+x, 1 );
+            STORE16( dsth+x, pack_avx2( _mm256_srai_epi16( _mm256_add_epi16( h, r5 ), 5 ) ) );
+        }
+        for( ; x < width; x++ )
+        {
+            dstc[x] = x264_clip_pixel( (TAPFILTER(buf+2,1) + 512) >> 10 );
+            dsth[x] = x264_clip_pixel( (TAPFILTER(src,1) + 16) >> 5 );
+        }
+        dsth += stride;
+        dstv += stride;
+        dstc += stride;
+        src += stride;
+    }
+}
+
+/* Same float operations in the same order as the C version.  With intra_cost == 0 the C
+ * conversion of NaN truncates to 0 in the int16 store, hence the explicit mask. */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i propagate_cost4_sse2( __m128i prop, __m128i intra, __m128i num, __m128i qscale, __m128 fps )
+{
+    __m128 amount = _mm_add_ps( _mm_cvtepi32_ps( prop ), _mm_mul_ps( _mm_cvtepi32_ps( qscale ), fps ) );
+    __m128 cost = _mm_div_ps( _mm_mul_ps( amount, _mm_cvtepi32_ps( num ) ), _mm_cvtepi32_ps( intra ) );
+    __m128i dst = _mm_cvttps_epi32( _mm_add_ps( cost, _mm_set1_ps( 0.5f ) ) );
+    return _mm_andnot_si128( _mm_cmpeq_epi32( intra, _mm_setzero_si128() ), dst );
+}
+
+static INTRIN_SSE2 void mbtree_propagate_cost_sse2( int16_t *dst, uint16_t *propagate_in, uint16_t *intra_costs,
+                                                   uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16( LOWRES_COST_MASK );
+    float fps_c = *fps_factor;
+    __m128 fps = _mm_set1_ps( fps_c );
+    int i = 0;
+    for( ; i+8 <= len; i += 8 )
+    {
+        __m128i intra = LOAD16( intra_costs+i );
+        __m128i num = _mm_subs_epu16( intra, _mm_and_si128( LOAD16( inter_costs+i ), mask ) );
+        __m128i invq = LOAD16( inv_qscales+i );
+        __m128i prop = LOAD16( propagate_in+i );
+        __m128i qlo = _mm_mullo_epi16( intra, invq );
+        __m128i qhi = _mm_mulhi_epu16( intra, invq );
+        __m128i lo = propagate_cost4_sse2( _mm_unpacklo_epi16( prop, zero ), _mm_unpacklo_epi16( intra, zero ),
+                                           _mm_unpacklo_epi16( num, zero ), _mm_unpacklo_epi16( qlo, qhi ), fps );
+        __m128i hi = propagate_cost4_sse2( _mm_unpackhi_epi16( prop, zero ), _mm_unpackhi_epi16( intra, zero ),
+                                           _mm_unpackhi_epi16( num, zero ), _mm_unpackhi_epi16( qlo, qhi ), fps );
+        STORE16( dst+i, _mm_packs_epi32( lo, hi ) );
+    }
+    for( ; i < len; i++ )
+    {
+        int intra_cost = intra_costs[i];
+        int inter_cost = X264_MIN(intra_costs[i], inter_costs[i] & LOWRES_COST_MASK);
+        float propagate_intra  = intra_cost * inv_qscales[i];
+        float propagate_amount = propagate_in[i] + propagate_intra*fps_c;
+        float propagate_num    = intra_cost - inter_cost;
+        float propagate_denom  = intra_cost;
+        dst[i] = X264_MIN((int)(propagate_amount * propagate_num / propagate_denom + 0.5f), 32767);
+    }
+}
+
+static INTRIN_AVX2 void mbtree_propagate_cost_avx2( int16_t *dst, uint16_t *propagate_in, uint16_t *intra_costs,
+                                                   uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32( LOWRES_COST_MASK );
+    __m256 fps = _mm256_set1_ps( *fps_factor );
+    __m256 half = _mm256_set1_ps( 0.5f );
+    int i = 0;
+    for( ; i+8 <= len; i += 8 )
+    {
+        __m256i intra = _mm256_cvtepu16_epi32( LOAD16( intra_costs+i ) );
+        __m256i inter = _mm256_min_epi32( intra, _mm256_and_si256( _mm256_cvtepu16_epi32( LOAD16( inter_costs+i ) ), mask ) );
+        __m256i invq = _mm256_cvtepu16_epi32( LOAD16( inv_qscales+i ) );
+        __m256i prop = _mm256_cvtepu16_epi32( LOAD16( propagate_in+i ) );
+        __m256 qscale = _mm256_cvtepi32_ps( _mm256_mullo_epi32( intra, invq ) );
+        __m256 amount = _mm256_add_ps( _mm256_cvtepi32_ps( prop ), _mm256_mul_ps( qscale, fps ) );
+        __m256 cost = _mm256_div_ps( _mm256_mul_ps( amount, _mm256_cvtepi32_ps( _mm256_sub_epi32( intra, inter ) ) ),
+                                     _mm256_cvtepi32_ps( intra ) );
+        __m256i res = _mm256_cvttps_epi32( _mm256_add_ps( cost, half ) );
+        res = _mm256_andnot_si256( _mm256_cmpeq_epi32( intra, zero ), res );
+        STORE16( dst+i, _mm_packs_epi32( _mm256_castsi256_si128( res ), _mm256_extracti128_si256( res, 1 ) ) );
+    }
+    if( i < len )
+        mbtree_propagate_cost_sse2( dst+i, propagate_in+i, intra_costs+i, inter_costs+i, inv_qscales+i, fps_factor, len-i );
+}
+
+/* (weight * amount + 512) >> 10 with 32-bit intermediates, weight <= 1024. */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i propagate_weight_sse2( __m128i weight, __m128i amount )
+{
+    const __m128i round = _mm_set1_epi32( 512 );
+    __m128i lo = _mm_mullo_epi16( weight, amount );
+    __m128i hi = _mm_mulhi_epi16( weight, amount );
+    __m128i w0 = _mm_srai_epi32( _mm_add_epi32( _mm_unpacklo_epi16( lo, hi ), round ), 10 );
+    __m128i w1 = _mm_srai_epi32( _mm_add_epi32( _mm_unpackhi_epi16( lo, hi ), round ), 10 );
+    return _mm_packs_epi32( w0, w1 );
+}
+
+/* Fills the buffer PROPAGATE_LIST scatters from: for every 8 mbs, their {mbx, mby} target,
+ * then the weighted amounts for the top two and bottom two target mbs. */
+#define x264_mbtree_propagate_list_internal_sse2 x264_template(mbtree_propagate_list_internal_sse2)
+INTRIN_SSE2 void x264_mbtree_propagate_list_internal_sse2( int16_t (*mvs)[2], int16_t *propagate_amount,
+                                                           uint16_t *lowres_costs, int16_t *output,
+                                                           int bipred_weight, int mb_y, int len )
+{
+    const __m128i pw_31 = _mm_set1_epi16( 31 );
+    const __m128i pw_32 = _mm_set1_epi16( 32 );
+    const __m128i bipred = _mm_set1_epi16( 0xc000 );
+    const __m128i bipred_w = _mm_set1_epi16( bipred_weight );
+    const __m128i neg_x = _mm_set_epi16( 0, -1, 0, -1, 0, -1, 0, -1 );
+    const __m128i pos_x = _mm_set_epi16( 0, 32, 0, 32, 0, 32, 0, 32 );
+    const __m128i step = _mm_set_epi16( 0, 4, 0, 4, 0, 4, 0, 4 );
+    __m128i pos = _mm_set_epi16( mb_y, 3, mb_y, 2, mb_y, 1, mb_y, 0 );
+    int i = 0;
+    for( ; i+8 <= len; i += 8, output += 48 )
+    {
+        __m128i amount = LOAD16( propagate_amount+i );
+        __m128i lists3 = _mm_cmpeq_epi16( _mm_and_si128( LOAD16( lowres_costs+i ), bipred ), bipred );
+        __m128i lo = _mm_mullo_epi16( amount, bipred_w );
+        __m128i hi = _mm_mulhi_epi16( amount, bipred_w );
+        __m128i round = _mm_set1_epi32( 32 );
+        __m128i weighted = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_unpacklo_epi16( lo, hi ), round ), 6 ),
+                                            _mm_srai_epi32( _mm_add_epi32( _mm_unpackhi_epi16( lo, hi ), round ), 6 ) );
+        amount = _mm_or_si128( _mm_and_si128( lists3, weighted ), _mm_andnot_si128( lists3, amount ) );
+
+        for( int j = 0; j < 2; j++ )
+        {
+            __m128i mv = LOAD16( mvs[i+4*j] );
+            STORE16( output+8*j, _mm_add_epi16( _mm_srai_epi16( mv, 5 ), pos ) );
+            pos = _mm_add_epi16( pos, step );
+
+            __m128i frac = _mm_and_si128( mv, pw_31 );
+            __m128i fx = _mm_shufflehi_epi16( _mm_shufflelo_epi16( frac, 0xa0 ), 0xa0 );
+            __m128i fy = _mm_shufflehi_epi16( _mm_shufflelo_epi16( frac, 0xf5 ), 0xf5 );
+            __m128i wx = _mm_add_epi16( _mm_sub_epi16( _mm_xor_si128( fx, neg_x ), neg_x ), pos_x ); /* {32-x, x} */
+            __m128i a = j ? _mm_unpackhi_epi16( amount, amount ) : _mm_unpacklo_epi16( amount, amount );
+            STORE16( output+16+8*j, propagate_weight_sse2( _mm_mullo_epi16( _mm_sub_epi16( pw_32, fy ), wx ), a ) );
+            STORE16( output+32+8*j, propagate_weight_sse2( _mm_mullo_epi16( fy, wx ), a ) );
+        }
+    }
+    for( int k = 0; i < len; i++, k += 2 )
+    {
+        int amount = propagate_amount[i];
+        if( (lowres_costs[i] >> LOWRES_COST_SHIFT) == 3 )
+            amount = (amount * bipred_weight + 32) >> 6;
+        int x = mvs[i][0];
+        int y = mvs[i][1];
+        output[k+0] = (x>>5) + i;
+        output[k+1] = (y>>5) + mb_y;
+        x &= 31;
+        y &= 31;
+        output[k+16] = ((32-y)*(32-x) * amount + 512) >> 10;
+        output[k+17] = ((32-y)*x * amount + 512) >> 10;
+        output[k+32] = (y*(32-x) * amount + 512) >> 10;
+        output[k+33] = (y*x * amount + 512) >> 10;
+    }
+}
+
+PROPAGATE_LIST(sse2)
+
+/****************************************************************************
+ * x264_mc_init_intrin:
+ ****************************************************************************/
+void x264_mc_init_intrin( uint32_t cpu, x264_mc_functions_t *pf )
+{
+    if( cpu&X264_CPU_SSE2 )
+    {
+        pf->mc_luma   = mc_luma_wrap_sse2;
+        pf->get_ref   = get_ref_sse2;
+        pf->mc_chroma = mc_chroma_sse2;
+
+        pf->avg[PIXEL_16x16] = pixel_avg_16x16_sse2;
+        pf->avg[PIXEL_16x8]  = pixel_avg_16x8_sse2;
+        pf->avg[PIXEL_8x16]  = pixel_avg_8x16_sse2;
+        pf->avg[PIXEL_8x8]   = pixel_avg_8x8_sse2;
+        pf->avg[PIXEL_8x4]   = pixel_avg_8x4_sse2;
+        pf->avg[PIXEL_4x16]  = pixel_avg_4x16_sse2;
+        pf->avg[PIXEL_4x8]   = pixel_avg_4x8_sse2;
+        pf->avg[PIXEL_4x4]   = pixel_avg_4x4_sse2;
+        pf->avg[PIXEL_4x2]   = pixel_avg_4x2_sse2;
+
+        pf->weight    = mc_weight_wtab_sse2;
+        pf->offsetadd = mc_weight_wtab_sse2;
+        pf->offsetsub = mc_weight_wtab_sse2;
+
+        pf->hpel_filter = hpel_filter_sse2;
+
+        pf->mbtree_propagate_cost = mbtree_propagate_cost_sse2;
+        pf->mbtree_propagate_list = mbtree_propagate_list_sse2;
+    }
+
+    if( cpu&X264_CPU_AVX2 )
+    {
+        pf->hpel_filter = hpel_filter_avx2;
+        pf->mbtree_propagate_cost = mbtree_propagate_cost_avx2;
+    }
+}
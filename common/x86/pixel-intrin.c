@@ -0,0 +1,704 @@
+/*****************************************************************************
+ * pixel-intrin.c: x86 pixel metrics, intrinsics
+ *****************************************************************************
+ * Copyright (C) 2003-2022 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "common/common.h"
+#include "intrin.h"
+
+#define LOAD4(p)  _mm_cvtsi32_si128( intrin_load32( p ) )
+#define LOAD8(p)  _mm_loadl_epi64( (__m128i*)(p) )
+#define LOAD16(p) _mm_loadu_si128( (__m128i*)(p) )
+
+#define SUMSUB_SSE2( a, b )\
+{\
+    __m128i t_ = a;\
+    a = _mm_add_epi16( t_, b );\
+    b = _mm_sub_epi16( t_, b );\
+}
+#define SUMSUB_AVX2( a, b )\
+{\
+    __m256i t_ = a;\
+    a = _mm256_add_epi16( t_, b );\
+    b = _mm256_sub_epi16( t_, b );\
+}
+
+/****************************************************************************
+ * SSE2
+ ****************************************************************************/
+static ALWAYS_INLINE INTRIN_SSE2 int hsum_epi32_sse2( __m128i x )
+{
+    x = _mm_add_epi32( x, _mm_shuffle_epi32( x, 0x4E ) );
+    x = _mm_add_epi32( x, _mm_shuffle_epi32( x, 0xB1 ) );
+    return _mm_cvtsi128_si32( x );
+}
+
+/* psadbw leaves two partial sums, one per qword */
+static ALWAYS_INLINE INTRIN_SSE2 int hsum_sad_sse2( __m128i x )
+{
+    return _mm_cvtsi128_si32( _mm_add_epi32( x, _mm_srli_si128( x, 8 ) ) );
+}
+
+/* 16 pixels: a 16-wide row, two 8-wide rows or four 4-wide rows */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i load_rows_sse2( pixel *p, intptr_t stride, int w )
+{
+    if( w == 16 )
+        return LOAD16( p );
+    if( w == 8 )
+        return _mm_unpacklo_epi64( LOAD8( p ), LOAD8( p+stride ) );
+    return _mm_unpacklo_epi64( _mm_unpacklo_epi32( LOAD4( p ), LOAD4( p+stride ) ),
+                               _mm_unpacklo_epi32( LOAD4( p+2*stride ), LOAD4( p+3*stride ) ) );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 int sad_sse2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int rows = 16 / w;
+    __m128i sum = _mm_setzero_si128();
+    for( int y = 0; y < h; y += rows, pix1 += rows*i_pix1, pix2 += rows*i_pix2 )
+        sum = _mm_add_epi64( sum, _mm_sad_epu8( load_rows_sse2( pix1, i_pix1, w ), load_rows_sse2( pix2, i_pix2, w ) ) );
+    return hsum_sad_sse2( sum );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 void sad_xn_sse2( int n, pixel *fenc, pixel **pix, intptr_t i_stride, int *scores, int w, int h )
+{
+    int rows = 16 / w;
+    __m128i sum[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+    for( int y = 0; y < h; y += rows )
+    {
+        __m128i f = load_rows_sse2( fenc + y*FENC_STRIDE, FENC_STRIDE, w );
+        for( int i = 0; i < n; i++ )
+            sum[i] = _mm_add_epi64( sum[i], _mm_sad_epu8( f, load_rows_sse2( pix[i] + y*i_stride, i_stride, w ) ) );
+    }
+    for( int i = 0; i < n; i++ )
+        scores[i] = hsum_sad_sse2( sum[i] );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 int ssd_sse2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int rows = 16 / w;
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+    for( int y = 0; y < h; y += rows, pix1 += rows*i_pix1, pix2 += rows*i_pix2 )
+    {
+        __m128i a = load_rows_sse2( pix1, i_pix1, w );
+        __m128i b = load_rows_sse2( pix2, i_pix2, w );
+        __m128i d0 = _mm_sub_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) );
+        __m128i d1 = _mm_sub_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) );
+        sum = _mm_add_epi32( sum, _mm_add_epi32( _mm_madd_epi16( d0, d0 ), _mm_madd_epi16( d1, d1 ) ) );
+    }
+    return hsum_epi32_sse2( sum );
+}
+
+/* 8 differences widened to words. 4-wide blocks pack each row with the row
+ * 4 below it, so that one transform covers two 4x4 blocks. */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i diff_row_sse2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a, b;
+    if( w >= 8 )
+    {
+        a = LOAD8( pix1 );
+        b = LOAD8( pix2 );
+    }
+    else if( h == 4 )
+    {
+        a = LOAD4( pix1 );
+        b = LOAD4( pix2 );
+    }
+    else
+    {
+        a = _mm_unpacklo_epi32( LOAD4( pix1 ), LOAD4( pix1+4*i_pix1 ) );
+        b = _mm_unpacklo_epi32( LOAD4( pix2 ), LOAD4( pix2+4*i_pix2 ) );
+    }
+    return _mm_sub_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) );
+}
+
+/* Horizontal butterflies between words 1, 2 and 4 apart: the lower word of
+ * each pair gets the sum, the upper one the difference. */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i hadamard_h1_sse2( __m128i x )
+{
+    const __m128i m = _mm_set_epi16( -1, 0, -1, 0, -1, 0, -1, 0 );
+    __m128i s = _mm_shufflehi_epi16( _mm_shufflelo_epi16( x, 0xB1 ), 0xB1 );
+    return _mm_add_epi16( s, _mm_sub_epi16( _mm_xor_si128( x, m ), m ) );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 __m128i hadamard_h2_sse2( __m128i x )
+{
+    const __m128i m = _mm_set_epi16( -1, -1, 0, 0, -1, -1, 0, 0 );
+    __m128i s = _mm_shufflehi_epi16( _mm_shufflelo_epi16( x, 0x4E ), 0x4E );
+    return _mm_add_epi16( s, _mm_sub_epi16( _mm_xor_si128( x, m ), m ) );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 __m128i hadamard_h4_sse2( __m128i x )
+{
+    const __m128i m = _mm_set_epi16( -1, -1, -1, -1, 0, 0, 0, 0 );
+    __m128i s = _mm_shuffle_epi32( x, 0x4E );
+    return _mm_add_epi16( s, _mm_sub_epi16( _mm_xor_si128( x, m ), m ) );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 __m128i abs_epi16_sse2( __m128i x )
+{
+    return _mm_max_epi16( x, _mm_sub_epi16( _mm_setzero_si128(), x ) );
+}
+
+/* Sums of |coefs| of two 4x4 hadamards as dwords */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i satd_4row_sse2( __m128i d0, __m128i d1, __m128i d2, __m128i d3 )
+{
+    SUMSUB_SSE2( d0, d1 );
+    SUMSUB_SSE2( d2, d3 );
+    SUMSUB_SSE2( d0, d2 );
+    SUMSUB_SSE2( d1, d3 );
+    d0 = abs_epi16_sse2( hadamard_h2_sse2( hadamard_h1_sse2( d0 ) ) );
+    d1 = abs_epi16_sse2( hadamard_h2_sse2( hadamard_h1_sse2( d1 ) ) );
+    d2 = abs_epi16_sse2( hadamard_h2_sse2( hadamard_h1_sse2( d2 ) ) );
+    d3 = abs_epi16_sse2( hadamard_h2_sse2( hadamard_h1_sse2( d3 ) ) );
+    d0 = _mm_add_epi16( _mm_add_epi16( d0, d1 ), _mm_add_epi16( d2, d3 ) );
+    return _mm_madd_epi16( d0, _mm_set1_epi16( 1 ) );
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 int satd_sse2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    int step = w == 4 ? 8 : 4;
+    __m128i sum = _mm_setzero_si128();
+    for( int x = 0; x < w; x += 8 )
+        for( int y = 0; y < h; y += step )
+        {
+            pixel *p1 = pix1 + y*i_pix1 + x;
+            pixel *p2 = pix2 + y*i_pix2 + x;
+            __m128i d0 = diff_row_sse2( p1,          i_pix1, p2,          i_pix2, w, h );
+            __m128i d1 = diff_row_sse2( p1+  i_pix1, i_pix1, p2+  i_pix2, i_pix2, w, h );
+            __m128i d2 = diff_row_sse2( p1+2*i_pix1, i_pix1, p2+2*i_pix2, i_pix2, w, h );
+            __m128i d3 = diff_row_sse2( p1+3*i_pix1, i_pix1, p2+3*i_pix2, i_pix2, w, h );
+            sum = _mm_add_epi32( sum, satd_4row_sse2( d0, d1, d2, d3 ) );
+        }
+    /* every coef of a 4x4 hadamard has the same parity, so halving the total
+     * equals halving each block as the C version does */
+    return hsum_epi32_sse2( sum ) >> 1;
+}
+
+/* 8x8 hadamard of d[], returning sums of |coefs| as dwords. If sum4 is
+ * non-NULL it also receives the sums after the 4x4 stage. */
+static ALWAYS_INLINE INTRIN_SSE2 __m128i hadamard_8x8_sse2( __m128i d[8], __m128i *sum4 )
+{
+    const __m128i one = _mm_set1_epi16( 1 );
+    SUMSUB_SSE2( d[0], d[1] ); SUMSUB_SSE2( d[2], d[3] );
+    SUMSUB_SSE2( d[4], d[5] ); SUMSUB_SSE2( d[6], d[7] );
+    SUMSUB_SSE2( d[0], d[2] ); SUMSUB_SSE2( d[1], d[3] );
+    SUMSUB_SSE2( d[4], d[6] ); SUMSUB_SSE2( d[5], d[7] );
+    for( int i = 0; i < 8; i++ )
+        d[i] = hadamard_h2_sse2( hadamard_h1_sse2( d[i] ) );
+    if( sum4 )
+    {
+        __m128i s0 = _mm_add_epi16( _mm_add_epi16( abs_epi16_sse2( d[0] ), abs_epi16_sse2( d[1] ) ),
+                                    _mm_add_epi16( abs_epi16_sse2( d[2] ), abs_epi16_sse2( d[3] ) ) );
+        __m128i s1 = _mm_add_epi16( _mm_add_epi16( abs_epi16_sse2( d[4] ), abs_epi16_sse2( d[5] ) ),
+                                    _mm_add_epi16( abs_epi16_sse2( d[6] ), abs_epi16_sse2( d[7] ) ) );
+        *sum4 = _mm_add_epi32( _mm_madd_epi16( s0, one ), _mm_madd_epi16( s1, one ) );
+    }
+    SUMSUB_SSE2( d[0], d[4] ); SUMSUB_SSE2( d[1], d[5] );
+    SUMSUB_SSE2( d[2], d[6] ); SUMSUB_SSE2( d[3], d[7] );
+    /* 8x8 coefs need up to 15 bits, so only pairs may be added as words */
+    __m128i sum = _mm_setzero_si128();
+    for( int i = 0; i < 8; i += 2 )
+    {
+        d[i]   = hadamard_h4_sse2( d[i] );
+        d[i+1] = hadamard_h4_sse2( d[i+1] );
+        __m128i a = _mm_add_epi16( abs_epi16_sse2( d[i] ), abs_epi16_sse2( d[i+1] ) );
+        sum = _mm_add_epi32( sum, _mm_madd_epi16( a, one ) );
+    }
+    return sum;
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 int sa8d_sse2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    __m128i sum = _mm_setzero_si128();
+    for( int y = 0; y < h; y += 8 )
+        for( int x = 0; x < w; x += 8 )
+        {
+            __m128i d[8];
+            for( int i = 0; i < 8; i++ )
+                d[i] = diff_row_sse2( pix1 + (y+i)*i_pix1 + x, i_pix1, pix2 + (y+i)*i_pix2 + x, i_pix2, 8, 8 );
+            sum = _mm_add_epi32( sum, hadamard_8x8_sse2( d, NULL ) );
+        }
+    return (hsum_epi32_sse2( sum ) + 2) >> 2;
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 uint64_t hadamard_ac_sse2( pixel *pix, intptr_t stride, int w, int h )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum4 = zero, sum8 = zero;
+    int dc = 0;
+    for( int y = 0; y < h; y += 8 )
+        for( int x = 0; x < w; x += 8 )
+        {
+            __m128i d[8], s4;
+            for( int i = 0; i < 8; i++ )
+                d[i] = _mm_unpacklo_epi8( LOAD8( pix + (y+i)*stride + x ), zero );
+            sum8 = _mm_add_epi32( sum8, hadamard_8x8_sse2( d, &s4 ) );
+            sum4 = _mm_add_epi32( sum4, s4 );
+            /* the transform leaves the pixel sum, i.e. the dc, in word 0 */
+            dc += _mm_extract_epi16( d[0], 0 );
+        }
+    uint32_t s4 = hsum_epi32_sse2( sum4 ) - dc;
+    uint32_t s8 = hsum_epi32_sse2( sum8 ) - dc;
+    return ((uint64_t)(s8>>2)<<32) + (s4>>1);
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 uint64_t var_sse2( pixel *pix, intptr_t i_stride, int w, int h )
+{
+    int rows = 16 / w;
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero, sqr = zero;
+    for( int y = 0; y < h; y += rows, pix += rows*i_stride )
+    {
+        __m128i p = load_rows_sse2( pix, i_stride, w );
+        __m128i lo = _mm_unpacklo_epi8( p, zero );
+        __m128i hi = _mm_unpackhi_epi8( p, zero );
+        sum = _mm_add_epi64( sum, _mm_sad_epu8( p, zero ) );
+        sqr = _mm_add_epi32( sqr, _mm_add_epi32( _mm_madd_epi16( lo, lo ), _mm_madd_epi16( hi, hi ) ) );
+    }
+    return (uint32_t)hsum_sad_sse2( sum ) + ((uint64_t)(uint32_t)hsum_epi32_sse2( sqr ) << 32);
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 int var2_sse2( pixel *fenc, pixel *fdec, int ssd[2], int h, int shift )
+{
+    const __m128i one = _mm_set1_epi16( 1 );
+    __m128i sum_u = _mm_setzero_si128(), sum_v = sum_u, sqr_u = sum_u, sqr_v = sum_u;
+    for( int y = 0; y < h; y++, fenc += FENC_STRIDE, fdec += FDEC_STRIDE )
+    {
+        __m128i du = diff_row_sse2( fenc, 0, fdec, 0, 8, 8 );
+        __m128i dv = diff_row_sse2( fenc+FENC_STRIDE/2, 0, fdec+FDEC_STRIDE/2, 0, 8, 8 );
+        sum_u = _mm_add_epi16( sum_u, du );
+        sum_v = _mm_add_epi16( sum_v, dv );
+        sqr_u = _mm_add_epi32( sqr_u, _mm_madd_epi16( du, du ) );
+        sqr_v = _mm_add_epi32( sqr_v, _mm_madd_epi16( dv, dv ) );
+    }
+    int su = hsum_epi32_sse2( _mm_madd_epi16( sum_u, one ) );
+    int sv = hsum_epi32_sse2( _mm_madd_epi16( sum_v, one ) );
+    ssd[0] = hsum_epi32_sse2( sqr_u );
+    ssd[1] = hsum_epi32_sse2( sqr_v );
+    return ssd[0] - ((int64_t)su * su >> shift) +
+           ssd[1] - ((int64_t)sv * sv >> shift);
+}
+
+#define PIXEL_CMP_SSE2( name, w, h ) \
+static INTRIN_SSE2 int pixel_##name##_##w##x##h##_sse2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2 )\
+{\
+    return name##_sse2( pix1, i_pix1, pix2, i_pix2, w, h );\
+}
+#define PIXEL_X_SSE2( name, w, h ) \
+static INTRIN_SSE2 void pixel_##name##_x3_##w##x##h##_sse2( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                                           intptr_t i_stride, int scores[3] )\
+{\
+    pixel *pix[3] = { pix0, pix1, pix2 };\
+    name##_xn_sse2( 3, fenc, pix, i_stride, scores, w, h );\
+}\
+static INTRIN_SSE2 void pixel_##name##_x4_##w##x##h##_sse2( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                                           pixel *pix3, intptr_t i_stride, int scores[4] )\
+{\
+    pixel *pix[4] = { pix0, pix1, pix2, pix3 };\
+    name##_xn_sse2( 4, fenc, pix, i_stride, scores, w, h );\
+}
+
+static ALWAYS_INLINE INTRIN_SSE2 void satd_xn_sse2( int n, pixel *fenc, pixel **pix, intptr_t i_stride, int *scores, int w, int h )
+{
+    for( int i = 0; i < n; i++ )
+        scores[i] = satd_sse2( fenc, FENC_STRIDE, pix[i], i_stride, w, h );
+}
+
+PIXEL_CMP_SSE2( sad, 16, 16 )
+PIXEL_CMP_SSE2( sad, 16,  8 )
+PIXEL_CMP_SSE2( sad,  8, 16 )
+PIXEL_CMP_SSE2( sad,  8,  8 )
+PIXEL_CMP_SSE2( sad,  8,  4 )
+PIXEL_CMP_SSE2( sad,  4, 16 )
+PIXEL_CMP_SSE2( sad,  4,  8 )
+PIXEL_CMP_SSE2( sad,  4,  4 )
+PIXEL_X_SSE2( sad, 16, 16 )
+PIXEL_X_SSE2( sad, 16,  8 )
+PIXEL_X_SSE2( sad,  8, 16 )
+PIXEL_X_SSE2( sad,  8,  8 )
+PIXEL_X_SSE2( sad,  8,  4 )
+PIXEL_X_SSE2( sad,  4,  8 )
+PIXEL_X_SSE2( sad,  4,  4 )
+PIXEL_CMP_SSE2( ssd, 16, 16 )
+PIXEL_CMP_SSE2( ssd, 16,  8 )
+PIXEL_CMP_SSE2( ssd,  8, 16 )
+PIXEL_CMP_SSE2( ssd,  8,  8 )
+PIXEL_CMP_SSE2( ssd,  8,  4 )
+PIXEL_CMP_SSE2( ssd,  4, 16 )
+PIXEL_CMP_SSE2( ssd,  4,  8 )
+PIXEL_CMP_SSE2( ssd,  4,  4 )
+PIXEL_CMP_SSE2( satd, 16, 16 )
+PIXEL_CMP_SSE2( satd, 16,  8 )
+PIXEL_CMP_SSE2( satd,  8, 16 )
+PIXEL_CMP_SSE2( satd,  8,  8 )
+PIXEL_CMP_SSE2( satd,  8,  4 )
+PIXEL_CMP_SSE2( satd,  4, 16 )
+PIXEL_CMP_SSE2( satd,  4,  8 )
+PIXEL_CMP_SSE2( satd,  4,  4 )
+PIXEL_X_SSE2( satd, 16, 16 )
+PIXEL_X_SSE2( satd, 16,  8 )
+PIXEL_X_SSE2( satd,  8, 16 )
+PIXEL_X_SSE2( satd,  8,  8 )
+PIXEL_X_SSE2( satd,  8,  4 )
+PIXEL_X_SSE2( satd,  4,  8 )
+PIXEL_X_SSE2( satd,  4,  4 )
+PIXEL_CMP_SSE2( sa8d, 16, 16 )
+PIXEL_CMP_SSE2( sa8d,  8,  8 )
+
+#define HADAMARD_AC_SSE2( w, h ) \
+static INTRIN_SSE2 uint64_t pixel_hadamard_ac_##w##x##h##_sse2( pixel *pix, intptr_t stride )\
+{\
+    return hadamard_ac_sse2( pix, stride, w, h );\
+}
+HADAMARD_AC_SSE2( 16, 16 )
+HADAMARD_AC_SSE2( 16, 8 )
+HADAMARD_AC_SSE2( 8, 16 )
+HADAMARD_AC_SSE2( 8, 8 )
+
+#define VAR_SSE2( w, h ) \
+static INTRIN_SSE2 uint64_t pixel_var_##w##x##h##_sse2( pixel *pix, intptr_t i_stride )\
+{\
+    return var_sse2( pix, i_stride, w, h );\
+}
+VAR_SSE2( 16, 16 )
+VAR_SSE2( 8, 16 )
+VAR_SSE2( 8, 8 )
+
+static INTRIN_SSE2 int pixel_var2_8x16_sse2( pixel *fenc, pixel *fdec, int ssd[2] )
+{
+    return var2_sse2( fenc, fdec, ssd, 16, 7 );
+}
+
+static INTRIN_SSE2 int pixel_var2_8x8_sse2( pixel *fenc, pixel *fdec, int ssd[2] )
+{
+    return var2_sse2( fenc, fdec, ssd, 8, 6 );
+}
+
+/****************************************************************************
+ * AVX2: 16-wide blocks as one row per register, 8-wide blocks as two rows
+ * per register, one in each 128-bit lane.
+ ****************************************************************************/
+static ALWAYS_INLINE INTRIN_AVX2 int hsum_epi32_avx2( __m256i x )
+{
+    __m128i s = _mm_add_epi32( _mm256_castsi256_si128( x ), _mm256_extracti128_si256( x, 1 ) );
+    s = _mm_add_epi32( s, _mm_shuffle_epi32( s, 0x4E ) );
+    s = _mm_add_epi32( s, _mm_shuffle_epi32( s, 0xB1 ) );
+    return _mm_cvtsi128_si32( s );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 __m256i load_2x16_avx2( pixel *p0, pixel *p1 )
+{
+    return _mm256_inserti128_si256( _mm256_castsi128_si256( LOAD16( p0 ) ), LOAD16( p1 ), 1 );
+}
+
+/* 16 differences widened to words: a 16-wide row, or two 8-wide rows */
+static ALWAYS_INLINE INTRIN_AVX2 __m256i diff_row_avx2( pixel *pix1, intptr_t o1, pixel *pix2, intptr_t o2, int w )
+{
+    __m128i a, b;
+    if( w == 16 )
+    {
+        a = LOAD16( pix1 );
+        b = LOAD16( pix2 );
+    }
+    else
+    {
+        a = _mm_unpacklo_epi64( LOAD8( pix1 ), LOAD8( pix1+o1 ) );
+        b = _mm_unpacklo_epi64( LOAD8( pix2 ), LOAD8( pix2+o2 ) );
+    }
+    return _mm256_sub_epi16( _mm256_cvtepu8_epi16( a ), _mm256_cvtepu8_epi16( b ) );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 int sad_16xh_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int h )
+{
+    __m256i sum = _mm256_setzero_si256();
+    for( int y = 0; y < h; y += 2, pix1 += 2*i_pix1, pix2 += 2*i_pix2 )
+        sum = _mm256_add_epi64( sum, _mm256_sad_epu8( load_2x16_avx2( pix1, pix1+i_pix1 ),
+                                                      load_2x16_avx2( pix2, pix2+i_pix2 ) ) );
+    return hsum_epi32_avx2( sum );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 void sad_xn_16xh_avx2( int n, pixel *fenc, pixel **pix, intptr_t i_stride, int *scores, int h )
+{
+    __m256i sum[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+    for( int y = 0; y < h; y += 2 )
+    {
+        __m256i f = _mm256_loadu_si256( (__m256i*)(fenc + y*FENC_STRIDE) );
+        for( int i = 0; i < n; i++ )
+        {
+            pixel *p = pix[i] + y*i_stride;
+            sum[i] = _mm256_add_epi64( sum[i], _mm256_sad_epu8( f, load_2x16_avx2( p, p+i_stride ) ) );
+        }
+    }
+    for( int i = 0; i < n; i++ )
+        scores[i] = hsum_epi32_avx2( sum[i] );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 int ssd_16xh_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int h )
+{
+    __m256i sum = _mm256_setzero_si256();
+    for( int y = 0; y < h; y++, pix1 += i_pix1, pix2 += i_pix2 )
+    {
+        __m256i d = diff_row_avx2( pix1, 0, pix2, 0, 16 );
+        sum = _mm256_add_epi32( sum, _mm256_madd_epi16( d, d ) );
+    }
+    return hsum_epi32_avx2( sum );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 __m256i hadamard_h1_avx2( __m256i x )
+{
+    const __m256i m = _mm256_set_epi16( -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1 );
+    __m256i s = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( x, 0xB1 ), 0xB1 );
+    return _mm256_add_epi16( s, _mm256_sign_epi16( x, m ) );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 __m256i hadamard_h2_avx2( __m256i x )
+{
+    const __m256i m = _mm256_set_epi16( -1, -1, 1, 1, -1, -1, 1, 1, -1, -1, 1, 1, -1, -1, 1, 1 );
+    __m256i s = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( x, 0x4E ), 0x4E );
+    return _mm256_add_epi16( s, _mm256_sign_epi16( x, m ) );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 __m256i hadamard_h4_avx2( __m256i x )
+{
+    const __m256i m = _mm256_set_epi16( -1, -1, -1, -1, 1, 1, 1, 1, -1, -1, -1, -1, 1, 1, 1, 1 );
+    return _mm256_add_epi16( _mm256_shuffle_epi32( x, 0x4E ), _mm256_sign_epi16( x, m ) );
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 int satd_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2, int w, int h )
+{
+    /* 8-wide blocks carry rows y and y+4 in the two lanes */
+    int step = w == 16 ? 4 : 8;
+    intptr_t o1 = 4*i_pix1, o2 = 4*i_pix2;
+    __m256i sum = _mm256_setzero_si256();
+    for( int y = 0; y < h; y += step, pix1 += step*i_pix1, pix2 += step*i_pix2 )
+    {
+        __m256i d0 = diff_row_avx2( pix1,          o1, pix2,          o2, w );
+        __m256i d1 = diff_row_avx2( pix1+  i_pix1, o1, pix2+  i_pix2, o2, w );
+        __m256i d2 = diff_row_avx2( pix1+2*i_pix1, o1, pix2+2*i_pix2, o2, w );
+        __m256i d3 = diff_row_avx2( pix1+3*i_pix1, o1, pix2+3*i_pix2, o2, w );
+        SUMSUB_AVX2( d0, d1 );
+        SUMSUB_AVX2( d2, d3 );
+        SUMSUB_AVX2( d0, d2 );
+        SUMSUB_AVX2( d1, d3 );
+        d0 = _mm256_abs_epi16( hadamard_h2_avx2( hadamard_h1_avx2( d0 ) ) );
+        d1 = _mm256_abs_epi16( hadamard_h2_avx2( hadamard_h1_avx2( d1 ) ) );
+        d2 = _mm256_abs_epi16( hadamard_h2_avx2( hadamard_h1_avx2( d2 ) ) );
+        d3 = _mm256_abs_epi16( hadamard_h2_avx2( hadamard_h1_avx2( d3 ) ) );
+        d0 = _mm256_add_epi16( _mm256_add_epi16( d0, d1 ), _mm256_add_epi16( d2, d3 ) );
+        sum = _mm256_add_epi32( sum, _mm256_madd_epi16( d0, _mm256_set1_epi16( 1 ) ) );
+    }
+    return hsum_epi32_avx2( sum ) >> 1;
+}
+
+/* Two 8x8 hadamards side by side, see hadamard_8x8_sse2 */
+static ALWAYS_INLINE INTRIN_AVX2 __m256i hadamard_8x8x2_avx2( __m256i d[8], __m256i *sum4 )
+{
+    const __m256i one = _mm256_set1_epi16( 1 );
+    SUMSUB_AVX2( d[0], d[1] ); SUMSUB_AVX2( d[2], d[3] );
+    SUMSUB_AVX2( d[4], d[5] ); SUMSUB_AVX2( d[6], d[7] );
+    SUMSUB_AVX2( d[0], d[2] ); SUMSUB_AVX2( d[1], d[3] );
+    SUMSUB_AVX2( d[4], d[6] ); SUMSUB_AVX2( d[5], d[7] );
+    for( int i = 0; i < 8; i++ )
+        d[i] = hadamard_h2_avx2( hadamard_h1_avx2( d[i] ) );
+    if( sum4 )
+    {
+        __m256i s0 = _mm256_add_epi16( _mm256_add_epi16( _mm256_abs_epi16( d[0] ), _mm256_abs_epi16( d[1] ) ),
+                                       _mm256_add_epi16( _mm256_abs_epi16( d[2] ), _mm256_abs_epi16( d[3] ) ) );
+        __m256i s1 = _mm256_add_epi16( _mm256_add_epi16( _mm256_abs_epi16( d[4] ), _mm256_abs_epi16( d[5] ) ),
+                                       _mm256_add_epi16( _mm256_abs_epi16( d[6] ), _mm256_abs_epi16( d[7] ) ) );
+        *sum4 = _mm256_add_epi32( _mm256_madd_epi16( s0, one ), _mm256_madd_epi16( s1, one ) );
+    }
+    SUMSUB_AVX2( d[0], d[4] ); SUMSUB_AVX2( d[1], d[5] );
+    SUMSUB_AVX2( d[2], d[6] ); SUMSUB_AVX2( d[3], d[7] );
+    __m256i sum = _mm256_setzero_si256();
+    for( int i = 0; i < 8; i += 2 )
+    {
+        d[i]   = hadamard_h4_avx2( d[i] );
+        d[i+1] = hadamard_h4_avx2( d[i+1] );
+        __m256i a = _mm256_add_epi16( _mm256_abs_epi16( d[i] ), _mm256_abs_epi16( d[i+1] ) );
+        sum = _mm256_add_epi32( sum, _mm256_madd_epi16( a, one ) );
+    }
+    return sum;
+}
+
+static INTRIN_AVX2 int pixel_sa8d_16x16_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2 )
+{
+    __m256i sum = _mm256_setzero_si256();
+    for( int y = 0; y < 16; y += 8 )
+    {
+        __m256i d[8];
+        for( int i = 0; i < 8; i++ )
+            d[i] = diff_row_avx2( pix1 + (y+i)*i_pix1, 0, pix2 + (y+i)*i_pix2, 0, 16 );
+        sum = _mm256_add_epi32( sum, hadamard_8x8x2_avx2( d, NULL ) );
+    }
+    return (hsum_epi32_avx2( sum ) + 2) >> 2;
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 uint64_t hadamard_ac_16xh_avx2( pixel *pix, intptr_t stride, int h )
+{
+    __m256i sum4 = _mm256_setzero_si256(), sum8 = sum4;
+    int dc = 0;
+    for( int y = 0; y < h; y += 8 )
+    {
+        __m256i d[8], s4;
+        for( int i = 0; i < 8; i++ )
+            d[i] = _mm256_cvtepu8_epi16( LOAD16( pix + (y+i)*stride ) );
+        sum8 = _mm256_add_epi32( sum8, hadamard_8x8x2_avx2( d, &s4 ) );
+        sum4 = _mm256_add_epi32( sum4, s4 );
+        dc += _mm256_extract_epi16( d[0], 0 ) + _mm256_extract_epi16( d[0], 8 );
+    }
+    uint32_t s4 = hsum_epi32_avx2( sum4 ) - dc;
+    uint32_t s8 = hsum_epi32_avx2( sum8 ) - dc;
+    return ((uint64_t)(s8>>2)<<32) + (s4>>1);
+}
+
+static ALWAYS_INLINE INTRIN_AVX2 uint64_t var_16x16_avx2( pixel *pix, intptr_t i_stride )
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i sum = zero, sqr = zero;
+    for( int y = 0; y < 16; y += 2, pix += 2*i_stride )
+    {
+        __m256i p = load_2x16_avx2( pix, pix+i_stride );
+        __m256i lo = _mm256_unpacklo_epi8( p, zero );
+        __m256i hi = _mm256_unpackhi_epi8( p, zero );
+        sum = _mm256_add_epi64( sum, _mm256_sad_epu8( p, zero ) );
+        sqr = _mm256_add_epi32( sqr, _mm256_add_epi32( _mm256_madd_epi16( lo, lo ), _mm256_madd_epi16( hi, hi ) ) );
+    }
+    return (uint32_t)hsum_epi32_avx2( sum ) + ((uint64_t)(uint32_t)hsum_epi32_avx2( sqr ) << 32);
+}
+
+#define PIXEL_16xH_AVX2( h ) \
+static INTRIN_AVX2 int pixel_sad_16x##h##_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2 )\
+{\
+    return sad_16xh_avx2( pix1, i_pix1, pix2, i_pix2, h );\
+}\
+static INTRIN_AVX2 void pixel_sad_x3_16x##h##_avx2( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                                   intptr_t i_stride, int scores[3] )\
+{\
+    pixel *pix[3] = { pix0, pix1, pix2 };\
+    sad_xn_16xh_avx2( 3, fenc, pix, i_stride, scores, h );\
+}\
+static INTRIN_AVX2 void pixel_sad_x4_16x##h##_avx2( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                                   pixel *pix3, intptr_t i_stride, int scores[4] )\
+{\
+    pixel *pix[4] = { pix0, pix1, pix2, pix3 };\
+    sad_xn_16xh_avx2( 4, fenc, pix, i_stride, scores, h );\
+}\
+static INTRIN_AVX2 int pixel_ssd_16x##h##_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2 )\
+{\
+    return ssd_16xh_avx2( pix1, i_pix1, pix2, i_pix2, h );\
+}\
+static INTRIN_AVX2 uint64_t pixel_hadamard_ac_16x##h##_avx2( pixel *pix, intptr_t stride )\
+{\
+    return hadamard_ac_16xh_avx2( pix, stride, h );\
+}
+PIXEL_16xH_AVX2( 16 )
+PIXEL_16xH_AVX2( 8 )
+
+#define SATD_AVX2( w, h ) \
+static INTRIN_AVX2 int pixel_satd_##w##x##h##_avx2( pixel *pix1, intptr_t i_pix1, pixel *pix2, intptr_t i_pix2 )\
+{\
+    return satd_avx2( pix1, i_pix1, pix2, i_pix2, w, h );\
+}\
+static INTRIN_AVX2 void pixel_satd_x3_##w##x##h##_avx2( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                                       intptr_t i_stride, int scores[3] )\
+{\
+    scores[0] = satd_avx2( fenc, FENC_STRIDE, pix0, i_stride, w, h );\
+    scores[1] = satd_avx2( fenc, FENC_STRIDE, pix1, i_stride, w, h );\
+    scores[2] = satd_avx2( fenc, FENC_STRIDE, pix2, i_stride, w, h );\
+}\
+static INTRIN_AVX2 void pixel_satd_x4_##w##x##h##_avx2( pixel *fenc, pixel *pix0, pixel *pix1, pixel *pix2,\
+                                                       pixel *pix3, intptr_t i_stride, int scores[4] )\
+{\
+    scores[0] = satd_avx2( fenc, FENC_STRIDE, pix0, i_stride, w, h );\
+    scores[1] = satd_avx2( fenc, FENC_STRIDE, pix1, i_stride, w, h );\
+    scores[2] = satd_avx2( fenc, FENC_STRIDE, pix2, i_stride, w, h );\
+    scores[3] = satd_avx2( fenc, FENC_STRIDE, pix3, i_stride, w, h );\
+}
+SATD_AVX2( 16, 16 )
+SATD_AVX2( 16, 8 )
+SATD_AVX2( 8, 16 )
+SATD_AVX2( 8, 8 )
+
+static INTRIN_AVX2 uint64_t pixel_var_16x16_avx2( pixel *pix, intptr_t i_stride )
+{
+    return var_16x16_avx2( pix, i_stride );
+}
+
+/****************************************************************************
+ * x264_pixel_init_intrin:
+ ****************************************************************************/
+void x264_pixel_init_intrin( uint32_t cpu, x264_pixel_function_t *pixf )
+{
+#define INIT2( name, cpu ) \
+    pixf->name[PIXEL_16x16] = pixel_##name##_16x16##cpu;\
+    pixf->name[PIXEL_16x8]  = pixel_##name##_16x8##cpu;
+#define INIT4( name, cpu ) \
+    INIT2( name, cpu ) \
+    pixf->name[PIXEL_8x16]  = pixel_##name##_8x16##cpu;\
+    pixf->name[PIXEL_8x8]   = pixel_##name##_8x8##cpu;
+#define INIT7( name, cpu ) \
+    INIT4( name, cpu ) \
+    pixf->name[PIXEL_8x4]   = pixel_##name##_8x4##cpu;\
+    pixf->name[PIXEL_4x8]   = pixel_##name##_4x8##cpu;\
+    pixf->name[PIXEL_4x4]   = pixel_##name##_4x4##cpu;
+#define INIT8( name, cpu ) \
+    INIT7( name, cpu ) \
+    pixf->name[PIXEL_4x16]  = pixel_##name##_4x16##cpu;
+
+    if( cpu&X264_CPU_SSE2 )
+    {
+        INIT8( sad, _sse2 );
+        INIT7( sad_x3, _sse2 );
+        INIT7( sad_x4, _sse2 );
+        INIT8( ssd, _sse2 );
+        INIT8( satd, _sse2 );
+        INIT7( satd_x3, _sse2 );
+        INIT7( satd_x4, _sse2 );
+        INIT4( hadamard_ac, _sse2 );
+        pixf->sa8d[PIXEL_16x16] = pixel_sa8d_16x16_sse2;
+        pixf->sa8d[PIXEL_8x8]   = pixel_sa8d_8x8_sse2;
+        pixf->var[PIXEL_16x16] = pixel_var_16x16_sse2;
+        pixf->var[PIXEL_8x16]  = pixel_var_8x16_sse2;
+        pixf->var[PIXEL_8x8]   = pixel_var_8x8_sse2;
+        pixf->var2[PIXEL_8x16] = pixel_var2_8x16_sse2;
+        pixf->var2[PIXEL_8x8]  = pixel_var2_8x8_sse2;
+        /* unaligned loads throughout */
+        memcpy( pixf->sad_aligned, pixf->sad, sizeof(pixf->sad_aligned) );
+    }
+
+    if( cpu&X264_CPU_AVX2 )
+    {
+        INIT2( sad, _avx2 );
+        INIT2( sad_x3, _avx2 );
+        INIT2( sad_x4, _avx2 );
+        INIT2( ssd, _avx2 );
+        INIT4( satd, _avx2 );
+        INIT4( satd_x3, _avx2 );
+        INIT4( satd_x4, _avx2 );
+        INIT2( hadamard_ac, _avx2 );
+        pixf->sa8d[PIXEL_16x16] = pixel_sa8d_16x16_avx2;
+        pixf->var[PIXEL_16x16] = pixel_var_16x16_avx2;
+        memcpy( pixf->sad_aligned, pixf->sad, sizeof(pixf->sad_aligned) );
+    }
+}
@@ -40,4 +40,5 @@
 #define HAVE_STRTOK_R 0
 #define HAVE_CLOCK_GETTIME 0
 #define HAVE_BITDEPTH10 0
+#define HAVE_INTRIN 0
 #define __SSE__ 1
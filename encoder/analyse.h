@@ -42,13 +42,15 @@ void x264_slicetype_decide( x264_t *h );
 void x264_slicetype_analyse( x264_t *h, int intra_minigop );
 
 #define x264_lookahead_init x264_template(lookahead_init)
-int  x264_lookahead_init( x264_t *h, int i_slicetype_length );
+int  x264_lookahead_init( x264_t *h, int i_slicetype_length, int i_slicetype_min );
 #define x264_lookahead_is_empty x264_template(lookahead_is_empty)
 int  x264_lookahead_is_empty( x264_t *h );
 #define x264_lookahead_put_frame x264_template(lookahead_put_frame)
 void x264_lookahead_put_frame( x264_t *h, x264_frame_t *frame );
 #define x264_lookahead_get_frames x264_template(lookahead_get_frames)
 void x264_lookahead_get_frames( x264_t *h );
+#define x264_lookahead_delay x264_template(lookahead_delay)
+int  x264_lookahead_delay( x264_t *h );
 #define x264_lookahead_delete x264_template(lookahead_delete)
 void x264_lookahead_delete( x264_t *h );
 
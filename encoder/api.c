@@ -25,12 +25,29 @@
  *****************************************************************************/
 
 #include "common/base.h"
+#include "common/threadpool.h"
 
 /****************************************************************************
  * global symbols
  ****************************************************************************/
 const int x264_chroma_format = X264_CHROMA_FORMAT;
 
+x264_threadpool_t *x264_threadpool_open( int i_threads )
+{
+    x264_threadpool_t *pool = NULL;
+    if( x264_threadpool_init_shared( &pool, i_threads ) < 0 )
+    {
+        x264_threadpool_delete( pool );
+        return NULL;
+    }
+    return pool;
+}
+
+void x264_threadpool_close( x264_threadpool_t *pool )
+{
+    x264_threadpool_delete( pool );
+}
+
 x264_t *x264_8_encoder_open( x264_param_t *, void * );
 void x264_8_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal );
 int  x264_8_encoder_reconfig( x264_t *, x264_param_t * );
@@ -42,6 +59,7 @@ int  x264_8_encoder_delayed_frames( x264_t * );
 int  x264_8_encoder_maximum_delayed_frames( x264_t * );
 void x264_8_encoder_intra_refresh( x264_t * );
 int  x264_8_encoder_invalidate_reference( x264_t *, int64_t pts );
+int  x264_8_encoder_input_layout( x264_t *, x264_image_t * );
 
 x264_t *x264_10_encoder_open( x264_param_t *, void * );
 void x264_10_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal );
@@ -54,6 +72,7 @@ int  x264_10_encoder_delayed_frames( x264_t * );
 int  x264_10_encoder_maximum_delayed_frames( x264_t * );
 void x264_10_encoder_intra_refresh( x264_t * );
 int  x264_10_encoder_invalidate_reference( x264_t *, int64_t pts );
+int  x264_10_encoder_input_layout( x264_t *, x264_image_t * );
 
 typedef struct x264_api_t
 {
@@ -71,6 +90,7 @@ typedef struct x264_api_t
     int  (*encoder_maximum_delayed_frames)( x264_t * );
     void (*encoder_intra_refresh)( x264_t * );
     int  (*encoder_invalidate_reference)( x264_t *, int64_t pts );
+    int  (*encoder_input_layout)( x264_t *, x264_image_t * );
 } x264_api_t;
 
 REALIGN_STACK x264_t *x264_encoder_open( x264_param_t *param )
@@ -79,7 +99,8 @@ REALIGN_STACK x264_t *x264_encoder_open( x264_param_t *param )
     if( !api )
         return NULL;
 
-    if( HAVE_BITDEPTH8 && param->i_bitdepth == 8 )
+#if HAVE_BITDEPTH8
+    if( param->i_bitdepth == 8 )
     {
         api->nal_encode = x264_8_nal_encode;
         api->encoder_reconfig = x264_8_encoder_reconfig;
@@ -91,25 +112,31 @@ REALIGN_STACK x264_t *x264_encoder_open( x264_param_t *param )
         api->encoder_maximum_delayed_frames = x264_8_encoder_maximum_delayed_frames;
         api->encoder_intra_refresh = x264_8_encoder_intra_refresh;
         api->encoder_invalidate_reference = x264_8_encoder_invalidate_reference;
+        api->encoder_input_layout = x264_8_encoder_input_layout;
 
         api->x264 = x264_8_encoder_open( param, api );
     }
-    else if( HAVE_BITDEPTH10 && param->i_bitdepth == 10 )
+    else
+#endif
+#if HAVE_BITDEPTH10
+    if( param->i_bitdepth == 10 )
     {
-        // api->nal_encode = x264_10_nal_encode;
-        // api->encoder_reconfig = x264_10_encoder_reconfig;
-        // api->encoder_parameters = x264_10_encoder_parameters;
-        // api->encoder_headers = x264_10_encoder_headers;
-        // api->encoder_encode = x264_10_encoder_encode;
-        // api->encoder_close = x264_10_encoder_close;
-        // api->encoder_delayed_frames = x264_10_encoder_delayed_frames;
-        // api->encoder_maximum_delayed_frames = x264_10_encoder_maximum_delayed_frames;
-        // api->encoder_intra_refresh = x264_10_encoder_intra_refresh;
-        // api->encoder_invalidate_reference = x264_10_encoder_invalidate_reference;
-
-        // api->x264 = x264_10_encoder_open( param, api );
+        api->nal_encode = x264_10_nal_encode;
+        api->encoder_reconfig = x264_10_encoder_reconfig;
+        api->encoder_parameters = x264_10_encoder_parameters;
+        api->encoder_headers = x264_10_encoder_headers;
+        api->encoder_encode = x264_10_encoder_encode;
+        api->encoder_close = x264_10_encoder_close;
+        api->encoder_delayed_frames = x264_10_encoder_delayed_frames;
+        api->encoder_maximum_delayed_frames = x264_10_encoder_maximum_delayed_frames;
+        api->encoder_intra_refresh = x264_10_encoder_intra_refresh;
+        api->encoder_invalidate_reference = x264_10_encoder_invalidate_reference;
+        api->encoder_input_layout = x264_10_encoder_input_layout;
+
+        api->x264 = x264_10_encoder_open( param, api );
     }
     else
+#endif
         x264_log_internal( X264_LOG_ERROR, "not compiled with %d bit depth support\n", param->i_bitdepth );
 
     if( !api->x264 )
@@ -192,3 +219,10 @@ REALIGN_STACK int x264_encoder_invalidate_reference( x264_t *h, int64_t pts )
 
     return api->encoder_invalidate_reference( api->x264, pts );
 }
+
+REALIGN_STACK int x264_encoder_input_layout( x264_t *h, x264_image_t *img )
+{
+    x264_api_t *api = (x264_api_t *)h;
+
+    return api->encoder_input_layout( api->x264, img );
+}
@@ -71,6 +71,35 @@ static double calc_ssim_db( double ssim )
     return -10.0 * log10( inv_ssim );
 }
 
+static int analysis_export( x264_t *h )
+{
+    x264_frame_analysis_t analysis;
+    analysis.i_pts       = h->fenc->i_pts;
+    analysis.i_type      = h->fenc->i_type;
+    analysis.b_keyframe  = h->fenc->b_keyframe;
+    analysis.i_mb_width  = h->mb.i_mb_width;
+    analysis.i_mb_height = h->mb.i_mb_height;
+    /* as in the mbtree stats file: only reference frames carry propagated offsets */
+    analysis.qp_offsets  = h->param.rc.b_mb_tree && h->fenc->b_kept_as_ref ? h->fenc->f_qp_offset : NULL;
+    if( h->param.analysis_export )
+        h->param.analysis_export( h, &analysis, h->fenc->opaque );
+    if( h->param.psz_analysis_out )
+        return x264_analysis_file_write( h, &analysis, h->fenc->i_frame );
+    return 0;
+}
+
+/* Jobs go to the pool shared through param.threadpool if there is one,
+ * otherwise to private workers.  Wavefront rows wait on each other, so all
+ * of them need a worker at once and they always get private ones, as do the
+ * analysis threads that entropy threads wait on and the rows frame threads
+ * encode ahead of time. */
+static int threadpool_init( x264_t *h, x264_threadpool_t **p_pool, int jobs )
+{
+    if( h->param.threadpool && !(h->param.b_wavefront_threads && p_pool == &h->threadpool) )
+        return x264_threadpool_attach( p_pool, h->param.threadpool, jobs );
+    return x264_threadpool_init( p_pool, jobs );
+}
+
 static int threadpool_wait_all( x264_t *h )
 {
     for( int i = 0; i < h->param.i_threads; i++ )
@@ -83,6 +112,239 @@ static int threadpool_wait_all( x264_t *h )
     return 0;
 }
 
+/* Wavefront threads analyse the mb rows of a frame with each row two mbs behind
+ * the one above it.  Finished mbs go through a ring of records to the calling
+ * thread, which writes them in raster order.  With more than one worker, row n > 0
+ * starts from the cabac contexts and qp of row n-1 after its second mb, so the
+ * contexts used for RD only approximate the ones the writer codes with.
+ * Entropy threads are the same pipeline with a single worker, one per frame thread. */
+struct x264_wavefront_t
+{
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv;
+    int b_abort;
+    int i_workers;
+    x264_t *worker[X264_THREAD_MAX];
+    int *row_done;      /* number of finished mbs in each row */
+    int i_rows_written; /* rows the bitstream writer is done with */
+    int i_ring_rows;
+    int i_mb_size;      /* size of one record in the ring */
+    uint8_t *ring;
+    struct
+    {
+        x264_cabac_t cabac;
+        int i_last_qp;
+        int i_last_dqp;
+        int i_mb_prev_xy;
+    } row_start[2];
+};
+
+/* The parts of x264_t the bitstream writer needs for one mb, followed by either
+ * the source pixels of a PCM mb or the dct coefs of a coded one. */
+#define WAVEFRONT_MB_FIXED_SIZE\
+    (offsetof(x264_t, mb.base) - offsetof(x264_t, mb.i_mb_x)\
+   + offsetof(x264_t, mb.pic) - offsetof(x264_t, mb.i_type)\
+   + offsetof(x264_t, mb.i_last_qp) - offsetof(x264_t, mb.cache))
+
+static void wavefront_mb_copy( x264_t *h, uint8_t *rec, int b_save )
+{
+#define COPY_RANGE( src, size )\
+    {\
+        if( b_save )\
+            memcpy( rec, src, size );\
+        else\
+            memcpy( src, rec, size );\
+        rec += size;\
+    }
+    COPY_RANGE( &h->mb.i_mb_x, offsetof(x264_t, mb.base) - offsetof(x264_t, mb.i_mb_x) );
+    COPY_RANGE( &h->mb.i_type, offsetof(x264_t, mb.pic) - offsetof(x264_t, mb.i_type) );
+    COPY_RANGE( &h->mb.cache, offsetof(x264_t, mb.i_last_qp) - offsetof(x264_t, mb.cache) );
+    if( h->mb.i_type == I_PCM )
+        COPY_RANGE( h->mb.pic.fenc_buf, sizeof(h->mb.pic.fenc_buf) )
+    else if( !IS_SKIP( h->mb.i_type ) )
+        COPY_RANGE( &h->dct, sizeof(h->dct) )
+#undef COPY_RANGE
+}
+
+static int wavefront_init( x264_t *h, int workers )
+{
+    x264_wavefront_t *wf;
+    int width = h->sps->i_mb_width;
+    int height = h->sps->i_mb_height;
+    CHECKED_MALLOCZERO( wf, sizeof(x264_wavefront_t) );
+    h->wavefront = wf;
+    if( x264_pthread_mutex_init( &wf->mutex, NULL ) )
+        goto fail;
+    if( x264_pthread_cond_init( &wf->cv, NULL ) )
+        goto fail;
+    wf->i_workers = workers;
+    /* One row in flight per worker, plus slack so that they don't wait on the writer. */
+    wf->i_ring_rows = X264_MIN( workers + 2, height );
+    wf->i_mb_size = ALIGN( WAVEFRONT_MB_FIXED_SIZE + X264_MAX( sizeof(h->dct), sizeof(h->mb.pic.fenc_buf) ), 16 );
+    CHECKED_MALLOC( wf->row_done, height * sizeof(int) );
+    CHECKED_MALLOC( wf->ring, (size_t)wf->i_ring_rows * width * wf->i_mb_size );
+    return 0;
+fail:
+    return -1;
+}
+
+static void wavefront_delete( x264_t *h )
+{
+    x264_wavefront_t *wf = h->wavefront;
+    if( !wf )
+        return;
+    /* The analysis context of an entropy thread belongs to its writer. */
+    if( h->param.b_entropy_threads && wf->worker[0] )
+    {
+        x264_t *t = wf->worker[0];
+        x264_macroblock_thread_free( t, 0 );
+        x264_free( t->out.p_bitstream );
+        x264_free( t );
+    }
+    x264_pthread_mutex_destroy( &wf->mutex );
+    x264_pthread_cond_destroy( &wf->cv );
+    x264_free( wf->row_done );
+    x264_free( wf->ring );
+    x264_free( wf );
+    h->wavefront = NULL;
+}
+
+/* Give frame thread h a context of its own to analyse mbs in, sharing its frame
+ * buffers, while h writes the bitstream. */
+static int entropy_thread_init( x264_t *h )
+{
+    x264_t *t;
+    if( wavefront_init( h, 1 ) < 0 )
+        return -1;
+    CHECKED_MALLOC( t, sizeof(x264_t) );
+    *t = *h;
+    h->wavefront->worker[0] = t;
+    t->wavefront_writer = h;
+    t->out.nal = NULL;
+    t->scratch_buffer = t->scratch_buffer2 = NULL;
+    CHECKED_MALLOC( t->out.p_bitstream, h->out.i_bitstream );
+    return 0;
+fail:
+    return -1;
+}
+
+/* Speculative rows: when ratecontrol expects the row a frame thread starts to be
+ * re-encoded for the VBV, contexts of the frame thread encode it at the qps it may
+ * be re-encoded at, while the frame thread encodes it at the planned one.  If
+ * ratecontrol does reject the row, the first of them at or above the qp it asks
+ * for takes its place instead of a re-encode.  Each context has mb tables and a
+ * view of the frame being encoded with mb data and reconstruction of its own; the
+ * row above goes to them by copy at the start of a row, and the row they encoded
+ * comes back the same way. */
+typedef struct
+{
+    x264_t *ctx;
+    x264_speculate_t *spec;
+    x264_frame_t own;   /* mb data and planes of fdec */
+    x264_frame_t fdec;  /* the frame thread's fdec, with the buffers of own */
+    x264_frame_t fenc;  /* the frame thread's fenc, so that weighting doesn't advance its lines */
+    uint8_t *base;
+    int i_mb_y;
+    float f_qp;
+    int b_done;
+    int i_bits;
+    int i_qp_sum;
+} x264_speculate_row_t;
+
+struct x264_speculate_t
+{
+    int b_abort;
+    int i_rows;         /* contexts started on the current row */
+    x264_speculate_row_t row[X264_SPECULATE_MAX];
+};
+
+static int speculate_init( x264_t *h )
+{
+    x264_speculate_t *spec;
+    int i_mb_count = h->mb.i_mb_count;
+    CHECKED_MALLOCZERO( spec, sizeof(x264_speculate_t) );
+    h->speculate = spec;
+    for( int i = 0; i < h->param.rc.i_vbv_speculate; i++ )
+    {
+        x264_speculate_row_t *row = &spec->row[i];
+        x264_frame_t *own = &row->own;
+        x264_t *t;
+        CHECKED_MALLOC( t, sizeof(x264_t) );
+        *t = *h;
+        row->ctx = t;
+        row->spec = spec;
+        t->speculate = NULL;
+        t->out.nal = NULL;
+        CHECKED_MALLOC( t->out.p_bitstream, h->out.i_bitstream );
+        if( x264_ratecontrol_row_context_new( t ) < 0 ||
+            x264_macroblock_cache_allocate( t ) < 0 ||
+            x264_macroblock_thread_allocate( t, 0 ) < 0 )
+            goto fail;
+
+        *own = *h->fdec;
+        PREALLOC_INIT
+        PREALLOC( own->mb_type, i_mb_count * sizeof(int8_t) );
+        PREALLOC( own->mb_partition, i_mb_count * sizeof(uint8_t) );
+        PREALLOC( own->mv[0], 2*16 * i_mb_count * sizeof(int16_t) );
+        PREALLOC( own->mv16x16, 2*(i_mb_count+1) * sizeof(int16_t) );
+        PREALLOC( own->ref[0], 4 * i_mb_count * sizeof(int8_t) );
+        if( h->param.i_bframe )
+        {
+            PREALLOC( own->mv[1], 2*16 * i_mb_count * sizeof(int16_t) );
+            PREALLOC( own->ref[1], 4 * i_mb_count * sizeof(int8_t) );
+        }
+        if( h->fdec->field )
+            PREALLOC( own->field, i_mb_count * sizeof(uint8_t) );
+        if( h->fdec->effective_qp )
+            PREALLOC( own->effective_qp, i_mb_count * sizeof(uint8_t) );
+        for( int p = 0; p < own->i_plane; p++ )
+            PREALLOC( own->plane[p], (int64_t)own->i_stride[p] * own->i_lines[p] * SIZEOF_PIXEL );
+        PREALLOC_END( row->base );
+        own->mv16x16++;
+    }
+    return 0;
+fail:
+    return -1;
+}
+
+static void speculate_delete( x264_t *h )
+{
+    x264_speculate_t *spec = h->speculate;
+    if( !spec )
+        return;
+    for( int i = 0; i < X264_SPECULATE_MAX; i++ )
+    {
+        x264_t *t = spec->row[i].ctx;
+        if( !t )
+            continue;
+        x264_macroblock_thread_free( t, 0 );
+        x264_macroblock_cache_free( t );
+        x264_free( t->rc );
+        x264_free( t->out.p_bitstream );
+        x264_free( t );
+        x264_free( spec->row[i].base );
+    }
+    x264_free( spec );
+    h->speculate = NULL;
+}
+
+static uint8_t *wavefront_record( x264_t *h, int mb_x, int mb_y )
+{
+    x264_wavefront_t *wf = h->wavefront;
+    return wf->ring + ((size_t)(mb_y % wf->i_ring_rows) * h->mb.i_mb_width + mb_x) * wf->i_mb_size;
+}
+
+/* Wait until row mb_y has at least mbs finished mbs, or until the frame is aborted. */
+static int wavefront_wait_row( x264_wavefront_t *wf, int mb_y, int mbs )
+{
+    x264_pthread_mutex_lock( &wf->mutex );
+    while( wf->row_done[mb_y] < mbs && !wf->b_abort )
+        x264_pthread_cond_wait( &wf->cv, &wf->mutex );
+    int ret = wf->b_abort ? -1 : wf->row_done[mb_y];
+    x264_pthread_mutex_unlock( &wf->mutex );
+    return ret;
+}
+
 static void frame_dump( x264_t *h )
 {
     FILE *f = x264_fopen( h->param.psz_dump_yuv, "r+b" );
@@ -556,9 +818,31 @@ static int validate_parameters( x264_t *h, int b_open )
         h->param.vui.i_sar_height = 0;
     }
 
+#if !HAVE_THREAD
+    h->param.b_entropy_threads = 0;
+#endif
+    /* The wavefront writer already runs apart from the analysis. */
+    if( h->param.b_wavefront_threads )
+        h->param.b_entropy_threads = 0;
+    if( h->param.b_wavefront_threads || h->param.b_entropy_threads )
+    {
+        if( !h->param.b_cabac || PARAM_INTERLACED || h->param.rc.i_vbv_buffer_size || h->param.i_avcintra_class ||
+            h->param.i_slice_count > 1 || h->param.i_slice_max_mbs || h->param.i_slice_max_size )
+        {
+            x264_log( h, X264_LOG_WARNING, "%s threads require CABAC, progressive, a single slice and no VBV\n",
+                      h->param.b_wavefront_threads ? "wavefront" : "entropy" );
+            h->param.b_wavefront_threads = 0;
+            h->param.b_entropy_threads = 0;
+        }
+        else
+            h->param.b_sliced_threads = 0;
+    }
     if( h->param.i_threads == X264_THREADS_AUTO )
     {
-        h->param.i_threads = x264_cpu_num_processors() * (h->param.b_sliced_threads?2:3)/2;
+        h->param.i_threads = x264_cpu_num_processors() * (h->param.b_sliced_threads || h->param.b_wavefront_threads ? 2 : 3)/2;
+        /* Each frame thread brings its analysis thread along. */
+        if( h->param.b_entropy_threads )
+            h->param.i_threads = X264_MAX( h->param.i_threads / 2, 1 );
         /* Avoid too many threads as they don't improve performance and
          * complicate VBV. Capped at an arbitrary 2 rows per thread. */
         int max_threads = X264_MAX( 1, (h->param.i_height+15)/16 / 2 );
@@ -580,9 +864,10 @@ static int validate_parameters( x264_t *h, int b_open )
     if( h->param.i_threads == 1 )
     {
         h->param.b_sliced_threads = 0;
+        h->param.b_wavefront_threads = 0;
         h->param.i_lookahead_threads = 1;
     }
-    h->i_thread_frames = h->param.b_sliced_threads ? 1 : h->param.i_threads;
+    h->i_thread_frames = h->param.b_sliced_threads || h->param.b_wavefront_threads ? 1 : h->param.i_threads;
     if( h->i_thread_frames > 1 )
         h->param.nalu_process = NULL;
 
@@ -1042,6 +1327,19 @@ static int validate_parameters( x264_t *h, int b_open )
     if( h->param.i_slice_count_max > 0 )
         h->param.i_slice_count_max = X264_MAX( h->param.i_slice_count, h->param.i_slice_count_max );
 
+    h->param.rc.i_vbv_speculate = x264_clip3( h->param.rc.i_vbv_speculate, 0, X264_SPECULATE_MAX );
+#if !HAVE_THREAD
+    h->param.rc.i_vbv_speculate = 0;
+#endif
+    if( h->param.rc.i_vbv_speculate &&
+        (!h->param.rc.i_vbv_buffer_size || !h->param.b_cabac || PARAM_INTERLACED || h->param.b_sliced_threads ||
+         h->param.b_wavefront_threads || h->param.b_entropy_threads || h->param.i_slice_count > 1 ||
+         h->param.i_slice_max_mbs || h->param.i_slice_max_size) )
+    {
+        x264_log( h, X264_LOG_WARNING, "vbv-speculate requires VBV, CABAC, progressive, one slice and no sliced threads\n" );
+        h->param.rc.i_vbv_speculate = 0;
+    }
+
     if( h->param.b_bluray_compat )
     {
         h->param.i_bframe_pyramid = X264_MIN( X264_B_PYRAMID_STRICT, h->param.i_bframe_pyramid );
@@ -1133,6 +1431,31 @@ static int validate_parameters( x264_t *h, int b_open )
     }
     if( b_open && h->param.rc.b_stat_read )
         h->param.rc.i_lookahead = 0;
+    if( h->param.psz_analysis_in )
+        h->param.b_analysis_import = 1;
+    if( h->param.b_analysis_import && (h->param.rc.b_stat_read || h->param.rc.b_stat_write) )
+    {
+        x264_log( h, X264_LOG_WARNING, "analysis import is not compatible with multipass\n" );
+        h->param.b_analysis_import = 0;
+    }
+    if( h->param.b_analysis_import )
+    {
+        /* frame types come from the exporting encoder */
+        h->param.i_bframe_adaptive = X264_B_ADAPT_NONE;
+        h->param.i_scenecut_threshold = 0;
+    }
+    if( h->param.rc.b_lookahead_pass && (!h->param.rc.b_stat_write || h->param.rc.b_stat_read) )
+    {
+        x264_log( h, X264_LOG_WARNING, "lookahead-pass is only for the first pass\n" );
+        h->param.rc.b_lookahead_pass = 0;
+    }
+    if( h->param.rc.b_lookahead_pass )
+    {
+        /* No slices are written: the AUD makes sure every frame still has a NAL. */
+        h->param.b_aud = 1;
+        h->param.analyse.b_psnr = 0;
+        h->param.analyse.b_ssim = 0;
+    }
 #if HAVE_THREAD
     if( h->param.i_sync_lookahead < 0 )
         h->param.i_sync_lookahead = h->param.i_bframe + 1;
@@ -1272,7 +1595,7 @@ static int validate_parameters( x264_t *h, int b_open )
 
     if( h->param.i_lookahead_threads == X264_THREADS_AUTO )
     {
-        if( h->param.b_sliced_threads )
+        if( h->param.b_sliced_threads || h->param.b_wavefront_threads )
             h->param.i_lookahead_threads = h->param.i_threads;
         else
         {
@@ -1291,13 +1614,12 @@ static int validate_parameters( x264_t *h, int b_open )
              {{3,2,1,1}, {2,1,1,1}, {4,3,2,1}, {6,4,3,2}, {12, 9, 6, 4}}};
 
             h->param.i_lookahead_threads = h->param.i_threads / lookahead_thread_div[badapt][subme][bframes];
-            /* Since too many lookahead threads significantly degrades lookahead accuracy, limit auto
-             * lookahead threads to about 8 macroblock rows high each at worst.  This number is chosen
-             * pretty much arbitrarily. */
-            h->param.i_lookahead_threads = X264_MIN( h->param.i_lookahead_threads, h->param.i_height / 128 );
         }
     }
-    h->param.i_lookahead_threads = x264_clip3( h->param.i_lookahead_threads, 1, X264_MIN( max_sliced_threads, X264_LOOKAHEAD_THREAD_MAX ) );
+    /* Lookahead threads work on the rows of a frame as a wavefront, so they don't affect its results,
+     * but each row trails the one below it and there's little to gain from fewer than 2 rows per thread. */
+    int max_lookahead_threads = X264_MAX( 1, (h->param.i_height+15)/16 / 2 );
+    h->param.i_lookahead_threads = x264_clip3( h->param.i_lookahead_threads, 1, X264_MIN( max_lookahead_threads, X264_LOOKAHEAD_THREAD_MAX ) );
 
     if( PARAM_INTERLACED )
     {
@@ -1365,6 +1687,8 @@ static int validate_parameters( x264_t *h, int b_open )
 
     if( h->param.i_nal_hrd == X264_NAL_HRD_CBR )
         h->param.rc.b_filler = 1;
+    if( h->param.rc.b_lookahead_pass )
+        h->param.rc.b_filler = 0;
 
     /* ensure the booleans are 0 or 1 so they can be used in math */
 #define BOOLIFY(x) h->param.x = !!h->param.x
@@ -1373,6 +1697,7 @@ static int validate_parameters( x264_t *h, int b_open )
     BOOLIFY( b_deblocking_filter );
     BOOLIFY( b_deterministic );
     BOOLIFY( b_sliced_threads );
+    BOOLIFY( b_wavefront_threads );
     BOOLIFY( b_interlaced );
     BOOLIFY( b_intra_refresh );
     BOOLIFY( b_aud );
@@ -1399,10 +1724,54 @@ static int validate_parameters( x264_t *h, int b_open )
     BOOLIFY( analyse.b_ssim );
     BOOLIFY( rc.b_stat_write );
     BOOLIFY( rc.b_stat_read );
+    BOOLIFY( rc.b_lookahead_pass );
+    BOOLIFY( b_analysis_import );
+    BOOLIFY( b_zero_copy_input );
     BOOLIFY( rc.b_mb_tree );
+    BOOLIFY( rc.b_mb_tree_incremental );
     BOOLIFY( rc.b_filler );
+    BOOLIFY( b_scenecut_prepass );
 #undef BOOLIFY
 
+    if( !h->param.rc.b_mb_tree || !h->param.rc.i_lookahead || h->param.b_analysis_import )
+        h->param.rc.b_mb_tree_incremental = 0;
+
+    /* the coarser levels are only for the lookahead's own frametype decisions */
+    if( h->param.i_lookahead_levels < 0 || h->param.i_lookahead_levels > 2 )
+    {
+        int levels = x264_clip3( h->param.i_lookahead_levels, 0, 2 );
+        x264_log( h, X264_LOG_WARNING, "lookahead-levels %d is out of range 0..2, using %d\n", h->param.i_lookahead_levels, levels );
+        h->param.i_lookahead_levels = levels;
+    }
+    if( h->param.rc.b_stat_read || h->param.b_opencl || (!h->param.i_bframe_adaptive && !h->param.i_scenecut_threshold) )
+        h->param.i_lookahead_levels = 0;
+    /* Below a couple thousand mbs the coarse decisions lose more than the speed is worth:
+     * eighth resolution is for 2160p and up, quarter for 1080p. */
+#define LOOKAHEAD_LEVEL_MIN_MBS 1920
+    int levels = h->param.i_lookahead_levels;
+    while( levels && (((h->param.i_width+15)/16 + (1<<levels) - 1) >> levels) *
+                     (((h->param.i_height+15)/16 + (1<<levels) - 1) >> levels) < LOOKAHEAD_LEVEL_MIN_MBS )
+        levels--;
+    if( levels < h->param.i_lookahead_levels )
+    {
+        x264_log( h, X264_LOG_WARNING, "lookahead-levels %d is too coarse for %dx%d, using %d\n",
+                  h->param.i_lookahead_levels, h->param.i_width, h->param.i_height, levels );
+        h->param.i_lookahead_levels = levels;
+    }
+
+    if( !h->param.i_scenecut_threshold || h->param.rc.b_stat_read )
+        h->param.b_scenecut_prepass = 0;
+
+    /* the window is adapted from how long decided frames wait for the encoder on the lookahead thread */
+    h->param.rc.i_lookahead_min = x264_clip3( h->param.rc.i_lookahead_min, 0, h->param.rc.i_lookahead );
+    if( h->param.rc.i_lookahead_min == h->param.rc.i_lookahead || !(h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size) )
+        h->param.rc.i_lookahead_min = 0;
+    if( h->param.rc.i_lookahead_min && !h->param.i_sync_lookahead )
+    {
+        x264_log( h, X264_LOG_WARNING, "rc-lookahead-min requires threaded lookahead (sync-lookahead and frame threads)\n" );
+        h->param.rc.i_lookahead_min = 0;
+    }
+
     return 0;
 }
 
@@ -1501,6 +1870,67 @@ static void set_aspect_ratio( x264_t *h, x264_param_t *param, int initial )
     }
 }
 
+/* The lookahead makes its frametype decisions on the coarsest level of the lowres pyramid with a copy of
+ * the encoder whose mb dimensions are those of that level, so slicetype.c can cost its frames as is.
+ * It has lookahead threads of its own for the same reason. */
+static int lookahead_coarse_init( x264_t *h )
+{
+    int level = h->param.i_lookahead_levels;
+    x264_t *c;
+    CHECKED_MALLOCZERO( h->lookahead_coarse, sizeof(x264_t) );
+    c = h->lookahead_coarse;
+    *c = *h;
+    c->lookahead_coarse = NULL;
+    c->lookaheadpool = NULL;
+    c->mb.i_mb_width = (h->mb.i_mb_width + (1<<level) - 1) >> level;
+    c->mb.i_mb_height = (h->mb.i_mb_height + (1<<level) - 1) >> level;
+    c->mb.i_mb_count = c->mb.i_mb_width * c->mb.i_mb_height;
+    c->mb.i_mb_stride = c->mb.i_mb_width;
+    /* none of these take part in the decisions */
+    c->param.rc.b_mb_tree = 0;
+    c->param.rc.i_vbv_buffer_size = 0;
+    c->param.rc.i_aq_mode = 0;
+    c->param.analyse.i_weighted_pred = 0;
+    if( x264_macroblock_thread_allocate( c, 1 ) < 0 )
+        goto fail;
+
+    if( h->lookaheadpool )
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            CHECKED_MALLOC( c->lookahead_thread[i], sizeof(x264_t) );
+            *c->lookahead_thread[i] = *c;
+            if( x264_macroblock_thread_allocate( c->lookahead_thread[i], 1 ) < 0 )
+                goto fail;
+        }
+    c->lookaheadpool = h->lookaheadpool;
+
+    if( level > 1 )
+    {
+        h->frames.pyramid = x264_frame_new_level( h, 1 );
+        if( !h->frames.pyramid )
+            goto fail;
+    }
+    return 0;
+fail:
+    return -1;
+}
+
+static void lookahead_coarse_delete( x264_t *h )
+{
+    x264_t *c = h->lookahead_coarse;
+    if( c->lookaheadpool )
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+            if( c->lookahead_thread[i] )
+            {
+                x264_macroblock_thread_free( c->lookahead_thread[i], 1 );
+                x264_free( c->lookahead_thread[i] );
+            }
+    x264_macroblock_thread_free( c, 1 );
+    x264_free( c );
+    if( h->frames.pyramid )
+        x264_frame_delete( h->frames.pyramid );
+}
+
 /****************************************************************************
  * x264_encoder_open:
  ****************************************************************************/
@@ -1508,7 +1938,7 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
 {
     x264_t *h;
     char buf[1000], *p;
-    int i_slicetype_length;
+    int i_slicetype_length, i_slicetype_min;
 
     CHECKED_MALLOCZERO( h, sizeof(x264_t) );
 
@@ -1525,6 +1955,10 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
         CHECKED_PARAM_STRDUP( h->param.rc.psz_stat_out, &h->param, h->param.rc.psz_stat_out );
     if( h->param.rc.psz_stat_in )
         CHECKED_PARAM_STRDUP( h->param.rc.psz_stat_in, &h->param, h->param.rc.psz_stat_in );
+    if( h->param.psz_analysis_out )
+        CHECKED_PARAM_STRDUP( h->param.psz_analysis_out, &h->param, h->param.psz_analysis_out );
+    if( h->param.psz_analysis_in )
+        CHECKED_PARAM_STRDUP( h->param.psz_analysis_in, &h->param, h->param.psz_analysis_in );
     if( h->param.rc.psz_zones )
         CHECKED_PARAM_STRDUP( h->param.rc.psz_zones, &h->param, h->param.rc.psz_zones );
     if( h->param.psz_clbin_file )
@@ -1604,9 +2038,16 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
         h->frames.i_delay = X264_MAX(h->param.i_bframe,3)*4;
     else
         h->frames.i_delay = h->param.i_bframe;
+    i_slicetype_min = h->frames.i_delay;
     if( h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size )
+    {
         h->frames.i_delay = X264_MAX( h->frames.i_delay, h->param.rc.i_lookahead );
+        if( h->param.rc.i_lookahead_min )
+            i_slicetype_min = X264_MAX( i_slicetype_min, h->param.rc.i_lookahead_min );
+    }
     i_slicetype_length = h->frames.i_delay;
+    if( !h->param.rc.i_lookahead_min )
+        i_slicetype_min = i_slicetype_length;
     h->frames.i_delay += h->i_thread_frames - 1;
     h->frames.i_delay += h->param.i_sync_lookahead;
     h->frames.i_delay += h->param.b_vfr_input;
@@ -1621,6 +2062,7 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
           || h->param.i_bframe_adaptive
           || h->param.i_scenecut_threshold
           || h->param.rc.b_mb_tree
+          || h->param.rc.b_lookahead_pass
           || h->param.analyse.i_weighted_pred );
     h->frames.b_have_lowres |= h->param.rc.b_stat_read && h->param.rc.i_vbv_buffer_size > 0;
     h->frames.b_have_sub8x8_esa = !!(h->param.analyse.inter & X264_ANALYSE_PSUB8x8);
@@ -1735,10 +2177,18 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
     CHECKED_MALLOC( h->reconfig_h, sizeof(x264_t) );
 
     if( h->param.i_threads > 1 &&
-        x264_threadpool_init( &h->threadpool, h->param.i_threads ) )
+        threadpool_init( h, &h->threadpool, h->param.i_threads ) )
         goto fail;
     if( h->param.i_lookahead_threads > 1 &&
-        x264_threadpool_init( &h->lookaheadpool, h->param.i_lookahead_threads ) )
+        threadpool_init( h, &h->lookaheadpool, h->param.i_lookahead_threads ) )
+        goto fail;
+    if( h->param.b_entropy_threads &&
+        x264_threadpool_init( &h->analysispool, h->i_thread_frames ) )
+        goto fail;
+    if( h->param.b_wavefront_threads && wavefront_init( h, h->param.i_threads - 1 ) < 0 )
+        goto fail;
+    if( h->param.rc.i_vbv_speculate &&
+        x264_threadpool_init( &h->speculatepool, h->i_thread_frames * h->param.rc.i_vbv_speculate ) )
         goto fail;
 
 #if HAVE_OPENCL
@@ -1762,14 +2212,23 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
             CHECKED_MALLOC( h->lookahead_thread[i], sizeof(x264_t) );
             *h->lookahead_thread[i] = *h;
         }
+    if( h->param.i_lookahead_levels && lookahead_coarse_init( h ) < 0 )
+        goto fail;
     *h->reconfig_h = *h;
 
     for( int i = 0; i < h->param.i_threads; i++ )
     {
         int init_nal_count = h->param.i_slice_count + 3;
-        int allocate_threadlocal_data = !h->param.b_sliced_threads || !i;
+        int allocate_threadlocal_data = !(h->param.b_sliced_threads || h->param.b_wavefront_threads) || !i;
         if( i > 0 )
+        {
             *h->thread[i] = *h;
+            if( h->param.b_wavefront_threads )
+            {
+                h->thread[i]->wavefront_writer = h;
+                h->wavefront->worker[i-1] = h->thread[i];
+            }
+        }
 
         if( x264_pthread_mutex_init( &h->thread[i]->mutex, NULL ) )
             goto fail;
@@ -1792,6 +2251,8 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
 
         if( allocate_threadlocal_data && x264_macroblock_cache_allocate( h->thread[i] ) < 0 )
             goto fail;
+        if( h->param.b_entropy_threads && entropy_thread_init( h->thread[i] ) < 0 )
+            goto fail;
     }
 
 #if HAVE_OPENCL
@@ -1799,15 +2260,46 @@ x264_t *x264_encoder_open( x264_param_t *param, void *api )
         h->param.b_opencl = 0;
 #endif
 
-    if( x264_lookahead_init( h, i_slicetype_length ) )
+    if( x264_lookahead_init( h, i_slicetype_length, i_slicetype_min ) )
         goto fail;
 
     for( int i = 0; i < h->param.i_threads; i++ )
+    {
         if( x264_macroblock_thread_allocate( h->thread[i], 0 ) < 0 )
             goto fail;
+        if( h->param.b_entropy_threads && x264_macroblock_thread_allocate( h->thread[i]->wavefront->worker[0], 0 ) < 0 )
+            goto fail;
+        if( h->param.rc.i_vbv_speculate && speculate_init( h->thread[i] ) < 0 )
+            goto fail;
+    }
+
+    /* The b-adapt trellis has each lookahead thread cost whole frames on its own,
+     * mb-tree has each one propagate a band of rows. */
+    if( h->param.i_lookahead_threads > 1 && (h->param.i_bframe_adaptive == X264_B_ADAPT_TRELLIS || h->param.rc.b_mb_tree) )
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            x264_t *t = h->lookahead_thread[i];
+            t->lookaheadpool = NULL;
+            /* copied before x264_macroblock_cache_allocate set it */
+            t->mb.i_mb_stride = h->mb.i_mb_stride;
+            if( x264_macroblock_thread_allocate( t, 1 ) < 0 )
+                goto fail;
+        }
+    /* The trellis paths and weights_lowres_threads run weights_analyse on the lookahead threads,
+     * which motion compensates the reference into this buffer once the lowres mvs are searched. */
+    if( h->param.i_lookahead_threads > 1 && h->param.analyse.i_weighted_pred )
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            int i_padv = PADV << PARAM_INTERLACED;
+            CHECKED_MALLOC( h->lookahead_thread[i]->mb.p_weight_buf[0], h->fdec->i_stride_lowres * (h->mb.i_mb_height*8+2*i_padv) * SIZEOF_PIXEL );
+        }
 
     if( x264_ratecontrol_new( h ) < 0 )
         goto fail;
+    /* The analysis thread of an entropy thread reads the qps its writer plans. */
+    if( h->param.b_entropy_threads )
+        for( int i = 0; i < h->param.i_threads; i++ )
+            h->thread[i]->wavefront->worker[0]->rc = h->thread[i]->rc;
 
     if( h->param.i_nal_hrd )
     {
@@ -2749,6 +3241,313 @@ static ALWAYS_INLINE void bitstream_restore( x264_t *h, x264_bs_bak_t *bak, int
     }
 }
 
+/* accumulate mb stats */
+static void mb_stats_accumulate( x264_t *h )
+{
+    h->stat.frame.i_mb_count[h->mb.i_type]++;
+
+    int b_intra = IS_INTRA( h->mb.i_type );
+    int b_skip = IS_SKIP( h->mb.i_type );
+    if( h->param.i_log_level >= X264_LOG_INFO || h->param.rc.b_stat_write )
+    {
+        if( !b_intra && !b_skip && !IS_DIRECT( h->mb.i_type ) )
+        {
+            if( h->mb.i_partition != D_8x8 )
+                    h->stat.frame.i_mb_partition[h->mb.i_partition] += 4;
+                else
+                    for( int i = 0; i < 4; i++ )
+                        h->stat.frame.i_mb_partition[h->mb.i_sub_partition[i]] ++;
+            if( h->param.i_frame_reference > 1 )
+                for( int i_list = 0; i_list <= (h->sh.i_type == SLICE_TYPE_B); i_list++ )
+                    for( int i = 0; i < 4; i++ )
+                    {
+                        int i_ref = h->mb.cache.ref[i_list][ x264_scan8[4*i] ];
+                        if( i_ref >= 0 )
+                            h->stat.frame.i_mb_count_ref[i_list][i_ref] ++;
+                    }
+        }
+    }
+
+    if( h->param.i_log_level >= X264_LOG_INFO )
+    {
+        if( h->mb.i_cbp_luma | h->mb.i_cbp_chroma )
+        {
+            if( CHROMA444 )
+            {
+                for( int i = 0; i < 4; i++ )
+                    if( h->mb.i_cbp_luma & (1 << i) )
+                        for( int p = 0; p < 3; p++ )
+                        {
+                            int s8 = i*4+p*16;
+                            int nnz8x8 = M16( &h->mb.cache.non_zero_count[x264_scan8[s8]+0] )
+                                       | M16( &h->mb.cache.non_zero_count[x264_scan8[s8]+8] );
+                            h->stat.frame.i_mb_cbp[!b_intra + p*2] += !!nnz8x8;
+                        }
+            }
+            else
+            {
+                int cbpsum = (h->mb.i_cbp_luma&1) + ((h->mb.i_cbp_luma>>1)&1)
+                           + ((h->mb.i_cbp_luma>>2)&1) + (h->mb.i_cbp_luma>>3);
+                h->stat.frame.i_mb_cbp[!b_intra + 0] += cbpsum;
+                h->stat.frame.i_mb_cbp[!b_intra + 2] += !!h->mb.i_cbp_chroma;
+                h->stat.frame.i_mb_cbp[!b_intra + 4] += h->mb.i_cbp_chroma >> 1;
+            }
+        }
+        if( h->mb.i_cbp_luma && !b_intra )
+        {
+            h->stat.frame.i_mb_count_8x8dct[0] ++;
+            h->stat.frame.i_mb_count_8x8dct[1] += h->mb.b_transform_8x8;
+        }
+        if( b_intra && h->mb.i_type != I_PCM )
+        {
+            if( h->mb.i_type == I_16x16 )
+                h->stat.frame.i_mb_pred_mode[0][h->mb.i_intra16x16_pred_mode]++;
+            else if( h->mb.i_type == I_8x8 )
+                for( int i = 0; i < 16; i += 4 )
+                    h->stat.frame.i_mb_pred_mode[1][h->mb.cache.intra4x4_pred_mode[x264_scan8[i]]]++;
+            else //if( h->mb.i_type == I_4x4 )
+                for( int i = 0; i < 16; i++ )
+                    h->stat.frame.i_mb_pred_mode[2][h->mb.cache.intra4x4_pred_mode[x264_scan8[i]]]++;
+            h->stat.frame.i_mb_pred_mode[3][x264_mb_chroma_pred_mode_fix[h->mb.i_chroma_pred_mode]]++;
+        }
+        h->stat.frame.i_mb_field[b_intra?0:b_skip?2:1] += MB_INTERLACED;
+    }
+}
+
+/* Copy the mb data of row mb_y, as x264_macroblock_cache_save leaves it, from src to dst. */
+static void speculate_copy_row( x264_t *dst, x264_t *src, int mb_y )
+{
+    int width = src->mb.i_mb_width;
+    int xy = mb_y * src->mb.i_mb_stride;
+#define COPY_ROW( var, n )\
+    if( src->var )\
+        memcpy( dst->var + (n)*xy, src->var + (n)*xy, (n)*width * sizeof(*src->var) );
+    COPY_ROW( mb.type, 1 )
+    COPY_ROW( mb.partition, 1 )
+    COPY_ROW( mb.qp, 1 )
+    COPY_ROW( mb.cbp, 1 )
+    COPY_ROW( mb.intra4x4_pred_mode, 1 )
+    COPY_ROW( mb.non_zero_count, 1 )
+    COPY_ROW( mb.chroma_pred_mode, 1 )
+    COPY_ROW( mb.mvd[0], 1 )
+    COPY_ROW( mb.mvd[1], 1 )
+    COPY_ROW( mb.skipbp, 1 )
+    COPY_ROW( mb.mb_transform_size, 1 )
+    COPY_ROW( mb.slice_table, 1 )
+    COPY_ROW( mb.field, 1 )
+    COPY_ROW( mb.mv[0], 16 )
+    COPY_ROW( mb.mv[1], 16 )
+    COPY_ROW( mb.ref[0], 4 )
+    COPY_ROW( mb.ref[1], 4 )
+    for( int i = 0; i < 2; i++ )
+        for( int j = 0; j < X264_REF_MAX*2; j++ )
+            COPY_ROW( mb.mvr[i][j], 1 )
+    COPY_ROW( fdec->effective_qp, 1 )
+#undef COPY_ROW
+}
+
+#if HAVE_THREAD
+static void *speculate_row_write( x264_speculate_row_t *row )
+{
+    x264_t *h = row->ctx;
+    int mb_y = row->i_mb_y;
+    int b_deblock = h->sh.i_disable_deblocking_filter_idc != 1;
+    b_deblock &= h->fdec->b_kept_as_ref || h->param.b_full_recon || h->param.psz_dump_yuv;
+    int start_bits = x264_cabac_pos( &h->cabac );
+    int qp_sum = 0;
+
+    for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
+    {
+        if( x264_atomic_load( &row->spec->b_abort ) )
+            return NULL;
+
+        int mb_xy = mb_x + mb_y * h->mb.i_mb_width;
+        x264_macroblock_cache_load_progressive( h, mb_x, mb_y );
+        x264_macroblock_analyse( h );
+        x264_macroblock_encode( h );
+
+        if( mb_xy > h->sh.i_first_mb )
+            x264_cabac_encode_terminal( &h->cabac );
+        if( IS_SKIP( h->mb.i_type ) )
+            x264_cabac_mb_skip( h, 1 );
+        else
+        {
+            if( h->sh.i_type != SLICE_TYPE_I )
+                x264_cabac_mb_skip( h, 0 );
+            x264_macroblock_write_cabac( h, &h->cabac );
+        }
+
+        x264_macroblock_cache_save( h );
+        qp_sum += h->mb.i_qp;
+        mb_stats_accumulate( h );
+        if( b_deblock )
+            x264_macroblock_deblock_strength( h );
+    }
+
+    row->i_bits = x264_cabac_pos( &h->cabac ) - start_bits;
+    row->i_qp_sum = qp_sum;
+    row->b_done = 1;
+    return NULL;
+}
+#endif
+
+/* Start contexts on row mb_y at the qps ratecontrol expects it may be re-encoded at,
+ * if any.  Called once the frame thread has analysed the first mb of the row, so that
+ * the references are ready and weighted as far as the contexts' mvs can reach. */
+static void speculate_row_start( x264_t *h, int mb_y, x264_bs_bak_t *bak )
+{
+    x264_speculate_t *spec = h->speculate;
+    float qps[X264_SPECULATE_MAX];
+    spec->i_rows = x264_ratecontrol_row_speculate( h, mb_y, qps, h->param.rc.i_vbv_speculate );
+    if( !spec->i_rows )
+        return;
+    x264_atomic_store( &spec->b_abort, 0 );
+
+    for( int i = 0; i < spec->i_rows; i++ )
+    {
+        x264_speculate_row_t *row = &spec->row[i];
+        x264_frame_t *own = &row->own;
+        x264_t *t = row->ctx;
+
+        row->fdec = *h->fdec;
+        row->fdec.mb_type = own->mb_type;
+        row->fdec.mb_partition = own->mb_partition;
+        row->fdec.mv[0] = own->mv[0];
+        row->fdec.mv[1] = own->mv[1];
+        row->fdec.mv16x16 = own->mv16x16;
+        row->fdec.ref[0] = own->ref[0];
+        row->fdec.ref[1] = own->ref[1];
+        row->fdec.field = own->field;
+        row->fdec.effective_qp = own->effective_qp;
+        for( int p = 0; p < own->i_plane; p++ )
+            row->fdec.plane[p] = own->plane[p];
+        row->fenc = *h->fenc;
+
+        t->param = h->param;
+        /* The mv range of the frame thread may be larger, never smaller. */
+        t->param.b_deterministic = 1;
+        memcpy( &t->i_frame, &h->i_frame, offsetof(x264_t, mb.base) - offsetof(x264_t, i_frame) );
+        memcpy( &t->mb.i_qp, &h->mb.i_qp, offsetof(x264_t, rc) - offsetof(x264_t, mb.i_qp) );
+        memcpy( t->mb.pic.i_fref, h->mb.pic.i_fref, sizeof(h->mb.pic.i_fref) );
+        t->fdec = &row->fdec;
+        t->fenc = &row->fenc;
+        x264_macroblock_slice_init( t );
+        x264_macroblock_thread_init( t );
+        t->mb.i_last_qp = bak->last_qp;
+        t->mb.i_last_dqp = bak->last_dqp;
+        t->mb.i_mb_prev_xy = mb_y * h->mb.i_mb_stride - 1;
+        x264_ratecontrol_row_context_set( t, qps[i] );
+
+        if( mb_y > h->i_threadslice_start )
+            speculate_copy_row( t, h, mb_y-1 );
+        for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
+            memcpy( t->intra_border_backup[!(mb_y&1)][j] - 16, h->intra_border_backup[!(mb_y&1)][j] - 16,
+                    (h->mb.i_mb_width*16+32) * SIZEOF_PIXEL );
+
+        /* Code into the context's own buffer, with the byte before it for the carry. */
+        t->cabac.p_start = t->out.p_bitstream;
+        t->cabac.p = t->out.p_bitstream + 1;
+        t->cabac.p_end = t->out.p_bitstream + t->out.i_bitstream;
+        t->cabac.p[-1] = bak->cabac_prevbyte;
+
+        /* Analysis looks at the mb type counts of the frame so far. */
+        t->stat.frame = h->stat.frame;
+        if( h->param.analyse.i_noise_reduction )
+        {
+            memcpy( t->nr_offset_denoise, h->nr_offset_denoise, sizeof(h->nr_offset_denoise) );
+            memset( t->nr_residual_sum_buf[0], 0, sizeof(t->nr_residual_sum_buf[0]) );
+            memset( t->nr_count_buf[0], 0, sizeof(t->nr_count_buf[0]) );
+        }
+
+        row->i_mb_y = mb_y;
+        row->f_qp = qps[i];
+        row->b_done = 0;
+        x264_threadpool_run( h->speculatepool, (void*)speculate_row_write, row );
+    }
+}
+
+/* Stop the contexts on the current row, except for the one already waited for. */
+static void speculate_row_join( x264_t *h, int i_waited )
+{
+    x264_speculate_t *spec = h->speculate;
+    x264_atomic_store( &spec->b_abort, 1 );
+    for( int i = 0; i < spec->i_rows; i++ )
+        if( i != i_waited )
+            x264_threadpool_wait( h->speculatepool, &spec->row[i] );
+    spec->i_rows = 0;
+}
+
+/* With ratecontrol having rejected row mb_y and the bitstream restored to its start,
+ * take the row from the first context that encoded it at a qp ratecontrol accepts.
+ * Returns -1, with the bitstream at the start of the row, if it has to be re-encoded. */
+static int speculate_row_commit( x264_t *h, int mb_y, x264_bs_bak_t *bak )
+{
+    x264_speculate_t *spec = h->speculate;
+    float qps[X264_SPECULATE_MAX];
+    for( int i = 0; i < spec->i_rows; i++ )
+        qps[i] = spec->row[i].f_qp;
+    int i = x264_ratecontrol_row_pick( h, qps, spec->i_rows );
+    if( i < 0 )
+    {
+        speculate_row_join( h, -1 );
+        return -1;
+    }
+    x264_speculate_row_t *row = &spec->row[i];
+    x264_t *t = row->ctx;
+    x264_threadpool_wait( h->speculatepool, row );
+    speculate_row_join( h, i );
+
+    uint8_t *start = t->out.p_bitstream + 1;
+    int bytes = t->cabac.p - start;
+    if( !row->b_done || bytes >= h->cabac.p_end - h->cabac.p )
+        return -1;
+
+    /* bitstream */
+    memcpy( h->cabac.p - 1, start - 1, bytes + 1 );
+    uint8_t *p_start = h->cabac.p_start;
+    uint8_t *p = h->cabac.p + bytes;
+    uint8_t *p_end = h->cabac.p_end;
+    h->cabac = t->cabac;
+    h->cabac.p_start = p_start;
+    h->cabac.p = p;
+    h->cabac.p_end = p_end;
+    h->mb.i_last_qp = t->mb.i_last_qp;
+    h->mb.i_last_dqp = t->mb.i_last_dqp;
+    h->mb.i_mb_prev_xy = t->mb.i_mb_prev_xy;
+
+    /* mb data, reconstruction and what deblocking and the row below need of it */
+    speculate_copy_row( h, t, mb_y );
+    for( int p = 0; p < h->fdec->i_plane; p++ )
+    {
+        int height = p && !CHROMA444 ? 16 >> CHROMA_V_SHIFT : 16;
+        int stride = h->fdec->i_stride[p];
+        for( int y = mb_y*height; y < (mb_y+1)*height; y++ )
+            memcpy( h->fdec->plane[p] + y*stride, t->fdec->plane[p] + y*stride, h->mb.i_mb_width*16 * SIZEOF_PIXEL );
+    }
+    for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
+        memcpy( h->intra_border_backup[mb_y&1][j] - 16, t->intra_border_backup[mb_y&1][j] - 16,
+                (h->mb.i_mb_width*16+32) * SIZEOF_PIXEL );
+    memcpy( h->deblock_strength[mb_y&1], t->deblock_strength[mb_y&1], h->mb.i_mb_width * sizeof(**h->deblock_strength) );
+
+    /* stats */
+    h->stat.frame = t->stat.frame;
+    if( h->param.analyse.i_noise_reduction )
+        for( int cat = 0; cat < 4; cat++ )
+        {
+            h->nr_count_buf[0][cat] += t->nr_count_buf[0][cat];
+            for( int j = 0; j < 64; j++ )
+                h->nr_residual_sum_buf[0][cat][j] += t->nr_residual_sum_buf[0][cat][j];
+        }
+
+    if( x264_ratecontrol_row( h, mb_y, row->f_qp, row->i_bits, row->i_qp_sum ) < 0 )
+    {
+        int i_skip = 0;
+        bitstream_restore( h, bak, &i_skip, 1 );
+        return -1;
+    }
+    return 0;
+}
+
 static intptr_t slice_write( x264_t *h )
 {
     int i_skip;
@@ -2860,6 +3659,9 @@ static intptr_t slice_write( x264_t *h )
 
         x264_macroblock_analyse( h );
 
+        if( h->speculate && i_mb_x == 0 && !h->mb.b_reencode_mb )
+            speculate_row_start( h, i_mb_y, &bs_bak[BS_BAK_ROW_VBV] );
+
         /* encode this macroblock -> be careful it can change the mb type to P_SKIP if needed */
 reencode:
         x264_macroblock_encode( h );
@@ -2974,6 +3776,15 @@ cont:
         if( x264_ratecontrol_mb( h, mb_size ) < 0 )
         {
             bitstream_restore( h, &bs_bak[BS_BAK_ROW_VBV], &i_skip, 1 );
+            /* Rather than re-encoding the row, take it from a context that encoded it ahead of time. */
+            if( h->speculate && h->speculate->i_rows && !speculate_row_commit( h, i_mb_y, &bs_bak[BS_BAK_ROW_VBV] ) )
+            {
+                if( mb_xy == h->sh.i_last_mb )
+                    break;
+                i_mb_x = 0;
+                i_mb_y++;
+                continue;
+            }
             h->mb.b_reencode_mb = 1;
             i_mb_x = 0;
             i_mb_y = i_mb_y - SLICE_MBAFF;
@@ -2981,76 +3792,10 @@ cont:
             h->sh.i_last_mb = orig_last_mb;
             continue;
         }
+        if( h->speculate && h->speculate->i_rows && i_mb_x == h->mb.i_mb_width - 1 )
+            speculate_row_join( h, -1 );
 
-        /* accumulate mb stats */
-        h->stat.frame.i_mb_count[h->mb.i_type]++;
-
-        int b_intra = IS_INTRA( h->mb.i_type );
-        int b_skip = IS_SKIP( h->mb.i_type );
-        if( h->param.i_log_level >= X264_LOG_INFO || h->param.rc.b_stat_write )
-        {
-            if( !b_intra && !b_skip && !IS_DIRECT( h->mb.i_type ) )
-            {
-                if( h->mb.i_partition != D_8x8 )
-                        h->stat.frame.i_mb_partition[h->mb.i_partition] += 4;
-                    else
-                        for( int i = 0; i < 4; i++ )
-                            h->stat.frame.i_mb_partition[h->mb.i_sub_partition[i]] ++;
-                if( h->param.i_frame_reference > 1 )
-                    for( int i_list = 0; i_list <= (h->sh.i_type == SLICE_TYPE_B); i_list++ )
-                        for( int i = 0; i < 4; i++ )
-                        {
-                            int i_ref = h->mb.cache.ref[i_list][ x264_scan8[4*i] ];
-                            if( i_ref >= 0 )
-                                h->stat.frame.i_mb_count_ref[i_list][i_ref] ++;
-                        }
-            }
-        }
-
-        if( h->param.i_log_level >= X264_LOG_INFO )
-        {
-            if( h->mb.i_cbp_luma | h->mb.i_cbp_chroma )
-            {
-                if( CHROMA444 )
-                {
-                    for( int i = 0; i < 4; i++ )
-                        if( h->mb.i_cbp_luma & (1 << i) )
-                            for( int p = 0; p < 3; p++ )
-                            {
-                                int s8 = i*4+p*16;
-                                int nnz8x8 = M16( &h->mb.cache.non_zero_count[x264_scan8[s8]+0] )
-                                           | M16( &h->mb.cache.non_zero_count[x264_scan8[s8]+8] );
-                                h->stat.frame.i_mb_cbp[!b_intra + p*2] += !!nnz8x8;
-                            }
-                }
-                else
-                {
-                    int cbpsum = (h->mb.i_cbp_luma&1) + ((h->mb.i_cbp_luma>>1)&1)
-                               + ((h->mb.i_cbp_luma>>2)&1) + (h->mb.i_cbp_luma>>3);
-                    h->stat.frame.i_mb_cbp[!b_intra + 0] += cbpsum;
-                    h->stat.frame.i_mb_cbp[!b_intra + 2] += !!h->mb.i_cbp_chroma;
-                    h->stat.frame.i_mb_cbp[!b_intra + 4] += h->mb.i_cbp_chroma >> 1;
-                }
-            }
-            if( h->mb.i_cbp_luma && !b_intra )
-            {
-                h->stat.frame.i_mb_count_8x8dct[0] ++;
-                h->stat.frame.i_mb_count_8x8dct[1] += h->mb.b_transform_8x8;
-            }
-            if( b_intra && h->mb.i_type != I_PCM )
-            {
-                if( h->mb.i_type == I_16x16 )
-                    h->stat.frame.i_mb_pred_mode[0][h->mb.i_intra16x16_pred_mode]++;
-                else if( h->mb.i_type == I_8x8 )
-                    for( int i = 0; i < 16; i += 4 )
-                        h->stat.frame.i_mb_pred_mode[1][h->mb.cache.intra4x4_pred_mode[x264_scan8[i]]]++;
-                else //if( h->mb.i_type == I_4x4 )
-                    for( int i = 0; i < 16; i++ )
-                        h->stat.frame.i_mb_pred_mode[2][h->mb.cache.intra4x4_pred_mode[x264_scan8[i]]]++;
-                h->stat.frame.i_mb_pred_mode[3][x264_mb_chroma_pred_mode_fix[h->mb.i_chroma_pred_mode]]++;
-            }
-            h->stat.frame.i_mb_field[b_intra?0:b_skip?2:1] += MB_INTERLACED;
-        }
+        mb_stats_accumulate( h );
 
         /* calculate deblock strength values (actual deblocking is done per-row along with hpel) */
         if( b_deblock )
@@ -3156,6 +3901,17 @@ static void thread_sync_stat( x264_t *dst, x264_t *src )
         memcpy( &dst->stat, &src->stat, offsetof(x264_t, stat.frame) - offsetof(x264_t, stat) );
 }
 
+static void thread_merge_stat_frame( x264_t *dst, x264_t *src )
+{
+    /* All entries in stat.frame are ints except for ssd/ssim. */
+    for( size_t j = 0; j < (offsetof(x264_t,stat.frame.i_ssd) - offsetof(x264_t,stat.frame.i_mv_bits)) / sizeof(int); j++ )
+        ((int*)&dst->stat.frame)[j] += ((int*)&src->stat.frame)[j];
+    for( int j = 0; j < 3; j++ )
+        dst->stat.frame.i_ssd[j] += src->stat.frame.i_ssd[j];
+    dst->stat.frame.f_ssim += src->stat.frame.f_ssim;
+    dst->stat.frame.i_ssim_cnt += src->stat.frame.i_ssim_cnt;
+}
+
 static void *slices_write( x264_t *h )
 {
     int i_slice_num = 0;
@@ -3216,6 +3972,14 @@ fail:
     return (void *)-1;
 }
 
+/* Stands in for slices_write in the lookahead pass: no slices are encoded, the
+ * frame's stats come from the lookahead. */
+static void *lookahead_pass_write( x264_t *h )
+{
+    x264_ratecontrol_lookahead_pass( h );
+    return (void *)0;
+}
+
 static int threaded_slices_write( x264_t *h )
 {
     int round_bias = h->param.i_avcintra_class ? 0 : h->param.i_slice_count/2;
@@ -3265,18 +4029,299 @@ static int threaded_slices_write( x264_t *h )
             h->out.i_nal++;
             nal_check_buffer( h );
         }
-        /* All entries in stat.frame are ints except for ssd/ssim. */
-        for( size_t j = 0; j < (offsetof(x264_t,stat.frame.i_ssd) - offsetof(x264_t,stat.frame.i_mv_bits)) / sizeof(int); j++ )
-            ((int*)&h->stat.frame)[j] += ((int*)&t->stat.frame)[j];
-        for( int j = 0; j < 3; j++ )
-            h->stat.frame.i_ssd[j] += t->stat.frame.i_ssd[j];
-        h->stat.frame.f_ssim += t->stat.frame.f_ssim;
-        h->stat.frame.i_ssim_cnt += t->stat.frame.i_ssim_cnt;
+        thread_merge_stat_frame( h, t );
+    }
+
+    return 0;
+}
+
+#if HAVE_THREAD
+/* Keep the contexts used for RD in step with what the writer will code, by coding
+ * the mb into the worker's own bitstream buffer, which is thrown away. */
+static void wavefront_mb_update_cabac( x264_t *h )
+{
+    int mv_bits = h->stat.frame.i_mv_bits;
+    int tex_bits = h->stat.frame.i_tex_bits;
+    /* Leave a byte for the carry into the previous one. */
+    x264_cabac_encode_init( &h->cabac, h->out.p_bitstream + 1, h->out.p_bitstream + h->out.i_bitstream );
+    if( IS_SKIP( h->mb.i_type ) )
+        x264_cabac_mb_skip( h, 1 );
+    else
+    {
+        if( h->sh.i_type != SLICE_TYPE_I )
+            x264_cabac_mb_skip( h, 0 );
+        x264_macroblock_write_cabac( h, &h->cabac );
+    }
+    h->stat.frame.i_mv_bits = mv_bits;
+    h->stat.frame.i_tex_bits = tex_bits;
+}
+
+static void *wavefront_rows_write( x264_t *h )
+{
+    x264_wavefront_t *wf = h->wavefront;
+    int width = h->mb.i_mb_width;
+    int workers = wf->i_workers;
+    int b_deblock = h->sh.i_disable_deblocking_filter_idc != 1;
+    b_deblock &= h->fdec->b_kept_as_ref || h->param.b_full_recon || h->param.psz_dump_yuv;
+
+    memset( &h->stat.frame, 0, sizeof(h->stat.frame) );
+    x264_macroblock_thread_init( h );
+    h->mb.i_last_qp = h->sh.i_qp;
+    h->mb.i_last_dqp = 0;
+    h->mb.field_decoding_flag = 0;
+    h->mb.b_reencode_mb = 0;
+
+    for( int mb_y = h->i_thread_idx - 1; mb_y < h->mb.i_mb_height; mb_y += workers )
+    {
+        int top_done = 0;
+
+        /* Wait for a free row in the ring. */
+        x264_pthread_mutex_lock( &wf->mutex );
+        while( wf->i_rows_written <= mb_y - wf->i_ring_rows && !wf->b_abort )
+            x264_pthread_cond_wait( &wf->cv, &wf->mutex );
+        x264_pthread_mutex_unlock( &wf->mutex );
+
+        /* A single worker carries its state across rows, like slice_write. */
+        if( mb_y > 0 && workers > 1 )
+        {
+            top_done = wavefront_wait_row( wf, mb_y-1, X264_MIN( 2, width ) );
+            if( top_done < 0 )
+                return (void *)-1;
+            memcpy( &h->cabac, &wf->row_start[(mb_y-1)&1].cabac, sizeof(x264_cabac_t) );
+            h->mb.i_last_qp = wf->row_start[(mb_y-1)&1].i_last_qp;
+            h->mb.i_last_dqp = wf->row_start[(mb_y-1)&1].i_last_dqp;
+            h->mb.i_mb_prev_xy = wf->row_start[(mb_y-1)&1].i_mb_prev_xy;
+        }
+
+        for( int mb_x = 0; mb_x < width; mb_x++ )
+        {
+            /* The top-right neighbour has to be done. */
+            int need = X264_MIN( mb_x+2, width );
+            if( mb_y > 0 && top_done < need )
+            {
+                top_done = wavefront_wait_row( wf, mb_y-1, need );
+                if( top_done < 0 )
+                    return (void *)-1;
+            }
+
+            x264_macroblock_cache_load_progressive( h, mb_x, mb_y );
+            x264_macroblock_analyse( h );
+            x264_macroblock_encode( h );
+            wavefront_mb_update_cabac( h );
+
+            wavefront_mb_copy( h, wavefront_record( h, mb_x, mb_y ), 1 );
+
+            x264_macroblock_cache_save( h );
+            mb_stats_accumulate( h );
+            if( b_deblock )
+                x264_macroblock_deblock_strength( h );
+
+            x264_pthread_mutex_lock( &wf->mutex );
+            if( workers > 1 && mb_x == X264_MIN( 1, width-1 ) )
+            {
+                memcpy( &wf->row_start[mb_y&1].cabac, &h->cabac, sizeof(x264_cabac_t) );
+                wf->row_start[mb_y&1].i_last_qp = h->mb.i_last_qp;
+                wf->row_start[mb_y&1].i_last_dqp = h->mb.i_last_dqp;
+                wf->row_start[mb_y&1].i_mb_prev_xy = h->mb.i_mb_prev_xy;
+            }
+            wf->row_done[mb_y] = mb_x+1;
+            x264_pthread_cond_broadcast( &wf->cv );
+            x264_pthread_mutex_unlock( &wf->mutex );
+        }
+    }
+
+    return (void *)0;
+}
+#endif
+
+static int wavefront_slice_write( x264_t *h )
+{
+    x264_wavefront_t *wf = h->wavefront;
+#if HAVE_THREAD
+    x264_threadpool_t *pool = h->param.b_entropy_threads ? h->analysispool : h->threadpool;
+#endif
+    int width = h->mb.i_mb_width;
+    int workers = wf->i_workers;
+    int ret = 0;
+
+    memset( &h->stat.frame, 0, sizeof(h->stat.frame) );
+    h->mb.b_reencode_mb = 0;
+    h->sh.i_first_mb = 0;
+    h->sh.i_last_mb = h->mb.i_mb_count - 1;
+
+    bs_realign( &h->out.bs );
+    nal_start( h, h->i_nal_type, h->i_nal_ref_idc );
+    h->out.nal[h->out.i_nal].i_first_mb = h->sh.i_first_mb;
+
+    x264_macroblock_thread_init( h );
+
+    /* Set the QP equal to the first QP in the slice for more accurate CABAC initialization. */
+    h->mb.i_mb_xy = h->sh.i_first_mb;
+    h->sh.i_qp = x264_ratecontrol_mb_qp( h );
+    h->sh.i_qp = SPEC_QP( h->sh.i_qp );
+    h->sh.i_qp_delta = h->sh.i_qp - h->pps->i_pic_init_qp;
+
+    slice_header_write( &h->out.bs, &h->sh, h->i_nal_ref_idc );
+    bs_align_1( &h->out.bs );
+    x264_cabac_context_init( h, &h->cabac, h->sh.i_type, x264_clip3( h->sh.i_qp-QP_BD_OFFSET, 0, 51 ), h->sh.i_cabac_init_idc );
+    x264_cabac_encode_init ( &h->cabac, h->out.bs.p, h->out.bs.p_end );
+    h->mb.i_last_qp = h->sh.i_qp;
+    h->mb.i_last_dqp = 0;
+    h->mb.field_decoding_flag = 0;
+
+    /* sync contexts */
+    for( int i = 1; i <= workers; i++ )
+    {
+        x264_t *t = wf->worker[i-1];
+        t->param = h->param;
+        memcpy( &t->i_frame, &h->i_frame, offsetof(x264_t, rc) - offsetof(x264_t, i_frame) );
+        t->i_thread_idx = i;
+        t->i_threadslice_start = 0;
+        t->i_threadslice_end = h->mb.i_mb_height;
+        if( h->param.analyse.i_noise_reduction )
+            memcpy( t->nr_offset_denoise, h->nr_offset_denoise, sizeof(h->nr_offset_denoise) );
+    }
+
+    /* With frame threads, the analysis weights the references as their rows come in. */
+    if( h->i_thread_frames == 1 )
+        x264_analyse_weight_frame( h, h->mb.i_mb_height*16 + 16 );
+
+    /* The analysis context of an entropy thread shares the writer's ratecontrol. */
+    if( h->param.b_wavefront_threads )
+        x264_threads_distribute_ratecontrol( h );
+
+    memset( wf->row_done, 0, h->mb.i_mb_height * sizeof(int) );
+    wf->i_rows_written = 0;
+    wf->b_abort = 0;
+
+    /* dispatch */
+    for( int i = 1; i <= workers; i++ )
+        x264_threadpool_run( pool, (void*)wavefront_rows_write, wf->worker[i-1] );
+
+    for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
+    {
+        int row_done = 0;
+        if( bitstream_check_buffer( h ) )
+        {
+            ret = -1;
+            goto end;
+        }
+        fdec_filter_row( h, mb_y, 0 );
+
+        for( int mb_x = 0; mb_x < width; mb_x++ )
+        {
+            int mb_xy = mb_x + mb_y * width;
+            if( row_done <= mb_x )
+                row_done = wavefront_wait_row( wf, mb_y, mb_x+1 );
+            if( row_done < 0 )
+            {
+                ret = -1;
+                goto end;
+            }
+
+            wavefront_mb_copy( h, wavefront_record( h, mb_x, mb_y ), 0 );
+            h->mb.i_mb_prev_xy = mb_xy - 1;
+
+            int mb_spos = bs_pos(&h->out.bs) + x264_cabac_pos(&h->cabac);
+            if( mb_xy > h->sh.i_first_mb )
+                x264_cabac_encode_terminal( &h->cabac );
+            if( IS_SKIP( h->mb.i_type ) )
+                x264_cabac_mb_skip( h, 1 );
+            else
+            {
+                if( h->sh.i_type != SLICE_TYPE_I )
+                    x264_cabac_mb_skip( h, 0 );
+                x264_macroblock_write_cabac( h, &h->cabac );
+            }
+            int mb_size = bs_pos(&h->out.bs) + x264_cabac_pos(&h->cabac) - mb_spos;
+
+            /* The qp chain of x264_macroblock_cache_save, on the real bitstream order. */
+            if( h->mb.i_type == I_PCM )
+            {
+                h->mb.qp[mb_xy] = 0;
+                h->mb.i_last_dqp = 0;
+            }
+            else
+            {
+                if( h->mb.i_type != I_16x16 && !h->mb.i_cbp_luma && !h->mb.i_cbp_chroma )
+                    h->mb.i_qp = h->mb.i_last_qp;
+                h->mb.qp[mb_xy] = h->mb.i_qp;
+                h->mb.i_last_dqp = h->mb.i_qp - h->mb.i_last_qp;
+                h->mb.i_last_qp = h->mb.i_qp;
+            }
+
+            x264_ratecontrol_mb( h, mb_size );
+        }
+
+        x264_pthread_mutex_lock( &wf->mutex );
+        wf->i_rows_written = mb_y+1;
+        x264_pthread_cond_broadcast( &wf->cv );
+        x264_pthread_mutex_unlock( &wf->mutex );
+    }
+
+    h->out.nal[h->out.i_nal].i_last_mb = h->sh.i_last_mb;
+    x264_cabac_encode_flush( h, &h->cabac );
+    h->out.bs.p = h->cabac.p;
+    if( nal_end( h ) )
+        ret = -1;
+
+end:
+    if( ret < 0 )
+    {
+        x264_pthread_mutex_lock( &wf->mutex );
+        wf->b_abort = 1;
+        x264_pthread_cond_broadcast( &wf->cv );
+        x264_pthread_mutex_unlock( &wf->mutex );
+    }
+    for( int i = 1; i <= workers; i++ )
+        if( (intptr_t)x264_threadpool_wait( pool, wf->worker[i-1] ) < 0 )
+            ret = -1;
+    if( ret < 0 )
+        return -1;
+
+    for( int i = 1; i <= workers; i++ )
+    {
+        x264_t *t = wf->worker[i-1];
+        thread_merge_stat_frame( h, t );
+        /* The denoise offsets are updated from the sums of the whole frame. */
+        if( h->param.analyse.i_noise_reduction )
+            for( int cat = 0; cat < 4; cat++ )
+            {
+                h->nr_count_buf[0][cat] += t->nr_count_buf[0][cat];
+                t->nr_count_buf[0][cat] = 0;
+                for( int j = 0; j < 64; j++ )
+                {
+                    h->nr_residual_sum_buf[0][cat][j] += t->nr_residual_sum_buf[0][cat][j];
+                    t->nr_residual_sum_buf[0][cat][j] = 0;
+                }
+            }
+    }
+    h->stat.frame.i_misc_bits = bs_pos( &h->out.bs )
+                              + (h->out.i_nal*NALU_OVERHEAD * 8)
+                              - h->stat.frame.i_tex_bits
+                              - h->stat.frame.i_mv_bits;
+    fdec_filter_row( h, h->mb.i_mb_height, 0 );
+
+    /* Free mb info after the workers are done using it */
+    if( h->fdec->mb_info_free )
+    {
+        h->fdec->mb_info_free( h->fdec->mb_info );
+        h->fdec->mb_info = NULL;
+        h->fdec->mb_info_free = NULL;
     }
 
     return 0;
 }
 
+#if HAVE_THREAD
+/* A frame thread job with entropy threads: write the bitstream of the frame
+ * while its analysis thread feeds it mbs. */
+static void *entropy_frame_write( x264_t *h )
+{
+    return (void *)(intptr_t)wavefront_slice_write( h );
+}
+#endif
+
 void x264_encoder_intra_refresh( x264_t *h )
 {
     h = h->thread[h->i_thread_phase];
@@ -3307,6 +4352,20 @@ int x264_encoder_invalidate_reference( x264_t *h, int64_t pts )
     return 0;
 }
 
+/****************************************************************************
+ * x264_encoder_input_layout:
+ ****************************************************************************/
+int x264_encoder_input_layout( x264_t *h, x264_image_t *img )
+{
+    if( !h->param.b_zero_copy_input )
+    {
+        x264_log( h, X264_LOG_ERROR, "x264_encoder_input_layout requires zero-copy input\n" );
+        return -1;
+    }
+    x264_frame_input_layout( h, img );
+    return 0;
+}
+
 /****************************************************************************
  * x264_encoder_encode:
  *  XXX: i_poc   : is the poc of the current given picture
@@ -3369,13 +4428,14 @@ int     x264_encoder_encode( x264_t *h,
         if( !fenc )
             return -1;
 
-        if( x264_frame_copy_picture( h, fenc, pic_in ) < 0 )
+        if( h->param.b_zero_copy_input )
+        {
+            if( x264_frame_borrow_picture( h, fenc, pic_in ) < 0 )
+                return -1;
+        }
+        else if( x264_frame_copy_picture( h, fenc, pic_in ) < 0 )
             return -1;
 
-        if( h->param.i_width != 16 * h->mb.i_mb_width ||
-            h->param.i_height != 16 * h->mb.i_mb_height )
-            x264_frame_expand_border_mod16( h, fenc );
-
         fenc->i_frame = h->frames.i_input++;
 
         if( fenc->i_frame == 0 )
@@ -3408,7 +4468,17 @@ int     x264_encoder_encode( x264_t *h,
                 fenc->i_pic_struct = PIC_STRUCT_PROGRESSIVE;
         }
 
-        if( h->param.rc.b_mb_tree && h->param.rc.b_stat_read )
+        if( h->param.b_analysis_import )
+        {
+            if( h->param.psz_analysis_in )
+            {
+                if( x264_analysis_file_read( h, fenc, pic_in->prop.quant_offsets ) )
+                    return -1;
+            }
+            else if( x264_macroblock_tree_import( h, fenc, pic_in->prop.analysis, pic_in->prop.quant_offsets ) )
+                return -1;
+        }
+        else if( h->param.rc.b_mb_tree && h->param.rc.b_stat_read )
         {
             if( x264_macroblock_tree_read( h, fenc, pic_in->prop.quant_offsets ) )
                 return -1;
@@ -3418,18 +4488,23 @@ int     x264_encoder_encode( x264_t *h,
 
         if( pic_in->prop.quant_offsets_free )
             pic_in->prop.quant_offsets_free( pic_in->prop.quant_offsets );
-
-        if( h->frames.b_have_lowres )
-            x264_frame_init_lowres( h, fenc );
+        if( pic_in->prop.analysis_free )
+            pic_in->prop.analysis_free( pic_in->prop.analysis );
 
         /* 2: Place the frame into the queue for its slice type decision */
         x264_lookahead_put_frame( h, fenc );
 
-        if( h->frames.i_input <= h->frames.i_delay + 1 - h->i_thread_frames )
+        if( h->frames.i_input - h->i_frame - 1 <= x264_lookahead_delay( h ) + 1 - h->i_thread_frames )
         {
             /* Nothing yet to encode, waiting for filling of buffers */
-            pic_out->i_type = X264_TYPE_AUTO;
-            return 0;
+            if( h->i_frame < 0 )
+            {
+                pic_out->i_type = X264_TYPE_AUTO;
+                return 0;
+            }
+            /* The adaptive lookahead grew its window: hold this frame back without starting
+             * a new one, but still return the oldest thread's output. */
+            return encoder_frame_end( thread_oldest, thread_current, pp_nal, pi_nal, pic_out );
         }
     }
     else
@@ -3559,6 +4634,9 @@ int     x264_encoder_encode( x264_t *h,
     h->fenc->b_kept_as_ref =
     h->fdec->b_kept_as_ref = i_nal_ref_idc != NAL_PRIORITY_DISPOSABLE && h->param.i_keyint_max > 1;
 
+    if( (h->param.analysis_export || h->param.psz_analysis_out) && analysis_export( h ) < 0 )
+        return -1;
+
     h->fdec->mb_info = h->fenc->mb_info;
     h->fdec->mb_info_free = h->fenc->mb_info_free;
     h->fenc->mb_info = NULL;
@@ -3884,9 +4962,12 @@ int     x264_encoder_encode( x264_t *h,
     /* Write frame */
     h->i_threadslice_start = 0;
     h->i_threadslice_end = h->mb.i_mb_height;
-    if( h->i_thread_frames > 1 )
+    if( h->param.rc.b_lookahead_pass && h->i_thread_frames == 1 )
+        lookahead_pass_write( h );
+    else if( h->i_thread_frames > 1 )
     {
-        x264_threadpool_run( h->threadpool, (void*)slices_write, h );
+        x264_threadpool_run( h->threadpool, h->param.rc.b_lookahead_pass ? (void*)lookahead_pass_write :
+                             h->param.b_entropy_threads ? (void*)entropy_frame_write : (void*)slices_write, h );
         h->b_thread_active = 1;
     }
     else if( h->param.b_sliced_threads )
@@ -3894,6 +4975,11 @@ int     x264_encoder_encode( x264_t *h,
         if( threaded_slices_write( h ) )
             return -1;
     }
+    else if( h->param.b_wavefront_threads || h->param.b_entropy_threads )
+    {
+        if( wavefront_slice_write( h ) )
+            return -1;
+    }
     else
         if( (intptr_t)slices_write( h ) )
             return -1;
@@ -4048,6 +5134,9 @@ static int encoder_frame_end( x264_t *h, x264_t *thread_current,
     /* Slice stat */
     h->stat.i_frame_count[h->sh.i_type]++;
     h->stat.i_frame_size[h->sh.i_type] += frame_size;
+    /* The lookahead pass wrote no slices, count what it modelled instead. */
+    if( h->param.rc.b_lookahead_pass )
+        h->stat.i_frame_size[h->sh.i_type] += (h->stat.frame.i_tex_bits + h->stat.frame.i_mv_bits + h->stat.frame.i_misc_bits) >> 3;
     h->stat.f_frame_qp[h->sh.i_type] += h->fdec->f_qp_avg_aq;
 
     for( int i = 0; i < X264_MBTYPE_MAX; i++ )
@@ -4215,6 +5304,20 @@ void    x264_encoder_close  ( x264_t *h )
         x264_threadpool_delete( h->threadpool );
     if( h->param.i_lookahead_threads > 1 )
         x264_threadpool_delete( h->lookaheadpool );
+    if( h->param.b_entropy_threads )
+    {
+        x264_threadpool_delete( h->analysispool );
+        for( int i = 0; i < h->param.i_threads; i++ )
+            wavefront_delete( h->thread[i] );
+    }
+    if( h->param.b_wavefront_threads )
+        wavefront_delete( h );
+    if( h->speculatepool )
+    {
+        x264_threadpool_delete( h->speculatepool );
+        for( int i = 0; i < h->param.i_threads; i++ )
+            speculate_delete( h->thread[i] );
+    }
     if( h->i_thread_frames > 1 )
     {
         for( int i = 0; i < h->i_thread_frames; i++ )
@@ -4505,7 +5608,7 @@ void    x264_encoder_close  ( x264_t *h )
                       f_bitrate );
         }
         else
-            x264_log( h, X264_LOG_INFO, "kb/s:%.2f\n", f_bitrate );
+            x264_log( h, X264_LOG_INFO, "kb/s:%.2f%s\n", f_bitrate, h->param.rc.b_lookahead_pass ? " (modelled)" : "" );
     }
 
     /* rc */
@@ -4539,13 +5642,20 @@ void    x264_encoder_close  ( x264_t *h )
 
     if( h->param.i_lookahead_threads > 1 )
         for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            if( h->param.i_bframe_adaptive == X264_B_ADAPT_TRELLIS || h->param.rc.b_mb_tree )
+                x264_macroblock_thread_free( h->lookahead_thread[i], 1 );
+            x264_free( h->lookahead_thread[i]->mb.p_weight_buf[0] );
             x264_free( h->lookahead_thread[i] );
+        }
+    if( h->lookahead_coarse )
+        lookahead_coarse_delete( h );
 
     for( int i = h->param.i_threads - 1; i >= 0; i-- )
     {
         x264_frame_t **frame;
 
-        if( !h->param.b_sliced_threads || i == 0 )
+        if( !(h->param.b_sliced_threads || h->param.b_wavefront_threads) || i == 0 )
         {
             for( frame = h->thread[i]->frames.reference; *frame; frame++ )
             {
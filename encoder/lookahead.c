@@ -77,6 +77,8 @@ static void lookahead_slicetype_decide( x264_t *h )
         x264_pthread_cond_wait( &h->lookahead->ofbuf.cv_empty, &h->lookahead->ofbuf.mutex );
 
     x264_pthread_mutex_lock( &h->lookahead->next.mutex );
+    if( h->param.rc.i_lookahead_min )
+        h->lookahead->next.list[0]->i_decided_date = x264_mdate();
     lookahead_shift( &h->lookahead->ofbuf, &h->lookahead->next, shift_frames );
     x264_pthread_mutex_unlock( &h->lookahead->next.mutex );
 
@@ -101,7 +103,7 @@ REALIGN_STACK static void *lookahead_thread( x264_t *h )
         int shift = X264_MIN( h->lookahead->next.i_max_size - h->lookahead->next.i_size, h->lookahead->ifbuf.i_size );
         lookahead_shift( &h->lookahead->next, &h->lookahead->ifbuf, shift );
         x264_pthread_mutex_unlock( &h->lookahead->next.mutex );
-        if( h->lookahead->next.i_size <= h->lookahead->i_slicetype_length + h->param.b_vfr_input )
+        if( h->lookahead->next.i_size <= x264_atomic_load( &h->lookahead->i_slicetype_length ) + h->param.b_vfr_input )
         {
             while( !h->lookahead->ifbuf.i_size && !h->lookahead->b_exit_thread )
                 x264_pthread_cond_wait( &h->lookahead->ifbuf.cv_fill, &h->lookahead->ifbuf.mutex );
@@ -129,7 +131,7 @@ REALIGN_STACK static void *lookahead_thread( x264_t *h )
 
 #endif
 
-int x264_lookahead_init( x264_t *h, int i_slicetype_length )
+int x264_lookahead_init( x264_t *h, int i_slicetype_length, int i_slicetype_min )
 {
     x264_lookahead_t *look;
     CHECKED_MALLOCZERO( look, sizeof(x264_lookahead_t) );
@@ -137,9 +139,12 @@ int x264_lookahead_init( x264_t *h, int i_slicetype_length )
         h->thread[i]->lookahead = look;
 
     look->i_last_keyframe = - h->param.i_keyint_max;
-    look->b_analyse_keyframe = (h->param.rc.b_mb_tree || (h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead))
+    look->b_analyse_keyframe = ((h->param.rc.b_mb_tree && !h->param.b_analysis_import) ||
+                                (h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead))
                                && !h->param.rc.b_stat_read;
-    look->i_slicetype_length = i_slicetype_length;
+    look->i_slicetype_length = i_slicetype_min;
+    look->i_slicetype_min = i_slicetype_min;
+    look->i_slicetype_max = i_slicetype_length;
 
     /* init frame lists */
     if( x264_sync_frame_list_init( &look->ifbuf, h->param.i_sync_lookahead+3 ) ||
@@ -220,15 +225,65 @@ static void lookahead_encoder_shift( x264_t *h )
     x264_pthread_cond_broadcast( &h->lookahead->ofbuf.cv_empty );
 }
 
+/* Frames the encoder has to buffer before it can start encoding, which follows the
+ * current lookahead window when that is adaptive. */
+int x264_lookahead_delay( x264_t *h )
+{
+    x264_lookahead_t *look = h->lookahead;
+    return h->frames.i_delay - look->i_slicetype_max + x264_atomic_load( &look->i_slicetype_length );
+}
+
+#define LOOKAHEAD_ADAPT_FETCHES 4
+
+/* Adapt the window from the encoder's side of ofbuf.  A decided minigop that waited there
+ * for longer than the encoder takes per minigop means the encoder is the bottleneck: the
+ * frames are buffered anyway, so a longer window costs no latency, only a held-back input.
+ * An encoder that had to wait for a decision means the lookahead thread is the bottleneck,
+ * so shorten the window to cut its work per decision.  Input that is already buffered
+ * can't be given back under the one-in, one-out API, so the delay never shrinks again;
+ * a shorter window only lowers the lookahead's cost until it grows back into that slack. */
+static void lookahead_adapt_length( x264_t *h, int b_starved, int64_t i_decided )
+{
+    x264_lookahead_t *look = h->lookahead;
+    int64_t i_now = x264_mdate();
+    int64_t i_period = i_now - look->i_last_fetch;
+    int b_first = !look->i_last_fetch;
+    look->i_last_fetch = i_now;
+    if( b_first )
+        return;
+    look->i_fetch_period = look->i_fetch_period ? (7 * look->i_fetch_period + i_period) >> 3 : i_period;
+
+    if( b_starved )
+        look->i_adapt_score = X264_MIN( look->i_adapt_score, 0 ) - 1;
+    else if( i_decided && i_now - i_decided > look->i_fetch_period )
+        look->i_adapt_score = X264_MAX( look->i_adapt_score, 0 ) + 1;
+    if( abs( look->i_adapt_score ) < LOOKAHEAD_ADAPT_FETCHES )
+        return;
+
+    int i_length = x264_clip3( look->i_slicetype_length + (look->i_adapt_score > 0 ? 1 : -1),
+                               look->i_slicetype_min, look->i_slicetype_max );
+    look->i_adapt_score = 0;
+    x264_atomic_store( &look->i_slicetype_length, i_length );
+}
+
 void x264_lookahead_get_frames( x264_t *h )
 {
     if( h->param.i_sync_lookahead )
     {   /* We have a lookahead thread, so get frames from there */
+        int b_starved = 0;
+        int64_t i_decided = 0;
         x264_pthread_mutex_lock( &h->lookahead->ofbuf.mutex );
         while( !h->lookahead->ofbuf.i_size && h->lookahead->b_thread_active )
+        {
+            b_starved = 1;
             x264_pthread_cond_wait( &h->lookahead->ofbuf.cv_fill, &h->lookahead->ofbuf.mutex );
+        }
+        if( h->lookahead->ofbuf.i_size )
+            i_decided = h->lookahead->ofbuf.list[0]->i_decided_date;
         lookahead_encoder_shift( h );
         x264_pthread_mutex_unlock( &h->lookahead->ofbuf.mutex );
+        if( h->param.rc.i_lookahead_min && !h->lookahead->b_exit_thread )
+            lookahead_adapt_length( h, b_starved, i_decided );
     }
     else
     {   /* We are not running a lookahead thread, so perform all the slicetype decide on the fly */
@@ -69,6 +69,28 @@ typedef struct
     float offset;
 } predictor_t;
 
+/* Where the frame threads stand: for every frame in flight, its planned and
+ * estimated size, republished after each row, and the buffer as of the last
+ * frame out.  Lock-free: each part has a single writer at a time, which bumps
+ * seq to odd and back around its update; readers retry until they see the
+ * same even seq on both sides of their reads. */
+typedef struct
+{
+    int seq;
+    int i_frame;                /* coded frame number, -1 once it's out */
+    int i_cpb_duration;
+    int i_bits_planned;
+    int i_bits_estimated;
+} rc_ledger_frame_t;
+
+typedef struct
+{
+    int seq;
+    int i_frame_out;            /* last frame whose bits are in i_buffer_fill */
+    int i_buffer_fill;          /* buffer_fill_final_min in bits */
+    rc_ledger_frame_t frame[X264_THREAD_MAX];
+} rc_ledger_t;
+
 struct x264_ratecontrol_t
 {
     /* constants */
@@ -97,11 +119,13 @@ struct x264_ratecontrol_t
     int64_t buffer_fill_final;
     int64_t buffer_fill_final_min;
     double buffer_fill;         /* planned buffer, if all in-progress frames hit their bit budget */
+    int buffer_overhead;        /* header bits taken off buffer_fill */
     double buffer_rate;         /* # of bits added to buffer_fill after each frame */
     double vbv_max_rate;        /* # of bits added to buffer_fill per second */
     predictor_t *pred;          /* predict frame size from satd */
     int single_frame_vbv;
     float rate_factor_max_increment; /* Don't allow RF above (CRF + this value). */
+    rc_ledger_t *ledger;        /* shared by the frame threads, NULL without them */
 
     /* ABR stuff */
     int    last_satd;
@@ -125,6 +149,15 @@ struct x264_ratecontrol_t
     char *psz_mbtree_stat_file_name;
     FILE *p_mbtree_stat_file_in;
 
+    /* analysis file */
+    FILE *p_analysis_file_out;
+    char *psz_analysis_file_tmpname;
+    FILE *p_analysis_file_in;
+    int analysis_mb_width;
+    int analysis_mb_height;
+    int analysis_record_size;
+    float *analysis_buffer;
+
     int num_entries;            /* number of ratecontrol_entry_ts */
     ratecontrol_entry_t *entry; /* FIXME: copy needed data and free this once init is done */
     ratecontrol_entry_t **entry_out;
@@ -183,6 +216,9 @@ static int init_pass2(x264_t *);
 static float rate_estimate_qscale( x264_t *h );
 static int update_vbv( x264_t *h, int bits );
 static void update_vbv_plan( x264_t *h, int overhead );
+static void ledger_publish_frame( x264_t *h, int i_frame, double planned, double estimated );
+static void ledger_publish_out( x264_t *h, int i_frame_out );
+static double ledger_buffer_fill( x264_t *h );
 static float predict_size( predictor_t *p, float q, float var );
 static void update_predictor( predictor_t *p, float q, float var, float bits );
 
@@ -300,8 +336,34 @@ static NOINLINE uint32_t ac_energy_mb( x264_t *h, int mb_x, int mb_y, x264_frame
     return var;
 }
 
+/* Remove mean from SSD calculation */
+static void pixel_ssd_remove_mean( x264_t *h, x264_frame_t *frame )
+{
+    for( int i = 0; i < 3; i++ )
+    {
+        uint64_t ssd = frame->i_pixel_ssd[i];
+        uint64_t sum = frame->i_pixel_sum[i];
+        int width  = 16*h->mb.i_mb_width  >> (i && CHROMA_H_SHIFT);
+        int height = 16*h->mb.i_mb_height >> (i && CHROMA_V_SHIFT);
+        frame->i_pixel_ssd[i] = ssd - (sum * sum + width * height / 2) / (width * height);
+    }
+}
+
+/* Sweep of a new frame gathering what each of its consumers needs from the pixels while a row is in cache:
+ * the AC energy of each mb for AQ, the plane sums and ssds for weighted prediction and, on the lowres
+ * plane, the lookahead's intra costs and the scenecut pre-pass statistics. */
 void x264_adaptive_quant_frame( x264_t *h, x264_frame_t *frame, float *quant_offsets )
 {
+    /* constants chosen to result in approximately the same overall bitrate as without AQ.
+     * FIXME: while they're written in 5 significant digits, they're only tuned to 2. */
+    int b_aq = h->param.rc.i_aq_mode != X264_AQ_NONE && h->param.rc.f_aq_strength != 0;
+    int b_autovariance = b_aq && (h->param.rc.i_aq_mode == X264_AQ_AUTOVARIANCE ||
+                                  h->param.rc.i_aq_mode == X264_AQ_AUTOVARIANCE_BIASED);
+    float strength = h->param.rc.f_aq_strength * 1.0397f;
+    float avg_adj = 0.f;
+    float avg_adj_pow2 = 0.f;
+    float bias_strength = 0.f;
+
     /* Initialize frame stats */
     for( int i = 0; i < 3; i++ )
     {
@@ -310,7 +372,7 @@ void x264_adaptive_quant_frame( x264_t *h, x264_frame_t *frame, float *quant_off
     }
 
     /* Degenerate cases */
-    if( h->param.rc.i_aq_mode == X264_AQ_NONE || h->param.rc.f_aq_strength == 0 )
+    if( !b_aq )
     {
         /* Need to init it anyways for MB tree */
         if( h->param.rc.i_aq_mode && h->param.rc.f_aq_strength == 0 )
@@ -332,67 +394,57 @@ void x264_adaptive_quant_frame( x264_t *h, x264_frame_t *frame, float *quant_off
                         frame->i_inv_qscale_factor[mb_xy] = 256;
             }
         }
-        /* Need variance data for weighted prediction */
-        if( h->param.analyse.i_weighted_pred )
+    }
+
+    /* Variance data is needed for AQ and for weighted prediction */
+    int b_energy = b_aq || h->param.analyse.i_weighted_pred;
+    for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
+    {
+        for( int mb_x = 0; b_energy && mb_x < h->mb.i_mb_width; mb_x++ )
         {
-            for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
-                for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
-                    ac_energy_mb( h, mb_x, mb_y, frame );
+            uint32_t energy = ac_energy_mb( h, mb_x, mb_y, frame );
+            int mb_xy = mb_x + mb_y*h->mb.i_mb_stride;
+            if( b_autovariance )
+            {
+                float bit_depth_correction = 1.f / (1 << (2*(BIT_DEPTH-8)));
+                float qp_adj = powf( energy * bit_depth_correction + 1, 0.125f );
+                frame->f_qp_offset[mb_xy] = qp_adj;
+                avg_adj += qp_adj;
+                avg_adj_pow2 += qp_adj * qp_adj;
+            }
+            else if( b_aq )
+            {
+                float qp_adj = strength * (x264_log2( X264_MAX(energy, 1) ) - (14.427f + 2*(BIT_DEPTH-8)));
+                if( quant_offsets )
+                    qp_adj += quant_offsets[mb_xy];
+                frame->f_qp_offset[mb_xy] =
+                frame->f_qp_offset_aq[mb_xy] = qp_adj;
+                if( h->frames.b_have_lowres )
+                    frame->i_inv_qscale_factor[mb_xy] = x264_exp2fix8(qp_adj);
+            }
         }
-        else
-            return;
+        if( h->frames.b_have_lowres )
+            x264_slicetype_stats_row( h, frame, mb_y );
     }
+
     /* Actual adaptive quantization */
-    else
+    if( b_autovariance )
     {
-        /* constants chosen to result in approximately the same overall bitrate as without AQ.
-         * FIXME: while they're written in 5 significant digits, they're only tuned to 2. */
-        float strength;
-        float avg_adj = 0.f;
-        float bias_strength = 0.f;
-
-        if( h->param.rc.i_aq_mode == X264_AQ_AUTOVARIANCE || h->param.rc.i_aq_mode == X264_AQ_AUTOVARIANCE_BIASED )
-        {
-            float bit_depth_correction = 1.f / (1 << (2*(BIT_DEPTH-8)));
-            float avg_adj_pow2 = 0.f;
-            for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
-                for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
-                {
-                    uint32_t energy = ac_energy_mb( h, mb_x, mb_y, frame );
-                    float qp_adj = powf( energy * bit_depth_correction + 1, 0.125f );
-                    frame->f_qp_offset[mb_x + mb_y*h->mb.i_mb_stride] = qp_adj;
-                    avg_adj += qp_adj;
-                    avg_adj_pow2 += qp_adj * qp_adj;
-                }
-            avg_adj /= h->mb.i_mb_count;
-            avg_adj_pow2 /= h->mb.i_mb_count;
-            strength = h->param.rc.f_aq_strength * avg_adj;
-            avg_adj = avg_adj - 0.5f * (avg_adj_pow2 - 14.f) / avg_adj;
-            bias_strength = h->param.rc.f_aq_strength;
-        }
-        else
-            strength = h->param.rc.f_aq_strength * 1.0397f;
+        avg_adj /= h->mb.i_mb_count;
+        avg_adj_pow2 /= h->mb.i_mb_count;
+        strength = h->param.rc.f_aq_strength * avg_adj;
+        avg_adj = avg_adj - 0.5f * (avg_adj_pow2 - 14.f) / avg_adj;
+        bias_strength = h->param.rc.f_aq_strength;
 
         for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
             for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
             {
-                float qp_adj;
                 int mb_xy = mb_x + mb_y*h->mb.i_mb_stride;
+                float qp_adj = frame->f_qp_offset[mb_xy];
                 if( h->param.rc.i_aq_mode == X264_AQ_AUTOVARIANCE_BIASED )
-                {
-                    qp_adj = frame->f_qp_offset[mb_xy];
                     qp_adj = strength * (qp_adj - avg_adj) + bias_strength * (1.f - 14.f / (qp_adj * qp_adj));
-                }
-                else if( h->param.rc.i_aq_mode == X264_AQ_AUTOVARIANCE )
-                {
-                    qp_adj = frame->f_qp_offset[mb_xy];
-                    qp_adj = strength * (qp_adj - avg_adj);
-                }
                 else
-                {
-                    uint32_t energy = ac_energy_mb( h, mb_x, mb_y, frame );
-                    qp_adj = strength * (x264_log2( X264_MAX(energy, 1) ) - (14.427f + 2*(BIT_DEPTH-8)));
-                }
+                    qp_adj = strength * (qp_adj - avg_adj);
                 if( quant_offsets )
                     qp_adj += quant_offsets[mb_xy];
                 frame->f_qp_offset[mb_xy] =
@@ -402,15 +454,37 @@ void x264_adaptive_quant_frame( x264_t *h, x264_frame_t *frame, float *quant_off
             }
     }
 
-    /* Remove mean from SSD calculation */
-    for( int i = 0; i < 3; i++ )
+    if( h->frames.b_have_lowres )
+        x264_slicetype_stats_end( h, frame );
+    if( b_energy )
+        pixel_ssd_remove_mean( h, frame );
+}
+
+/* x264_adaptive_quant_frame's sweep without the AQ, for frames whose qp offsets come from elsewhere.
+ * The plane sums and ssds are only gathered if b_energy. */
+static void frame_stats( x264_t *h, x264_frame_t *frame, int b_energy )
+{
+    if( b_energy )
+        for( int i = 0; i < 3; i++ )
+        {
+            frame->i_pixel_sum[i] = 0;
+            frame->i_pixel_ssd[i] = 0;
+        }
+    else if( !h->frames.b_have_lowres )
+        return;
+
+    for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
     {
-        uint64_t ssd = frame->i_pixel_ssd[i];
-        uint64_t sum = frame->i_pixel_sum[i];
-        int width  = 16*h->mb.i_mb_width  >> (i && CHROMA_H_SHIFT);
-        int height = 16*h->mb.i_mb_height >> (i && CHROMA_V_SHIFT);
-        frame->i_pixel_ssd[i] = ssd - (sum * sum + width * height / 2) / (width * height);
+        for( int mb_x = 0; b_energy && mb_x < h->mb.i_mb_width; mb_x++ )
+            ac_energy_mb( h, mb_x, mb_y, frame );
+        if( h->frames.b_have_lowres )
+            x264_slicetype_stats_row( h, frame, mb_y );
     }
+
+    if( h->frames.b_have_lowres )
+        x264_slicetype_stats_end( h, frame );
+    if( b_energy )
+        pixel_ssd_remove_mean( h, frame );
 }
 
 static int macroblock_tree_rescale_init( x264_t *h, x264_ratecontrol_t *rc )
@@ -571,6 +645,7 @@ int x264_macroblock_tree_read( x264_t *h, x264_frame_t *frame, float *quant_offs
         if( h->frames.b_have_lowres )
             for( int i = 0; i < h->mb.i_mb_count; i++ )
                 frame->i_inv_qscale_factor[i] = x264_exp2fix8( frame->f_qp_offset[i] );
+        frame_stats( h, frame, 0 );
         rc->mbtree.qpbuf_pos--;
     }
     else
@@ -581,6 +656,68 @@ fail:
     return -1;
 }
 
+/* Same as x264_macroblock_tree_read, but the qp offsets come from another
+ * encoder of the same source through x264_picture_t.prop.analysis. */
+int x264_macroblock_tree_import( x264_t *h, x264_frame_t *frame, x264_frame_analysis_t *analysis, float *quant_offsets )
+{
+    /* The rescale state is set up lazily, after the per-thread copies of rc[0] were made,
+     * so keep it in rc[0] only: imports run serially from the api thread, and
+     * x264_ratecontrol_delete frees it from there. */
+    x264_ratecontrol_t *rc = h->thread[0]->rc;
+
+    if( !analysis )
+    {
+        x264_log( h, X264_LOG_ERROR, "analysis import requires an analysis for every input frame\n" );
+        return -1;
+    }
+
+    if( analysis->i_type < X264_TYPE_AUTO || analysis->i_type > X264_TYPE_KEYFRAME )
+    {
+        x264_log( h, X264_LOG_ERROR, "imported frame type (%d) at %d is unknown\n", analysis->i_type, frame->i_frame );
+        return -1;
+    }
+    frame->i_type = frame->i_forced_type = analysis->i_type;
+
+    if( h->param.rc.b_mb_tree && analysis->qp_offsets )
+    {
+        /* The source dimensions are only known once the first analysis arrives. */
+        if( !rc->mbtree.src_mb_count )
+        {
+            rc->mbtree.srcdim[0] = analysis->i_mb_width * 16;
+            rc->mbtree.srcdim[1] = analysis->i_mb_height * 16;
+            if( macroblock_tree_rescale_init( h, rc ) < 0 )
+                return -1;
+            if( !rc->mbtree.rescale_enabled )
+            {
+                rc->mbtree.srcdim[0] = analysis->i_mb_width;
+                rc->mbtree.srcdim[1] = analysis->i_mb_height;
+            }
+        }
+        if( analysis->i_mb_width != rc->mbtree.srcdim[0] || analysis->i_mb_height != rc->mbtree.srcdim[1] )
+        {
+            x264_log( h, X264_LOG_ERROR, "imported analysis changed size from %dx%d to %dx%d macroblocks\n",
+                      rc->mbtree.srcdim[0], rc->mbtree.srcdim[1], analysis->i_mb_width, analysis->i_mb_height );
+            return -1;
+        }
+
+        if( rc->mbtree.rescale_enabled )
+        {
+            memcpy( rc->mbtree.scale_buffer[0], analysis->qp_offsets, rc->mbtree.src_mb_count * sizeof(float) );
+            macroblock_tree_rescale( h, rc, frame->f_qp_offset );
+        }
+        else
+            memcpy( frame->f_qp_offset, analysis->qp_offsets, h->mb.i_mb_count * sizeof(float) );
+        if( h->frames.b_have_lowres )
+            for( int i = 0; i < h->mb.i_mb_count; i++ )
+                frame->i_inv_qscale_factor[i] = x264_exp2fix8( frame->f_qp_offset[i] );
+        /* the weighted prediction analysis needs the plane statistics AQ would have gathered */
+        frame_stats( h, frame, h->param.analyse.i_weighted_pred );
+    }
+    else
+        x264_adaptive_quant_frame( h, frame, quant_offsets );
+    return 0;
+}
+
 int x264_reference_build_list_optimal( x264_t *h )
 {
     ratecontrol_entry_t *rce = h->rc->rce;
@@ -628,6 +765,110 @@ static char *strcat_filename( char *input, char *suffix )
     return output;
 }
 
+/* Analysis file: a header, then one record per input frame in input order.
+ *   header: "x264anls", int32 version, mb width, mb height, record size
+ *   record: int64 pts, int32 type, keyframe, has qp offsets, reserved,
+ *           float qp offsets[mb width * mb height] if it has them
+ * All in native byte order.  Records have a fixed size so that frame n is at
+ * header size + n * record size. */
+#define ANALYSIS_MAGIC "x264anls"
+#define ANALYSIS_VERSION 1
+#define ANALYSIS_HEADER_SIZE 24
+#define ANALYSIS_RECORD_SIZE( mb_count ) (24 + (mb_count) * (int)sizeof(float))
+
+static int analysis_file_open_out( x264_t *h, x264_ratecontrol_t *rc )
+{
+    /* write to a temp file, in case the input is the same file */
+    rc->psz_analysis_file_tmpname = strcat_filename( h->param.psz_analysis_out, ".temp" );
+    if( !rc->psz_analysis_file_tmpname )
+        return -1;
+    rc->p_analysis_file_out = x264_fopen( rc->psz_analysis_file_tmpname, "wb" );
+    if( !rc->p_analysis_file_out )
+    {
+        x264_log( h, X264_LOG_ERROR, "ratecontrol_init: can't open analysis file\n" );
+        return -1;
+    }
+    rc->analysis_record_size = ANALYSIS_RECORD_SIZE( h->mb.i_mb_count );
+    int32_t header[4] = { ANALYSIS_VERSION, h->mb.i_mb_width, h->mb.i_mb_height, rc->analysis_record_size };
+    if( fwrite( ANALYSIS_MAGIC, 8, 1, rc->p_analysis_file_out ) < 1 ||
+        fwrite( header, sizeof(header), 1, rc->p_analysis_file_out ) < 1 )
+    {
+        x264_log( h, X264_LOG_ERROR, "ratecontrol_init: analysis file could not be written to\n" );
+        return -1;
+    }
+    return 0;
+}
+
+static int analysis_file_open_in( x264_t *h, x264_ratecontrol_t *rc )
+{
+    char magic[8];
+    int32_t header[4];
+    rc->p_analysis_file_in = x264_fopen( h->param.psz_analysis_in, "rb" );
+    if( !rc->p_analysis_file_in )
+    {
+        x264_log( h, X264_LOG_ERROR, "ratecontrol_init: can't open analysis file\n" );
+        return -1;
+    }
+    if( fread( magic, 8, 1, rc->p_analysis_file_in ) < 1 || memcmp( magic, ANALYSIS_MAGIC, 8 ) ||
+        fread( header, sizeof(header), 1, rc->p_analysis_file_in ) < 1 )
+    {
+        x264_log( h, X264_LOG_ERROR, "ratecontrol_init: %s is not an analysis file\n", h->param.psz_analysis_in );
+        return -1;
+    }
+    if( header[0] != ANALYSIS_VERSION || header[1] <= 0 || header[2] <= 0 ||
+        header[1] > (1<<20) / header[2] || header[3] != ANALYSIS_RECORD_SIZE( header[1] * header[2] ) )
+    {
+        x264_log( h, X264_LOG_ERROR, "ratecontrol_init: unsupported analysis file version or size\n" );
+        return -1;
+    }
+    rc->analysis_mb_width  = header[1];
+    rc->analysis_mb_height = header[2];
+    rc->analysis_record_size = header[3];
+    CHECKED_MALLOC( rc->analysis_buffer, header[1] * header[2] * sizeof(float) );
+    return 0;
+fail:
+    return -1;
+}
+
+int x264_analysis_file_write( x264_t *h, const x264_frame_analysis_t *analysis, int i_frame )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    FILE *f = rc->p_analysis_file_out;
+    int32_t record[4] = { analysis->i_type, analysis->b_keyframe, !!analysis->qp_offsets, 0 };
+    if( fseek( f, ANALYSIS_HEADER_SIZE + (int64_t)i_frame * rc->analysis_record_size, SEEK_SET ) ||
+        fwrite( &analysis->i_pts, sizeof(int64_t), 1, f ) < 1 ||
+        fwrite( record, sizeof(record), 1, f ) < 1 ||
+        (analysis->qp_offsets && fwrite( analysis->qp_offsets, sizeof(float), h->mb.i_mb_count, f ) < (unsigned)h->mb.i_mb_count) )
+    {
+        x264_log( h, X264_LOG_ERROR, "analysis file could not be written to\n" );
+        return -1;
+    }
+    return 0;
+}
+
+int x264_analysis_file_read( x264_t *h, x264_frame_t *frame, float *quant_offsets )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    FILE *f = rc->p_analysis_file_in;
+    x264_frame_analysis_t analysis;
+    int32_t record[4];
+    int mb_count = rc->analysis_mb_width * rc->analysis_mb_height;
+    if( fseek( f, ANALYSIS_HEADER_SIZE + (int64_t)frame->i_frame * rc->analysis_record_size, SEEK_SET ) ||
+        fread( &analysis.i_pts, sizeof(int64_t), 1, f ) < 1 ||
+        fread( record, sizeof(record), 1, f ) < 1 ||
+        (record[2] && fread( rc->analysis_buffer, sizeof(float), mb_count, f ) < (unsigned)mb_count) )
+    {
+        x264_log( h, X264_LOG_ERROR, "analysis file has no frame %d\n", frame->i_frame );
+        return -1;
+    }
+    analysis.i_type      = record[0];
+    analysis.b_keyframe  = record[1];
+    analysis.i_mb_width  = rc->analysis_mb_width;
+    analysis.i_mb_height = rc->analysis_mb_height;
+    analysis.qp_offsets  = record[2] ? rc->analysis_buffer : NULL;
+    return x264_macroblock_tree_import( h, frame, &analysis, quant_offsets );
+}
+
 void x264_ratecontrol_init_reconfigurable( x264_t *h, int b_init )
 {
     x264_ratecontrol_t *rc = h->rc;
@@ -1187,6 +1428,11 @@ parse_error:
         }
     }
 
+    if( h->param.psz_analysis_out && analysis_file_open_out( h, rc ) < 0 )
+        return -1;
+    if( h->param.b_analysis_import && h->param.psz_analysis_in && analysis_file_open_in( h, rc ) < 0 )
+        return -1;
+
     if( h->param.rc.b_mb_tree && (h->param.rc.b_stat_read || h->param.rc.b_stat_write) )
     {
         if( !h->param.rc.b_stat_read )
@@ -1198,6 +1444,15 @@ parse_error:
             return -1;
     }
 
+    if( rc->b_vbv && h->i_thread_frames > 1 )
+    {
+        CHECKED_MALLOCZERO( rc->ledger, sizeof(rc_ledger_t) );
+        for( int i = 0; i < h->i_thread_frames; i++ )
+            rc->ledger->frame[i].i_frame = -1;
+        rc->ledger->i_frame_out = -1;
+        rc->ledger->i_buffer_fill = rc->buffer_fill_final_min / h->sps->vui.i_time_scale;
+    }
+
     for( int i = 0; i<h->param.i_threads; i++ )
     {
         h->thread[i]->rc = rc+i;
@@ -1386,10 +1641,23 @@ void x264_ratecontrol_delete( x264_t *h )
     }
     if( rc->p_mbtree_stat_file_in )
         fclose( rc->p_mbtree_stat_file_in );
+    if( rc->p_analysis_file_out )
+    {
+        b_regular_file = x264_is_regular_file( rc->p_analysis_file_out );
+        fclose( rc->p_analysis_file_out );
+        if( b_regular_file && x264_rename( rc->psz_analysis_file_tmpname, h->param.psz_analysis_out ) != 0 )
+            x264_log( h, X264_LOG_ERROR, "failed to rename \"%s\" to \"%s\"\n",
+                      rc->psz_analysis_file_tmpname, h->param.psz_analysis_out );
+        x264_free( rc->psz_analysis_file_tmpname );
+    }
+    if( rc->p_analysis_file_in )
+        fclose( rc->p_analysis_file_in );
+    x264_free( rc->analysis_buffer );
     x264_free( rc->pred );
     x264_free( rc->pred_b_from_p );
     x264_free( rc->entry );
     x264_free( rc->entry_out );
+    x264_free( rc->ledger );
     macroblock_tree_rescale_destroy( rc );
     if( rc->zones )
     {
@@ -1534,6 +1802,9 @@ void x264_ratecontrol_start( x264_t *h, int i_force_qp, int overhead )
 
     if( h->sh.i_type != SLICE_TYPE_B )
         rc->last_non_b_pict_type = h->sh.i_type;
+
+    if( rc->ledger )
+        ledger_publish_frame( h, h->i_frame, rc->frame_size_planned, rc->frame_size_planned );
 }
 
 static float predict_row_size( x264_t *h, int y, float qscale )
@@ -1586,16 +1857,9 @@ static float predict_row_size_to_end( x264_t *h, int y, float qp )
  *  eliminate all use of qp in row ratecontrol: make it entirely qscale-based.
  *  make this function stop being needlessly O(N^2)
  *  update more often than once per row? */
-int x264_ratecontrol_mb( x264_t *h, int bits )
+static int ratecontrol_row_end( x264_t *h, int y )
 {
     x264_ratecontrol_t *rc = h->rc;
-    const int y = h->mb.i_mb_y;
-
-    h->fdec->i_row_bits[y] += bits;
-    rc->qpa_aq += h->mb.i_qp;
-
-    if( h->mb.i_mb_x != h->mb.i_mb_width - 1 )
-        return 0;
 
     x264_emms();
     rc->qpa_rc += rc->qpm * h->mb.i_mb_width;
@@ -1615,9 +1879,14 @@ int x264_ratecontrol_mb( x264_t *h, int bits )
     if( SLICE_MBAFF && !(y&1) )
         return 0;
 
+    /* The frames ahead of this one have been coding all along: plan against where
+     * they stand now rather than where they stood when this one started. */
+    if( rc->ledger )
+        rc->buffer_fill = X264_MIN( ledger_buffer_fill( h ), rc->buffer_size ) - rc->buffer_overhead;
+
     /* FIXME: We don't currently support the case where there's a slice
      * boundary in between. */
-    int can_reencode_row = h->sh.i_first_mb <= ((h->mb.i_mb_y - SLICE_MBAFF) * h->mb.i_mb_stride);
+    int can_reencode_row = h->sh.i_first_mb <= ((y - SLICE_MBAFF) * h->mb.i_mb_stride);
 
     /* tweak quality based on difference from predicted size */
     float prev_row_qp = h->fdec->f_row_qp[y];
@@ -1734,26 +2003,138 @@ int x264_ratecontrol_mb( x264_t *h, int bits )
         }
     }
 
+    /* Once the last row is in, the estimate is the actual size and no longer bounded
+     * below by the plan. */
+    if( rc->ledger )
+        ledger_publish_frame( h, h->i_frame, y < h->i_threadslice_end-1 ? rc->frame_size_planned : bits_so_far,
+                              rc->frame_size_estimated );
+
     rc->qpa_rc_prev = rc->qpa_rc;
     rc->qpa_aq_prev = rc->qpa_aq;
 
     return 0;
 }
 
+int x264_ratecontrol_mb( x264_t *h, int bits )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    const int y = h->mb.i_mb_y;
+
+    h->fdec->i_row_bits[y] += bits;
+    rc->qpa_aq += h->mb.i_qp;
+
+    if( h->mb.i_mb_x != h->mb.i_mb_width - 1 )
+        return 0;
+
+    return ratecontrol_row_end( h, y );
+}
+
+/* Account for row y as a whole, encoded elsewhere at row qp qp in the given bits,
+ * with qp_sum the sum of its mb qps.  Returns -1 if it has to be re-encoded,
+ * like x264_ratecontrol_mb. */
+int x264_ratecontrol_row( x264_t *h, int y, float qp, int bits, int qp_sum )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    rc->qpm = qp;
+    h->fdec->i_row_bits[y] += bits;
+    rc->qpa_aq += qp_sum;
+    return ratecontrol_row_end( h, y );
+}
+
+/* Whether row y, about to be encoded at the current row qp, is likely to come out
+ * large enough for x264_ratecontrol_mb to ask for it to be re-encoded.  If so, fill
+ * qps with up to max qps to encode it at in the meantime, starting at the one it is
+ * expected to be re-encoded at, and return how many. */
+int x264_ratecontrol_row_speculate( x264_t *h, int y, float *qps, int max )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    if( !rc->b_vbv || SLICE_MBAFF || h->param.b_sliced_threads || h->sh.i_first_mb > y * h->mb.i_mb_stride )
+        return 0;
+
+    x264_emms();
+    float qp_absolute_max = h->param.rc.i_qp_max;
+    if( rc->rate_factor_max_increment )
+        qp_absolute_max = X264_MIN( qp_absolute_max, rc->qp_novbv + rc->rate_factor_max_increment );
+    float qp_max = X264_MIN( rc->qpm + h->param.rc.i_qp_step, qp_absolute_max );
+    if( rc->qpm >= qp_max )
+        return 0;
+    float bits = row_bits_so_far( h, y-1 ) + predict_row_size( h, y, qp2qscale( rc->qpm ) );
+
+    /* The last row is only ever re-encoded at qp_max. */
+    if( y == h->i_threadslice_end-1 )
+    {
+        if( bits <= X264_MIN( rc->frame_size_maximum, rc->buffer_fill ) )
+            return 0;
+        qps[0] = qp_max;
+        return 1;
+    }
+
+    /* Same limits as x264_ratecontrol_mb, which doesn't raise qps on the first few percent of the frame. */
+    if( bits < rc->frame_size_planned * 0.05f )
+        return 0;
+    float buffer_left_planned = X264_MAX( rc->buffer_fill - rc->frame_size_planned, 0.f );
+    float rc_tol = buffer_left_planned / h->param.i_threads * rc->rate_tolerance;
+    if( h->sh.i_type != SLICE_TYPE_I )
+        rc_tol *= 0.5f;
+    float max_frame_error = x264_clip3f( 1.0 / h->mb.i_mb_height, 0.05, 0.25 );
+    float max_frame_size = rc->frame_size_maximum - rc->frame_size_maximum * max_frame_error;
+    max_frame_size = X264_MIN( max_frame_size, rc->buffer_fill - rc->buffer_rate * max_frame_error );
+    float size_limit = X264_MIN( rc->frame_size_planned + rc_tol, max_frame_size );
+
+    float qp = rc->qpm;
+    while( qp <= qp_max && bits + predict_row_size_to_end( h, y, qp ) > size_limit )
+        qp += 0.5f;
+    if( qp <= qp_max )
+        return 0;
+
+    float qp_reencode = x264_clip3f( (rc->qpm + qp)*0.5f, rc->qpm + 1.0f, qp_max );
+    int n = 0;
+    while( n < max && (!n || qps[n-1] < qp_max) )
+    {
+        qps[n] = X264_MIN( qp_reencode + n, qp_max );
+        n++;
+    }
+    return n;
+}
+
+/* Of the qps a row was encoded at ahead of time, in increasing order, the first
+ * one that x264_ratecontrol_mb would accept after asking for a re-encode, or -1. */
+int x264_ratecontrol_row_pick( x264_t *h, const float *qps, int n )
+{
+    x264_emms();
+    for( int i = 0; i < n; i++ )
+        if( qps[i] >= h->rc->qpm )
+            return i;
+    return -1;
+}
+
+/* Ratecontrol of a context encoding rows ahead of time: all its mbs read is the row qp. */
+int x264_ratecontrol_row_context_new( x264_t *h )
+{
+    CHECKED_MALLOCZERO( h->rc, sizeof(x264_ratecontrol_t) );
+    return 0;
+fail:
+    return -1;
+}
+
+void x264_ratecontrol_row_context_set( x264_t *h, float qp )
+{
+    h->rc->qpm = qp;
+}
+
 int x264_ratecontrol_qp( x264_t *h )
 {
     x264_emms();
     return x264_clip3( h->rc->qpm + 0.5f, h->param.rc.i_qp_min, h->param.rc.i_qp_max );
 }
 
-int x264_ratecontrol_mb_qp( x264_t *h )
+static int mb_qp( x264_t *h, int mb_xy )
 {
-    x264_emms();
     float qp = h->rc->qpm;
     if( h->param.rc.i_aq_mode )
     {
          /* MB-tree currently doesn't adjust quantizers in unreferenced frames. */
-        float qp_offset = h->fdec->b_kept_as_ref ? h->fenc->f_qp_offset[h->mb.i_mb_xy] : h->fenc->f_qp_offset_aq[h->mb.i_mb_xy];
+        float qp_offset = h->fdec->b_kept_as_ref ? h->fenc->f_qp_offset[mb_xy] : h->fenc->f_qp_offset_aq[mb_xy];
         /* Scale AQ's effect towards zero in emergency mode. */
         if( qp > QP_MAX_SPEC )
             qp_offset *= (QP_MAX - qp) / (QP_MAX - QP_MAX_SPEC);
@@ -1762,6 +2143,55 @@ int x264_ratecontrol_mb_qp( x264_t *h )
     return x264_clip3( qp + 0.5f, h->param.rc.i_qp_min, h->param.rc.i_qp_max );
 }
 
+int x264_ratecontrol_mb_qp( x264_t *h )
+{
+    x264_emms();
+    return mb_qp( h, h->mb.i_mb_xy );
+}
+
+/* Lookahead pass: fill in the frame's stats as if it had been encoded at the frame
+ * qp, from its lookahead cost.  The bits model is fitted against fast first passes:
+ * texture and mv bits per mb are a power of the cost per mb times a power of qscale,
+ * of which the mvs take their share as estimated from the lowres mvs (a fixed share
+ * in I-frames, for the intra modes), and the rest is a constant per mb. */
+void x264_ratecontrol_lookahead_pass( x264_t *h )
+{
+    /* P, B, I, and B-frames kept as reference */
+    static const float bits_coeff[4] = { 69.3f, 1.61f, 37.3f, 4.43f };
+    static const float cost_exp[4]   = { 0.625f, 1.511f, 0.633f, 1.287f };
+    static const float qscale_exp[4] = { -1.985f, -3.262f, -1.618f, -2.766f };
+    static const float mv_coeff[4]   = { 0.742f, 0.182f, 0.081f, 0.236f };
+    static const float misc_coeff[4] = { 1.06f, 0.78f, 14.9f, 0.79f };
+    x264_ratecontrol_t *rc = h->rc;
+    int type = h->sh.i_type == SLICE_TYPE_B && h->fdec->b_kept_as_ref ? 3 : h->sh.i_type;
+
+    memset( &h->stat.frame, 0, sizeof(h->stat.frame) );
+    int satd = x264_rc_analyse_slice( h );
+    int mv_bits = x264_rc_analyse_slice_mbs( h );
+
+    x264_emms();
+    /* Lowres costs are in 8-bit terms already. */
+    float cost = (float)satd / h->mb.i_mb_count;
+    float qscale = qp2qscale( rc->qpm - QP_BD_OFFSET );
+#define MODEL_BITS( i ) (bits_coeff[i] * powf( cost, cost_exp[i] ) * powf( qscale, qscale_exp[i] ))
+    float bits = MODEL_BITS( type );
+    /* Inter mbs can always fall back to intra. */
+    if( type != SLICE_TYPE_I )
+        bits = X264_MIN( bits, MODEL_BITS( SLICE_TYPE_I ) );
+#undef MODEL_BITS
+    bits *= h->mb.i_mb_count;
+    float mv = mv_coeff[type] * (type == SLICE_TYPE_I ? bits : mv_bits);
+    h->stat.frame.i_mv_bits = X264_MIN( mv, bits );
+    h->stat.frame.i_tex_bits = bits - h->stat.frame.i_mv_bits;
+    h->stat.frame.i_misc_bits = misc_coeff[type] * h->mb.i_mb_count;
+
+    /* What x264_ratecontrol_mb would have summed up. */
+    rc->qpa_rc = rc->qpm * h->mb.i_mb_count;
+    rc->qpa_aq = 0;
+    for( int mb_xy = 0; mb_xy < h->mb.i_mb_count; mb_xy++ )
+        rc->qpa_aq += mb_qp( h, mb_xy );
+}
+
 /* In 2pass, force the same frame types as in the 1st pass */
 int x264_ratecontrol_slice_type( x264_t *h, int frame_num )
 {
@@ -1828,6 +2258,10 @@ int x264_ratecontrol_end( x264_t *h, int bits, int *filler )
 
     x264_emms();
 
+    /* Count the slices the lookahead pass didn't write. */
+    if( h->param.rc.b_lookahead_pass )
+        bits += h->stat.frame.i_tex_bits + h->stat.frame.i_mv_bits + h->stat.frame.i_misc_bits;
+
     h->stat.frame.i_mb_count_skip = mbs[P_SKIP] + mbs[B_SKIP];
     h->stat.frame.i_mb_count_i = mbs[I_16x16] + mbs[I_8x8] + mbs[I_4x4] + mbs[I_PCM];
     h->stat.frame.i_mb_count_p = mbs[P_L0] + mbs[P_8x8];
@@ -1942,6 +2376,13 @@ int x264_ratecontrol_end( x264_t *h, int bits, int *filler )
     *filler = update_vbv( h, bits );
     rc->filler_bits_sum += *filler * 8;
 
+    /* Out of flight: its bits are in the buffer now. */
+    if( rc->ledger )
+    {
+        ledger_publish_out( h, h->i_frame );
+        ledger_publish_frame( h, -1, 0, 0 );
+    }
+
     if( h->sps->vui.b_nal_hrd_parameters_present )
     {
         if( h->fenc->i_frame == 0 )
@@ -2206,31 +2647,104 @@ void x264_hrd_fullness( x264_t *h )
 
     int64_t decoder_buffer_fill = h->initial_cpb_removal_delay * denom / multiply_factor;
     rct->buffer_fill_final_min = X264_MIN( rct->buffer_fill_final_min, decoder_buffer_fill );
+    if( rct->ledger )
+        ledger_publish_out( h, rct->ledger->i_frame_out );
 }
 
-// provisionally update VBV according to the planned size of all frames currently in progress
-static void update_vbv_plan( x264_t *h, int overhead )
+static void ledger_frame_set( rc_ledger_frame_t *f, int i_frame, int i_cpb_duration, int i_bits_planned, int i_bits_estimated )
+{
+    x264_atomic_fetch_add( &f->seq, 1 );
+    x264_atomic_store( &f->i_frame, i_frame );
+    x264_atomic_store( &f->i_cpb_duration, i_cpb_duration );
+    x264_atomic_store( &f->i_bits_planned, i_bits_planned );
+    x264_atomic_store( &f->i_bits_estimated, i_bits_estimated );
+    x264_atomic_fetch_add( &f->seq, 1 );
+}
+
+static void ledger_frame_get( rc_ledger_frame_t *f, rc_ledger_frame_t *dst )
+{
+    int seq;
+    do
+    {
+        while( (seq = x264_atomic_load( &f->seq )) & 1 );
+        dst->i_frame = x264_atomic_load( &f->i_frame );
+        dst->i_cpb_duration = x264_atomic_load( &f->i_cpb_duration );
+        dst->i_bits_planned = x264_atomic_load( &f->i_bits_planned );
+        dst->i_bits_estimated = x264_atomic_load( &f->i_bits_estimated );
+    } while( x264_atomic_load( &f->seq ) != seq );
+}
+
+/* Publish the current frame's sizes for the other frame threads, or with i_frame
+ * -1 that it's out. */
+static void ledger_publish_frame( x264_t *h, int i_frame, double planned, double estimated )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    ledger_frame_set( &rc->ledger->frame[rc - h->thread[0]->rc], i_frame, h->fenc->i_cpb_duration, planned, estimated );
+}
+
+/* Publish the buffer after the frames out up to i_frame_out. */
+static void ledger_publish_out( x264_t *h, int i_frame_out )
+{
+    rc_ledger_t *ledger = h->rc->ledger;
+    int i_buffer_fill = h->thread[0]->rc->buffer_fill_final_min / h->sps->vui.i_time_scale;
+    x264_atomic_fetch_add( &ledger->seq, 1 );
+    x264_atomic_store( &ledger->i_frame_out, i_frame_out );
+    x264_atomic_store( &ledger->i_buffer_fill, i_buffer_fill );
+    x264_atomic_fetch_add( &ledger->seq, 1 );
+}
+
+/* The buffer before the current frame if the frames in flight ahead of it hit
+ * their bit budget, from their latest published sizes.  Safe to call from the
+ * frame threads at any point of their frame. */
+static double ledger_buffer_fill( x264_t *h )
 {
     x264_ratecontrol_t *rcc = h->rc;
-    rcc->buffer_fill = h->thread[0]->rc->buffer_fill_final_min / h->sps->vui.i_time_scale;
-    if( h->i_thread_frames > 1 )
+    rc_ledger_t *ledger = rcc->ledger;
+    rc_ledger_frame_t ahead[X264_THREAD_MAX];
+    int n = 0;
+
+    /* Read the frames before the buffer: one that gets out in between is then
+     * counted in the buffer and skipped below, rather than missed by both. */
+    int j = rcc - h->thread[0]->rc;
+    for( int i = 1; i < h->i_thread_frames; i++ )
     {
-        int j = rcc - h->thread[0]->rc;
-        for( int i = 1; i < h->i_thread_frames; i++ )
-        {
-            x264_t *t = h->thread[ (j+i)%h->i_thread_frames ];
-            double bits = t->rc->frame_size_planned;
-            if( !t->b_thread_active )
-                continue;
-            bits = X264_MAX(bits, t->rc->frame_size_estimated);
-            rcc->buffer_fill -= bits;
-            rcc->buffer_fill = X264_MAX( rcc->buffer_fill, 0 );
-            rcc->buffer_fill += t->rc->buffer_rate;
-            rcc->buffer_fill = X264_MIN( rcc->buffer_fill, rcc->buffer_size );
-        }
+        ledger_frame_get( &ledger->frame[(j+i) % h->i_thread_frames], &ahead[n] );
+        if( ahead[n].i_frame >= 0 && ahead[n].i_frame < h->i_frame )
+            n++;
+    }
+
+    int seq, i_frame_out, i_buffer_fill;
+    do
+    {
+        while( (seq = x264_atomic_load( &ledger->seq )) & 1 );
+        i_frame_out = x264_atomic_load( &ledger->i_frame_out );
+        i_buffer_fill = x264_atomic_load( &ledger->i_buffer_fill );
+    } while( x264_atomic_load( &ledger->seq ) != seq );
+
+    double buffer_fill = i_buffer_fill;
+    for( int i = 0; i < n; i++ )
+    {
+        if( ahead[i].i_frame <= i_frame_out )
+            continue;
+        buffer_fill -= X264_MAX( ahead[i].i_bits_planned, ahead[i].i_bits_estimated );
+        buffer_fill = X264_MAX( buffer_fill, 0 );
+        buffer_fill += (double)ahead[i].i_cpb_duration * rcc->vbv_max_rate * h->sps->vui.i_num_units_in_tick / h->sps->vui.i_time_scale;
+        buffer_fill = X264_MIN( buffer_fill, rcc->buffer_size );
     }
+    return buffer_fill;
+}
+
+// provisionally update VBV according to the planned size of all frames currently in progress
+static void update_vbv_plan( x264_t *h, int overhead )
+{
+    x264_ratecontrol_t *rcc = h->rc;
+    if( rcc->ledger )
+        rcc->buffer_fill = ledger_buffer_fill( h );
+    else
+        rcc->buffer_fill = h->thread[0]->rc->buffer_fill_final_min / h->sps->vui.i_time_scale;
     rcc->buffer_fill = X264_MIN( rcc->buffer_fill, rcc->buffer_size );
     rcc->buffer_fill -= overhead;
+    rcc->buffer_overhead = overhead;
 }
 
 // apply VBV constraints and clip qscale to between lmin and lmax
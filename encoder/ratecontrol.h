@@ -53,6 +53,12 @@ int x264_encoder_reconfig_apply( x264_t *h, x264_param_t *param );
 void x264_adaptive_quant_frame( x264_t *h, x264_frame_t *frame, float *quant_offsets );
 #define x264_macroblock_tree_read x264_template(macroblock_tree_read)
 int  x264_macroblock_tree_read( x264_t *h, x264_frame_t *frame, float *quant_offsets );
+#define x264_macroblock_tree_import x264_template(macroblock_tree_import)
+int  x264_macroblock_tree_import( x264_t *h, x264_frame_t *frame, x264_frame_analysis_t *analysis, float *quant_offsets );
+#define x264_analysis_file_write x264_template(analysis_file_write)
+int  x264_analysis_file_write( x264_t *h, const x264_frame_analysis_t *analysis, int i_frame );
+#define x264_analysis_file_read x264_template(analysis_file_read)
+int  x264_analysis_file_read( x264_t *h, x264_frame_t *frame, float *quant_offsets );
 #define x264_reference_build_list_optimal x264_template(reference_build_list_optimal)
 int  x264_reference_build_list_optimal( x264_t *h );
 #define x264_thread_sync_ratecontrol x264_template(thread_sync_ratecontrol)
@@ -67,6 +73,18 @@ int  x264_ratecontrol_slice_type( x264_t *, int i_frame );
 void x264_ratecontrol_set_weights( x264_t *h, x264_frame_t *frm );
 #define x264_ratecontrol_mb x264_template(ratecontrol_mb)
 int  x264_ratecontrol_mb( x264_t *, int bits );
+#define x264_ratecontrol_row x264_template(ratecontrol_row)
+int  x264_ratecontrol_row( x264_t *, int y, float qp, int bits, int qp_sum );
+#define x264_ratecontrol_lookahead_pass x264_template(ratecontrol_lookahead_pass)
+void x264_ratecontrol_lookahead_pass( x264_t * );
+#define x264_ratecontrol_row_speculate x264_template(ratecontrol_row_speculate)
+int  x264_ratecontrol_row_speculate( x264_t *, int y, float *qps, int max );
+#define x264_ratecontrol_row_pick x264_template(ratecontrol_row_pick)
+int  x264_ratecontrol_row_pick( x264_t *, const float *qps, int n );
+#define x264_ratecontrol_row_context_new x264_template(ratecontrol_row_context_new)
+int  x264_ratecontrol_row_context_new( x264_t * );
+#define x264_ratecontrol_row_context_set x264_template(ratecontrol_row_context_set)
+void x264_ratecontrol_row_context_set( x264_t *, float qp );
 #define x264_ratecontrol_qp x264_template(ratecontrol_qp)
 int  x264_ratecontrol_qp( x264_t * );
 #define x264_ratecontrol_mb_qp x264_template(ratecontrol_mb_qp)
@@ -77,6 +95,12 @@ int  x264_ratecontrol_end( x264_t *, int bits, int *filler );
 void x264_ratecontrol_summary( x264_t * );
 #define x264_rc_analyse_slice x264_template(rc_analyse_slice)
 int  x264_rc_analyse_slice( x264_t *h );
+#define x264_rc_analyse_slice_mbs x264_template(rc_analyse_slice_mbs)
+int  x264_rc_analyse_slice_mbs( x264_t *h );
+#define x264_slicetype_stats_row x264_template(slicetype_stats_row)
+void x264_slicetype_stats_row( x264_t *h, x264_frame_t *fenc, int mb_y );
+#define x264_slicetype_stats_end x264_template(slicetype_stats_end)
+void x264_slicetype_stats_end( x264_t *h, x264_frame_t *fenc );
 #define x264_threads_distribute_ratecontrol x264_template(threads_distribute_ratecontrol)
 void x264_threads_distribute_ratecontrol( x264_t *h );
 #define x264_threads_merge_ratecontrol x264_template(threads_merge_ratecontrol)
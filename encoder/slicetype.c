@@ -281,12 +281,11 @@ static NOINLINE unsigned int weight_cost_chroma444( x264_t *h, x264_frame_t *fen
     return cost;
 }
 
-void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int b_lookahead )
+static void weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int b_lookahead, x264_weight_t *weights )
 {
     int i_delta_index = fenc->i_frame - ref->i_frame - 1;
     /* epsilon is chosen to require at least a numerator of 127 (with denominator = 128) */
     const float epsilon = 1.f/128.f;
-    x264_weight_t *weights = fenc->weight[0];
     SET_WEIGHT( weights[0], 0, 1, 0, 0 );
     SET_WEIGHT( weights[1], 0, 1, 0, 0 );
     SET_WEIGHT( weights[2], 0, 1, 0, 0 );
@@ -486,30 +485,144 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
     for( int i = 1; i <= 2; i++ )
         if( weights[i].weightfn )
             h->mc.weight_cache( h, &weights[i] );
+}
+
+/* scale lowres in lookahead for slicetype_frame_cost */
+static pixel *weights_scale_lowres( x264_t *h, pixel *dst, x264_frame_t *ref, x264_weight_t *w )
+{
+    pixel *src = ref->buffer_lowres;
+    int width = ref->i_width_lowres + PADH2;
+    int height = ref->i_lines_lowres + PADV*2;
+    x264_weight_scale_plane( h, dst, ref->i_stride_lowres, src, ref->i_stride_lowres,
+                             width, height, w );
+    return dst + PADH_ALIGN + ref->i_stride_lowres * PADV;
+}
+
+void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int b_lookahead )
+{
+    weights_analyse( h, fenc, ref, b_lookahead, fenc->weight[0] );
+    if( fenc->weight[0][0].weightfn && b_lookahead )
+        fenc->weighted[0] = weights_scale_lowres( h, h->mb.p_weight_buf[0], ref, fenc->weight[0] );
+}
+
+/* The lookahead tries each frame as a P-frame against several references, so its weights are kept
+ * per reference distance.  They only depend on the two frames, which lets weights_lowres_threads work
+ * them out for the whole window ahead of the frame costs.  The plane scaled for the nearest reference
+ * is kept as well, in frames that have room for it. */
+static void weights_analyse_lowres( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref )
+{
+    int dist = fenc->i_frame - ref->i_frame - 1;
+    x264_weight_t *w = fenc->lowres_weight[dist];
+    weights_analyse( h, fenc, ref, 1, w );
+    if( w[0].weightfn && !dist && fenc->buffer_weighted_lowres )
+        weights_scale_lowres( h, fenc->buffer_weighted_lowres, ref, w );
+    fenc->b_lowres_weight[dist] = 1;
+}
+
+static const x264_weight_t *weights_lowres( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref )
+{
+    int dist = fenc->i_frame - ref->i_frame - 1;
+    x264_weight_t *w = fenc->lowres_weight[dist];
+    if( !fenc->b_lowres_weight[dist] )
+        weights_analyse_lowres( h, fenc, ref );
+    memcpy( fenc->weight[0], w, sizeof(fenc->weight[0]) );
+    if( w[0].weightfn )
+    {
+        if( !dist && fenc->buffer_weighted_lowres )
+            fenc->weighted[0] = fenc->buffer_weighted_lowres + PADH_ALIGN + ref->i_stride_lowres * PADV;
+        else
+            fenc->weighted[0] = weights_scale_lowres( h, h->mb.p_weight_buf[0], ref, w );
+    }
+    return fenc->weight[0];
+}
+
+#if HAVE_THREAD
+typedef struct
+{
+    x264_t *h;
+    x264_frame_t **frames;
+    int num_frames;
+    int max_dist;
+    int thread;
+    int threads;
+} x264_slicetype_weights_t;
+
+static void weights_lowres_pairs( x264_slicetype_weights_t *s )
+{
+    for( int b = 1, n = 0; b <= s->num_frames; b++ )
+        for( int dist = 1; dist <= s->max_dist && dist <= b; dist++, n++ )
+        {
+            x264_frame_t *fenc = s->frames[b];
+            if( n % s->threads == s->thread && !fenc->b_lowres_weight[dist-1] && fenc->b_intra_calculated )
+                weights_analyse_lowres( s->h, fenc, s->frames[b-dist] );
+        }
+    x264_emms();
+}
+
+/* Analyse the weights of every pair of frames in the window the frame costs may try as a P-frame and its
+ * reference on the lookahead threads.  Pairs whose intra costs aren't known yet are left to the lookahead.
+ * Every lookahead thread has a p_weight_buf whenever weightp is on, see x264_encoder_open. */
+static void weights_lowres_threads( x264_t *h, x264_frame_t **frames, int num_frames )
+{
+    x264_slicetype_weights_t s[X264_LOOKAHEAD_THREAD_MAX];
+    int threads = h->param.i_lookahead_threads;
+    for( int i = 0; i < threads; i++ )
+    {
+        s[i] = (x264_slicetype_weights_t){ h->lookahead_thread[i], frames, num_frames, h->param.i_bframe+1, i, threads };
+        x264_threadpool_run( h->lookaheadpool, (void*)weights_lowres_pairs, &s[i] );
+    }
+    for( int i = 0; i < threads; i++ )
+        x264_threadpool_wait( h->lookaheadpool, &s[i] );
+}
+#endif
+
+/* A small, arbitrary bias to avoid VBV problems caused by zero-residual lookahead blocks. */
+#define LOWRES_PENALTY 4
+
+/* Intra cost of the lowres mb at src, copied to p_fenc, predicted from the neighbouring source pixels. */
+static int lowres_intra_mb_cost( x264_t *h, pixel *p_fenc, pixel *src, intptr_t i_stride, int i_lambda )
+{
+    ALIGNED_ARRAY_16( pixel, pix1,[9*FDEC_STRIDE] );
+    ALIGNED_ARRAY_16( pixel, edge,[36] );
+    pixel *pix = &pix1[8+FDEC_STRIDE];
+    const int intra_penalty = 5 * i_lambda;
+    int satds[3];
+    int pixoff = 4 / SIZEOF_PIXEL;
+
+    /* Avoid store forwarding stalls by writing larger chunks */
+    memcpy( pix-FDEC_STRIDE, src-i_stride, 16 * SIZEOF_PIXEL );
+    for( int i = -1; i < 8; i++ )
+        M32( &pix[i*FDEC_STRIDE-pixoff] ) = M32( &src[i*i_stride-pixoff] );
+
+    h->pixf.intra_mbcmp_x3_8x8c( p_fenc, pix, satds );
+    int i_icost = X264_MIN3( satds[0], satds[1], satds[2] );
 
-    if( weights[0].weightfn && b_lookahead )
+    if( h->param.analyse.i_subpel_refine > 1 )
     {
-        //scale lowres in lookahead for slicetype_frame_cost
-        pixel *src = ref->buffer_lowres;
-        pixel *dst = h->mb.p_weight_buf[0];
-        int width = ref->i_width_lowres + PADH2;
-        int height = ref->i_lines_lowres + PADV*2;
-        x264_weight_scale_plane( h, dst, ref->i_stride_lowres, src, ref->i_stride_lowres,
-                                 width, height, &weights[0] );
-        fenc->weighted[0] = h->mb.p_weight_buf[0] + PADH_ALIGN + ref->i_stride_lowres * PADV;
+        h->predict_8x8c[I_PRED_CHROMA_P]( pix );
+        int satd = h->pixf.mbcmp[PIXEL_8x8]( p_fenc, FENC_STRIDE, pix, FDEC_STRIDE );
+        i_icost = X264_MIN( i_icost, satd );
+        h->predict_8x8_filter( pix, edge, ALL_NEIGHBORS, ALL_NEIGHBORS );
+        for( int i = 3; i < 9; i++ )
+        {
+            h->predict_8x8[i]( pix, edge );
+            satd = h->pixf.mbcmp[PIXEL_8x8]( p_fenc, FENC_STRIDE, pix, FDEC_STRIDE );
+            i_icost = X264_MIN( i_icost, satd );
+        }
     }
+
+    return ((i_icost + intra_penalty) >> (BIT_DEPTH - 8)) + LOWRES_PENALTY;
 }
 
 /* Output buffers are separated by 128 bytes to avoid false sharing of cachelines
  * in multithreaded lookahead. */
 #define PAD_SIZE 32
-/* cost_est, cost_est_aq, intra_mbs, num rows */
-#define NUM_INTS 4
+/* cost_est, cost_est_aq, intra_mbs */
+#define NUM_INTS 3
 #define COST_EST 0
 #define COST_EST_AQ 1
 #define INTRA_MBS 2
-#define NUM_ROWS 3
-#define ROW_SATD (NUM_INTS + (h->mb.i_mb_y - h->i_threadslice_start))
+#define ROW_SATD (NUM_INTS + h->mb.i_mb_y)
 
 static void slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
                                x264_frame_t **frames, int p0, int p1, int b,
@@ -538,8 +651,6 @@ static void slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
     x264_me_t m[2];
     int i_bcost = COST_MAX;
     int list_used = 0;
-    /* A small, arbitrary bias to avoid VBV problems caused by zero-residual lookahead blocks. */
-    int lowres_penalty = 4;
 
     h->mb.pic.p_fenc[0] = h->mb.pic.fenc_buf;
     h->mc.copy[PIXEL_8x8]( h->mb.pic.p_fenc[0], FENC_STRIDE, &fenc->lowres[0][i_pel_offset], i_stride, 8 );
@@ -657,7 +768,7 @@ static void slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
         {
             int i_mvc = 0;
             int16_t (*fenc_mv)[2] = fenc_mvs[l];
-            ALIGNED_ARRAY_8( int16_t, mvc,[4],[2] );
+            ALIGNED_ARRAY_8( int16_t, mvc,[5],[2] );
 
             /* Reverse-order MV prediction. */
             M32( mvc[0] ) = 0;
@@ -679,6 +790,18 @@ static void slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
             else
                 x264_median_mv( m[l].mvp, mvc[0], mvc[1], mvc[2] );
 
+            /* Coarse-to-fine: the vector this block got on the level the frametype decisions were made on. */
+            x264_frame_t *coarse = fenc->coarse;
+            int dist = l ? p1-b : b-p0;
+            if( coarse && coarse->lowres_mvs[l][dist-1][0][0] != 0x7FFF )
+            {
+                int level = h->param.i_lookahead_levels;
+                int coarse_xy = (i_mb_x >> level) + (i_mb_y >> level) * (coarse->i_width_lowres >> 3);
+                mvc[i_mvc][0] = coarse->lowres_mvs[l][dist-1][coarse_xy][0] * (1 << level);
+                mvc[i_mvc][1] = coarse->lowres_mvs[l][dist-1][coarse_xy][1] * (1 << level);
+                i_mvc++;
+            }
+
             /* Fast skip for cases of near-zero residual.  Shortcut: don't bother except in the mv0 case,
              * since anything else is likely to have enough residual to not trigger the skip. */
             if( !M32( m[l].mvp ) )
@@ -714,36 +837,7 @@ skip_motionest:
 lowres_intra_mb:
     if( !fenc->b_intra_calculated )
     {
-        ALIGNED_ARRAY_16( pixel, edge,[36] );
-        pixel *pix = &pix1[8+FDEC_STRIDE];
-        pixel *src = &fenc->lowres[0][i_pel_offset];
-        const int intra_penalty = 5 * a->i_lambda;
-        int satds[3];
-        int pixoff = 4 / SIZEOF_PIXEL;
-
-        /* Avoid store forwarding stalls by writing larger chunks */
-        memcpy( pix-FDEC_STRIDE, src-i_stride, 16 * SIZEOF_PIXEL );
-        for( int i = -1; i < 8; i++ )
-            M32( &pix[i*FDEC_STRIDE-pixoff] ) = M32( &src[i*i_stride-pixoff] );
-
-        h->pixf.intra_mbcmp_x3_8x8c( h->mb.pic.p_fenc[0], pix, satds );
-        int i_icost = X264_MIN3( satds[0], satds[1], satds[2] );
-
-        if( h->param.analyse.i_subpel_refine > 1 )
-        {
-            h->predict_8x8c[I_PRED_CHROMA_P]( pix );
-            int satd = h->pixf.mbcmp[PIXEL_8x8]( h->mb.pic.p_fenc[0], FENC_STRIDE, pix, FDEC_STRIDE );
-            i_icost = X264_MIN( i_icost, satd );
-            h->predict_8x8_filter( pix, edge, ALL_NEIGHBORS, ALL_NEIGHBORS );
-            for( int i = 3; i < 9; i++ )
-            {
-                h->predict_8x8[i]( pix, edge );
-                satd = h->pixf.mbcmp[PIXEL_8x8]( h->mb.pic.p_fenc[0], FENC_STRIDE, pix, FDEC_STRIDE );
-                i_icost = X264_MIN( i_icost, satd );
-            }
-        }
-
-        i_icost = ((i_icost + intra_penalty) >> (BIT_DEPTH - 8)) + lowres_penalty;
+        int i_icost = lowres_intra_mb_cost( h, h->mb.pic.p_fenc[0], &fenc->lowres[0][i_pel_offset], i_stride, a->i_lambda );
         fenc->i_intra_cost[i_mb_xy] = i_icost;
         int i_icost_aq = i_icost;
         if( h->param.rc.i_aq_mode )
@@ -755,7 +849,7 @@ lowres_intra_mb:
             output_intra[COST_EST_AQ] += i_icost_aq;
         }
     }
-    i_bcost = (i_bcost >> (BIT_DEPTH - 8)) + lowres_penalty;
+    i_bcost = (i_bcost >> (BIT_DEPTH - 8)) + LOWRES_PENALTY;
 
     /* forbid intra-mbs in B-frames, because it's rare and not worth checking */
     /* FIXME: Should we still forbid them now that we cache intra scores? */
@@ -791,10 +885,105 @@ lowres_intra_mb:
 }
 #undef TRY_BIDIR
 
-#define NUM_MBS\
-   (h->mb.i_mb_width > 2 && h->mb.i_mb_height > 2 ?\
-   (h->mb.i_mb_width - 2) * (h->mb.i_mb_height - 2) :\
-    h->mb.i_mb_width * h->mb.i_mb_height)
+#define NUM_MBS( h )\
+   ((h)->mb.i_mb_width > 2 && (h)->mb.i_mb_height > 2 ?\
+   ((h)->mb.i_mb_width - 2) * ((h)->mb.i_mb_height - 2) :\
+    (h)->mb.i_mb_width * (h)->mb.i_mb_height)
+
+/* The lowres statistics of a new frame are gathered row by row in the same sweep as its AC energies
+ * (x264_adaptive_quant_frame): the intra costs the lookahead would otherwise compute the first time it
+ * costs the frame, and for the scenecut pre-pass the mean and variance of each block and the luma
+ * histogram.  OpenCL computes its intra costs on the GPU along with the frame upload, so it keeps doing so. */
+void x264_slicetype_stats_row( x264_t *h, x264_frame_t *fenc, int mb_y )
+{
+    ALIGNED_ARRAY_64( pixel, p_fenc,[FENC_STRIDE*8] );
+    intptr_t stride = fenc->i_stride_lowres;
+    pixel *src = fenc->lowres[0] + 8*mb_y*stride;
+    int b_intra = !h->param.b_opencl;
+    int i_lambda = x264_lambda_tab[X264_LOOKAHEAD_QP];
+
+    for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
+    {
+        int mb_xy = mb_x + mb_y*h->mb.i_mb_width;
+        if( b_intra )
+        {
+            h->mc.copy[PIXEL_8x8]( p_fenc, FENC_STRIDE, src + 8*mb_x, stride, 8 );
+            fenc->i_intra_cost[mb_xy] = lowres_intra_mb_cost( h, p_fenc, src + 8*mb_x, stride, i_lambda );
+        }
+        if( h->param.b_scenecut_prepass )
+        {
+            uint64_t res = h->pixf.var[PIXEL_8x8]( src + 8*mb_x, stride );
+            uint32_t sum = (uint32_t)res;
+            fenc->i_lowres_block_sum[mb_xy] = sum;
+            fenc->i_lowres_block_var[mb_xy] = (res >> 32) - (((uint64_t)sum * sum) >> 6);
+        }
+    }
+
+    if( h->param.b_scenecut_prepass )
+    {
+        /* interleaved partial histograms so that runs of equal pixels don't serialize on one counter */
+        uint32_t hist[4][LOWRES_HIST_BINS] = {{0}};
+        for( int y = 0; y < 8; y++, src += stride )
+            for( int x = 0; x < fenc->i_width_lowres; x += 4 )
+            {
+                hist[0][src[x+0] >> (BIT_DEPTH-5)]++;
+                hist[1][src[x+1] >> (BIT_DEPTH-5)]++;
+                hist[2][src[x+2] >> (BIT_DEPTH-5)]++;
+                hist[3][src[x+3] >> (BIT_DEPTH-5)]++;
+            }
+        for( int i = 0; i < LOWRES_HIST_BINS; i++ )
+            fenc->i_lowres_hist[i] = (mb_y ? fenc->i_lowres_hist[i] : 0) + hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+    }
+    x264_emms();
+}
+
+/* Sum up the intra costs once the AQ offsets they are weighted with are known, as slicetype_frame_cost
+ * would have for an I-frame. */
+void x264_slicetype_stats_end( x264_t *h, x264_frame_t *fenc )
+{
+    if( h->param.b_opencl )
+        return;
+
+    int cost = 0, cost_aq = 0, intra_mbs = 0;
+    for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
+    {
+        int row_satd = 0;
+        for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
+        {
+            int mb_xy = mb_x + mb_y*h->mb.i_mb_width;
+            int i_icost = fenc->i_intra_cost[mb_xy];
+            int i_icost_aq = i_icost;
+            if( h->param.rc.i_aq_mode )
+                i_icost_aq = (i_icost_aq * fenc->i_inv_qscale_factor[mb_xy] + 128) >> 8;
+            row_satd += i_icost_aq;
+            if( (mb_x > 0 && mb_x < h->mb.i_mb_width - 1 && mb_y > 0 && mb_y < h->mb.i_mb_height - 1) ||
+                h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2 )
+            {
+                cost += i_icost;
+                cost_aq += i_icost_aq;
+                intra_mbs++;
+            }
+            fenc->lowres_costs[0][0][mb_xy] = X264_MIN( i_icost, LOWRES_COST_MASK );
+        }
+        if( h->param.rc.i_vbv_buffer_size )
+            fenc->i_row_satds[0][0][mb_y] = row_satd;
+    }
+    fenc->i_cost_est[0][0] = cost;
+    fenc->i_cost_est_aq[0][0] = cost_aq;
+    fenc->i_intra_mbs[0] = intra_mbs;
+    fenc->b_intra_calculated = 1;
+}
+
+/* Lookahead threads share the rows of a frame as a wavefront: each mb's MV predictors include
+ * the mbs below it, so a row can only advance while it stays behind the row below. */
+typedef struct
+{
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv;
+    int next_row;  /* rows handed out so far, from the bottom */
+    int waiters;
+    int *row_done; /* mbs finished in each row */
+} x264_slicetype_wavefront_t;
 
 typedef struct
 {
@@ -809,28 +998,84 @@ typedef struct
     const x264_weight_t *w;
     int *output_inter;
     int *output_intra;
+    x264_slicetype_wavefront_t *wavefront;
 } x264_slicetype_slice_t;
 
+static void wavefront_wait( x264_slicetype_wavefront_t *wf, int *row_done, int count )
+{
+    if( x264_atomic_load( row_done ) >= count )
+        return;
+    x264_pthread_mutex_lock( &wf->mutex );
+    x264_atomic_fetch_add( &wf->waiters, 1 );
+    while( x264_atomic_load( row_done ) < count )
+        x264_pthread_cond_wait( &wf->cv, &wf->mutex );
+    x264_atomic_fetch_add( &wf->waiters, -1 );
+    x264_pthread_mutex_unlock( &wf->mutex );
+}
+
+static void wavefront_signal( x264_slicetype_wavefront_t *wf, int *row_done, int count )
+{
+    x264_atomic_store( row_done, count );
+    if( x264_atomic_load( &wf->waiters ) )
+    {
+        x264_pthread_mutex_lock( &wf->mutex );
+        x264_pthread_cond_broadcast( &wf->cv );
+        x264_pthread_mutex_unlock( &wf->mutex );
+    }
+}
+
 static void slicetype_slice_cost( x264_slicetype_slice_t *s )
 {
     x264_t *h = s->h;
+    x264_slicetype_wavefront_t *wf = s->wavefront;
 
     /* Lowres lookahead goes backwards because the MVs are used as predictors in the main encode.
      * This considerably improves MV prediction overall. */
 
     /* The edge mbs seem to reduce the predictive quality of the
      * whole frame's score, but are needed for a spatial distribution. */
-    int do_edges = h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size || h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
+    int do_edges = h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size || h->param.rc.b_lookahead_pass
+                || h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
 
-    int start_y = X264_MIN( h->i_threadslice_end - 1, h->mb.i_mb_height - 2 + do_edges );
-    int end_y = X264_MAX( h->i_threadslice_start, 1 - do_edges );
+    int start_y = h->mb.i_mb_height - 2 + do_edges;
+    int end_y = 1 - do_edges;
     int start_x = h->mb.i_mb_width - 2 + do_edges;
     int end_x = 1 - do_edges;
+    int row_len = start_x - end_x + 1;
+
+    if( !wf )
+    {
+        for( h->mb.i_mb_y = start_y; h->mb.i_mb_y >= end_y; h->mb.i_mb_y-- )
+            for( h->mb.i_mb_x = start_x; h->mb.i_mb_x >= end_x; h->mb.i_mb_x-- )
+                slicetype_mb_cost( h, s->a, s->frames, s->p0, s->p1, s->b, s->dist_scale_factor,
+                                   s->do_search, s->w, s->output_inter, s->output_intra );
+        return;
+    }
 
-    for( h->mb.i_mb_y = start_y; h->mb.i_mb_y >= end_y; h->mb.i_mb_y-- )
-        for( h->mb.i_mb_x = start_x; h->mb.i_mb_x >= end_x; h->mb.i_mb_x-- )
+    while( (h->mb.i_mb_y = start_y - x264_atomic_fetch_add( &wf->next_row, 1 )) >= end_y )
+    {
+        int *row_done = &wf->row_done[h->mb.i_mb_y];
+        int b_below = h->mb.i_mb_y < start_y;
+        for( int i = 0; i < row_len; i++ )
+        {
+            h->mb.i_mb_x = start_x - i;
+            /* wait for the mb below and to the left */
+            if( b_below )
+                wavefront_wait( wf, row_done+1, X264_MIN( i+2, row_len ) );
             slicetype_mb_cost( h, s->a, s->frames, s->p0, s->p1, s->b, s->dist_scale_factor,
                                s->do_search, s->w, s->output_inter, s->output_intra );
+            wavefront_signal( wf, row_done, i+1 );
+        }
+    }
+}
+
+/* Check whether we already evaluated this frame
+ * If we have tried this frame as P, then we have also tried
+ * the preceding frames as B. (is this still true?) */
+/* Also check that we already calculated the row SATDs for the current frame. */
+static int slicetype_frame_cost_cached( x264_t *h, x264_frame_t *fenc, int p0, int p1, int b )
+{
+    return fenc->i_cost_est[b-p0][p1-b] >= 0 && (!h->param.rc.i_vbv_buffer_size || fenc->i_row_satds[b-p0][p1-b][0] != -1);
 }
 
 static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
@@ -841,11 +1086,7 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
     const x264_weight_t *w = x264_weight_none;
     x264_frame_t *fenc = frames[b];
 
-    /* Check whether we already evaluated this frame
-     * If we have tried this frame as P, then we have also tried
-     * the preceding frames as B. (is this still true?) */
-    /* Also check that we already calculated the row SATDs for the current frame. */
-    if( fenc->i_cost_est[b-p0][p1-b] >= 0 && (!h->param.rc.i_vbv_buffer_size || fenc->i_row_satds[b-p0][p1-b][0] != -1) )
+    if( slicetype_frame_cost_cached( h, fenc, p0, p1, b ) )
         i_score = fenc->i_cost_est[b-p0][p1-b];
     else
     {
@@ -859,8 +1100,7 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
             if( h->param.analyse.i_weighted_pred && b == p1 )
             {
                 x264_emms();
-                x264_weights_analyse( h, fenc, frames[p0], 1 );
-                w = fenc->weight[0];
+                w = weights_lowres( h, fenc, frames[p0] );
             }
             fenc->lowres_mvs[0][b-p0-1][0][0] = 0;
         }
@@ -869,11 +1109,19 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
         if( p1 != p0 )
             dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
 
-        int output_buf_size = h->mb.i_mb_height + (NUM_INTS + PAD_SIZE) * h->param.i_lookahead_threads;
-        int *output_inter[X264_LOOKAHEAD_THREAD_MAX+1];
-        int *output_intra[X264_LOOKAHEAD_THREAD_MAX+1];
-        output_inter[0] = h->scratch_buffer2;
-        output_intra[0] = output_inter[0] + output_buf_size;
+        /* per thread accumulators and row costs, rows done by other threads are left at zero.
+         * The contexts of the lookahead threads have no pool, they always cost a frame alone. */
+        int threads = h->lookaheadpool ? h->param.i_lookahead_threads : 1;
+        int output_size = NUM_INTS + h->mb.i_mb_height;
+        int *output_inter[X264_LOOKAHEAD_THREAD_MAX];
+        int *output_intra[X264_LOOKAHEAD_THREAD_MAX];
+        for( int i = 0; i < threads; i++ )
+        {
+            output_inter[i] = (int*)h->scratch_buffer2 + i * (output_size + PAD_SIZE);
+            output_intra[i] = output_inter[i] + threads * (output_size + PAD_SIZE);
+            memset( output_inter[i], 0, output_size * sizeof(int) );
+            memset( output_intra[i], 0, output_size * sizeof(int) );
+        }
 
 #if HAVE_OPENCL
         if( h->param.b_opencl )
@@ -898,11 +1146,28 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
         else
 #endif
         {
-            if( h->param.i_lookahead_threads > 1 )
+#if HAVE_THREAD
+            x264_slicetype_wavefront_t wf;
+            if( threads > 1 )
+            {
+                /* Without the wavefront's mutex and cv, do the rows on this thread. */
+                if( x264_pthread_mutex_init( &wf.mutex, NULL ) )
+                    threads = 1;
+                else if( x264_pthread_cond_init( &wf.cv, NULL ) )
+                {
+                    x264_pthread_mutex_destroy( &wf.mutex );
+                    threads = 1;
+                }
+            }
+            if( threads > 1 )
             {
                 x264_slicetype_slice_t s[X264_LOOKAHEAD_THREAD_MAX];
+                wf.next_row = 0;
+                wf.waiters = 0;
+                wf.row_done = output_intra[0] + threads * (output_size + PAD_SIZE);
+                memset( wf.row_done, 0, h->mb.i_mb_height * sizeof(int) );
 
-                for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+                for( int i = 0; i < threads; i++ )
                 {
                     x264_t *t = h->lookahead_thread[i];
 
@@ -910,36 +1175,26 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
                     t->mb.i_me_method = h->mb.i_me_method;
                     t->mb.i_subpel_refine = h->mb.i_subpel_refine;
                     t->mb.b_chroma_me = h->mb.b_chroma_me;
+                    t->i_threadslice_start = 0;
+                    t->i_threadslice_end = h->mb.i_mb_height;
 
                     s[i] = (x264_slicetype_slice_t){ t, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
-                        output_inter[i], output_intra[i] };
-
-                    t->i_threadslice_start = ((h->mb.i_mb_height *  i    + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
-                    t->i_threadslice_end   = ((h->mb.i_mb_height * (i+1) + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
-
-                    int thread_height = t->i_threadslice_end - t->i_threadslice_start;
-                    int thread_output_size = thread_height + NUM_INTS;
-                    memset( output_inter[i], 0, thread_output_size * sizeof(int) );
-                    memset( output_intra[i], 0, thread_output_size * sizeof(int) );
-                    output_inter[i][NUM_ROWS] = output_intra[i][NUM_ROWS] = thread_height;
-
-                    output_inter[i+1] = output_inter[i] + thread_output_size + PAD_SIZE;
-                    output_intra[i+1] = output_intra[i] + thread_output_size + PAD_SIZE;
-
+                        output_inter[i], output_intra[i], &wf };
                     x264_threadpool_run( h->lookaheadpool, (void*)slicetype_slice_cost, &s[i] );
                 }
-                for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+                for( int i = 0; i < threads; i++ )
                     x264_threadpool_wait( h->lookaheadpool, &s[i] );
+
+                x264_pthread_mutex_destroy( &wf.mutex );
+                x264_pthread_cond_destroy( &wf.cv );
             }
             else
+#endif
             {
                 h->i_threadslice_start = 0;
                 h->i_threadslice_end = h->mb.i_mb_height;
-                memset( output_inter[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
-                memset( output_intra[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
-                output_inter[0][NUM_ROWS] = output_intra[0][NUM_ROWS] = h->mb.i_mb_height;
                 x264_slicetype_slice_t s = (x264_slicetype_slice_t){ h, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
-                    output_inter[0], output_intra[0] };
+                    output_inter[0], output_intra[0], NULL };
                 slicetype_slice_cost( &s );
             }
 
@@ -954,9 +1209,7 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
             fenc->i_cost_est[b-p0][p1-b] = 0;
             fenc->i_cost_est_aq[b-p0][p1-b] = 0;
 
-            int *row_satd_inter = fenc->i_row_satds[b-p0][p1-b];
-            int *row_satd_intra = fenc->i_row_satds[0][0];
-            for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+            for( int i = 0; i < threads; i++ )
             {
                 if( b == p1 )
                     fenc->i_intra_mbs[b-p0] += output_inter[i][INTRA_MBS];
@@ -969,14 +1222,23 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
                 fenc->i_cost_est[b-p0][p1-b] += output_inter[i][COST_EST];
                 fenc->i_cost_est_aq[b-p0][p1-b] += output_inter[i][COST_EST_AQ];
 
-                if( h->param.rc.i_vbv_buffer_size )
+            }
+
+            if( h->param.rc.i_vbv_buffer_size )
+            {
+                int *row_satd_inter = fenc->i_row_satds[b-p0][p1-b];
+                int *row_satd_intra = fenc->i_row_satds[0][0];
+                for( int y = 0; y < h->mb.i_mb_height; y++ )
                 {
-                    int row_count = output_inter[i][NUM_ROWS];
-                    memcpy( row_satd_inter, output_inter[i] + NUM_INTS, row_count * sizeof(int) );
+                    row_satd_inter[y] = output_inter[0][NUM_INTS+y];
+                    for( int i = 1; i < threads; i++ )
+                        row_satd_inter[y] += output_inter[i][NUM_INTS+y];
                     if( !fenc->b_intra_calculated )
-                        memcpy( row_satd_intra, output_intra[i] + NUM_INTS, row_count * sizeof(int) );
-                    row_satd_inter += row_count;
-                    row_satd_intra += row_count;
+                    {
+                        row_satd_intra[y] = output_intra[0][NUM_INTS+y];
+                        for( int i = 1; i < threads; i++ )
+                            row_satd_intra[y] += output_intra[i][NUM_INTS+y];
+                    }
                 }
             }
 
@@ -994,6 +1256,34 @@ static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
     return i_score;
 }
 
+/* With i_lookahead_levels, frametype decisions are costed on the coarse frames.  They only differ from the
+ * lowres ones in resolution, so the lookahead_coarse context with the mb dimensions of that level costs
+ * them with the same functions. */
+static x264_t *coarse_context( x264_t *h )
+{
+    x264_t *c = h->lookahead_coarse;
+    c->mb.i_me_method = h->mb.i_me_method;
+    c->mb.i_subpel_refine = h->mb.i_subpel_refine;
+    c->mb.b_chroma_me = h->mb.b_chroma_me;
+    c->param.i_bframe_bias = h->param.i_bframe_bias;
+    return c;
+}
+
+static x264_frame_t **coarse_frames( x264_frame_t **coarse, x264_frame_t **frames, int p0, int p1 )
+{
+    for( int i = p0; i <= p1; i++ )
+        coarse[i] = frames[i]->coarse;
+    return coarse;
+}
+
+static int slicetype_decision_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int b )
+{
+    if( !h->lookahead_coarse )
+        return slicetype_frame_cost( h, a, frames, p0, p1, b );
+    x264_frame_t *coarse[X264_LOOKAHEAD_MAX+3];
+    return slicetype_frame_cost( coarse_context( h ), a, coarse_frames( coarse, frames, p0, p1 ), p0, p1, b );
+}
+
 /* If MB-tree changes the quantizers, we need to recalculate the frame cost without
  * re-running lookahead. */
 static int slicetype_frame_cost_recalculate( x264_t *h, x264_frame_t **frames, int p0, int p1, int b )
@@ -1048,51 +1338,204 @@ static void macroblock_tree_finish( x264_t *h, x264_frame_t *frame, float averag
     }
 }
 
-static void macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, float average_duration, int p0, int p1, int b, int referenced )
+/* Incremental mb-tree keeps each frame's i_propagate_cost across lookahead calls.  Cost received
+ * in the current call goes to i_propagate_cost_delta and only that delta is pushed on to the
+ * references; a frame that was already propagated into the same references adds no source cost
+ * a second time, and is skipped entirely if nothing new reached it. */
+static void macroblock_tree_clear( x264_t *h, x264_frame_t *frame, int b_incremental )
+{
+    memset( b_incremental ? frame->i_propagate_cost_delta : frame->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+    frame->b_mbtree_dirty = 0;
+}
+
+static void macroblock_tree_accumulate( x264_t *h, x264_frame_t *frame )
+{
+    if( frame->i_mbtree_pass != h->lookahead->i_mbtree_pass )
+    {
+        memcpy( frame->i_propagate_cost, frame->i_propagate_cost_delta, h->mb.i_mb_count * sizeof(uint16_t) );
+        frame->i_mbtree_pass = h->lookahead->i_mbtree_pass;
+        frame->i_mbtree_ref[0] = frame->i_mbtree_ref[1] = -1;
+        frame->b_mbtree_referenced = 1;
+    }
+    else
+        for( int i = 0; i < h->mb.i_mb_count; i++ )
+            frame->i_propagate_cost[i] = X264_MIN( frame->i_propagate_cost[i] + frame->i_propagate_cost_delta[i], 32767 );
+}
+
+typedef struct
+{
+    x264_t *h;
+    x264_frame_t *frame;
+    uint16_t *propagate_cost; /* a single zeroed row if the frame isn't referenced */
+    uint16_t *lowres_costs;
+    int16_t (*mvs[2])[2];
+    int bipred_weights[2];
+    float fps_factor;
+    int referenced;
+    int lists;
+    int y_start;
+    int y_end;
+    uint16_t *ref_costs[2];
+    int ref_y_start; /* rows of ref_costs a thread wrote to */
+    int ref_y_end;
+} x264_mbtree_propagate_t;
+
+/* Each lookahead thread propagates a band of at least this many rows. */
+#define MBTREE_BAND_MIN 8
+
+static void macroblock_tree_propagate_rows( x264_mbtree_propagate_t *s )
+{
+    x264_t *h = s->h;
+    int16_t *buf = h->scratch_buffer;
+    for( int mb_y = s->y_start; mb_y < s->y_end; mb_y++ )
+    {
+        int mb_index = mb_y*h->mb.i_mb_stride;
+        uint16_t *propagate_cost = s->referenced ? s->propagate_cost + mb_y*h->mb.i_mb_width : s->propagate_cost;
+        h->mc.mbtree_propagate_cost( buf, propagate_cost,
+            s->frame->i_intra_cost+mb_index, s->lowres_costs+mb_index,
+            s->frame->i_inv_qscale_factor+mb_index, &s->fps_factor, h->mb.i_mb_width );
+
+        for( int list = 0; list < s->lists; list++ )
+            h->mc.mbtree_propagate_list( h, s->ref_costs[list], &s->mvs[list][mb_index], buf, &s->lowres_costs[mb_index],
+                                         s->bipred_weights[list], mb_y, h->mb.i_mb_width, list );
+    }
+}
+
+#if HAVE_THREAD
+/* Scatters into private copies of the reference costs, limited to the rows the band's mvs can reach. */
+static void macroblock_tree_propagate_band( x264_mbtree_propagate_t *s )
+{
+    x264_t *h = s->h;
+    int ref_y_start = h->mb.i_mb_height;
+    int ref_y_end = 0;
+    for( int list = 0; list < s->lists; list++ )
+        for( int mb_y = s->y_start; mb_y < s->y_end; mb_y++ )
+        {
+            int16_t (*mvs)[2] = s->mvs[list] + mb_y*h->mb.i_mb_stride;
+            for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
+            {
+                int y = (mvs[mb_x][1] >> 5) + mb_y;
+                ref_y_start = X264_MIN( ref_y_start, y );
+                ref_y_end = X264_MAX( ref_y_end, y+2 );
+            }
+        }
+    s->ref_y_start = X264_MAX( ref_y_start, 0 );
+    s->ref_y_end = X264_MIN( ref_y_end, h->mb.i_mb_height );
+    for( int list = 0; list < s->lists; list++ )
+        if( s->ref_y_start < s->ref_y_end )
+            memset( s->ref_costs[list] + s->ref_y_start*h->mb.i_mb_stride, 0,
+                    (s->ref_y_end - s->ref_y_start) * h->mb.i_mb_stride * sizeof(uint16_t) );
+
+    macroblock_tree_propagate_rows( s );
+}
+#endif
+
+/* Propagated amounts are never negative, so adding the clipped per-thread sums and clipping again
+ * gives the same costs as the single-threaded scatter. */
+static void macroblock_tree_propagate_threads( x264_t *h, x264_mbtree_propagate_t *prop, int threads )
+{
+    x264_mbtree_propagate_t s[X264_LOOKAHEAD_THREAD_MAX];
+    int offset = ((h->mb.i_mb_width+15)&~15) * sizeof(int16_t) * 12; /* past the propagate_list asm buffer */
+    for( int i = 0; i < threads; i++ )
+    {
+        x264_t *t = h->lookahead_thread[i];
+        uint16_t *acc = (uint16_t*)(t->scratch_buffer2 + offset);
+        s[i] = *prop;
+        s[i].h = t;
+        s[i].y_start = h->mb.i_mb_height * i / threads;
+        s[i].y_end = h->mb.i_mb_height * (i+1) / threads;
+        s[i].ref_costs[0] = acc;
+        s[i].ref_costs[1] = acc + h->mb.i_mb_count;
+        x264_threadpool_run( h->lookaheadpool, (void*)macroblock_tree_propagate_band, &s[i] );
+    }
+    for( int i = 0; i < threads; i++ )
+    {
+        x264_threadpool_wait( h->lookaheadpool, &s[i] );
+        for( int list = 0; list < prop->lists; list++ )
+        {
+            int start = s[i].ref_y_start * h->mb.i_mb_stride;
+            int end = s[i].ref_y_end * h->mb.i_mb_stride;
+            for( int j = start; j < end; j++ )
+                MC_CLIP_ADD( prop->ref_costs[list][j], s[i].ref_costs[list][j] );
+        }
+    }
+}
+
+/* Returns -1 if an incremental pass finds the frame propagated differently than last time. */
+static int macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, float average_duration, int p0, int p1, int b, int referenced,
+                                      int b_incremental )
 {
-    uint16_t *ref_costs[2] = {frames[p0]->i_propagate_cost,frames[p1]->i_propagate_cost};
+    x264_frame_t *frame = frames[b];
+    int b_source = 1;
+    if( b_incremental && frame->i_mbtree_pass == h->lookahead->i_mbtree_pass )
+    {
+        if( frame->b_mbtree_referenced != referenced )
+            return -1;
+        if( frame->i_mbtree_ref[0] != -1 )
+        {
+            if( frame->i_mbtree_ref[0] != frames[p0]->i_frame || frame->i_mbtree_ref[1] != frames[p1]->i_frame )
+                return -1;
+            if( !referenced || !frame->b_mbtree_dirty )
+                return 0;
+            /* Far enough back the new cost rounds away to nothing. */
+            int b_zero = 1;
+            for( int i = 0; i < h->mb.i_mb_count && b_zero; i++ )
+                b_zero = !frame->i_propagate_cost_delta[i];
+            if( b_zero )
+                return 0;
+            b_source = 0;
+        }
+    }
+
+    uint16_t *ref_costs[2] = {b_incremental ? frames[p0]->i_propagate_cost_delta : frames[p0]->i_propagate_cost,
+                              b_incremental ? frames[p1]->i_propagate_cost_delta : frames[p1]->i_propagate_cost};
     int dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
     int i_bipred_weight = h->param.analyse.b_weighted_bipred ? 64 - (dist_scale_factor>>2) : 32;
-    int16_t (*mvs[2])[2] = { b != p0 ? frames[b]->lowres_mvs[0][b-p0-1] : NULL, b != p1 ? frames[b]->lowres_mvs[1][p1-b-1] : NULL };
+    int16_t (*mvs[2])[2] = { b != p0 ? frame->lowres_mvs[0][b-p0-1] : NULL, b != p1 ? frame->lowres_mvs[1][p1-b-1] : NULL };
     int bipred_weights[2] = {i_bipred_weight, 64 - i_bipred_weight};
-    int16_t *buf = h->scratch_buffer;
-    uint16_t *propagate_cost = frames[b]->i_propagate_cost;
-    uint16_t *lowres_costs = frames[b]->lowres_costs[b-p0][p1-b];
+    uint16_t *propagate_cost = b_incremental && !b_source ? frame->i_propagate_cost_delta : frame->i_propagate_cost;
+    uint16_t *lowres_costs = frame->lowres_costs[b-p0][p1-b];
+
+    /* A frame propagated for the first time passes on everything it has received so far. */
+    if( b_incremental && referenced )
+        macroblock_tree_accumulate( h, frame );
 
     x264_emms();
-    float fps_factor = CLIP_DURATION(frames[b]->f_duration) / (CLIP_DURATION(average_duration) * 256.0f) * MBTREE_PRECISION;
+    float fps_factor = b_source ? CLIP_DURATION(frame->f_duration) / (CLIP_DURATION(average_duration) * 256.0f) * MBTREE_PRECISION : 0.0f;
 
     /* For non-reffed frames the source costs are always zero, so just memset one row and re-use it. */
     if( !referenced )
-        memset( frames[b]->i_propagate_cost, 0, h->mb.i_mb_width * sizeof(uint16_t) );
+        memset( propagate_cost, 0, h->mb.i_mb_width * sizeof(uint16_t) );
+
+    x264_mbtree_propagate_t prop = { h, frame, propagate_cost, lowres_costs, { mvs[0], mvs[1] },
+        { bipred_weights[0], bipred_weights[1] }, fps_factor, referenced, 1 + (b != p1),
+        0, h->mb.i_mb_height, { ref_costs[0], ref_costs[1] } };
+    int threads = h->lookaheadpool ? X264_MIN( h->param.i_lookahead_threads, h->mb.i_mb_height / MBTREE_BAND_MIN ) : 1;
+    if( threads > 1 )
+        macroblock_tree_propagate_threads( h, &prop, threads );
+    else
+        macroblock_tree_propagate_rows( &prop );
 
-    for( h->mb.i_mb_y = 0; h->mb.i_mb_y < h->mb.i_mb_height; h->mb.i_mb_y++ )
+    if( h->param.rc.b_mb_tree_incremental )
     {
-        int mb_index = h->mb.i_mb_y*h->mb.i_mb_stride;
-        h->mc.mbtree_propagate_cost( buf, propagate_cost,
-            frames[b]->i_intra_cost+mb_index, lowres_costs+mb_index,
-            frames[b]->i_inv_qscale_factor+mb_index, &fps_factor, h->mb.i_mb_width );
-        if( referenced )
-            propagate_cost += h->mb.i_mb_width;
-
-        h->mc.mbtree_propagate_list( h, ref_costs[0], &mvs[0][mb_index], buf, &lowres_costs[mb_index],
-                                     bipred_weights[0], h->mb.i_mb_y, h->mb.i_mb_width, 0 );
+        frame->i_mbtree_pass = h->lookahead->i_mbtree_pass;
+        frame->i_mbtree_ref[0] = frames[p0]->i_frame;
+        frame->i_mbtree_ref[1] = frames[p1]->i_frame;
+        frame->b_mbtree_referenced = referenced;
+        frames[p0]->b_mbtree_dirty = 1;
         if( b != p1 )
-        {
-            h->mc.mbtree_propagate_list( h, ref_costs[1], &mvs[1][mb_index], buf, &lowres_costs[mb_index],
-                                         bipred_weights[1], h->mb.i_mb_y, h->mb.i_mb_width, 1 );
-        }
+            frames[p1]->b_mbtree_dirty = 1;
     }
 
     if( h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead && referenced )
-        macroblock_tree_finish( h, frames[b], average_duration, b == p1 ? b - p0 : 0 );
+        macroblock_tree_finish( h, frame, average_duration, b == p1 ? b - p0 : 0 );
+    return 0;
 }
 
 static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int num_frames, int b_intra )
 {
     int idx = !b_intra;
-    int last_nonb, cur_nonb = 1;
-    int bframes = 0;
+    int i, last_nonb, cur_nonb, bframes;
 
     x264_emms();
     float total_duration = 0.0;
@@ -1100,13 +1543,40 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
         total_duration += frames[j]->f_duration;
     float average_duration = total_duration / (num_frames + 1);
 
-    int i = num_frames;
+    /* Build on the previous call's costs only if its window is contained in this one and every
+     * frame's fps factor is the same; otherwise start a new full pass. */
+    int b_incremental = h->param.rc.b_mb_tree_incremental && !b_intra &&
+                        average_duration == h->lookahead->f_mbtree_duration &&
+                        frames[num_frames]->i_frame >= h->lookahead->i_mbtree_last_frame;
 
     if( b_intra )
         slicetype_frame_cost( h, a, frames, 0, 0, 0 );
 
+restart:
+    if( h->param.rc.b_mb_tree_incremental )
+    {
+        if( !b_incremental )
+            h->lookahead->i_mbtree_pass++;
+        h->lookahead->i_mbtree_last_frame = frames[num_frames]->i_frame;
+        h->lookahead->f_mbtree_duration = average_duration;
+    }
+
+    i = num_frames;
+    cur_nonb = 1;
+    bframes = 0;
     while( i > 0 && IS_X264_TYPE_B( frames[i]->i_type ) )
         i--;
+    if( h->param.rc.b_mb_tree_incremental && i > idx )
+    {
+        /* The frame closing the window is only a P-frame because nothing follows it yet, and
+         * usually turns into a B-frame in the next call.  Leave its minigop out so that what
+         * gets kept stays valid. */
+        int prev_nonb = i - 1;
+        while( prev_nonb > 0 && IS_X264_TYPE_B( frames[prev_nonb]->i_type ) )
+            prev_nonb--;
+        if( prev_nonb >= idx )
+            i = prev_nonb;
+    }
     last_nonb = i;
 
     /* Lookaheadless MB-tree is not a theoretically distinct case; the same extrapolation could
@@ -1127,7 +1597,7 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
     {
         if( last_nonb < idx )
             return;
-        memset( frames[last_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        macroblock_tree_clear( h, frames[last_nonb], b_incremental );
     }
 
     while( i-- > idx )
@@ -1138,13 +1608,13 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
         if( cur_nonb < idx )
             break;
         slicetype_frame_cost( h, a, frames, cur_nonb, last_nonb, last_nonb );
-        memset( frames[cur_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        macroblock_tree_clear( h, frames[cur_nonb], b_incremental );
         bframes = last_nonb - cur_nonb - 1;
         if( h->param.i_bframe_pyramid && bframes > 1 )
         {
             int middle = (bframes + 1)/2 + cur_nonb;
             slicetype_frame_cost( h, a, frames, cur_nonb, last_nonb, middle );
-            memset( frames[middle]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+            macroblock_tree_clear( h, frames[middle], b_incremental );
             while( i > cur_nonb )
             {
                 int p0 = i > middle ? middle : cur_nonb;
@@ -1152,35 +1622,54 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
                 if( i != middle )
                 {
                     slicetype_frame_cost( h, a, frames, p0, p1, i );
-                    macroblock_tree_propagate( h, frames, average_duration, p0, p1, i, 0 );
+                    if( macroblock_tree_propagate( h, frames, average_duration, p0, p1, i, 0, b_incremental ) < 0 )
+                        goto recompute;
                 }
                 i--;
             }
-            macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, middle, 1 );
+            if( macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, middle, 1, b_incremental ) < 0 )
+                goto recompute;
         }
         else
         {
             while( i > cur_nonb )
             {
                 slicetype_frame_cost( h, a, frames, cur_nonb, last_nonb, i );
-                macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, i, 0 );
+                if( macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, i, 0, b_incremental ) < 0 )
+                    goto recompute;
                 i--;
             }
         }
-        macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, last_nonb, 1 );
+        if( macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, last_nonb, 1, b_incremental ) < 0 )
+            goto recompute;
         last_nonb = cur_nonb;
     }
 
     if( !h->param.rc.i_lookahead )
     {
         slicetype_frame_cost( h, a, frames, 0, last_nonb, last_nonb );
-        macroblock_tree_propagate( h, frames, average_duration, 0, last_nonb, last_nonb, 1 );
+        macroblock_tree_propagate( h, frames, average_duration, 0, last_nonb, last_nonb, 1, 0 );
         XCHG( uint16_t*, frames[last_nonb]->i_propagate_cost, frames[0]->i_propagate_cost );
     }
+    else if( b_incremental )
+        macroblock_tree_accumulate( h, frames[last_nonb] );
+    else if( h->param.rc.b_mb_tree_incremental )
+    {
+        /* Received cost but was never propagated itself. */
+        frames[last_nonb]->i_mbtree_pass = h->lookahead->i_mbtree_pass;
+        frames[last_nonb]->i_mbtree_ref[0] = frames[last_nonb]->i_mbtree_ref[1] = -1;
+        frames[last_nonb]->b_mbtree_referenced = 1;
+    }
 
     macroblock_tree_finish( h, frames[last_nonb], average_duration, last_nonb );
     if( h->param.i_bframe_pyramid && bframes > 1 && !h->param.rc.i_vbv_buffer_size )
         macroblock_tree_finish( h, frames[last_nonb+(bframes+1)/2], average_duration, 0 );
+    return;
+
+recompute:
+    /* A frame decision changed since the previous call: redo the whole window. */
+    b_incremental = 0;
+    goto restart;
 }
 
 static int vbv_frame_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int b )
@@ -1300,9 +1789,9 @@ static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_fram
 
         /* Add the cost of the non-B-frame found above */
         if( path[next_nonb] == 'P' )
-            cost += slicetype_frame_cost( h, a, frames, cur_nonb, next_nonb, next_nonb );
+            cost += slicetype_decision_cost( h, a, frames, cur_nonb, next_nonb, next_nonb );
         else /* I-frame */
-            cost += slicetype_frame_cost( h, a, frames, next_nonb, next_nonb, next_nonb );
+            cost += slicetype_decision_cost( h, a, frames, next_nonb, next_nonb, next_nonb );
         /* Early terminate if the cost we have found is larger than the best path cost so far */
         if( cost > threshold )
             break;
@@ -1310,15 +1799,15 @@ static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_fram
         if( h->param.i_bframe_pyramid && next_nonb - cur_nonb > 2 )
         {
             int middle = cur_nonb + (next_nonb - cur_nonb)/2;
-            cost += slicetype_frame_cost( h, a, frames, cur_nonb, next_nonb, middle );
+            cost += slicetype_decision_cost( h, a, frames, cur_nonb, next_nonb, middle );
             for( int next_b = loc; next_b < middle && cost < threshold; next_b++ )
-                cost += slicetype_frame_cost( h, a, frames, cur_nonb, middle, next_b );
+                cost += slicetype_decision_cost( h, a, frames, cur_nonb, middle, next_b );
             for( int next_b = middle+1; next_b < next_nonb && cost < threshold; next_b++ )
-                cost += slicetype_frame_cost( h, a, frames, middle, next_nonb, next_b );
+                cost += slicetype_decision_cost( h, a, frames, middle, next_nonb, next_b );
         }
         else
             for( int next_b = loc; next_b < next_nonb && cost < threshold; next_b++ )
-                cost += slicetype_frame_cost( h, a, frames, cur_nonb, next_nonb, next_b );
+                cost += slicetype_decision_cost( h, a, frames, cur_nonb, next_nonb, next_b );
 
         loc = next_nonb + 1;
         cur_nonb = next_nonb;
@@ -1326,59 +1815,259 @@ static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_fram
     return cost;
 }
 
+/* Frame costs needed by the candidate paths of the trellis, packed into one int each.
+ * Sorting by the packed value orders them by phase, then by fenc. */
+#define PATH_COST_PACK( phase, p0, p1, b ) \
+    ((((phase) * (X264_LOOKAHEAD_MAX+3) + (b)) * (X264_BFRAME_MAX+2) + (b)-(p0)) * (X264_BFRAME_MAX+2) + (p1)-(b))
+#define PATH_COST_P1( c ) (PATH_COST_B( c ) + (c) % (X264_BFRAME_MAX+2))
+#define PATH_COST_P0( c ) (PATH_COST_B( c ) - (c) / (X264_BFRAME_MAX+2) % (X264_BFRAME_MAX+2))
+#define PATH_COST_B( c ) ((c) / ((X264_BFRAME_MAX+2) * (X264_BFRAME_MAX+2)) % (X264_LOOKAHEAD_MAX+3))
+#define PATH_COST_PHASE( c ) ((c) / ((X264_BFRAME_MAX+2) * (X264_BFRAME_MAX+2) * (X264_LOOKAHEAD_MAX+3)))
+
+static int slicetype_path_cost_add( x264_t *h, x264_frame_t **frames, int *costs, int count, int phase, int p0, int p1, int b )
+{
+    if( slicetype_frame_cost_cached( h, frames[b], p0, p1, b ) )
+        return count;
+    int c = PATH_COST_PACK( phase, p0, p1, b );
+    int i = 0;
+    for( ; i < count; i++ )
+        if( PATH_COST_P0( costs[i] ) == p0 && PATH_COST_P1( costs[i] ) == p1 && PATH_COST_B( costs[i] ) == b )
+        {
+            /* keep the earliest phase a cost is needed in */
+            if( costs[i] <= c )
+                return count;
+            memmove( costs+i, costs+i+1, (--count - i) * sizeof(int) );
+            break;
+        }
+    for( i = count; i > 0 && costs[i-1] > c; i-- )
+        costs[i] = costs[i-1];
+    costs[i] = c;
+    return count + 1;
+}
+
+/* Lists the frame costs slicetype_path_cost needs for path, in three phases:
+ * P and I-frames, then the middle B-frame of each pyramid, then the other B-frames.
+ * B-frames use the MVs of their future reference as predictors, so each phase only depends on the
+ * ones before it, and the costs within a phase only write to their own fenc. */
+static int slicetype_path_list( x264_t *h, x264_frame_t **frames, char *path, int *costs, int count )
+{
+    int loc = 1;
+    int cur_nonb = 0;
+    path--; /* Since the 1st path element is really the second frame */
+    while( path[loc] )
+    {
+        int next_nonb = loc;
+        while( path[next_nonb] == 'B' )
+            next_nonb++;
+
+        if( path[next_nonb] == 'P' )
+            count = slicetype_path_cost_add( h, frames, costs, count, 0, cur_nonb, next_nonb, next_nonb );
+        else
+            count = slicetype_path_cost_add( h, frames, costs, count, 0, next_nonb, next_nonb, next_nonb );
+
+        if( h->param.i_bframe_pyramid && next_nonb - cur_nonb > 2 )
+        {
+            int middle = cur_nonb + (next_nonb - cur_nonb)/2;
+            count = slicetype_path_cost_add( h, frames, costs, count, 1, cur_nonb, next_nonb, middle );
+            for( int next_b = loc; next_b < middle; next_b++ )
+                count = slicetype_path_cost_add( h, frames, costs, count, 2, cur_nonb, middle, next_b );
+            for( int next_b = middle+1; next_b < next_nonb; next_b++ )
+                count = slicetype_path_cost_add( h, frames, costs, count, 2, middle, next_nonb, next_b );
+        }
+        else
+            for( int next_b = loc; next_b < next_nonb; next_b++ )
+                count = slicetype_path_cost_add( h, frames, costs, count, 2, cur_nonb, next_nonb, next_b );
+
+        loc = next_nonb + 1;
+        cur_nonb = next_nonb;
+    }
+    return count;
+}
+
+#if HAVE_THREAD
+typedef struct
+{
+    x264_t *h;
+    x264_mb_analysis_t *a;
+    x264_frame_t **frames;
+    int *costs;
+    int *groups; /* first cost of each fenc, costs of one fenc are done in order by one thread */
+    int i_groups;
+    int *next_group;
+} x264_slicetype_path_job_t;
+
+static void slicetype_path_job( x264_slicetype_path_job_t *s )
+{
+    int g;
+    while( (g = x264_atomic_fetch_add( s->next_group, 1 )) < s->i_groups )
+        for( int i = s->groups[g]; i < s->groups[g+1]; i++ )
+        {
+            int c = s->costs[i];
+            slicetype_frame_cost( s->h, s->a, s->frames, PATH_COST_P0( c ), PATH_COST_P1( c ), PATH_COST_B( c ) );
+        }
+}
+#endif
+
+/* Compute the frame costs of all candidate paths up front, each lookahead thread taking whole frames,
+ * so that the serial path search only finds cached costs. */
+static void slicetype_path_precompute( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int length,
+                                       char (*paths)[X264_LOOKAHEAD_MAX+1], int num_paths, int *possible, int any_possible )
+{
+    int *costs = x264_malloc( 2 * (num_paths * length + 1) * sizeof(int) );
+    if( !costs )
+        return;
+    int *groups = costs + num_paths * length;
+
+    int count = 0;
+    for( int path = 0; path < num_paths; path++ )
+        if( possible[path] || !any_possible )
+            count = slicetype_path_list( h, frames, paths[path], costs, count );
+
+    for( int start = 0; start < count; )
+    {
+        int phase = PATH_COST_PHASE( costs[start] );
+        int i_groups = 0;
+        int end = start;
+        for( ; end < count && PATH_COST_PHASE( costs[end] ) == phase; end++ )
+            if( end == start || PATH_COST_B( costs[end] ) != PATH_COST_B( costs[end-1] ) )
+                groups[i_groups++] = end;
+        groups[i_groups] = end;
+
+#if HAVE_THREAD
+        /* Spread whole frames over the threads when there are enough of them; with few frames
+         * to cost, the wavefront within each frame keeps more threads busy. */
+        if( i_groups * 2 > h->param.i_lookahead_threads )
+        {
+            x264_slicetype_path_job_t s[X264_LOOKAHEAD_THREAD_MAX];
+            int next_group = 0;
+            int threads = X264_MIN( h->param.i_lookahead_threads, i_groups );
+            for( int i = 0; i < threads; i++ )
+            {
+                x264_t *t = h->lookahead_thread[i];
+                t->mb.i_me_method = h->mb.i_me_method;
+                t->mb.i_subpel_refine = h->mb.i_subpel_refine;
+                t->mb.b_chroma_me = h->mb.b_chroma_me;
+                s[i] = (x264_slicetype_path_job_t){ t, a, frames, costs, groups, i_groups, &next_group };
+                x264_threadpool_run( h->lookaheadpool, (void*)slicetype_path_job, &s[i] );
+            }
+            for( int i = 0; i < threads; i++ )
+                x264_threadpool_wait( h->lookaheadpool, &s[i] );
+            start = end;
+            continue;
+        }
+#endif
+        for( ; start < end; start++ )
+            slicetype_frame_cost( h, a, frames, PATH_COST_P0( costs[start] ), PATH_COST_P1( costs[start] ), PATH_COST_B( costs[start] ) );
+    }
+
+    x264_free( costs );
+}
+
 /* Viterbi/trellis slicetype decision algorithm. */
 /* Uses strings due to the fact that the speed of the control functions is
    negligible compared to the cost of running slicetype_frame_cost, and because
    it makes debugging easier. */
 static void slicetype_path( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int length, char (*best_paths)[X264_LOOKAHEAD_MAX+1] )
 {
-    char paths[2][X264_LOOKAHEAD_MAX+1];
+    char paths[X264_BFRAME_MAX+1][X264_LOOKAHEAD_MAX+1];
+    int possible[X264_BFRAME_MAX+1];
     int num_paths = X264_MIN( h->param.i_bframe+1, length );
     uint64_t best_cost = COST_MAX64;
     int best_possible = 0;
-    int idx = 0;
+    int any_possible = 0;
+    int best = 0;
 
-    /* Iterate over all currently possible paths */
+    /* Build all currently possible paths */
     for( int path = 0; path < num_paths; path++ )
     {
         /* Add suffixes to the current path */
         int len = length - (path + 1);
-        memcpy( paths[idx], best_paths[len % (X264_BFRAME_MAX+1)], len );
-        memset( paths[idx]+len, 'B', path );
-        strcpy( paths[idx]+len+path, "P" );
+        memcpy( paths[path], best_paths[len % (X264_BFRAME_MAX+1)], len );
+        memset( paths[path]+len, 'B', path );
+        strcpy( paths[path]+len+path, "P" );
 
-        int possible = 1;
+        possible[path] = 1;
         for( int i = 1; i <= length; i++ )
         {
             int i_type = frames[i]->i_type;
             if( i_type == X264_TYPE_AUTO )
                 continue;
             if( IS_X264_TYPE_B( i_type ) )
-                possible = possible && (i < len || i == length || paths[idx][i-1] == 'B');
+                possible[path] = possible[path] && (i < len || i == length || paths[path][i-1] == 'B');
             else
             {
-                possible = possible && (i < len || paths[idx][i-1] != 'B');
-                paths[idx][i-1] = IS_X264_TYPE_I( i_type ) ? 'I' : 'P';
+                possible[path] = possible[path] && (i < len || paths[path][i-1] != 'B');
+                paths[path][i-1] = IS_X264_TYPE_I( i_type ) ? 'I' : 'P';
             }
         }
+        any_possible |= possible[path];
+    }
 
-        if( possible || !best_possible )
+    if( h->param.i_lookahead_threads > 1 && !h->param.b_opencl )
+    {
+        if( h->lookahead_coarse )
         {
-            if( possible && !best_possible )
+            x264_frame_t *coarse[X264_LOOKAHEAD_MAX+3];
+            slicetype_path_precompute( coarse_context( h ), a, coarse_frames( coarse, frames, 0, length ),
+                                       length, paths, num_paths, possible, any_possible );
+        }
+        else
+            slicetype_path_precompute( h, a, frames, length, paths, num_paths, possible, any_possible );
+    }
+
+    /* Iterate over all currently possible paths */
+    for( int path = 0; path < num_paths; path++ )
+        if( possible[path] || !best_possible )
+        {
+            if( possible[path] && !best_possible )
                 best_cost = COST_MAX64;
             /* Calculate the actual cost of the current path */
-            uint64_t cost = slicetype_path_cost( h, a, frames, paths[idx], best_cost );
+            uint64_t cost = slicetype_path_cost( h, a, frames, paths[path], best_cost );
             if( cost < best_cost )
             {
                 best_cost = cost;
-                best_possible = possible;
-                idx ^= 1;
+                best_possible = possible[path];
+                best = path;
             }
         }
-    }
 
     /* Store the best path. */
-    memcpy( best_paths[length % (X264_BFRAME_MAX+1)], paths[idx^1], length );
+    memcpy( best_paths[length % (X264_BFRAME_MAX+1)], paths[best], length );
+}
+
+/* Classify a scenecut candidate from the statistics gathered on ingest alone: 0 if it is obviously
+ * not a cut and -1 if it takes the lowres costs to tell.  Cuts are never settled here, as whether
+ * the cost test calls one depends on --scenecut and the distance to the last keyframe.
+ * Fades move the histogram as much as cuts do, but shift every block the same way, so a global
+ * change in brightness is left to the cost test (and weightp) rather than called a non-cut. */
+static int scenecut_prepass( x264_t *h, x264_frame_t *f0, x264_frame_t *f1 )
+{
+    int pixels = h->mb.i_mb_count * 64;
+    int hist_diff = 0;
+    for( int i = 0; i < LOWRES_HIST_BINS; i++ )
+        hist_diff += abs( (int)f0->i_lowres_hist[i] - (int)f1->i_lowres_hist[i] );
+
+    /* Blocks are matched against the closest of their neighbours in f0, so that ordinary
+     * motion doesn't look like new content. */
+    int64_t block_diff = 0, var_diff = 0, var_total = 0;
+    for( int mb_y = 0, mb_xy = 0; mb_y < h->mb.i_mb_height; mb_y++ )
+        for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++, mb_xy++ )
+        {
+            int sum = f1->i_lowres_block_sum[mb_xy];
+            int best = INT_MAX;
+            for( int y = X264_MAX( mb_y-1, 0 ); y <= X264_MIN( mb_y+1, h->mb.i_mb_height-1 ); y++ )
+                for( int x = X264_MAX( mb_x-1, 0 ); x <= X264_MIN( mb_x+1, h->mb.i_mb_width-1 ); x++ )
+                    best = X264_MIN( best, abs( sum - f0->i_lowres_block_sum[y*h->mb.i_mb_width+x] ) );
+            block_diff += best;
+            var_diff += abs( (int)f1->i_lowres_block_var[mb_xy] - (int)f0->i_lowres_block_var[mb_xy] );
+            var_total += f0->i_lowres_block_var[mb_xy] + f1->i_lowres_block_var[mb_xy];
+        }
+
+    /* magic numbers pulled from a handful of cuts, fades and pans: settle only clear non-cuts.
+     * Noise is invisible in block means, so a change in noise level can still pass. */
+    if( hist_diff < pixels >> 3 && block_diff < 8*pixels << (BIT_DEPTH-8) && 5*var_diff < var_total )
+        return 0;
+    return -1;
 }
 
 static int scenecut_internal( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int real_scenecut )
@@ -1389,12 +2078,20 @@ static int scenecut_internal( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **f
     if( real_scenecut && h->param.i_frame_packing == 5 && (frame->i_frame&1) )
         return 0;
 
-    slicetype_frame_cost( h, a, frames, p0, p1, p1 );
+    int i_gop_size = frame->i_frame - h->lookahead->i_last_keyframe;
+    /* The non-cut margins hold up to the default --scenecut 40; above it the cost test
+     * calls cuts on smaller changes, so leave everything to it. */
+    if( h->param.b_scenecut_prepass && h->param.i_scenecut_threshold <= 40 &&
+        !scenecut_prepass( h, frames[p0], frame ) )
+        return 0;
+
+    slicetype_decision_cost( h, a, frames, p0, p1, p1 );
 
-    int icost = frame->i_cost_est[0][0];
-    int pcost = frame->i_cost_est[p1-p0][0];
+    x264_t *hd = h->lookahead_coarse ? h->lookahead_coarse : h;
+    x264_frame_t *cost = h->lookahead_coarse ? frame->coarse : frame;
+    int icost = cost->i_cost_est[0][0];
+    int pcost = cost->i_cost_est[p1-p0][0];
     float f_bias;
-    int i_gop_size = frame->i_frame - h->lookahead->i_last_keyframe;
     float f_thresh_max = h->param.i_scenecut_threshold / 100.0;
     /* magic numbers pulled out of thin air */
     float f_thresh_min = f_thresh_max * 0.25;
@@ -1417,8 +2114,8 @@ static int scenecut_internal( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **f
     res = pcost >= (1.0 - f_bias) * icost;
     if( res && real_scenecut )
     {
-        int imb = frame->i_intra_mbs[p1-p0];
-        int pmb = NUM_MBS - imb;
+        int imb = cost->i_intra_mbs[p1-p0];
+        int pmb = NUM_MBS( hd ) - imb;
         x264_log( h, X264_LOG_DEBUG, "scene cut at %d Icost:%d Pcost:%d ratio:%.4f bias:%.4f gop:%d (imb:%d pmb:%d)\n",
                   frame->i_frame,
                   icost, pcost, 1. - (double)pcost / icost,
@@ -1480,9 +2177,10 @@ void x264_slicetype_analyse( x264_t *h, int intra_minigop )
     /* For determinism we should limit the search to the number of frames lookahead has for sure
      * in h->lookahead->next.list buffer, except at the end of stream.
      * For normal calls with (intra_minigop == 0) that is h->lookahead->i_slicetype_length + 1 frames.
-     * And for I-frame calls (intra_minigop != 0) we already removed intra_minigop frames from there. */
-    if( h->param.b_deterministic )
-        i_max_search = X264_MIN( i_max_search, h->lookahead->i_slicetype_length + 1 - intra_minigop );
+     * And for I-frame calls (intra_minigop != 0) we already removed intra_minigop frames from there.
+     * An adaptive window is always enforced here, next.list may still hold the frames of a longer one. */
+    if( h->param.b_deterministic || h->param.rc.i_lookahead_min )
+        i_max_search = X264_MIN( i_max_search, x264_atomic_load( &h->lookahead->i_slicetype_length ) + 1 - intra_minigop );
     int keyframe = !!intra_minigop;
 
     assert( h->frames.b_have_lowres );
@@ -1495,9 +2193,17 @@ void x264_slicetype_analyse( x264_t *h, int intra_minigop )
 
     lowres_context_init( h, &a );
 
+#if HAVE_THREAD
+    if( h->lookaheadpool && h->param.analyse.i_weighted_pred && !h->param.b_opencl )
+        weights_lowres_threads( h, frames, framecnt );
+#endif
+
+    /* with an imported analysis the qp offsets are already set */
+    int b_mb_tree = h->param.rc.b_mb_tree && !h->param.b_analysis_import;
+
     if( !framecnt )
     {
-        if( h->param.rc.b_mb_tree )
+        if( b_mb_tree )
             macroblock_tree( h, &a, frames, 0, keyframe );
         return;
     }
@@ -1509,7 +2215,7 @@ void x264_slicetype_analyse( x264_t *h, int intra_minigop )
      * there will be significant visual artifacts if the frames just before
      * go down in quality due to being referenced less, despite it being
      * more RD-optimal. */
-    if( (h->param.analyse.b_psy && h->param.rc.b_mb_tree) || b_vbv_lookahead )
+    if( (h->param.analyse.b_psy && b_mb_tree) || b_vbv_lookahead )
         num_frames = framecnt;
     else if( h->param.b_open_gop && num_frames < framecnt )
         num_frames++;
@@ -1674,7 +2380,7 @@ void x264_slicetype_analyse( x264_t *h, int intra_minigop )
 
     /* Perform the actual macroblock tree analysis.
      * Don't go farther than the maximum keyframe interval; this helps in short GOPs. */
-    if( h->param.rc.b_mb_tree )
+    if( b_mb_tree )
         macroblock_tree( h, &a, frames, X264_MIN(num_frames, h->param.i_keyint_max), keyframe );
 
     /* Enforce keyframe limit. */
@@ -1792,7 +2498,7 @@ void x264_slicetype_decide( x264_t *h )
     }
     else if( (h->param.i_bframe && h->param.i_bframe_adaptive)
              || h->param.i_scenecut_threshold
-             || h->param.rc.b_mb_tree
+             || (h->param.rc.b_mb_tree && !h->param.b_analysis_import)
              || (h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead) )
         x264_slicetype_analyse( h, 0 );
 
@@ -1896,7 +2602,7 @@ void x264_slicetype_decide( x264_t *h )
     }
 
     /* calculate the frame costs ahead of time for x264_rc_analyse_slice while we still have lowres */
-    if( h->param.rc.i_rc_method != X264_RC_CQP )
+    if( h->param.rc.i_rc_method != X264_RC_CQP || h->param.rc.b_lookahead_pass )
     {
         x264_mb_analysis_t a;
         int p0, p1, b;
@@ -1913,7 +2619,7 @@ void x264_slicetype_decide( x264_t *h )
 
         slicetype_frame_cost( h, &a, frames, p0, p1, b );
 
-        if( (p0 != p1 || bframes) && h->param.rc.i_vbv_buffer_size )
+        if( (p0 != p1 || bframes) && (h->param.rc.i_vbv_buffer_size || h->param.rc.b_lookahead_pass) )
         {
             /* We need the intra costs for row SATDs. */
             slicetype_frame_cost( h, &a, frames, b, b, b );
@@ -1973,23 +2679,29 @@ void x264_slicetype_decide( x264_t *h )
     }
 }
 
-int x264_rc_analyse_slice( x264_t *h )
+/* The current frame's b and p1 in the lookahead's terms, p0 being 0. */
+static x264_frame_t **rc_slice_frames( x264_t *h, int *p1, int *b )
 {
-    int p0 = 0, p1, b;
-    int cost;
-    x264_emms();
-
     if( IS_X264_TYPE_I(h->fenc->i_type) )
-        p1 = b = 0;
+        *p1 = *b = 0;
     else if( h->fenc->i_type == X264_TYPE_P )
-        p1 = b = h->fenc->i_bframes + 1;
+        *p1 = *b = h->fenc->i_bframes + 1;
     else //B
     {
-        p1 = (h->fref_nearest[1]->i_poc - h->fref_nearest[0]->i_poc)/2;
-        b  = (h->fenc->i_poc - h->fref_nearest[0]->i_poc)/2;
+        *p1 = (h->fref_nearest[1]->i_poc - h->fref_nearest[0]->i_poc)/2;
+        *b  = (h->fenc->i_poc - h->fref_nearest[0]->i_poc)/2;
     }
     /* We don't need to assign p0/p1 since we are not performing any real analysis here. */
-    x264_frame_t **frames = &h->fenc - b;
+    return &h->fenc - *b;
+}
+
+int x264_rc_analyse_slice( x264_t *h )
+{
+    int p0 = 0, p1, b;
+    int cost;
+    x264_emms();
+
+    x264_frame_t **frames = rc_slice_frames( h, &p1, &b );
 
     /* cost should have been already calculated by x264_slicetype_decide */
     cost = frames[b]->i_cost_est[b-p0][p1-b];
@@ -2034,3 +2746,45 @@ int x264_rc_analyse_slice( x264_t *h )
 
     return cost;
 }
+
+/* For the lookahead pass: the mb types and references of the current frame as the
+ * lookahead chose them, into h->stat.frame.  Returns the bits its mvs would take,
+ * each coded against the one to its left. */
+int x264_rc_analyse_slice_mbs( x264_t *h )
+{
+    static const uint8_t b_type[4] = { I_16x16, B_L0_L0, B_L1_L1, B_BI_BI };
+    int p0 = 0, p1, b;
+    x264_frame_t **frames = rc_slice_frames( h, &p1, &b );
+    x264_frame_t *fenc = frames[b];
+    int mv_bits = 0;
+
+    if( p0 == p1 )
+    {
+        h->stat.frame.i_mb_count[I_16x16] = h->mb.i_mb_count;
+        return 0;
+    }
+
+    uint16_t *lowres_costs = fenc->lowres_costs[b-p0][p1-b];
+    int16_t (*mvs[2])[2] = { fenc->lowres_mvs[0][b-p0-1], b == p1 ? NULL : fenc->lowres_mvs[1][p1-b-1] };
+    for( int y = 0; y < h->mb.i_mb_height; y++ )
+    {
+        int16_t mvp[2][2] = {{0}};
+        for( int x = 0; x < h->mb.i_mb_width; x++ )
+        {
+            int mb_xy = x + y * h->mb.i_mb_stride;
+            int list_used = lowres_costs[mb_xy] >> LOWRES_COST_SHIFT;
+            h->stat.frame.i_mb_count[b == p1 ? (list_used ? P_L0 : I_16x16) : b_type[list_used]]++;
+            h->stat.frame.i_mb_partition[D_16x16] += !!list_used;
+            for( int l = 0; l < 2; l++ )
+                if( list_used & (1 << l) )
+                {
+                    /* lowres mvs are in lowres qpel */
+                    int16_t *mv = mvs[l][mb_xy];
+                    mv_bits += bs_size_se( 2*(mv[0] - mvp[l][0]) ) + bs_size_se( 2*(mv[1] - mvp[l][1]) );
+                    CP32( mvp[l], mv );
+                    h->stat.frame.i_mb_count_ref[l][0]++;
+                }
+        }
+    }
+    return mv_bits;
+}
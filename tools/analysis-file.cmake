@@ -0,0 +1,99 @@
+# Checks of --analysis-out / --analysis-in with the x264 cli.
+# cmake -DX264=<x264> -DWORKDIR=<dir> -P analysis-file.cmake
+
+cmake_minimum_required(VERSION 3.22.2)
+
+set(frames 16)
+
+# A textured, moving clip fading in, so the import has to get weighted prediction right.
+function(make_source file width height)
+    math(EXPR reps "${width} / 32 + 2")
+    math(EXPR chroma "${width} * ${height} / 2")
+    string(REPEAT "P" ${chroma} chroma_planes)
+    file(WRITE ${file} "")
+    foreach(f RANGE 1 ${frames})
+        math(EXPR brightness "32 + ${f} * 4")
+        set(codes "")
+        foreach(k RANGE 0 31)
+            math(EXPR c "${brightness} + (${k} * 13) % 32")
+            list(APPEND codes ${c})
+        endforeach()
+        string(ASCII ${codes} pattern)
+        string(REPEAT "${pattern}" ${reps} row)
+        set(luma "")
+        foreach(y RANGE 1 ${height})
+            math(EXPR phase "(${y} * 3 / 4 + ${f}) % 32")
+            string(SUBSTRING "${row}" ${phase} ${width} r)
+            string(APPEND luma "${r}")
+        endforeach()
+        file(APPEND ${file} "${luma}${chroma_planes}")
+    endforeach()
+endfunction()
+
+# Runs x264 and returns the P and B frame summary lines of its log in ${out}.
+function(encode out)
+    execute_process(COMMAND ${X264} ${ARGN} ERROR_VARIABLE log RESULT_VARIABLE res)
+    if(NOT res EQUAL 0)
+        message(FATAL_ERROR "x264 ${ARGN} failed: ${res}\n${log}")
+    endif()
+    string(REGEX MATCHALL "frame [PB]:[^\n]*" stats "${log}")
+    set(${out} "${stats}" PARENT_SCOPE)
+endfunction()
+
+# Position in ${out} of the first byte aligned ${pattern} at or after ${from} in the hex string ${hex}, or -1.
+function(find_byte hex pattern from out)
+    set(pos ${from})
+    while(TRUE)
+        string(SUBSTRING "${hex}" ${pos} -1 rest)
+        string(FIND "${rest}" "${pattern}" i)
+        if(i EQUAL -1)
+            set(${out} -1 PARENT_SCOPE)
+            return()
+        endif()
+        math(EXPR pos "${pos} + ${i}")
+        math(EXPR odd "${pos} % 2")
+        if(NOT odd)
+            set(${out} ${pos} PARENT_SCOPE)
+            return()
+        endif()
+        math(EXPR pos "${pos} + 1")
+    endwhile()
+endfunction()
+
+# The bitstream in ${file} as a hex string in ${out}, without the SEI holding the encoder's options.
+function(read_without_options file out)
+    file(READ ${file} hex HEX)
+    find_byte("${hex}" "00000106" 0 sei)
+    if(sei EQUAL -1)
+        message(FATAL_ERROR "${file} has no options SEI")
+    endif()
+    math(EXPR payload "${sei} + 8")
+    find_byte("${hex}" "000001" ${payload} next)
+    string(SUBSTRING "${hex}" 0 ${sei} head)
+    string(SUBSTRING "${hex}" ${next} -1 tail)
+    set(${out} "${head}${tail}" PARENT_SCOPE)
+endfunction()
+
+file(MAKE_DIRECTORY ${WORKDIR})
+make_source(${WORKDIR}/src320.yuv 320 180)
+make_source(${WORKDIR}/src640.yuv 640 360)
+
+# An import at the settings of the export must code the same frames the same way.
+encode(export --input-res 640x360 --analysis-out ${WORKDIR}/same.analysis
+              -o ${WORKDIR}/export.264 ${WORKDIR}/src640.yuv)
+encode(import --input-res 640x360 --analysis-in ${WORKDIR}/same.analysis
+              -o ${WORKDIR}/import.264 ${WORKDIR}/src640.yuv)
+if(NOT export STREQUAL import)
+    message(FATAL_ERROR "import at the export's settings differs:\n${export}\n${import}")
+endif()
+read_without_options(${WORKDIR}/export.264 export)
+read_without_options(${WORKDIR}/import.264 import)
+if(NOT export STREQUAL import)
+    message(FATAL_ERROR "import at the export's settings gives another bitstream")
+endif()
+
+# An import at another resolution with frame threads, so every thread goes through the mb-tree rescale.
+encode(unused --input-res 320x180 --analysis-out ${WORKDIR}/rescale.analysis
+              -o ${WORKDIR}/out320.264 ${WORKDIR}/src320.yuv)
+encode(unused --threads 4 --input-res 640x360 --analysis-in ${WORKDIR}/rescale.analysis
+              -o ${WORKDIR}/out640.264 ${WORKDIR}/src640.yuv)
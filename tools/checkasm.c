@@ -33,6 +33,14 @@
 #include <windows.h>
 #endif
 
+#if HAVE_INTRIN && (ARCH_X86 || ARCH_X86_64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
 // GCC doesn't align stack variables on ARM, so use .bss
 #if ARCH_ARM
 #undef ALIGNED_16
@@ -107,6 +115,9 @@ static inline uint32_t read_time(void)
     asm volatile( "lfence \n"
                   "rdtsc  \n"
                   : "=a"(a) :: "edx", "memory" );
+#elif HAVE_INTRIN && (ARCH_X86 || ARCH_X86_64)
+    _mm_lfence();
+    a = __rdtsc();
 #elif ARCH_PPC
     asm volatile( "mftb %0" : "=r"(a) :: "memory" );
 #elif HAVE_ARM_INLINE_ASM    // ARMv7 only
@@ -0,0 +1,367 @@
+/*****************************************************************************
+ * threadpool-bench.c: threadpool dispatch latency benchmark
+ *****************************************************************************
+ * Copyright (C) 2010-2022 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+/* Measures run+wait latency of x264_threadpool, private and shared, against
+ * the list-based pool it replaced, which is kept here as the reference. Also
+ * checks that every wait returns the result of its own job, that a shared
+ * pool makes progress with more blocking jobs than workers, and that a handle
+ * can be closed while the shared workers are busy, so it doubles as a test.
+ *
+ * usage: threadpool-bench [threads] [iterations] */
+
+#include "common/common.h"
+
+#if HAVE_THREAD
+
+/****************************************************************************
+ * reference: three synchronized frame lists, done is scanned for arg
+ ****************************************************************************/
+typedef struct
+{
+    void *(*func)(void *);
+    void *arg;
+    void *ret;
+} ref_job_t;
+
+typedef struct
+{
+    volatile int   exit;
+    int            threads;
+    x264_pthread_t *thread_handle;
+    x264_sync_frame_list_t uninit;
+    x264_sync_frame_list_t run;
+    x264_sync_frame_list_t done;
+} ref_pool_t;
+
+static void *ref_pool_thread( ref_pool_t *pool )
+{
+    while( !pool->exit )
+    {
+        ref_job_t *job = NULL;
+        x264_pthread_mutex_lock( &pool->run.mutex );
+        while( !pool->exit && !pool->run.i_size )
+            x264_pthread_cond_wait( &pool->run.cv_fill, &pool->run.mutex );
+        if( pool->run.i_size )
+        {
+            job = (void*)x264_frame_shift( pool->run.list );
+            pool->run.i_size--;
+        }
+        x264_pthread_mutex_unlock( &pool->run.mutex );
+        if( !job )
+            continue;
+        job->ret = job->func( job->arg );
+        x264_sync_frame_list_push( &pool->done, (void*)job );
+    }
+    return NULL;
+}
+
+static ref_pool_t *ref_pool_init( int threads )
+{
+    ref_pool_t *pool = calloc( 1, sizeof(ref_pool_t) );
+    pool->threads = threads;
+    pool->thread_handle = malloc( threads * sizeof(x264_pthread_t) );
+    x264_sync_frame_list_init( &pool->uninit, threads );
+    x264_sync_frame_list_init( &pool->run, threads );
+    x264_sync_frame_list_init( &pool->done, threads );
+    for( int i = 0; i < threads; i++ )
+        x264_sync_frame_list_push( &pool->uninit, calloc( 1, sizeof(ref_job_t) ) );
+    for( int i = 0; i < threads; i++ )
+        x264_pthread_create( pool->thread_handle+i, NULL, (void*)ref_pool_thread, pool );
+    return pool;
+}
+
+static void ref_pool_run( ref_pool_t *pool, void *(*func)(void *), void *arg )
+{
+    ref_job_t *job = (void*)x264_sync_frame_list_pop( &pool->uninit );
+    job->func = func;
+    job->arg  = arg;
+    x264_sync_frame_list_push( &pool->run, (void*)job );
+}
+
+static void *ref_pool_wait( ref_pool_t *pool, void *arg )
+{
+    x264_pthread_mutex_lock( &pool->done.mutex );
+    while( 1 )
+    {
+        for( int i = 0; i < pool->done.i_size; i++ )
+            if( ((ref_job_t*)pool->done.list[i])->arg == arg )
+            {
+                ref_job_t *job = (void*)x264_frame_shift( pool->done.list+i );
+                pool->done.i_size--;
+                x264_pthread_mutex_unlock( &pool->done.mutex );
+                void *ret = job->ret;
+                x264_sync_frame_list_push( &pool->uninit, (void*)job );
+                return ret;
+            }
+        x264_pthread_cond_wait( &pool->done.cv_fill, &pool->done.mutex );
+    }
+}
+
+static void ref_pool_delete( ref_pool_t *pool )
+{
+    x264_pthread_mutex_lock( &pool->run.mutex );
+    pool->exit = 1;
+    x264_pthread_cond_broadcast( &pool->run.cv_fill );
+    x264_pthread_mutex_unlock( &pool->run.mutex );
+    for( int i = 0; i < pool->threads; i++ )
+        x264_pthread_join( pool->thread_handle[i], NULL );
+    for( int i = 0; pool->uninit.list[i]; i++ )
+    {
+        free( pool->uninit.list[i] );
+        pool->uninit.list[i] = NULL;
+    }
+    x264_sync_frame_list_delete( &pool->uninit );
+    x264_sync_frame_list_delete( &pool->run );
+    x264_sync_frame_list_delete( &pool->done );
+    free( pool->thread_handle );
+    free( pool );
+}
+
+/****************************************************************************
+ * benchmark
+ ****************************************************************************/
+typedef struct
+{
+    void *pool;
+    void  (*run)( void *pool, void *(*func)(void *), void *arg );
+    void *(*wait)( void *pool, void *arg );
+} pool_ops_t;
+
+typedef struct
+{
+    int in;
+    int out;
+} job_arg_t;
+
+static void *job_func( job_arg_t *arg )
+{
+    arg->out = arg->in * 3 + 1;
+    return (void*)(intptr_t)arg->out;
+}
+
+/* Returns the average ns per job, or -1 if a wait returned the wrong result.
+ * batch == 1 is the round trip of a single job; batch == threads fans a job
+ * out to every worker and collects them in reverse order, which is the worst
+ * case for a scan of the done list. */
+static double bench( pool_ops_t *ops, job_arg_t *args, int batch, int iterations )
+{
+    int64_t t = x264_mdate();
+    for( int it = 0; it < iterations; it++ )
+    {
+        for( int i = 0; i < batch; i++ )
+        {
+            args[i].in = it * batch + i;
+            ops->run( ops->pool, (void*)job_func, &args[i] );
+        }
+        for( int i = batch-1; i >= 0; i-- )
+            if( (intptr_t)ops->wait( ops->pool, &args[i] ) != args[i].in * 3 + 1 )
+                return -1;
+    }
+    t = x264_mdate() - t;
+    return t * 1000. / ((double)iterations * batch);
+}
+
+/* Frame threads block on the frames queued before them. A shared pool runs
+ * more such jobs than it has workers, so check that they still complete. */
+typedef struct
+{
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv;
+    int done;
+} chain_t;
+
+typedef struct
+{
+    chain_t *chain;
+    int index;
+} chain_arg_t;
+
+static void *chain_func( chain_arg_t *arg )
+{
+    chain_t *chain = arg->chain;
+    x264_pthread_mutex_lock( &chain->mutex );
+    while( chain->done < arg->index )
+        x264_pthread_cond_wait( &chain->cv, &chain->mutex );
+    chain->done++;
+    x264_pthread_cond_broadcast( &chain->cv );
+    x264_pthread_mutex_unlock( &chain->mutex );
+    return NULL;
+}
+
+static int check_chain( x264_threadpool_t *shared, int jobs )
+{
+    x264_threadpool_t *pool;
+    if( x264_threadpool_attach( &pool, shared, jobs ) )
+        return -1;
+    chain_t chain = { .done = 0 };
+    x264_pthread_mutex_init( &chain.mutex, NULL );
+    x264_pthread_cond_init( &chain.cv, NULL );
+    chain_arg_t *args = calloc( jobs, sizeof(chain_arg_t) );
+    for( int i = 0; i < jobs; i++ )
+    {
+        args[i].chain = &chain;
+        args[i].index = i;
+        x264_threadpool_run( pool, (void*)chain_func, &args[i] );
+    }
+    for( int i = jobs-1; i >= 0; i-- )
+        x264_threadpool_wait( pool, &args[i] );
+    int ret = chain.done == jobs ? 0 : -1;
+    free( args );
+    x264_pthread_mutex_destroy( &chain.mutex );
+    x264_pthread_cond_destroy( &chain.cv );
+    x264_threadpool_delete( pool );
+    return ret;
+}
+
+/* Encoders sharing a core close independently, so a handle can go away while
+ * the workers are busy with another one's jobs, or still finishing its own.
+ * delete() must wait for its jobs, including those never waited for. */
+static void *spin_func( job_arg_t *arg )
+{
+    volatile uint32_t x = arg->in;
+    for( int i = 0; i < 20000; i++ )
+        x = x * 1103515245 + 12345;
+    arg->out = arg->in * 3 + 1;
+    return (void*)(intptr_t)arg->out;
+}
+
+static int check_close( x264_threadpool_t *shared, int threads, int rounds )
+{
+    x264_threadpool_t *busy;
+    if( x264_threadpool_attach( &busy, shared, threads ) )
+        return -1;
+    job_arg_t *spin = calloc( threads, sizeof(job_arg_t) );
+    job_arg_t *args = calloc( threads, sizeof(job_arg_t) );
+    int ret = 0;
+    for( int r = 0; r < rounds && !ret; r++ )
+    {
+        for( int i = 0; i < threads; i++ )
+        {
+            spin[i].in = r * threads + i;
+            x264_threadpool_run( busy, (void*)spin_func, &spin[i] );
+        }
+        x264_threadpool_t *pool;
+        if( x264_threadpool_attach( &pool, shared, threads ) )
+        {
+            ret = -1;
+            break;
+        }
+        for( int i = 0; i < threads; i++ )
+        {
+            args[i].in = r * threads + i;
+            args[i].out = 0;
+            x264_threadpool_run( pool, (void*)spin_func, &args[i] );
+        }
+        /* leave the second half to delete() */
+        for( int i = 0; i < threads / 2; i++ )
+            x264_threadpool_wait( pool, &args[i] );
+        x264_threadpool_delete( pool );
+        for( int i = 0; i < threads; i++ )
+            ret |= args[i].out != args[i].in * 3 + 1;
+        for( int i = 0; i < threads; i++ )
+            ret |= (intptr_t)x264_threadpool_wait( busy, &spin[i] ) != spin[i].in * 3 + 1;
+    }
+    free( spin );
+    free( args );
+    x264_threadpool_delete( busy );
+    return ret ? -1 : 0;
+}
+
+int main( int argc, char **argv )
+{
+    int threads    = argc > 1 ? atoi( argv[1] ) : 8;
+    int iterations = argc > 2 ? atoi( argv[2] ) : 20000;
+    if( threads <= 0 || iterations <= 0 )
+    {
+        fprintf( stderr, "usage: threadpool-bench [threads] [iterations]\n" );
+        return 1;
+    }
+
+    x264_threadpool_t *pool;
+    if( x264_threadpool_init( &pool, threads ) )
+    {
+        fprintf( stderr, "x264_threadpool_init failed\n" );
+        return 1;
+    }
+    x264_threadpool_t *shared, *attached;
+    if( x264_threadpool_init_shared( &shared, threads ) ||
+        x264_threadpool_attach( &attached, shared, threads ) )
+    {
+        fprintf( stderr, "x264_threadpool_init_shared failed\n" );
+        return 1;
+    }
+    ref_pool_t *ref = ref_pool_init( threads );
+    job_arg_t *args = calloc( threads, sizeof(job_arg_t) );
+
+    pool_ops_t ops[3] =
+    {
+        { ref,      (void*)ref_pool_run,        (void*)ref_pool_wait },
+        { pool,     (void*)x264_threadpool_run, (void*)x264_threadpool_wait },
+        { attached, (void*)x264_threadpool_run, (void*)x264_threadpool_wait },
+    };
+    static const char *names[3] = { "list pool", "work-stealing pool", "shared pool" };
+
+    int ret = 0;
+    printf( "%d threads, %d iterations, ns per job\n", threads, iterations );
+    printf( "%-20s %12s %12s\n", "", "round trip", "fan-out" );
+    for( int i = 0; i < 3; i++ )
+    {
+        double single = bench( ops+i, args, 1, iterations );
+        double fanout = bench( ops+i, args, threads, iterations / threads + 1 );
+        printf( "%-20s %12.0f %12.0f\n", names[i], single, fanout );
+        if( single < 0 || fanout < 0 )
+        {
+            fprintf( stderr, "%s: wait returned the wrong job [FAILED]\n", names[i] );
+            ret = 1;
+        }
+    }
+
+    if( check_chain( shared, 4 * threads ) )
+    {
+        fprintf( stderr, "shared pool: dependent jobs did not complete [FAILED]\n" );
+        ret = 1;
+    }
+
+    if( check_close( shared, threads, 100 ) )
+    {
+        fprintf( stderr, "shared pool: closing a handle lost its jobs [FAILED]\n" );
+        ret = 1;
+    }
+
+    free( args );
+    ref_pool_delete( ref );
+    x264_threadpool_delete( pool );
+    x264_threadpool_delete( attached );
+    x264_threadpool_delete( shared );
+    return ret;
+}
+
+#else
+
+int main( void )
+{
+    fprintf( stderr, "threadpool-bench requires thread support\n" );
+    return 0;
+}
+
+#endif
@@ -680,6 +680,8 @@ static void help( x264_param_t *defaults, int longhelp )
     H2( "  -i, --min-keyint <integer>  Minimum GOP size [auto]\n" );
     H2( "      --no-scenecut           Disable adaptive I-frame decision\n" );
     H2( "      --scenecut <integer>    How aggressively to insert extra I-frames [%d]\n", defaults->i_scenecut_threshold );
+    H2( "      --scenecut-prepass      Rule out obvious non-cuts from luma histograms\n"
+        "                                  without running the lowres motion search\n" );
     H2( "      --intra-refresh         Use Periodic Intra Refresh instead of IDR frames\n" );
     H1( "  -b, --bframes <integer>     Number of B-frames between I and P [%d]\n", defaults->i_bframe );
     H1( "      --b-adapt <integer>     Adaptive B-frame decision method [%d]\n"
@@ -688,6 +690,13 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - 1: Fast\n"
         "                                  - 2: Optimal (slow with high --bframes)\n", defaults->i_bframe_adaptive );
     H2( "      --b-bias <integer>      Influences how often B-frames are used [%d]\n", defaults->i_bframe_bias );
+    H2( "      --lookahead-levels <integer> Resolution of scenecut and B-frame decisions [%d]\n"
+        "                                  - 0: Half\n"
+        "                                  - 1: Quarter\n"
+        "                                  - 2: Eighth\n"
+        "                                  Faster lookahead at 4K and above. Lowered when\n"
+        "                                  the level would have under 1920 mbs: eighth\n"
+        "                                  needs about 2160p, quarter about 1080p\n", defaults->i_lookahead_levels );
     H1( "      --b-pyramid <string>    Keep some B-frames as references [%s]\n"
         "                                  - none: Disabled\n"
         "                                  - strict: Strictly hierarchical pyramid\n"
@@ -732,9 +741,15 @@ static void help( x264_param_t *defaults, int longhelp )
     H0( "  -B, --bitrate <integer>     Set bitrate (kbit/s)\n" );
     H0( "      --crf <float>           Quality-based VBR (%d-51) [%.1f]\n", 51 - QP_MAX_SPEC, defaults->rc.f_rf_constant );
     H1( "      --rc-lookahead <integer> Number of frames for frametype lookahead [%d]\n", defaults->rc.i_lookahead );
+    H2( "      --rc-lookahead-min <integer> Start with this many lookahead frames and only grow\n"
+        "                                  up to --rc-lookahead while the encoder is backlogged\n"
+        "                                  Requires threaded lookahead, makes output timing-dependent\n" );
     H0( "      --vbv-maxrate <integer> Max local bitrate (kbit/s) [%d]\n", defaults->rc.i_vbv_max_bitrate );
     H0( "      --vbv-bufsize <integer> Set size of the VBV buffer (kbit) [%d]\n", defaults->rc.i_vbv_buffer_size );
     H2( "      --vbv-init <float>      Initial VBV buffer occupancy [%.1f]\n", defaults->rc.f_vbv_buffer_init );
+    H2( "      --vbv-speculate <integer> Encode rows that VBV is likely to re-encode at up to\n"
+        "                                  this many higher QPs on threads of their own [%d]\n"
+        "                                  - Requires CABAC, progressive, one slice and no sliced threads\n", defaults->rc.i_vbv_speculate );
     H2( "      --crf-max <float>       With CRF+VBV, limit RF to this value\n"
         "                                  May cause VBV underflows!\n" );
     H2( "      --qpmin <integer>       Set min QP [%d]\n", defaults->rc.i_qp_min );
@@ -757,7 +772,19 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - 2: Last pass, does not overwrite stats file\n" );
     H2( "                                  - 3: Nth pass, overwrites stats file\n" );
     H1( "      --stats <string>        Filename for 2 pass stats [\"%s\"]\n", defaults->rc.psz_stat_out );
+    H2( "      --lookahead-pass        With --pass 1, write the stats from the lookahead's\n"
+        "                                  frame costs instead of encoding the frames.\n"
+        "                                  Rough: the model ignores the analysis settings\n"
+        "                                  and pass 2 can miss its bitrate by 10-45%%\n" );
+    H2( "      --analysis-out <string> Save frametypes and mb-tree offsets for later encodes\n" );
+    H2( "      --analysis-in <string>  Reuse frametypes and mb-tree offsets from --analysis-out\n"
+        "                                  instead of running the frametype decision and mb-tree.\n"
+        "                                  The offsets include the exporting encode's AQ and\n"
+        "                                  replace this encode's on reference frames, so --aq-*\n"
+        "                                  only applies to the other frames\n" );
     H2( "      --no-mbtree             Disable mb-tree ratecontrol.\n");
+    H2( "      --mbtree-incremental    Only propagate mb-tree costs added by new lookahead\n"
+        "                                  frames instead of the whole window each time\n" );
     H2( "      --qcomp <float>         QP curve compression [%.2f]\n", defaults->rc.f_qcompress );
     H2( "      --cplxblur <float>      Reduce fluctuations in QP (before curve compression) [%.1f]\n", defaults->rc.f_complexity_blur );
     H2( "      --qblur <float>         Reduce fluctuations in QP (after curve compression) [%.1f]\n", defaults->rc.f_qblur );
@@ -939,6 +966,11 @@ static void help( x264_param_t *defaults, int longhelp )
     H1( "      --threads <integer>     Force a specific number of threads\n" );
     H2( "      --lookahead-threads <integer> Force a specific number of lookahead threads\n" );
     H2( "      --sliced-threads        Low-latency but lower-efficiency threading\n" );
+    H2( "      --wavefront-threads     Low-latency threading over the mb rows of each frame\n"
+        "                                  - Requires CABAC, progressive, one slice and no VBV\n" );
+    H2( "      --entropy-threads       Write the bitstream of each frame thread on a\n"
+        "                                  separate thread, behind the mb analysis\n"
+        "                                  - Same requirements as --wavefront-threads\n" );
     H2( "      --thread-input          Run Avisynth in its own thread\n" );
     H2( "      --sync-lookahead <integer> Number of buffer frames for threaded lookahead\n" );
     H2( "      --non-deterministic     Slightly improve quality of SMP, at the cost of repeatability\n" );
@@ -1024,6 +1056,7 @@ static struct option long_options[] =
     { "b-adapt",              required_argument, NULL, 0 },
     { "no-b-adapt",           no_argument,       NULL, 0 },
     { "b-bias",               required_argument, NULL, 0 },
+    { "lookahead-levels",     required_argument, NULL, 0 },
     { "b-pyramid",            required_argument, NULL, 0 },
     { "open-gop",             no_argument,       NULL, 0 },
     { "bluray-compat",        no_argument,       NULL, 0 },
@@ -1034,6 +1067,7 @@ static struct option long_options[] =
     { "intra-refresh",        no_argument,       NULL, 0 },
     { "scenecut",             required_argument, NULL, 0 },
     { "no-scenecut",          no_argument,       NULL, 0 },
+    { "scenecut-prepass",     no_argument,       NULL, 0 },
     { "nf",                   no_argument,       NULL, 0 },
     { "no-deblock",           no_argument,       NULL, 0 },
     { "filter",               required_argument, NULL, 0 },
@@ -1051,6 +1085,7 @@ static struct option long_options[] =
     { "qpstep",               required_argument, NULL, 0 },
     { "crf",                  required_argument, NULL, 0 },
     { "rc-lookahead",         required_argument, NULL, 0 },
+    { "rc-lookahead-min",     required_argument, NULL, 0 },
     { "ref",                  required_argument, NULL, 'r' },
     { "asm",                  required_argument, NULL, 0 },
     { "no-asm",               no_argument,       NULL, 0 },
@@ -1099,15 +1134,18 @@ static struct option long_options[] =
     { "vbv-maxrate",          required_argument, NULL, 0 },
     { "vbv-bufsize",          required_argument, NULL, 0 },
     { "vbv-init",             required_argument, NULL, 0 },
+    { "vbv-speculate",        required_argument, NULL, 0 },
     { "crf-max",              required_argument, NULL, 0 },
     { "ipratio",              required_argument, NULL, 0 },
     { "pbratio",              required_argument, NULL, 0 },
     { "chroma-qp-offset",     required_argument, NULL, 0 },
     { "pass",                 required_argument, NULL, 'p' },
     { "stats",                required_argument, NULL, 0 },
+    { "lookahead-pass",       no_argument,       NULL, 0 },
     { "qcomp",                required_argument, NULL, 0 },
     { "mbtree",               no_argument,       NULL, 0 },
     { "no-mbtree",            no_argument,       NULL, 0 },
+    { "mbtree-incremental",   no_argument,       NULL, 0 },
     { "qblur",                required_argument, NULL, 0 },
     { "cplxblur",             required_argument, NULL, 0 },
     { "zones",                required_argument, NULL, 0 },
@@ -1116,6 +1154,8 @@ static struct option long_options[] =
     { "lookahead-threads",    required_argument, NULL, 0 },
     { "sliced-threads",       no_argument,       NULL, 0 },
     { "no-sliced-threads",    no_argument,       NULL, 0 },
+    { "wavefront-threads",    no_argument,       NULL, 0 },
+    { "entropy-threads",      no_argument,       NULL, 0 },
     { "slice-max-size",       required_argument, NULL, 0 },
     { "slice-max-mbs",        required_argument, NULL, 0 },
     { "slice-min-mbs",        required_argument, NULL, 0 },
@@ -1132,6 +1172,8 @@ static struct option long_options[] =
     { "log-level",            required_argument, NULL, OPT_LOG_LEVEL },
     { "no-progress",          no_argument,       NULL, OPT_NOPROGRESS },
     { "dump-yuv",             required_argument, NULL, 0 },
+    { "analysis-out",         required_argument, NULL, 0 },
+    { "analysis-in",          required_argument, NULL, 0 },
     { "sps-id",               required_argument, NULL, 0 },
     { "aud",                  no_argument,       NULL, 0 },
     { "nr",                   required_argument, NULL, 0 },
@@ -1672,13 +1714,15 @@ generic_option:
 
     /* init threaded input while the information about the input video is unaltered by filtering */
 #if HAVE_THREAD
-    const cli_input_t *thread_input;
-    if( HAVE_BITDEPTH8 && param->i_bitdepth == 8 )
+    const cli_input_t *thread_input = NULL;
+#if HAVE_BITDEPTH8
+    if( param->i_bitdepth == 8 )
         thread_input = &thread_8_input;
-    else if( HAVE_BITDEPTH10 && param->i_bitdepth == 10 ){}
-        // thread_input = &thread_10_input;
-    else
-        thread_input = NULL;
+#endif
+#if HAVE_BITDEPTH10
+    if( param->i_bitdepth == 10 )
+        thread_input = &thread_10_input;
+#endif
 
     if( thread_input && info.thread_safe && (b_thread_input || param->i_threads > 1
         || (param->i_threads == X264_THREADS_AUTO && x264_cpu_num_processors() > 1)) )
@@ -1868,15 +1912,19 @@ static int64_t print_status( int64_t i_start, int64_t i_previous, int i_frame, i
         bitrate = (double) i_file * 8 / ( (double) last_ts * 1000 * param->i_timebase_num / param->i_timebase_den );
     else
         bitrate = (double) i_file * 8 / ( (double) 1000 * param->i_fps_den / param->i_fps_num );
+    /* The lookahead pass only writes AUDs, its modelled bitrate is in the encoder's stats. */
+    char rate[32] = "";
+    if( !param->rc.b_lookahead_pass )
+        sprintf( rate, ", %.2f kb/s", bitrate );
     if( i_frame_total )
     {
         int eta = i_elapsed * (i_frame_total - i_frame) / ((int64_t)i_frame * 1000000);
-        sprintf( buf, "x264 [%.1f%%] %d/%d frames, %.2f fps, %.2f kb/s, eta %d:%02d:%02d",
-                 100. * i_frame / i_frame_total, i_frame, i_frame_total, fps, bitrate,
+        sprintf( buf, "x264 [%.1f%%] %d/%d frames, %.2f fps%s, eta %d:%02d:%02d",
+                 100. * i_frame / i_frame_total, i_frame, i_frame_total, fps, rate,
                  eta/3600, (eta/60)%60, eta%60 );
     }
     else
-        sprintf( buf, "x264 %d frames: %.2f fps, %.2f kb/s", i_frame, fps, bitrate );
+        sprintf( buf, "x264 %d frames: %.2f fps%s", i_frame, fps, rate );
     fprintf( stderr, "%s  \r", buf+5 );
     x264_cli_set_console_title( buf );
     fflush( stderr ); // needed in windows
@@ -2080,8 +2128,11 @@ fail:
         double fps = (double)i_frame_output * (double)1000000 /
                      (double)( i_end - i_start );
 
-        fprintf( stderr, "encoded %d frames, %.2f fps, %.2f kb/s\n", i_frame_output, fps,
-                 (double) i_file * 8 / ( 1000 * duration ) );
+        if( param->rc.b_lookahead_pass )
+            fprintf( stderr, "encoded %d frames, %.2f fps, no slices written (lookahead pass)\n", i_frame_output, fps );
+        else
+            fprintf( stderr, "encoded %d frames, %.2f fps, %.2f kb/s\n", i_frame_output, fps,
+                     (double) i_file * 8 / ( 1000 * duration ) );
     }
 
     return retval;
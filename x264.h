@@ -45,7 +45,7 @@ extern "C" {
 
 #include "x264_config.h"
 
-#define X264_BUILD 164
+#define X264_BUILD 176
 
 #ifdef _WIN32
 #   define X264_DLL_IMPORT __declspec(dllimport)
@@ -79,6 +79,9 @@ extern "C" {
  *      opaque handler for encoder */
 typedef struct x264_t x264_t;
 
+/* x264_threadpool_t : opaque handler for a thread pool shared between encoders */
+typedef struct x264_threadpool_t x264_threadpool_t;
+
 /****************************************************************************
  * NAL structure and functions
  ****************************************************************************/
@@ -289,6 +292,19 @@ static const char * const x264_avcintra_flavor_names[] = { "panasonic", "sony",
 #define X264_NAL_HRD_VBR             1
 #define X264_NAL_HRD_CBR             2
 
+/* x264_frame_analysis_t: lookahead decisions for one frame, see x264_param_t.analysis_export */
+typedef struct x264_frame_analysis_t
+{
+    int64_t i_pts;        /* pts of the input picture */
+    int     i_type;       /* X264_TYPE_* decided by the lookahead */
+    int     b_keyframe;
+    int     i_mb_width;   /* dimensions of qp_offsets */
+    int     i_mb_height;
+    /* qp offset per macroblock, adaptive quantization and macroblock-tree combined.
+     * NULL if macroblock-tree is off or the frame is not kept as a reference. */
+    float   *qp_offsets;
+} x264_frame_analysis_t;
+
 /* Zones: override ratecontrol or other options for specific sections of the video.
  * See x264_encoder_reconfig() for which options can be changed.
  * If zones overlap, whichever comes later in the list takes precedence. */
@@ -308,9 +324,17 @@ typedef struct x264_param_t
     int         i_threads;           /* encode multiple frames in parallel */
     int         i_lookahead_threads; /* multiple threads for lookahead analysis */
     int         b_sliced_threads;  /* Whether to use slice-based threading. */
+    int         b_wavefront_threads; /* Thread across the mb rows of each frame, with the bitstream
+                                      * written behind them on the calling thread. Takes precedence
+                                      * over b_sliced_threads. Requires CABAC, progressive, one slice, no VBV. */
+    int         b_entropy_threads;   /* Pair each frame thread with a thread analysing its mbs, so that the
+                                      * bitstream is written on a core of its own. Same requirements as
+                                      * b_wavefront_threads, which takes precedence. */
     int         b_deterministic; /* whether to allow non-deterministic optimizations when threaded */
     int         b_cpu_independent; /* force canonical behavior rather than cpu-dependent optimal algorithms */
     int         i_sync_lookahead; /* threaded lookahead buffer */
+    x264_threadpool_t *threadpool; /* run frame threads and lookahead threads as jobs on this
+                                    * shared pool instead of private workers, see x264_threadpool_open */
 
     /* Video Properties */
     int         i_width;
@@ -352,10 +376,13 @@ typedef struct x264_param_t
     int         i_keyint_max;       /* Force an IDR keyframe at this interval */
     int         i_keyint_min;       /* Scenecuts closer together than this are coded as I, not IDR. */
     int         i_scenecut_threshold; /* how aggressively to insert extra I frames */
+    int         b_scenecut_prepass; /* Rule out obvious non-cuts from histograms before the lowres search */
     int         b_intra_refresh;    /* Whether or not to use periodic intra refresh instead of IDR frames. */
 
     int         i_bframe;   /* how many b-frame between 2 references pictures */
     int         i_bframe_adaptive;
+    int         i_lookahead_levels; /* Make scenecut and b-adapt decisions on a coarser lowres level: 0=half, 1=quarter, 2=eighth resolution,
+                                     * lowered when the level would have under 1920 mbs */
     int         i_bframe_bias;
     int         i_bframe_pyramid;   /* Keep some B-frames as references: 0=off, 1=strict hierarchical, 2=normal */
     int         b_open_gop;
@@ -445,6 +472,8 @@ typedef struct x264_param_t
         int         i_vbv_max_bitrate;
         int         i_vbv_buffer_size;
         float       f_vbv_buffer_init; /* <=1: fraction of buffer_size. >1: kbit */
+        int         i_vbv_speculate; /* Encode rows that are likely to be re-encoded for VBV at up to this many
+                                      * higher QPs at once, on threads of their own. 0=off */
         float       f_ip_factor;
         float       f_pb_factor;
 
@@ -455,13 +484,20 @@ typedef struct x264_param_t
         int         i_aq_mode;      /* psy adaptive QP. (X264_AQ_*) */
         float       f_aq_strength;
         int         b_mb_tree;      /* Macroblock-tree ratecontrol. */
+        int         b_mb_tree_incremental; /* Keep mb-tree costs between lookahead calls and only propagate changes. */
         int         i_lookahead;
+        int         i_lookahead_min; /* Adaptive lookahead: start at this many frames and only grow towards
+                                      * i_lookahead while the encoder is backlogged. 0=fixed window */
 
         /* 2pass */
         int         b_stat_write;   /* Enable stat writing in psz_stat_out */
         char        *psz_stat_out;  /* output filename (in UTF-8) of the 2pass stats file */
         int         b_stat_read;    /* Read stat from psz_stat_in and use it */
         char        *psz_stat_in;   /* input filename (in UTF-8) of the 2pass stats file */
+        /* 1st pass: model the stats from the lookahead's costs instead of encoding.  The model only sees the
+         * lowres costs and the qp, not the analysis settings (subme, partitions, trellis, psy...), so a 2nd pass
+         * on these stats can miss its bitrate by 10-45%, where a real 1st pass gets within about 1%. */
+        int         b_lookahead_pass;
 
         /* 2pass params (same as ffmpeg ones) */
         float       f_qcompress;    /* 0.0 => cbr, 1.0 => constant qp */
@@ -609,6 +645,41 @@ typedef struct x264_param_t
      */
     void (*nalu_process)( x264_t *h, x264_nal_t *nal, void *opaque );
 
+    /* Lookahead sharing between encodes of one source at several resolutions, e.g. the rungs
+     * of an ABR ladder.  One encoder runs the lookahead and exports its decisions, the others
+     * import them instead of repeating the frametype decision, scenecut detection and
+     * macroblock-tree analysis.
+     *
+     * analysis_export: optional callback, called for each frame in coded order once its frame
+     * type and macroblock-tree qp offsets are final.  The analysis is only valid during the
+     * call.  The opaque pointer is the one of the input frame.
+     *
+     * b_analysis_import: take the frame type and macroblock-tree qp offsets of each frame from
+     * x264_picture_t.prop.analysis, which must be set on every input picture to the analysis
+     * exported for the same frame.  Offsets are rescaled to this encoder's resolution.  GOP
+     * settings (keyint, bframes, b-pyramid, open-gop) should match the exporting encoder; b-adapt
+     * and scenecut are ignored.  Not compatible with multipass. */
+    void (*analysis_export)( x264_t *h, const x264_frame_analysis_t *analysis, void *opaque );
+    int b_analysis_import;
+
+    /* Analysis file, for encoding the same source again with other settings.
+     * psz_analysis_out: save the analysis of every frame, as given to analysis_export.
+     * psz_analysis_in: import the analysis of every frame from a file saved by an earlier encode,
+     * instead of from x264_picture_t.prop.analysis.  Implies b_analysis_import.  As with any
+     * import, the offsets of reference frames are the exporting encoder's adaptive quantization and
+     * macroblock-tree combined and replace this encoder's own AQ, so its aq settings only apply to
+     * frames without offsets.
+     * Records have a fixed size and are stored in input order, so the file can be memory-mapped. */
+    char *psz_analysis_out;    /* filename (in UTF-8) */
+    char *psz_analysis_in;     /* filename (in UTF-8) */
+
+    /* Zero-copy input: x264_encoder_encode references the planes of the input picture for as
+     * long as the frame is in use by the lookahead and the encoder, instead of copying them.
+     * The planes must use the layout returned by x264_encoder_input_layout and stay valid
+     * until x264_picture_t.prop.img_free is called.  x264 writes to them: the area up to the
+     * macroblock-aligned size is padded, plus one extra luma column and row. */
+    int b_zero_copy_input;
+
     /* For internal use only */
     void *opaque;
 } x264_param_t;
@@ -816,6 +887,17 @@ typedef struct x264_image_properties_t
      *     Useful if one wants to use a different quant_offset array for each frame. */
     void (*quant_offsets_free)( void* );
 
+    /* In: lookahead analysis of this frame exported by another encoder, used if
+     *     x264_param_t.b_analysis_import is set. */
+    x264_frame_analysis_t *analysis;
+    /* In: optional callback to free analysis when used. */
+    void (*analysis_free)( void* );
+
+    /* In: with x264_param_t.b_zero_copy_input, called with img_opaque once x264 no longer
+     *     references the planes of img.  May be called from any of x264's threads. */
+    void (*img_free)( void* );
+    void *img_opaque;
+
     /* In: optional array of flags for each macroblock.
      *     Allows specifying additional information for the encoder such as which macroblocks
      *     remain unchanged.  Usable flags are listed below.
@@ -912,6 +994,27 @@ X264_API int x264_picture_alloc( x264_picture_t *pic, int i_csp, int i_width, in
  *  x264_picture_alloc ONLY */
 X264_API void x264_picture_clean( x264_picture_t *pic );
 
+/****************************************************************************
+ * Thread pool functions
+ ****************************************************************************/
+
+/* x264_threadpool_open:
+ *      create a pool of i_threads worker threads that several encoders can share,
+ *      e.g. the rungs of an ABR ladder encoded in one process. Set
+ *      x264_param_t.threadpool to it before x264_encoder_open: the encoder then
+ *      queues its frame-thread and lookahead jobs on the pool instead of starting
+ *      its own workers, so the total number of threads stays at i_threads however
+ *      many encoders are attached. Jobs run in the order they are queued.
+ *      i_threads and i_lookahead_threads still set how many jobs an encoder
+ *      keeps in flight.
+ *      returns NULL on failure or if x264 was built without threading. */
+X264_API x264_threadpool_t *x264_threadpool_open( int i_threads );
+
+/* x264_threadpool_close:
+ *      release the pool. Encoders still attached keep it alive, the worker threads
+ *      exit once the last of them is closed. */
+X264_API void x264_threadpool_close( x264_threadpool_t * );
+
 /****************************************************************************
  * Encoder functions
  ****************************************************************************/
@@ -1012,6 +1115,13 @@ X264_API void x264_encoder_intra_refresh( x264_t * );
  *      Returns 0 on success, negative on failure. */
 X264_API int x264_encoder_invalidate_reference( x264_t *, int64_t pts );
 
+/* x264_encoder_input_layout:
+ *      For zero-copy input, fills in the colorspace, plane count and strides (in bytes) that
+ *      input pictures must have.  Each plane must additionally be 64-byte aligned and writable
+ *      for the macroblock-aligned height, plus one line for luma.
+ *      Returns 0 on success, negative if b_zero_copy_input is not set. */
+X264_API int x264_encoder_input_layout( x264_t *, x264_image_t *img );
+
 #ifdef __cplusplus
 }
 #endif